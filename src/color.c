@@ -0,0 +1,573 @@
+#include "color.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct _media_color_node {
+    struct media_color_transform transform;
+    struct _media_color_node* next;
+};
+
+// up to MEDIA_COLOR_CACHE pairs of spaces asked for so far, nodes are never freed so returned
+// transforms stay valid
+static struct _media_color_node* media_color_cache = NULL;
+static uint32_t media_color_cached = 0;
+static pthread_mutex_t media_color_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// cone response of the Bradford chromatic adaptation
+static const double MEDIA_BRADFORD[9] = {
+     0.8951,  0.2664, -0.1614,
+    -0.7502,  1.7135,  0.0367,
+     0.0389, -0.0685,  1.0296
+};
+
+static void _media_color_multiply(const double* a, const double* b, double* out) {
+    double result[9];
+
+    for (uint32_t i = 0; i < 3; i++) {
+        for (uint32_t j = 0; j < 3; j++) {
+            result[i * 3 + j] = a[i * 3] * b[j] + a[i * 3 + 1] * b[3 + j] + a[i * 3 + 2] * b[6 + j];
+        }
+    }
+
+    memcpy(out, result, sizeof(result));
+}
+
+static void _media_color_apply(const double* m, const double* v, double* out) {
+    double result[3];
+
+    for (uint32_t i = 0; i < 3; i++) {
+        result[i] = m[i * 3] * v[0] + m[i * 3 + 1] * v[1] + m[i * 3 + 2] * v[2];
+    }
+
+    memcpy(out, result, sizeof(result));
+}
+
+// return 0 if success, otherwise another number if m is singular
+static int _media_color_invert(const double* m, double* out) {
+    double cofactors[9] = {
+        m[4] * m[8] - m[5] * m[7], m[2] * m[7] - m[1] * m[8], m[1] * m[5] - m[2] * m[4],
+        m[5] * m[6] - m[3] * m[8], m[0] * m[8] - m[2] * m[6], m[2] * m[3] - m[0] * m[5],
+        m[3] * m[7] - m[4] * m[6], m[1] * m[6] - m[0] * m[7], m[0] * m[4] - m[1] * m[3]
+    };
+
+    double determinant = m[0] * cofactors[0] + m[1] * cofactors[3] + m[2] * cofactors[6];
+    if (fabs(determinant) < 1e-12) {
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < 9; i++) {
+        out[i] = cofactors[i] / determinant;
+    }
+
+    return 0;
+}
+
+// XYZ with Y = 1 of a CIE xy chromaticity, return 0 if success otherwise another number
+static int _media_color_xy_to_xyz(double x, double y, double* xyz) {
+    if (y <= 0) {
+        return 1;
+    }
+
+    xyz[0] = x / y;
+    xyz[1] = 1;
+    xyz[2] = (1 - x - y) / y;
+
+    return 0;
+}
+
+int media_color_space_from_xy(double white_x, double white_y, double red_x, double red_y,
+                              double green_x, double green_y, double blue_x, double blue_y,
+                              uint32_t gamma, struct media_color_space* space) {
+    double red[3];
+    double green[3];
+    double blue[3];
+
+    if (_media_color_xy_to_xyz(white_x, white_y, space->white) || _media_color_xy_to_xyz(red_x, red_y, red)
+        || _media_color_xy_to_xyz(green_x, green_y, green) || _media_color_xy_to_xyz(blue_x, blue_y, blue)) {
+        return 1;
+    }
+
+    double primaries[9] = {
+        red[0], green[0], blue[0],
+        red[1], green[1], blue[1],
+        red[2], green[2], blue[2]
+    };
+
+    // primaries are scaled so all of them at full intensity give the white point
+    double inverse[9];
+    double scale[3];
+
+    if (_media_color_invert(primaries, inverse)) {
+        return 2;
+    }
+
+    _media_color_apply(inverse, space->white, scale);
+
+    for (uint32_t i = 0; i < 9; i++) {
+        space->to_xyz[i] = primaries[i] * scale[i % 3];
+    }
+
+    space->gamma = gamma;
+
+    return 0;
+}
+
+void media_color_space_srgb(struct media_color_space* space) {
+    media_color_space_from_xy(0.3127, 0.3290, 0.64, 0.33, 0.30, 0.60, 0.15, 0.06, MEDIA_GAMMA_SRGB, space);
+}
+
+static inline uint32_t _media_color_be32(const uint8_t* data) {
+    return (uint32_t) data[0] << 24 | (uint32_t) data[1] << 16 | (uint32_t) data[2] << 8 | data[3];
+}
+
+static inline double _media_color_s15f16(const uint8_t* data) {
+    return (int32_t) _media_color_be32(data) / 65536.0;
+}
+
+// data and size of the tag with signature, NULL if there is none or it's out of the profile
+static const uint8_t* _media_color_icc_tag(const uint8_t* profile, size_t size, const char* signature,
+                                           size_t* tag_size) {
+    uint32_t count = _media_color_be32(&profile[128]);
+    if (count > (size - 132) / 12) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* entry = &profile[132 + i * 12];
+
+        if (memcmp(entry, signature, 4) == 0) {
+            uint32_t offset = _media_color_be32(&entry[4]);
+            uint32_t length = _media_color_be32(&entry[8]);
+
+            if (offset > size || length > size - offset || length < 12) {
+                return NULL;
+            }
+
+            *tag_size = length;
+            return &profile[offset];
+        }
+    }
+
+    return NULL;
+}
+
+// return 0 if success, otherwise another number
+static int _media_color_icc_xyz(const uint8_t* profile, size_t size, const char* signature, double* xyz) {
+    size_t tag_size;
+    const uint8_t* tag = _media_color_icc_tag(profile, size, signature, &tag_size);
+
+    if (tag == NULL || tag_size < 20 || memcmp(tag, "XYZ ", 4) != 0) {
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < 3; i++) {
+        xyz[i] = _media_color_s15f16(&tag[8 + i * 4]);
+    }
+
+    return 0;
+}
+
+// value of a curv or para tone curve at x between 0 and 1, return 0 if success otherwise another number
+static int _media_color_icc_curve(const uint8_t* tag, size_t tag_size, double x, double* y) {
+    if (memcmp(tag, "curv", 4) == 0) {
+        uint32_t count = _media_color_be32(&tag[8]);
+
+        if (count > (tag_size - 12) / 2) {
+            return 1;
+        }
+
+        if (count == 0) {
+            *y = x;
+        } else if (count == 1) {
+            *y = pow(x, ((tag[12] << 8) | tag[13]) / 256.0);
+        } else {
+            double position = x * (count - 1);
+            uint32_t i = (uint32_t) position;
+            if (i >= count - 1) {
+                i = count - 2;
+            }
+
+            const uint8_t* entry = &tag[12 + i * 2];
+            double low = ((entry[0] << 8) | entry[1]) / 65535.0;
+            double high = ((entry[2] << 8) | entry[3]) / 65535.0;
+            *y = low + (high - low) * (position - i);
+        }
+
+        return 0;
+    }
+
+    if (memcmp(tag, "para", 4) == 0) {
+        static const uint32_t PARAMETERS[5] = {1, 3, 4, 5, 7};
+        uint32_t type = (tag[8] << 8) | tag[9];
+
+        if (type > 4 || tag_size < 12 + PARAMETERS[type] * 4) {
+            return 1;
+        }
+
+        // g, a, b, c, d, e, f as named by ICC
+        double p[7] = {0, 1, 0, 0, 0, 0, 0};
+        for (uint32_t i = 0; i < PARAMETERS[type]; i++) {
+            p[i] = _media_color_s15f16(&tag[12 + i * 4]);
+        }
+
+        switch (type) {
+            case 0: *y = pow(x, p[0]); break;
+            case 1: *y = x >= -p[2] / p[1] ? pow(p[1] * x + p[2], p[0]) : 0; break;
+            case 2: *y = x >= -p[2] / p[1] ? pow(p[1] * x + p[2], p[0]) + p[3] : p[3]; break;
+            case 3: *y = x >= p[4] ? pow(p[1] * x + p[2], p[0]) : p[3] * x; break;
+            case 4: *y = x >= p[4] ? pow(p[1] * x + p[2], p[0]) + p[5] : p[3] * x + p[6]; break;
+        }
+
+        return 0;
+    }
+
+    return 1;
+}
+
+// encoded value between 0 and 1 to linear light along a media_gamma curve
+static double _media_color_gamma_decode(uint32_t gamma, double x) {
+    if (gamma == MEDIA_GAMMA_SRGB) {
+        return x <= 0.04045 ? x / 12.92 : pow((x + 0.055) / 1.055, 2.4);
+    }
+
+    return pow(x, 100000.0 / gamma);
+}
+
+// largest distance between the tone curve of signature and the media_gamma curve at every 8 bits
+// sample, return 0 if success otherwise another number
+static int _media_color_icc_error(const uint8_t* profile, size_t size, const char* signature, uint32_t gamma,
+                                  double* error) {
+    size_t tag_size;
+    const uint8_t* tag = _media_color_icc_tag(profile, size, signature, &tag_size);
+
+    if (tag == NULL) {
+        return 1;
+    }
+
+    *error = 0;
+
+    for (uint32_t i = 0; i < 256; i++) {
+        double x = i / 255.0;
+        double y;
+
+        if (_media_color_icc_curve(tag, tag_size, x, &y)) {
+            return 2;
+        }
+
+        *error = fmax(*error, fabs(y - _media_color_gamma_decode(gamma, x)));
+    }
+
+    return 0;
+}
+
+// tone curves as a single media_gamma curve, the sRGB one if it's close enough otherwise the power
+// going through the middle point of rTRC. return 0 if success, otherwise another number, also when
+// some channel's curve is too far from it (e.g. a curve per channel or a shape no power follows)
+static int _media_color_icc_gamma(const uint8_t* profile, size_t size, uint32_t* gamma) {
+    static const char* const SIGNATURES[3] = {"rTRC", "gTRC", "bTRC"};
+    // about half a step of 8 bits samples
+    static const double TOLERANCE = 0.002;
+
+    double error;
+
+    if (_media_color_icc_error(profile, size, "rTRC", MEDIA_GAMMA_SRGB, &error)) {
+        return 1;
+    }
+
+    if (error < TOLERANCE) {
+        *gamma = MEDIA_GAMMA_SRGB;
+    } else {
+        size_t tag_size;
+        const uint8_t* tag = _media_color_icc_tag(profile, size, "rTRC", &tag_size);
+        double middle;
+
+        if (_media_color_icc_curve(tag, tag_size, 0.5, &middle) || middle <= 0 || middle >= 1) {
+            return 2;
+        }
+
+        // decoding power is log(middle) / log(0.5), gAMA keeps 100000 times its inverse
+        *gamma = (uint32_t) lround(100000 * log(0.5) / log(middle));
+        if (*gamma == 0) {
+            return 3;
+        }
+    }
+
+    // the transform decodes the three channels with the same tables
+    for (uint32_t i = 0; i < 3; i++) {
+        if (_media_color_icc_error(profile, size, SIGNATURES[i], *gamma, &error) || error >= TOLERANCE) {
+            return 4;
+        }
+    }
+
+    return 0;
+}
+
+int media_color_space_from_icc(const uint8_t* profile, size_t size, struct media_color_space* space) {
+    if (profile == NULL || size < 132 || memcmp(&profile[16], "RGB ", 4) != 0 || memcmp(&profile[20], "XYZ ", 4) != 0) {
+        return 1;
+    }
+
+    double red[3];
+    double green[3];
+    double blue[3];
+
+    if (_media_color_icc_xyz(profile, size, "rXYZ", red) || _media_color_icc_xyz(profile, size, "gXYZ", green)
+        || _media_color_icc_xyz(profile, size, "bXYZ", blue)) {
+        return 2;
+    }
+
+    if (_media_color_icc_gamma(profile, size, &space->gamma)) {
+        return 3;
+    }
+
+    double to_xyz[9] = {
+        red[0], green[0], blue[0],
+        red[1], green[1], blue[1],
+        red[2], green[2], blue[2]
+    };
+
+    memcpy(space->to_xyz, to_xyz, sizeof(to_xyz));
+
+    // colorants are adapted to the PCS illuminant of the header, D50 in practice
+    for (uint32_t i = 0; i < 3; i++) {
+        space->white[i] = _media_color_s15f16(&profile[68 + i * 4]);
+    }
+
+    if (space->white[1] <= 0) {
+        return 4;
+    }
+
+    return 0;
+}
+
+static uint64_t _media_color_hash(uint64_t hash, const struct media_color_space* space) {
+    double values[13];
+    memcpy(values, space->to_xyz, sizeof(double) * 9);
+    memcpy(&values[9], space->white, sizeof(double) * 3);
+    values[12] = space->gamma;
+
+    // FNV-1a over values, padding of the struct is left out
+    const uint8_t* bytes = (const uint8_t*) values;
+    for (size_t i = 0; i < sizeof(values); i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3;
+    }
+
+    return hash;
+}
+
+static int _media_color_equals(const struct media_color_space* a, const struct media_color_space* b) {
+    return memcmp(a->to_xyz, b->to_xyz, sizeof(a->to_xyz)) == 0 && memcmp(a->white, b->white, sizeof(a->white)) == 0
+        && a->gamma == b->gamma;
+}
+
+// return 0 if success, otherwise another number
+static int _media_color_build(struct media_color_transform* transform, const struct media_color_space* src,
+                              const struct media_color_space* dst) {
+    transform->src = *src;
+    transform->dst = *dst;
+    transform->decode = media_gamma_get(src->gamma);
+    transform->encode = media_gamma_get(dst->gamma);
+
+    if (transform->decode == NULL || transform->encode == NULL) {
+        media_gamma_release(transform->decode);
+        media_gamma_release(transform->encode);
+        return 1;
+    }
+
+    // src RGB -> XYZ -> cone responses, scaled from src white to dst white -> XYZ -> dst RGB
+    double bradford_inverse[9];
+    double dst_inverse[9];
+
+    if (_media_color_invert(MEDIA_BRADFORD, bradford_inverse) || _media_color_invert(dst->to_xyz, dst_inverse)) {
+        media_gamma_release(transform->decode);
+        media_gamma_release(transform->encode);
+        return 2;
+    }
+
+    double src_cone[3];
+    double dst_cone[3];
+    _media_color_apply(MEDIA_BRADFORD, src->white, src_cone);
+    _media_color_apply(MEDIA_BRADFORD, dst->white, dst_cone);
+
+    double adaptation[9] = {0};
+    for (uint32_t i = 0; i < 3; i++) {
+        adaptation[i * 4] = dst_cone[i] / src_cone[i];
+    }
+
+    double matrix[9];
+    _media_color_multiply(adaptation, MEDIA_BRADFORD, matrix);
+    _media_color_multiply(bradford_inverse, matrix, matrix);
+    _media_color_multiply(matrix, src->to_xyz, matrix);
+    _media_color_multiply(dst_inverse, matrix, matrix);
+
+    transform->identity = src->gamma == dst->gamma;
+
+    for (uint32_t i = 0; i < 9; i++) {
+        transform->matrix[i] = (float) matrix[i];
+
+        if (fabs(matrix[i] - (i % 4 == 0 ? 1 : 0)) > 1e-5) {
+            transform->identity = 0;
+        }
+    }
+
+    return 0;
+}
+
+// node of the pair in the cache, or NULL. media_color_lock must be held
+static struct _media_color_node* _media_color_find(uint64_t hash, const struct media_color_space* src,
+                                                   const struct media_color_space* dst) {
+    struct _media_color_node* node = media_color_cache;
+    while (node != NULL && (node->transform.hash != hash || !_media_color_equals(&node->transform.src, src)
+                            || !_media_color_equals(&node->transform.dst, dst))) {
+        node = node->next;
+    }
+
+    return node;
+}
+
+const struct media_color_transform* media_color_transform_get(const struct media_color_space* src,
+                                                              const struct media_color_space* dst) {
+    uint64_t hash = _media_color_hash(_media_color_hash(0xCBF29CE484222325, src), dst);
+
+    pthread_mutex_lock(&media_color_lock);
+    struct _media_color_node* node = _media_color_find(hash, src, dst);
+    pthread_mutex_unlock(&media_color_lock);
+
+    if (node != NULL) {
+        return &node->transform;
+    }
+
+    // built without the lock, its gamma tables may have to be built too
+    struct _media_color_node* built = malloc(sizeof(struct _media_color_node));
+    if (built == NULL) {
+        return NULL;
+    }
+
+    if (_media_color_build(&built->transform, src, dst) != 0) {
+        free(built);
+        return NULL;
+    }
+
+    built->transform.hash = hash;
+    built->transform.shared = 0;
+
+    pthread_mutex_lock(&media_color_lock);
+
+    // another thread may have kept the same pair meanwhile
+    node = _media_color_find(hash, src, dst);
+    if (node == NULL && media_color_cached < MEDIA_COLOR_CACHE) {
+        built->transform.shared = 1;
+        built->next = media_color_cache;
+        media_color_cache = built;
+        media_color_cached++;
+    }
+
+    pthread_mutex_unlock(&media_color_lock);
+
+    if (node != NULL) {
+        media_color_transform_release(&built->transform);
+        return &node->transform;
+    }
+
+    return &built->transform;
+}
+
+void media_color_transform_release(const struct media_color_transform* transform) {
+    // transform is the first member of its node
+    if (transform != NULL && !transform->shared) {
+        media_gamma_release(transform->decode);
+        media_gamma_release(transform->encode);
+        free((void*) transform);
+    }
+}
+
+// linear sample c of pixel x
+static inline uint16_t _media_color_decode(const struct media_color_transform* transform, uint32_t depth,
+                                           const uint8_t* pixels, uint32_t channels, size_t x, uint32_t c) {
+    if (depth == 8) {
+        return transform->decode->to_linear8[pixels[x * channels + c]];
+    }
+
+    return transform->decode->to_linear16[((const uint16_t*) pixels)[x * channels + c]];
+}
+
+static inline void _media_color_encode(const struct media_color_transform* transform, uint32_t depth,
+                                       uint8_t* pixels, uint32_t channels, size_t x, uint32_t c, int32_t value) {
+    if (depth == 8) {
+        pixels[x * channels + c] = transform->encode->from_linear8[value];
+    } else {
+        ((uint16_t*) pixels)[x * channels + c] = transform->encode->from_linear16[value];
+    }
+}
+
+int media_color_transform_row(const struct media_color_transform* transform, enum media_pixel_format format,
+                              uint8_t* pixels, size_t count) {
+    if (format != MEDIA_PIXEL_RGB8 && format != MEDIA_PIXEL_RGBA8
+        && format != MEDIA_PIXEL_RGB16 && format != MEDIA_PIXEL_RGBA16) {
+        return 1;
+    }
+
+    if (transform->identity) {
+        return 0;
+    }
+
+    uint32_t channels = media_pixel_channels(format);
+    uint32_t depth = media_pixel_depth(format);
+    const float* m = transform->matrix;
+    size_t x = 0;
+
+#ifdef __SSE2__
+    // curves are lookups, the matrix goes over 4 pixels at once
+    __m128 max = _mm_set1_ps(65535.0f);
+    __m128 zero = _mm_setzero_ps();
+
+    for (; x + 4 <= count; x += 4) {
+        __m128 in[3];
+
+        for (uint32_t c = 0; c < 3; c++) {
+            in[c] = _mm_setr_ps(_media_color_decode(transform, depth, pixels, channels, x, c),
+                                _media_color_decode(transform, depth, pixels, channels, x + 1, c),
+                                _media_color_decode(transform, depth, pixels, channels, x + 2, c),
+                                _media_color_decode(transform, depth, pixels, channels, x + 3, c));
+        }
+
+        for (uint32_t c = 0; c < 3; c++) {
+            __m128 out = _mm_add_ps(_mm_add_ps(_mm_mul_ps(in[0], _mm_set1_ps(m[c * 3])),
+                                               _mm_mul_ps(in[1], _mm_set1_ps(m[c * 3 + 1]))),
+                                    _mm_mul_ps(in[2], _mm_set1_ps(m[c * 3 + 2])));
+            out = _mm_max_ps(_mm_min_ps(out, max), zero);
+
+            int32_t values[4];
+            _mm_storeu_si128((__m128i*) values, _mm_cvtps_epi32(out));
+
+            for (uint32_t j = 0; j < 4; j++) {
+                _media_color_encode(transform, depth, pixels, channels, x + j, c, values[j]);
+            }
+        }
+    }
+#endif
+
+    for (; x < count; x++) {
+        float in[3];
+
+        for (uint32_t c = 0; c < 3; c++) {
+            in[c] = _media_color_decode(transform, depth, pixels, channels, x, c);
+        }
+
+        for (uint32_t c = 0; c < 3; c++) {
+            float out = in[0] * m[c * 3] + in[1] * m[c * 3 + 1] + in[2] * m[c * 3 + 2];
+            out = fminf(fmaxf(out, 0.0f), 65535.0f);
+
+            _media_color_encode(transform, depth, pixels, channels, x, c, (int32_t) lrintf(out));
+        }
+    }
+
+    return 0;
+}
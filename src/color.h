@@ -0,0 +1,68 @@
+#ifndef MEDIA_COLOR_GUARD_HEADER
+#define MEDIA_COLOR_GUARD_HEADER
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pixel.h"
+#include "gamma.h"
+
+// transforms media_color_transform_get keeps, past them they're built for each caller alone
+#define MEDIA_COLOR_CACHE 16
+
+// RGB color space given by its primaries in CIE XYZ and a transfer curve
+struct media_color_space {
+    // row major, columns are XYZ of red, green and blue at full intensity
+    double to_xyz[9];
+    // XYZ of the white point primaries are relative to
+    double white[3];
+    // transfer curve as in media_gamma
+    uint32_t gamma;
+};
+
+// compiled conversion between two color spaces, immutable and shared by every thread
+struct media_color_transform {
+    uint64_t hash;
+    struct media_color_space src;
+    struct media_color_space dst;
+
+    const struct media_gamma* decode;
+    const struct media_gamma* encode;
+    // row major, linear src RGB to linear dst RGB with white points adapted (Bradford)
+    float matrix[9];
+    // not zero if pixels are kept as they are
+    uint8_t identity;
+    // 0 if it belongs to the caller of media_color_transform_get alone
+    uint8_t shared;
+};
+
+// space of cHRM like chromaticities (CIE xy) of white and primaries.
+// return 0 if success, otherwise another number if they are degenerate
+int media_color_space_from_xy(double white_x, double white_y, double red_x, double red_y,
+                              double green_x, double green_y, double blue_x, double blue_y,
+                              uint32_t gamma, struct media_color_space* space);
+
+// sRGB primaries with D65 white and the sRGB curve
+void media_color_space_srgb(struct media_color_space* space);
+
+// space of an uncompressed ICC profile of RGB data with rXYZ/gXYZ/bXYZ colorants and
+// curv or para tone curves (matrix/TRC profiles). the three curves must follow one power or the
+// sRGB curve closely, since a space has a single gamma.
+// return 0 if success, otherwise another number (e.g. LUT based profiles or curves per channel)
+int media_color_space_from_icc(const uint8_t* profile, size_t size, struct media_color_space* space);
+
+// transform from src to dst, the first MEDIA_COLOR_CACHE pairs asked for are built once and kept
+// until exit, others are built for this caller. either way it's given back with
+// media_color_transform_release. NULL if it couldn't be allocated
+const struct media_color_transform* media_color_transform_get(const struct media_color_space* src,
+                                                              const struct media_color_space* dst);
+
+// frees a transform of media_color_transform_get unless it's kept, transform can be NULL
+void media_color_transform_release(const struct media_color_transform* transform);
+
+// converts count pixels in place, RGB and RGBA of any depth, alpha is kept.
+// return 0 if success, otherwise another number
+int media_color_transform_row(const struct media_color_transform* transform, enum media_pixel_format format,
+                              uint8_t* pixels, size_t count);
+
+#endif // MEDIA_COLOR_GUARD_HEADER
@@ -0,0 +1,413 @@
+#include "compare.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+// vectors of 8 bits squares summed into 32 bits lanes before they're moved to 64 bits ones,
+// every vector adds up to 4 * 255 * 255 to a lane
+#define MEDIA_DIFF_FLUSH 8192
+
+// BT.601 luma weights
+#define MEDIA_LUMA_R 0.299f
+#define MEDIA_LUMA_G 0.587f
+#define MEDIA_LUMA_B 0.114f
+
+// largest difference and squared differences of size bytes of samples
+static void _media_diff_samples(struct media_diff* diff, uint8_t wide, const uint8_t* a, const uint8_t* b,
+                                size_t size);
+// differing pixels of a row with the first and last of them
+static void _media_diff_pixels(uint32_t pixel_size, const uint8_t* a, const uint8_t* b, uint32_t count,
+                               uint64_t* pixels, uint32_t* first, uint32_t* last);
+static inline uint32_t _media_popcount16(uint32_t v);
+
+void media_diff_init(struct media_diff* diff) {
+    memset(diff, 0, sizeof(struct media_diff));
+    diff->min_x = UINT32_MAX;
+    diff->min_y = UINT32_MAX;
+}
+
+void media_diff_row(struct media_diff* diff, enum media_pixel_format format,
+                    const uint8_t* a, const uint8_t* b, uint32_t count, uint32_t y) {
+    uint32_t pixel_size = media_pixel_size(format);
+    size_t size = (size_t) count * pixel_size;
+
+    // most rows of similar images are the same
+    if (memcmp(a, b, size) == 0) {
+        return;
+    }
+
+    _media_diff_samples(diff, media_pixel_depth(format) == 16, a, b, size);
+
+    uint64_t pixels = 0;
+    uint32_t first = UINT32_MAX;
+    uint32_t last = 0;
+    _media_diff_pixels(pixel_size, a, b, count, &pixels, &first, &last);
+
+    diff->pixels += pixels;
+    diff->min_x = first < diff->min_x ? first : diff->min_x;
+    diff->max_x = last > diff->max_x ? last : diff->max_x;
+    diff->min_y = y < diff->min_y ? y : diff->min_y;
+    diff->max_y = y > diff->max_y ? y : diff->max_y;
+}
+
+void media_diff_merge(struct media_diff* diff, const struct media_diff* other) {
+    diff->pixels += other->pixels;
+    diff->min_x = other->min_x < diff->min_x ? other->min_x : diff->min_x;
+    diff->min_y = other->min_y < diff->min_y ? other->min_y : diff->min_y;
+    diff->max_x = other->max_x > diff->max_x ? other->max_x : diff->max_x;
+    diff->max_y = other->max_y > diff->max_y ? other->max_y : diff->max_y;
+    diff->max_error = other->max_error > diff->max_error ? other->max_error : diff->max_error;
+    diff->squares += other->squares;
+}
+
+void media_luma_row(enum media_pixel_format format, const uint8_t* src, uint32_t count, float* luma) {
+    uint32_t channels = media_pixel_channels(format);
+    uint8_t wide = media_pixel_depth(format) == 16;
+    const uint16_t* samples = (const uint16_t*) src;
+    uint32_t x = 0;
+
+    if (channels <= 2) {
+        for (; x < count; x++) {
+            luma[x] = wide ? samples[(size_t) x * channels] : src[(size_t) x * channels];
+        }
+
+        return;
+    }
+
+#ifdef __SSE2__
+    // 4 RGBA pixels transposed into planes of red, green and blue
+    if (channels == 4) {
+        __m128i zero = _mm_setzero_si128();
+        __m128 weight_r = _mm_set1_ps(MEDIA_LUMA_R);
+        __m128 weight_g = _mm_set1_ps(MEDIA_LUMA_G);
+        __m128 weight_b = _mm_set1_ps(MEDIA_LUMA_B);
+
+        for (; x + 4 <= count; x += 4) {
+            __m128i lo;
+            __m128i hi;
+
+            if (wide) {
+                lo = _mm_loadu_si128((const __m128i*) &samples[(size_t) x * 4]);
+                hi = _mm_loadu_si128((const __m128i*) &samples[(size_t) x * 4 + 8]);
+            } else {
+                __m128i v = _mm_loadu_si128((const __m128i*) &src[(size_t) x * 4]);
+                lo = _mm_unpacklo_epi8(v, zero);
+                hi = _mm_unpackhi_epi8(v, zero);
+            }
+
+            __m128 p0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+            __m128 p1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+            __m128 p2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+            __m128 p3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+            _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+
+            __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(weight_r, p0), _mm_mul_ps(weight_g, p1)),
+                                  _mm_mul_ps(weight_b, p2));
+            _mm_storeu_ps(&luma[x], y);
+        }
+    }
+#endif
+
+    if (wide) {
+        for (; x < count; x++) {
+            const uint16_t* pixel = &samples[(size_t) x * channels];
+            luma[x] = MEDIA_LUMA_R * pixel[0] + MEDIA_LUMA_G * pixel[1] + MEDIA_LUMA_B * pixel[2];
+        }
+    } else {
+        for (; x < count; x++) {
+            const uint8_t* pixel = &src[(size_t) x * channels];
+            luma[x] = MEDIA_LUMA_R * pixel[0] + MEDIA_LUMA_G * pixel[1] + MEDIA_LUMA_B * pixel[2];
+        }
+    }
+}
+
+void media_ssim_sums(const float* const* a, const float* const* b, struct media_ssim_band* band) {
+    uint32_t blocks = band->blocks;
+    float* s1 = &band->sums[0 * blocks];
+    float* s2 = &band->sums[1 * blocks];
+    float* ss = &band->sums[2 * blocks];
+    float* s12 = &band->sums[3 * blocks];
+    uint32_t block = 0;
+
+#ifdef __SSE2__
+    // 4 blocks at once, lanes of each one are transposed so their sums end in a vector
+    for (; block + 4 <= blocks; block += 4) {
+        __m128 sums[4][4];
+        for (uint32_t j = 0; j < 4; j++) {
+            size_t x = (size_t) (block + j) * MEDIA_SSIM_BLOCK;
+            __m128 sum1 = _mm_setzero_ps();
+            __m128 sum2 = _mm_setzero_ps();
+            __m128 squares = _mm_setzero_ps();
+            __m128 products = _mm_setzero_ps();
+
+            for (uint32_t r = 0; r < MEDIA_SSIM_BLOCK; r++) {
+                __m128 va = _mm_loadu_ps(&a[r][x]);
+                __m128 vb = _mm_loadu_ps(&b[r][x]);
+
+                sum1 = _mm_add_ps(sum1, va);
+                sum2 = _mm_add_ps(sum2, vb);
+                squares = _mm_add_ps(squares, _mm_add_ps(_mm_mul_ps(va, va), _mm_mul_ps(vb, vb)));
+                products = _mm_add_ps(products, _mm_mul_ps(va, vb));
+            }
+
+            sums[0][j] = sum1;
+            sums[1][j] = sum2;
+            sums[2][j] = squares;
+            sums[3][j] = products;
+        }
+
+        float* planes[4] = {s1, s2, ss, s12};
+        for (uint32_t k = 0; k < 4; k++) {
+            _MM_TRANSPOSE4_PS(sums[k][0], sums[k][1], sums[k][2], sums[k][3]);
+
+            __m128 total = _mm_add_ps(_mm_add_ps(sums[k][0], sums[k][1]), _mm_add_ps(sums[k][2], sums[k][3]));
+            _mm_storeu_ps(&planes[k][block], total);
+        }
+    }
+#endif
+
+    for (; block < blocks; block++) {
+        size_t x = (size_t) block * MEDIA_SSIM_BLOCK;
+        float sum1 = 0.0f;
+        float sum2 = 0.0f;
+        float squares = 0.0f;
+        float products = 0.0f;
+
+        for (uint32_t r = 0; r < MEDIA_SSIM_BLOCK; r++) {
+            for (uint32_t i = 0; i < MEDIA_SSIM_BLOCK; i++) {
+                float va = a[r][x + i];
+                float vb = b[r][x + i];
+
+                sum1 += va;
+                sum2 += vb;
+                squares += va * va + vb * vb;
+                products += va * vb;
+            }
+        }
+
+        s1[block] = sum1;
+        s2[block] = sum2;
+        ss[block] = squares;
+        s12[block] = products;
+    }
+}
+
+double media_ssim(double s1, double s2, double ss, double s12, double count, double max) {
+    // constants of the SSIM paper, scaled like the sums
+    double c1 = 0.01 * 0.01 * max * max * count * count;
+    double c2 = 0.03 * 0.03 * max * max * count * (count - 1);
+
+    double variances = ss * count - s1 * s1 - s2 * s2;
+    double covariance = s12 * count - s1 * s2;
+
+    return (2 * s1 * s2 + c1) * (2 * covariance + c2) / ((s1 * s1 + s2 * s2 + c1) * (variances + c2));
+}
+
+uint32_t media_ssim_windows(const struct media_ssim_band* top, const struct media_ssim_band* bottom,
+                            double max, double* ssim) {
+    uint32_t blocks = top->blocks;
+    if (blocks < 2) {
+        return 0;
+    }
+
+    double sums[4];
+    double count = 4 * MEDIA_SSIM_BLOCK * MEDIA_SSIM_BLOCK;
+
+    for (uint32_t x = 0; x + 1 < blocks; x++) {
+        for (uint32_t k = 0; k < 4; k++) {
+            const float* t = &top->sums[k * blocks + x];
+            const float* b = &bottom->sums[k * blocks + x];
+
+            sums[k] = (double) t[0] + t[1] + b[0] + b[1];
+        }
+
+        *ssim += media_ssim(sums[0], sums[1], sums[2], sums[3], count, max);
+    }
+
+    return blocks - 1;
+}
+
+static void _media_diff_samples(struct media_diff* diff, uint8_t wide, const uint8_t* a, const uint8_t* b,
+                                size_t size) {
+    size_t i = 0;
+    uint32_t max_error = diff->max_error;
+    uint64_t squares = 0;
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i max = _mm_setzero_si128();
+    __m128i sums64 = _mm_setzero_si128();
+
+    if (wide) {
+        __m128i bias = _mm_set1_epi16(-0x8000);
+        max = bias;
+
+        for (; i + 16 <= size; i += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i*) &a[i]);
+            __m128i vb = _mm_loadu_si128((const __m128i*) &b[i]);
+            __m128i d = _mm_or_si128(_mm_subs_epu16(va, vb), _mm_subs_epu16(vb, va));
+
+            // no unsigned 16 bits max before SSE4.1
+            max = _mm_max_epi16(max, _mm_xor_si128(d, bias));
+
+            // 32 bits squares from their low and high halves
+            __m128i lo = _mm_mullo_epi16(d, d);
+            __m128i hi = _mm_mulhi_epu16(d, d);
+            __m128i squares_lo = _mm_unpacklo_epi16(lo, hi);
+            __m128i squares_hi = _mm_unpackhi_epi16(lo, hi);
+
+            sums64 = _mm_add_epi64(sums64, _mm_unpacklo_epi32(squares_lo, zero));
+            sums64 = _mm_add_epi64(sums64, _mm_unpackhi_epi32(squares_lo, zero));
+            sums64 = _mm_add_epi64(sums64, _mm_unpacklo_epi32(squares_hi, zero));
+            sums64 = _mm_add_epi64(sums64, _mm_unpackhi_epi32(squares_hi, zero));
+        }
+
+        uint16_t lanes[8];
+        _mm_storeu_si128((__m128i*) lanes, max);
+
+        for (uint32_t j = 0; j < 8; j++) {
+            uint32_t lane = lanes[j] ^ 0x8000;
+            max_error = lane > max_error ? lane : max_error;
+        }
+    } else {
+        __m128i sums32 = _mm_setzero_si128();
+        uint32_t pending = 0;
+
+        for (; i + 16 <= size; i += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i*) &a[i]);
+            __m128i vb = _mm_loadu_si128((const __m128i*) &b[i]);
+            __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+
+            max = _mm_max_epu8(max, d);
+
+            __m128i lo = _mm_unpacklo_epi8(d, zero);
+            __m128i hi = _mm_unpackhi_epi8(d, zero);
+            sums32 = _mm_add_epi32(sums32, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+
+            if (++pending == MEDIA_DIFF_FLUSH) {
+                sums64 = _mm_add_epi64(sums64, _mm_unpacklo_epi32(sums32, zero));
+                sums64 = _mm_add_epi64(sums64, _mm_unpackhi_epi32(sums32, zero));
+                sums32 = _mm_setzero_si128();
+                pending = 0;
+            }
+        }
+
+        sums64 = _mm_add_epi64(sums64, _mm_unpacklo_epi32(sums32, zero));
+        sums64 = _mm_add_epi64(sums64, _mm_unpackhi_epi32(sums32, zero));
+
+        uint8_t lanes[16];
+        _mm_storeu_si128((__m128i*) lanes, max);
+
+        for (uint32_t j = 0; j < 16; j++) {
+            max_error = lanes[j] > max_error ? lanes[j] : max_error;
+        }
+    }
+
+    uint64_t halves[2];
+    _mm_storeu_si128((__m128i*) halves, sums64);
+    squares = halves[0] + halves[1];
+#endif
+
+    // samples left after the vectors
+    for (; i < size; i += wide ? 2 : 1) {
+        uint32_t va = wide ? *(const uint16_t*) &a[i] : a[i];
+        uint32_t vb = wide ? *(const uint16_t*) &b[i] : b[i];
+        uint32_t d = va > vb ? va - vb : vb - va;
+
+        max_error = d > max_error ? d : max_error;
+        squares += (uint64_t) d * d;
+    }
+
+    diff->max_error = max_error;
+    diff->squares += squares;
+}
+
+static void _media_diff_pixels(uint32_t pixel_size, const uint8_t* a, const uint8_t* b, uint32_t count,
+                               uint64_t* pixels, uint32_t* first, uint32_t* last) {
+    size_t size = (size_t) count * pixel_size;
+    size_t begin = 0;
+    size_t end = size;
+    uint64_t found = 0;
+
+#ifdef __SSE2__
+    if (pixel_size == 1 || pixel_size == 2 || pixel_size == 4 || pixel_size == 8) {
+        size_t i = 0;
+        size_t first_chunk = SIZE_MAX;
+        size_t last_chunk = 0;
+
+        for (; i + 16 <= size; i += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i*) &a[i]);
+            __m128i vb = _mm_loadu_si128((const __m128i*) &b[i]);
+            uint32_t different = ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xFFFF;
+
+            if (different == 0) {
+                continue;
+            }
+
+            // a bit on the first byte of every differing pixel
+            switch (pixel_size) {
+                case 2: {
+                    different = (different | different >> 1) & 0x5555;
+                    break;
+                }
+                case 4: {
+                    different |= different >> 1;
+                    different = (different | different >> 2) & 0x1111;
+                    break;
+                }
+                case 8: {
+                    different |= different >> 1;
+                    different |= different >> 2;
+                    different = (different | different >> 4) & 0x0101;
+                    break;
+                }
+            }
+
+            found += _media_popcount16(different);
+            first_chunk = first_chunk == SIZE_MAX ? i : first_chunk;
+            last_chunk = i;
+        }
+
+        // first and last pixels are looked for in their chunks, pixels after the vectors one by one
+        if (first_chunk != SIZE_MAX) {
+            for (size_t x = first_chunk / pixel_size; ; x++) {
+                if (memcmp(&a[x * pixel_size], &b[x * pixel_size], pixel_size) != 0) {
+                    *first = (uint32_t) x;
+                    break;
+                }
+            }
+
+            for (size_t x = (last_chunk + 16) / pixel_size; x-- > 0; ) {
+                if (memcmp(&a[x * pixel_size], &b[x * pixel_size], pixel_size) != 0) {
+                    *last = (uint32_t) x;
+                    break;
+                }
+            }
+        }
+
+        begin = i;
+    }
+#endif
+
+    for (size_t x = begin / pixel_size; x < end / pixel_size; x++) {
+        if (memcmp(&a[x * pixel_size], &b[x * pixel_size], pixel_size) != 0) {
+            found++;
+            *first = (uint32_t) x < *first ? (uint32_t) x : *first;
+            *last = (uint32_t) x;
+        }
+    }
+
+    *pixels = found;
+}
+
+static inline uint32_t _media_popcount16(uint32_t v) {
+    v = v - ((v >> 1) & 0x5555);
+    v = (v & 0x3333) + ((v >> 2) & 0x3333);
+    v = (v + (v >> 4)) & 0x0F0F;
+
+    return (v + (v >> 8)) & 0x1F;
+}
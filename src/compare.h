@@ -0,0 +1,57 @@
+#ifndef MEDIA_COMPARE_GUARD_HEADER
+#define MEDIA_COMPARE_GUARD_HEADER
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pixel.h"
+
+// side of the blocks SSIM sums are taken over, windows are 2 x 2 blocks
+#define MEDIA_SSIM_BLOCK 4
+
+// differences between rows of two images, filled row by row and merged between threads
+struct media_diff {
+    // pixels with any sample different
+    uint64_t pixels;
+    // bounds of those pixels, min_x > max_x while there's none
+    uint32_t min_x;
+    uint32_t min_y;
+    uint32_t max_x;
+    uint32_t max_y;
+    // largest difference of a sample
+    uint32_t max_error;
+    // squared differences of every sample, exact up to 2^32 samples of 16 bits
+    uint64_t squares;
+};
+
+// sums of blocks of a band of MEDIA_SSIM_BLOCK rows, one plane of blocks for each of them:
+// a, b, a * a + b * b and a * b
+struct media_ssim_band {
+    uint32_t blocks;
+    float* sums;
+};
+
+void media_diff_init(struct media_diff* diff);
+
+// adds count pixels of row y of two images in format (any but INDEXED8)
+void media_diff_row(struct media_diff* diff, enum media_pixel_format format,
+                    const uint8_t* a, const uint8_t* b, uint32_t count, uint32_t y);
+
+// adds other into diff
+void media_diff_merge(struct media_diff* diff, const struct media_diff* other);
+
+// luma of count pixels in format (any but INDEXED8) with BT.601 weights, alpha is left out
+void media_luma_row(enum media_pixel_format format, const uint8_t* src, uint32_t count, float* luma);
+
+// sums of blocks of MEDIA_SSIM_BLOCK luma rows of both images, blocks of band are width / MEDIA_SSIM_BLOCK
+void media_ssim_sums(const float* const* a, const float* const* b, struct media_ssim_band* band);
+
+// SSIM of count pairs of samples given their sums (a, b, a * a + b * b and a * b), max is the largest sample
+double media_ssim(double s1, double s2, double ss, double s12, double count, double max);
+
+// adds SSIM of the windows over two consecutive bands, max is the largest sample.
+// return how many windows were added
+uint32_t media_ssim_windows(const struct media_ssim_band* top, const struct media_ssim_band* bottom,
+                            double max, double* ssim);
+
+#endif // MEDIA_COMPARE_GUARD_HEADER
@@ -0,0 +1,681 @@
+#include "convolve.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// largest fraction bits of weights, like the Q14 ones of media_resize
+#define MEDIA_CONVOLVE_BITS 14
+
+// bytes of horizontal rows a band of media_convolve works through, about an L2 cache
+#define MEDIA_CONVOLVE_BLOCK (256 * 1024)
+
+// samples of the columns media_box_blur runs its vertical passes over at once
+#define MEDIA_BOX_STRIP 128
+
+// samples are kept as signed (sample - 32768) between passes, so pairs of them fit pmaddwd
+#define MEDIA_CONVOLVE_BIAS 0x8000
+
+// weights of a kernel in fixed point, taps is size rounded up to even and the last tap weighs 0
+struct _media_convolve_kernel {
+    uint32_t size;
+    uint32_t taps;
+    uint32_t bits;
+    // added to the shifted sums, what the bias of the samples turns into through the weights minus that bias
+    int32_t offset;
+    int16_t* weights;
+};
+
+// state shared by the threads of media_convolve
+struct _media_convolve_job {
+    enum media_pixel_format format;
+    enum media_pixel_format wide_format;
+    uint32_t channels;
+    uint8_t alpha;
+
+    const uint8_t* src;
+    size_t src_stride;
+    uint32_t width;
+    uint32_t height;
+
+    uint8_t* dst;
+    size_t dst_stride;
+
+    struct _media_convolve_kernel horizontal;
+    struct _media_convolve_kernel vertical;
+    // rows of every band but the last one
+    uint32_t band;
+
+    // set by any range that couldn't allocate its buffers
+    volatile uint8_t failed;
+};
+
+// state shared by the threads of media_box_blur
+struct _media_box_job {
+    enum media_pixel_format format;
+    enum media_pixel_format wide_format;
+    uint32_t channels;
+    uint8_t alpha;
+
+    const uint8_t* src;
+    size_t src_stride;
+    uint32_t width;
+    uint32_t height;
+
+    uint8_t* dst;
+    size_t dst_stride;
+
+    const uint32_t* radii;
+    uint32_t passes;
+
+    // every row after the horizontal passes, width * channels samples each
+    uint16_t* rows;
+    size_t samples;
+
+    // set by any range that couldn't allocate its buffers
+    volatile uint8_t failed;
+};
+
+// rows of media_unsharp_mask, dst already holds the blurred ones
+struct _media_unsharp_job {
+    enum media_pixel_format format;
+    const uint8_t* src;
+    size_t src_stride;
+    uint32_t width;
+
+    uint8_t* dst;
+    size_t dst_stride;
+
+    float amount;
+    uint32_t threshold;
+};
+
+// return 0 if success, otherwise another number
+static int _media_convolve_kernel_build(struct _media_convolve_kernel* kernel, const float* values, uint32_t size) {
+    double total = 0;
+    double absolute = 0;
+    double largest = 0;
+
+    for (uint32_t i = 0; i < size; i++) {
+        total += values[i];
+        absolute += fabs(values[i]);
+        largest = fabs(values[i]) > largest ? fabs(values[i]) : largest;
+    }
+
+    // sums of biased samples and the offset must stay under 2^30, so weights add up under 2^15
+    // and rounding can grow them by up to size
+    uint32_t bits = MEDIA_CONVOLVE_BITS;
+    while (bits > 0 && absolute * (1 << bits) + size >= 32768) {
+        bits--;
+    }
+
+    if (absolute * (1 << bits) + size >= 32768 || largest * (1 << bits) + size >= 32768) {
+        return 1;
+    }
+
+    kernel->size = size;
+    kernel->taps = size + 1;
+    kernel->bits = bits;
+    kernel->weights = calloc(kernel->taps, sizeof(int16_t));
+
+    if (kernel->weights == NULL) {
+        return 2;
+    }
+
+    // rounding leftovers go to the heaviest tap, so weights keep adding up to the rounded total
+    int32_t sum = 0;
+    uint32_t heaviest = 0;
+
+    for (uint32_t i = 0; i < size; i++) {
+        kernel->weights[i] = (int16_t) lround(values[i] * (1 << bits));
+        sum += kernel->weights[i];
+
+        if (abs(kernel->weights[i]) > abs(kernel->weights[heaviest])) {
+            heaviest = i;
+        }
+    }
+
+    int32_t weights = (int32_t) lround(total * (1 << bits));
+    kernel->weights[heaviest] += weights - sum;
+    kernel->offset = weights * (1 << (15 - bits)) - 32768;
+
+    return 0;
+}
+
+// dst[i] of samples is the weighted sum of taps[t][i], all of them biased. dst is biased if flip is 0
+// or unsigned if it's MEDIA_CONVOLVE_BIAS
+static void _media_convolve_taps(const struct _media_convolve_kernel* kernel, const int16_t* const* taps,
+                                 size_t samples, uint16_t flip, uint16_t* dst) {
+    const int16_t* weights = kernel->weights;
+    int32_t half = kernel->bits > 0 ? 1 << (kernel->bits - 1) : 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i round = _mm_set1_epi32(half);
+    const __m128i offset = _mm_set1_epi32(kernel->offset);
+    const __m128i shift = _mm_cvtsi32_si128((int) kernel->bits);
+    const __m128i flips = _mm_set1_epi16((short) flip);
+
+    for (; i + 8 <= samples; i += 8) {
+        __m128i low = _mm_setzero_si128();
+        __m128i high = _mm_setzero_si128();
+
+        for (uint32_t t = 0; t < kernel->taps; t += 2) {
+            __m128i first = _mm_loadu_si128((const __m128i*) &taps[t][i]);
+            __m128i second = _mm_loadu_si128((const __m128i*) &taps[t + 1][i]);
+            __m128i pair = _mm_set1_epi32((int32_t) ((uint32_t) (uint16_t) weights[t + 1] << 16 | (uint16_t) weights[t]));
+
+            low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(first, second), pair));
+            high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(first, second), pair));
+        }
+
+        low = _mm_add_epi32(_mm_sra_epi32(_mm_add_epi32(low, round), shift), offset);
+        high = _mm_add_epi32(_mm_sra_epi32(_mm_add_epi32(high, round), shift), offset);
+
+        _mm_storeu_si128((__m128i*) &dst[i], _mm_xor_si128(_mm_packs_epi32(low, high), flips));
+    }
+#endif
+
+    for (; i < samples; i++) {
+        int32_t sum = 0;
+
+        for (uint32_t t = 0; t < kernel->taps; t++) {
+            sum += weights[t] * taps[t][i];
+        }
+
+        int32_t value = ((sum + half) >> kernel->bits) + kernel->offset;
+        value = value < -32768 ? -32768 : (value > 32767 ? 32767 : value);
+
+        dst[i] = (uint16_t) value ^ flip;
+    }
+}
+
+// source row y of a media_convolve job through the horizontal kernel into biased samples of dst.
+// wide holds a row of wide samples and padded the row with kernel size more pixels
+static void _media_convolve_row(const struct _media_convolve_job* job, uint32_t y, uint16_t* wide,
+                                int16_t* padded, const int16_t** taps, int16_t* dst) {
+    const struct _media_convolve_kernel* kernel = &job->horizontal;
+    uint32_t channels = job->channels;
+    uint32_t radius = kernel->size / 2;
+    size_t samples = (size_t) job->width * channels;
+
+    media_convert_row(job->format, &job->src[y * job->src_stride], job->wide_format, (uint8_t*) wide,
+                      job->width, MEDIA_LUMA_AVERAGE);
+
+    if (job->alpha) {
+        media_premultiply_row(job->wide_format, (uint8_t*) wide, job->width);
+    }
+
+    // radius pixels on the left and radius + 1 on the right repeat the border ones, the last for the tap weighing 0
+    for (uint32_t x = 0; x < radius; x++) {
+        for (uint32_t c = 0; c < channels; c++) {
+            padded[x * channels + c] = (int16_t) (wide[c] ^ MEDIA_CONVOLVE_BIAS);
+        }
+    }
+
+    int16_t* middle = &padded[(size_t) radius * channels];
+    for (size_t i = 0; i < samples; i++) {
+        middle[i] = (int16_t) (wide[i] ^ MEDIA_CONVOLVE_BIAS);
+    }
+
+    int16_t* right = &middle[samples];
+    for (uint32_t x = 0; x <= radius; x++) {
+        for (uint32_t c = 0; c < channels; c++) {
+            right[x * channels + c] = (int16_t) (wide[samples - channels + c] ^ MEDIA_CONVOLVE_BIAS);
+        }
+    }
+
+    for (uint32_t t = 0; t < kernel->taps; t++) {
+        taps[t] = &padded[(size_t) t * channels];
+    }
+
+    _media_convolve_taps(kernel, taps, samples, 0, (uint16_t*) dst);
+}
+
+// media_range_fn of bands [begin, end), each one goes through the horizontal kernel into rows
+// of a buffer about MEDIA_CONVOLVE_BLOCK big and then through the vertical one into dst
+static void _media_convolve_bands(void* context, size_t begin, size_t end) {
+    struct _media_convolve_job* job = context;
+    uint32_t radius = job->vertical.size / 2;
+    size_t samples = (size_t) job->width * job->channels;
+    size_t rows = (size_t) job->band + 2 * radius;
+    uint32_t taps = job->horizontal.taps > job->vertical.taps ? job->horizontal.taps : job->vertical.taps;
+
+    uint16_t* wide = malloc(sizeof(uint16_t) * samples);
+    int16_t* padded = malloc(sizeof(int16_t) * ((size_t) job->width + job->horizontal.taps) * job->channels);
+    int16_t* band = malloc(sizeof(int16_t) * samples * rows);
+    const int16_t** pointers = malloc(sizeof(int16_t*) * taps);
+
+    if (wide == NULL || padded == NULL || band == NULL || pointers == NULL) {
+        job->failed = 1;
+        begin = end;
+    }
+
+    for (size_t b = begin; b < end; b++) {
+        uint32_t first = (uint32_t) (b * job->band);
+        uint32_t last = first + job->band < job->height ? first + job->band : job->height;
+
+        // rows from first - radius up to last + radius, the ones past the borders repeat the nearest one
+        for (uint32_t i = 0; i < last - first + 2 * radius; i++) {
+            int64_t y = (int64_t) first + i - radius;
+            y = y < 0 ? 0 : (y >= job->height ? job->height - 1 : y);
+
+            _media_convolve_row(job, (uint32_t) y, wide, padded, pointers, &band[i * samples]);
+        }
+
+        for (uint32_t y = first; y < last; y++) {
+            for (uint32_t t = 0; t < job->vertical.size; t++) {
+                pointers[t] = &band[(y - first + t) * samples];
+            }
+
+            // the tap weighing 0, any row would do
+            pointers[job->vertical.size] = band;
+
+            _media_convolve_taps(&job->vertical, pointers, samples, MEDIA_CONVOLVE_BIAS, wide);
+
+            if (job->alpha) {
+                media_unpremultiply_row(job->wide_format, (uint8_t*) wide, job->width);
+            }
+
+            media_convert_row(job->wide_format, (const uint8_t*) wide, job->format, &job->dst[y * job->dst_stride],
+                              job->width, MEDIA_LUMA_AVERAGE);
+        }
+    }
+
+    free(wide);
+    free(padded);
+    free(band);
+    free(pointers);
+}
+
+int media_convolve(enum media_pixel_format format, const float* kx, uint32_t kx_size, const float* ky,
+                   uint32_t ky_size, uint32_t threads, const uint8_t* src, size_t src_stride,
+                   uint32_t width, uint32_t height, uint8_t* dst, size_t dst_stride) {
+    if (format == MEDIA_PIXEL_INDEXED8 || (kx_size & 1) == 0 || (ky_size & 1) == 0) {
+        return 1;
+    }
+
+    if (width == 0 || height == 0) {
+        return 2;
+    }
+
+    struct _media_convolve_job job;
+    memset(&job, 0, sizeof(struct _media_convolve_job));
+
+    job.format = format;
+    job.wide_format = media_pixel_wide_format(format);
+    job.channels = media_pixel_channels(format);
+    job.alpha = job.channels == 2 || job.channels == 4;
+    job.src = src;
+    job.src_stride = src_stride;
+    job.width = width;
+    job.height = height;
+    job.dst = dst;
+    job.dst_stride = dst_stride;
+
+    int ret = 0;
+
+    if (_media_convolve_kernel_build(&job.horizontal, kx, kx_size) != 0
+        || _media_convolve_kernel_build(&job.vertical, ky, ky_size) != 0) {
+        ret = 3;
+    }
+
+    if (ret == 0) {
+        // bands fill MEDIA_CONVOLVE_BLOCK with their rows and those around them, but never get shorter
+        // than the rows around them, nor longer than needed to give every thread one
+        uint32_t radius = ky_size / 2;
+        size_t block_rows = MEDIA_CONVOLVE_BLOCK / (sizeof(int16_t) * width * job.channels);
+        size_t band = block_rows > 4 * (size_t) radius ? block_rows - 2 * radius : 2 * (size_t) radius;
+        size_t share = (height + (size_t) (threads > 0 ? threads : 1) - 1) / (threads > 0 ? threads : 1);
+
+        band = band < share ? band : share;
+        job.band = (uint32_t) (band > 0 ? band : 1);
+
+        media_parallel_for((height + job.band - 1) / job.band, threads, _media_convolve_bands, &job);
+        ret = job.failed ? 3 : 0;
+    }
+
+    free(job.horizontal.weights);
+    free(job.vertical.weights);
+
+    return ret;
+}
+
+// averages of 2 * radius + 1 pixels around each one of count pixels of channels samples
+static void _media_box_row(const uint16_t* src, uint16_t* dst, uint32_t count, uint32_t channels,
+                           uint32_t radius) {
+    float scale = 1.0f / (2 * radius + 1);
+    uint32_t sums[4];
+
+    for (uint32_t c = 0; c < channels; c++) {
+        sums[c] = (radius + 1) * src[c];
+
+        for (uint32_t i = 1; i <= radius; i++) {
+            sums[c] += src[(i < count ? i : count - 1) * channels + c];
+        }
+    }
+
+    for (uint32_t x = 0; x < count; x++) {
+        const uint16_t* in = &src[(x + radius + 1 < count ? x + radius + 1 : count - 1) * channels];
+        const uint16_t* out = &src[(x > radius ? x - radius : 0) * channels];
+
+        for (uint32_t c = 0; c < channels; c++) {
+            dst[x * channels + c] = (uint16_t) (uint32_t) ((float) sums[c] * scale + 0.5f);
+            sums[c] += in[c] - out[c];
+        }
+    }
+}
+
+// averages of 2 * radius + 1 rows around each one of height rows of count samples, sums holds count of them
+static void _media_box_columns(const uint16_t* src, size_t src_stride, uint16_t* dst, size_t dst_stride,
+                               uint32_t count, uint32_t height, uint32_t radius, uint32_t* sums) {
+    float scale = 1.0f / (2 * radius + 1);
+
+    for (uint32_t s = 0; s < count; s++) {
+        sums[s] = (radius + 1) * src[s];
+    }
+
+    for (uint32_t i = 1; i <= radius; i++) {
+        const uint16_t* row = &src[(i < height ? i : height - 1) * src_stride];
+
+        for (uint32_t s = 0; s < count; s++) {
+            sums[s] += row[s];
+        }
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+        uint32_t next = y + radius + 1;
+        const uint16_t* in = &src[(next < height ? next : height - 1) * src_stride];
+        const uint16_t* out = &src[(y > radius ? y - radius : 0) * src_stride];
+        uint16_t* row = &dst[y * dst_stride];
+        uint32_t s = 0;
+
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i bias = _mm_set1_epi32(32768);
+        const __m128 scales = _mm_set1_ps(scale);
+        const __m128 half = _mm_set1_ps(0.5f);
+
+        for (; s + 8 <= count; s += 8) {
+            __m128i low = _mm_loadu_si128((const __m128i*) &sums[s]);
+            __m128i high = _mm_loadu_si128((const __m128i*) &sums[s + 4]);
+
+            // averages are unsigned 16 bits, biased so the signed pack doesn't saturate them
+            __m128i first = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(low), scales), half));
+            __m128i second = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(high), scales), half));
+            __m128i values = _mm_packs_epi32(_mm_sub_epi32(first, bias), _mm_sub_epi32(second, bias));
+            _mm_storeu_si128((__m128i*) &row[s], _mm_xor_si128(values, _mm_set1_epi16((short) 0x8000)));
+
+            __m128i added = _mm_loadu_si128((const __m128i*) &in[s]);
+            __m128i removed = _mm_loadu_si128((const __m128i*) &out[s]);
+
+            low = _mm_sub_epi32(_mm_add_epi32(low, _mm_unpacklo_epi16(added, zero)), _mm_unpacklo_epi16(removed, zero));
+            high = _mm_sub_epi32(_mm_add_epi32(high, _mm_unpackhi_epi16(added, zero)), _mm_unpackhi_epi16(removed, zero));
+
+            _mm_storeu_si128((__m128i*) &sums[s], low);
+            _mm_storeu_si128((__m128i*) &sums[s + 4], high);
+        }
+#endif
+
+        for (; s < count; s++) {
+            row[s] = (uint16_t) (uint32_t) ((float) sums[s] * scale + 0.5f);
+            sums[s] += in[s] - out[s];
+        }
+    }
+}
+
+// media_range_fn of the horizontal passes over rows [begin, end)
+static void _media_box_rows(void* context, size_t begin, size_t end) {
+    struct _media_box_job* job = context;
+    uint16_t* buffers[2] = {malloc(sizeof(uint16_t) * job->samples), malloc(sizeof(uint16_t) * job->samples)};
+
+    if (buffers[0] == NULL || buffers[1] == NULL) {
+        job->failed = 1;
+        begin = end;
+    }
+
+    for (size_t y = begin; y < end; y++) {
+        uint16_t* row = &job->rows[y * job->samples];
+
+        media_convert_row(job->format, &job->src[y * job->src_stride], job->wide_format, (uint8_t*) buffers[0],
+                          job->width, MEDIA_LUMA_AVERAGE);
+
+        if (job->alpha) {
+            media_premultiply_row(job->wide_format, (uint8_t*) buffers[0], job->width);
+        }
+
+        const uint16_t* from = buffers[0];
+        for (uint32_t p = 0; p < job->passes; p++) {
+            uint16_t* to = p + 1 == job->passes ? row : buffers[(p + 1) % 2];
+
+            _media_box_row(from, to, job->width, job->channels, job->radii[p]);
+            from = to;
+        }
+
+        if (job->passes == 0) {
+            memcpy(row, buffers[0], sizeof(uint16_t) * job->samples);
+        }
+    }
+
+    free(buffers[0]);
+    free(buffers[1]);
+}
+
+// media_range_fn of the vertical passes over strips [begin, end) of MEDIA_BOX_STRIP samples of every row,
+// through two buffers of the strip before it's copied back into the rows
+static void _media_box_strips(void* context, size_t begin, size_t end) {
+    struct _media_box_job* job = context;
+    uint16_t* buffers[2] = {
+        malloc(sizeof(uint16_t) * MEDIA_BOX_STRIP * job->height),
+        malloc(sizeof(uint16_t) * MEDIA_BOX_STRIP * job->height)
+    };
+    uint32_t* sums = malloc(sizeof(uint32_t) * MEDIA_BOX_STRIP);
+
+    if (buffers[0] == NULL || buffers[1] == NULL || sums == NULL) {
+        job->failed = 1;
+        begin = end;
+    }
+
+    for (size_t strip = begin; strip < end && job->passes > 0; strip++) {
+        size_t first = strip * MEDIA_BOX_STRIP;
+        uint32_t count = (uint32_t) (job->samples - first < MEDIA_BOX_STRIP ? job->samples - first : MEDIA_BOX_STRIP);
+
+        _media_box_columns(&job->rows[first], job->samples, buffers[0], MEDIA_BOX_STRIP, count, job->height,
+                           job->radii[0], sums);
+
+        for (uint32_t p = 1; p < job->passes; p++) {
+            _media_box_columns(buffers[(p + 1) % 2], MEDIA_BOX_STRIP, buffers[p % 2], MEDIA_BOX_STRIP, count,
+                               job->height, job->radii[p], sums);
+        }
+
+        const uint16_t* last = buffers[(job->passes + 1) % 2];
+        for (uint32_t y = 0; y < job->height; y++) {
+            memcpy(&job->rows[y * job->samples + first], &last[y * MEDIA_BOX_STRIP], sizeof(uint16_t) * count);
+        }
+    }
+
+    free(buffers[0]);
+    free(buffers[1]);
+    free(sums);
+}
+
+// media_range_fn writing rows [begin, end) of dst
+static void _media_box_resolve(void* context, size_t begin, size_t end) {
+    struct _media_box_job* job = context;
+
+    for (size_t y = begin; y < end; y++) {
+        uint8_t* row = (uint8_t*) &job->rows[y * job->samples];
+
+        if (job->alpha) {
+            media_unpremultiply_row(job->wide_format, row, job->width);
+        }
+
+        media_convert_row(job->wide_format, row, job->format, &job->dst[y * job->dst_stride], job->width,
+                          MEDIA_LUMA_AVERAGE);
+    }
+}
+
+int media_box_blur(enum media_pixel_format format, const uint32_t* radii, uint32_t passes, uint32_t threads,
+                   const uint8_t* src, size_t src_stride, uint32_t width, uint32_t height,
+                   uint8_t* dst, size_t dst_stride) {
+    if (format == MEDIA_PIXEL_INDEXED8) {
+        return 1;
+    }
+
+    // sums of a window must fit 32 bits
+    for (uint32_t p = 0; p < passes; p++) {
+        if (radii[p] >= 16384) {
+            return 1;
+        }
+    }
+
+    if (width == 0 || height == 0) {
+        return 2;
+    }
+
+    struct _media_box_job job;
+    memset(&job, 0, sizeof(struct _media_box_job));
+
+    job.format = format;
+    job.wide_format = media_pixel_wide_format(format);
+    job.channels = media_pixel_channels(format);
+    job.alpha = job.channels == 2 || job.channels == 4;
+    job.src = src;
+    job.src_stride = src_stride;
+    job.width = width;
+    job.height = height;
+    job.dst = dst;
+    job.dst_stride = dst_stride;
+    job.radii = radii;
+    job.passes = passes;
+    job.samples = (size_t) width * job.channels;
+    job.rows = malloc(sizeof(uint16_t) * job.samples * height);
+
+    if (job.rows == NULL) {
+        return 3;
+    }
+
+    media_parallel_for(height, threads, _media_box_rows, &job);
+
+    if (!job.failed) {
+        media_parallel_for((job.samples + MEDIA_BOX_STRIP - 1) / MEDIA_BOX_STRIP, threads, _media_box_strips, &job);
+    }
+
+    if (!job.failed) {
+        media_parallel_for(height, threads, _media_box_resolve, &job);
+    }
+
+    free(job.rows);
+
+    return job.failed ? 3 : 0;
+}
+
+int media_gaussian_blur(enum media_pixel_format format, float sigma, uint32_t threads,
+                        const uint8_t* src, size_t src_stride, uint32_t width, uint32_t height,
+                        uint8_t* dst, size_t dst_stride) {
+    if (!(sigma > 0)) {
+        return 1;
+    }
+
+    if (sigma >= MEDIA_GAUSSIAN_BOX_SIGMA) {
+        // odd widths of 3 boxes whose variances add up to sigma^2, the first ones a size narrower (Kovesi)
+        double variance = 12.0 * sigma * sigma;
+        uint32_t narrow = (uint32_t) sqrt(variance / 3 + 1);
+        narrow -= (narrow & 1) == 0 ? 1 : 0;
+
+        long count = lround((variance - 3.0 * narrow * narrow - 12.0 * narrow - 9.0) / (-4.0 * narrow - 4.0));
+        count = count < 0 ? 0 : (count > 3 ? 3 : count);
+
+        uint32_t radii[3];
+        for (uint32_t i = 0; i < 3; i++) {
+            radii[i] = ((i < count ? narrow : narrow + 2) - 1) / 2;
+        }
+
+        return media_box_blur(format, radii, 3, threads, src, src_stride, width, height, dst, dst_stride);
+    }
+
+    uint32_t radius = (uint32_t) ceilf(3 * sigma);
+    uint32_t size = 2 * radius + 1;
+    float* kernel = malloc(sizeof(float) * size);
+
+    if (kernel == NULL) {
+        return 3;
+    }
+
+    double total = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        double x = (double) i - radius;
+        kernel[i] = (float) exp(-x * x / (2.0 * sigma * sigma));
+        total += kernel[i];
+    }
+
+    for (uint32_t i = 0; i < size; i++) {
+        kernel[i] = (float) (kernel[i] / total);
+    }
+
+    int ret = media_convolve(format, kernel, size, kernel, size, threads, src, src_stride, width, height,
+                             dst, dst_stride);
+    free(kernel);
+
+    return ret;
+}
+
+// media_range_fn sharpening rows [begin, end)
+static void _media_unsharp_rows(void* context, size_t begin, size_t end) {
+    struct _media_unsharp_job* job = context;
+    uint32_t channels = media_pixel_channels(job->format);
+    uint32_t colors = channels == 2 || channels == 4 ? channels - 1 : channels;
+    int32_t max = media_pixel_depth(job->format) == 16 ? 65535 : 255;
+    size_t samples = (size_t) job->width * channels;
+
+    for (size_t y = begin; y < end; y++) {
+        const uint8_t* src = &job->src[y * job->src_stride];
+        uint8_t* dst = &job->dst[y * job->dst_stride];
+
+        for (size_t i = 0; i < samples; i++) {
+            int32_t sample = max == 255 ? src[i] : ((const uint16_t*) src)[i];
+            int32_t blurred = max == 255 ? dst[i] : ((const uint16_t*) dst)[i];
+            int32_t diff = sample - blurred;
+            int32_t value = sample;
+
+            if (i % channels < colors && (uint32_t) abs(diff) >= job->threshold) {
+                value = (int32_t) floorf(sample + job->amount * diff + 0.5f);
+                value = value < 0 ? 0 : (value > max ? max : value);
+            }
+
+            if (max == 255) {
+                dst[i] = (uint8_t) value;
+            } else {
+                ((uint16_t*) dst)[i] = (uint16_t) value;
+            }
+        }
+    }
+}
+
+int media_unsharp_mask(enum media_pixel_format format, float sigma, float amount, uint32_t threshold,
+                       uint32_t threads, const uint8_t* src, size_t src_stride, uint32_t width, uint32_t height,
+                       uint8_t* dst, size_t dst_stride) {
+    int ret = media_gaussian_blur(format, sigma, threads, src, src_stride, width, height, dst, dst_stride);
+    if (ret != 0) {
+        return ret;
+    }
+
+    struct _media_unsharp_job job;
+    job.format = format;
+    job.src = src;
+    job.src_stride = src_stride;
+    job.width = width;
+    job.dst = dst;
+    job.dst_stride = dst_stride;
+    job.amount = amount;
+    job.threshold = threshold;
+
+    media_parallel_for(height, threads, _media_unsharp_rows, &job);
+
+    return 0;
+}
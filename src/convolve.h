@@ -0,0 +1,42 @@
+#ifndef MEDIA_CONVOLVE_GUARD_HEADER
+#define MEDIA_CONVOLVE_GUARD_HEADER
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pixel.h"
+
+// media_gaussian_blur runs 3 box blurs instead of a kernel from this sigma up
+#define MEDIA_GAUSSIAN_BOX_SIGMA 4.0f
+
+// all of them work on src pixels in format (any but INDEXED8) with rows stride bytes apart into dst ones,
+// through 16 bits samples with colors weighted by alpha. pixels past the borders repeat the nearest one.
+// rows are split between threads. src and dst must not overlap.
+// return 0 if success, otherwise another number
+
+// rows then columns weighted by kx and ky, of odd sizes. tap i weighs the pixel i - size / 2 away from
+// each one. weights are Q14, or fewer bits if their absolute values add up to 2 or more, and rows go
+// through bands small enough to stay in L2
+int media_convolve(enum media_pixel_format format, const float* kx, uint32_t kx_size, const float* ky,
+                   uint32_t ky_size, uint32_t threads, const uint8_t* src, size_t src_stride,
+                   uint32_t width, uint32_t height, uint8_t* dst, size_t dst_stride);
+
+// passes averages of 2 * radius + 1 pixels one after another over rows and then columns, each
+// through a running sum so any radius costs the same
+int media_box_blur(enum media_pixel_format format, const uint32_t* radii, uint32_t passes, uint32_t threads,
+                   const uint8_t* src, size_t src_stride, uint32_t width, uint32_t height,
+                   uint8_t* dst, size_t dst_stride);
+
+// media_convolve with a gaussian kernel of radius 3 * sigma, or media_box_blur with 3 boxes of the
+// same variance from MEDIA_GAUSSIAN_BOX_SIGMA up
+int media_gaussian_blur(enum media_pixel_format format, float sigma, uint32_t threads,
+                        const uint8_t* src, size_t src_stride, uint32_t width, uint32_t height,
+                        uint8_t* dst, size_t dst_stride);
+
+// src + amount * (src - blurred src) for color samples differing from the blurred ones by threshold or more,
+// others and alpha are kept
+int media_unsharp_mask(enum media_pixel_format format, float sigma, float amount, uint32_t threshold,
+                       uint32_t threads, const uint8_t* src, size_t src_stride, uint32_t width, uint32_t height,
+                       uint8_t* dst, size_t dst_stride);
+
+#endif // MEDIA_CONVOLVE_GUARD_HEADER
@@ -0,0 +1,181 @@
+#include "gamma.h"
+
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+
+struct _media_gamma_node {
+    struct media_gamma tables;
+    struct _media_gamma_node* next;
+};
+
+// up to MEDIA_GAMMA_CACHE gammas asked for so far, nodes are never freed so returned tables stay valid
+static struct _media_gamma_node* media_gamma_cache = NULL;
+static uint32_t media_gamma_cached = 0;
+static pthread_mutex_t media_gamma_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// encoded value between 0 and 1 to linear light
+static double _media_gamma_decode(uint32_t gamma, double value) {
+    if (gamma == MEDIA_GAMMA_SRGB) {
+        return value <= 0.04045 ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4);
+    }
+
+    return pow(value, 100000.0 / gamma);
+}
+
+// linear light between 0 and 1 to encoded value
+static double _media_gamma_encode(uint32_t gamma, double value) {
+    if (gamma == MEDIA_GAMMA_SRGB) {
+        return value <= 0.0031308 ? value * 12.92 : 1.055 * pow(value, 1 / 2.4) - 0.055;
+    }
+
+    return pow(value, gamma / 100000.0);
+}
+
+static void _media_gamma_build(struct media_gamma* tables, uint32_t gamma) {
+    tables->gamma = gamma;
+
+    for (uint32_t i = 0; i < 256; i++) {
+        tables->to_linear8[i] = lround(_media_gamma_decode(gamma, i / 255.0) * 65535);
+    }
+
+    for (uint32_t i = 0; i < 65536; i++) {
+        double value = i / 65535.0;
+        double encoded = _media_gamma_encode(gamma, value);
+
+        tables->to_linear16[i] = lround(_media_gamma_decode(gamma, value) * 65535);
+        tables->from_linear8[i] = lround(encoded * 255);
+        tables->from_linear16[i] = lround(encoded * 65535);
+    }
+}
+
+// node of gamma in the cache, or NULL. media_gamma_lock must be held
+static struct _media_gamma_node* _media_gamma_find(uint32_t gamma) {
+    struct _media_gamma_node* node = media_gamma_cache;
+    while (node != NULL && node->tables.gamma != gamma) {
+        node = node->next;
+    }
+
+    return node;
+}
+
+const struct media_gamma* media_gamma_get(uint32_t gamma) {
+    pthread_mutex_lock(&media_gamma_lock);
+    struct _media_gamma_node* node = _media_gamma_find(gamma);
+    pthread_mutex_unlock(&media_gamma_lock);
+
+    if (node != NULL) {
+        return &node->tables;
+    }
+
+    // tables are built without the lock, so other gammas aren't held up meanwhile
+    struct _media_gamma_node* built = malloc(sizeof(struct _media_gamma_node));
+    if (built == NULL) {
+        return NULL;
+    }
+
+    _media_gamma_build(&built->tables, gamma);
+    built->tables.shared = 0;
+
+    pthread_mutex_lock(&media_gamma_lock);
+
+    // another thread may have kept the same gamma meanwhile
+    node = _media_gamma_find(gamma);
+    if (node == NULL && media_gamma_cached < MEDIA_GAMMA_CACHE) {
+        built->tables.shared = 1;
+        built->next = media_gamma_cache;
+        media_gamma_cache = built;
+        media_gamma_cached++;
+    }
+
+    pthread_mutex_unlock(&media_gamma_lock);
+
+    if (node != NULL) {
+        free(built);
+        return &node->tables;
+    }
+
+    return &built->tables;
+}
+
+void media_gamma_release(const struct media_gamma* gamma) {
+    // tables are the first member of their node
+    if (gamma != NULL && !gamma->shared) {
+        free((void*) gamma);
+    }
+}
+
+int media_gamma_to_linear(const struct media_gamma* gamma, enum media_pixel_format format,
+                          const uint8_t* src, uint16_t* dst, size_t count) {
+    if (format == MEDIA_PIXEL_INDEXED8) {
+        return 1;
+    }
+
+    uint32_t channels = media_pixel_channels(format);
+    // gray alpha and RGBA have alpha as last channel, it isn't gamma encoded
+    uint32_t colors = channels == 2 || channels == 4 ? channels - 1 : channels;
+    size_t samples = count * channels;
+
+    if (media_pixel_depth(format) == 8) {
+        for (size_t i = 0; i < samples; i += channels) {
+            for (uint32_t j = 0; j < colors; j++) {
+                dst[i + j] = gamma->to_linear8[src[i + j]];
+            }
+
+            if (colors != channels) {
+                dst[i + colors] = src[i + colors] * 257;
+            }
+        }
+    } else {
+        const uint16_t* src16 = (const uint16_t*) src;
+
+        for (size_t i = 0; i < samples; i += channels) {
+            for (uint32_t j = 0; j < colors; j++) {
+                dst[i + j] = gamma->to_linear16[src16[i + j]];
+            }
+
+            if (colors != channels) {
+                dst[i + colors] = src16[i + colors];
+            }
+        }
+    }
+
+    return 0;
+}
+
+int media_gamma_from_linear(const struct media_gamma* gamma, enum media_pixel_format format,
+                            const uint16_t* src, uint8_t* dst, size_t count) {
+    if (format == MEDIA_PIXEL_INDEXED8) {
+        return 1;
+    }
+
+    uint32_t channels = media_pixel_channels(format);
+    uint32_t colors = channels == 2 || channels == 4 ? channels - 1 : channels;
+    size_t samples = count * channels;
+
+    if (media_pixel_depth(format) == 8) {
+        for (size_t i = 0; i < samples; i += channels) {
+            for (uint32_t j = 0; j < colors; j++) {
+                dst[i + j] = gamma->from_linear8[src[i + j]];
+            }
+
+            if (colors != channels) {
+                dst[i + colors] = (src[i + colors] * 255 + 32895) >> 16;
+            }
+        }
+    } else {
+        uint16_t* dst16 = (uint16_t*) dst;
+
+        for (size_t i = 0; i < samples; i += channels) {
+            for (uint32_t j = 0; j < colors; j++) {
+                dst16[i + j] = gamma->from_linear16[src[i + j]];
+            }
+
+            if (colors != channels) {
+                dst16[i + colors] = src[i + colors];
+            }
+        }
+    }
+
+    return 0;
+}
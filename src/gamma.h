@@ -0,0 +1,46 @@
+#ifndef MEDIA_GAMMA_GUARD_HEADER
+#define MEDIA_GAMMA_GUARD_HEADER
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pixel.h"
+
+// sRGB transfer curve instead of a pure power
+#define MEDIA_GAMMA_SRGB 0
+// gammas media_gamma_get keeps, past them tables are built for each caller alone
+#define MEDIA_GAMMA_CACHE 8
+
+// lookup tables between encoded samples and 16 bits linear light, for one gamma.
+// they are immutable once built and shared by every thread
+struct media_gamma {
+    // 100000 times the encoding gamma as in gAMA (45455 is 1/2.2), or MEDIA_GAMMA_SRGB
+    uint32_t gamma;
+    // 0 if they belong to the caller of media_gamma_get alone
+    uint8_t shared;
+
+    uint16_t to_linear8[256];
+    uint16_t to_linear16[65536];
+    uint8_t from_linear8[65536];
+    uint16_t from_linear16[65536];
+};
+
+// tables of gamma, the first MEDIA_GAMMA_CACHE gammas asked for are built once and kept until exit,
+// others are built for this caller. either way they're given back with media_gamma_release.
+// NULL if they couldn't be allocated
+const struct media_gamma* media_gamma_get(uint32_t gamma);
+
+// frees tables of media_gamma_get unless they're kept, gamma can be NULL
+void media_gamma_release(const struct media_gamma* gamma);
+
+// encoded pixels to 16 bits linear samples in the same channel order, alpha is only widened.
+// return 0 if success, otherwise another number (e.g. INDEXED8)
+int media_gamma_to_linear(const struct media_gamma* gamma, enum media_pixel_format format,
+                          const uint8_t* src, uint16_t* dst, size_t count);
+
+// 16 bits linear samples back to encoded pixels of format, alpha is only narrowed.
+// return 0 if success, otherwise another number
+int media_gamma_from_linear(const struct media_gamma* gamma, enum media_pixel_format format,
+                            const uint16_t* src, uint8_t* dst, size_t count);
+
+#endif // MEDIA_GAMMA_GUARD_HEADER
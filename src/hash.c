@@ -0,0 +1,162 @@
+#include "hash.h"
+
+#include <string.h>
+#include <math.h>
+
+#define MEDIA_HASH_PI 3.14159265358979323846
+
+void media_hash_grid_init(struct media_hash_grid* grid, uint32_t columns, uint32_t rows,
+                          uint32_t width, uint32_t height) {
+    memset(grid, 0, sizeof(struct media_hash_grid));
+    grid->columns = columns;
+    grid->rows = rows;
+
+    // at least a pixel for every cell, so small images repeat theirs
+    for (uint32_t c = 0; c < columns; c++) {
+        grid->x0[c] = (uint32_t) ((uint64_t) c * width / columns);
+        grid->x1[c] = (uint32_t) ((uint64_t) (c + 1) * width / columns);
+        grid->x1[c] = grid->x1[c] > grid->x0[c] ? grid->x1[c] : grid->x0[c] + 1;
+    }
+
+    for (uint32_t r = 0; r < rows; r++) {
+        grid->y0[r] = (uint32_t) ((uint64_t) r * height / rows);
+        grid->y1[r] = (uint32_t) ((uint64_t) (r + 1) * height / rows);
+        grid->y1[r] = grid->y1[r] > grid->y0[r] ? grid->y1[r] : grid->y0[r] + 1;
+    }
+}
+
+void media_hash_grid_row(struct media_hash_grid* grid, const double* prefix, uint32_t y) {
+    for (uint32_t r = 0; r < grid->rows; r++) {
+        if (y < grid->y0[r] || y >= grid->y1[r]) {
+            continue;
+        }
+
+        double* cells = &grid->cells[r * grid->columns];
+        for (uint32_t c = 0; c < grid->columns; c++) {
+            cells[c] += prefix[grid->x1[c]] - prefix[grid->x0[c]];
+        }
+    }
+}
+
+void media_hash_grid_merge(struct media_hash_grid* grid, const struct media_hash_grid* other) {
+    for (uint32_t i = 0; i < grid->columns * grid->rows; i++) {
+        grid->cells[i] += other->cells[i];
+    }
+}
+
+void media_hash_grid_end(struct media_hash_grid* grid) {
+    for (uint32_t r = 0; r < grid->rows; r++) {
+        for (uint32_t c = 0; c < grid->columns; c++) {
+            double area = (double) (grid->x1[c] - grid->x0[c]) * (grid->y1[r] - grid->y0[r]);
+            grid->cells[r * grid->columns + c] /= area;
+        }
+    }
+}
+
+uint64_t media_ahash(const struct media_hash_grid* grid) {
+    uint32_t step = MEDIA_HASH_GRID / MEDIA_HASH_SIDE;
+    double means[MEDIA_HASH_SIDE * MEDIA_HASH_SIDE] = {0.0};
+    double mean = 0.0;
+
+    for (uint32_t r = 0; r < MEDIA_HASH_GRID; r++) {
+        for (uint32_t c = 0; c < MEDIA_HASH_GRID; c++) {
+            means[(r / step) * MEDIA_HASH_SIDE + c / step] += grid->cells[r * MEDIA_HASH_GRID + c] / (step * step);
+        }
+    }
+
+    for (uint32_t i = 0; i < MEDIA_HASH_SIDE * MEDIA_HASH_SIDE; i++) {
+        mean += means[i] / (MEDIA_HASH_SIDE * MEDIA_HASH_SIDE);
+    }
+
+    uint64_t hash = 0;
+    for (uint32_t i = 0; i < MEDIA_HASH_SIDE * MEDIA_HASH_SIDE; i++) {
+        hash = hash << 1 | (means[i] > mean);
+    }
+
+    return hash;
+}
+
+uint64_t media_dhash(const struct media_hash_grid* grid) {
+    uint64_t hash = 0;
+
+    for (uint32_t r = 0; r < MEDIA_HASH_SIDE; r++) {
+        const double* cells = &grid->cells[r * (MEDIA_HASH_SIDE + 1)];
+
+        for (uint32_t c = 0; c < MEDIA_HASH_SIDE; c++) {
+            hash = hash << 1 | (cells[c + 1] > cells[c]);
+        }
+    }
+
+    return hash;
+}
+
+uint64_t media_phash(const struct media_hash_grid* grid) {
+    // only the lowest frequencies are needed, so the DCT is MEDIA_HASH_GRID x MEDIA_HASH_SIDE both ways
+    double basis[MEDIA_HASH_SIDE][MEDIA_HASH_GRID];
+    for (uint32_t u = 0; u < MEDIA_HASH_SIDE; u++) {
+        for (uint32_t x = 0; x < MEDIA_HASH_GRID; x++) {
+            basis[u][x] = cos(MEDIA_HASH_PI * (2 * x + 1) * u / (2 * MEDIA_HASH_GRID));
+        }
+    }
+
+    double rows[MEDIA_HASH_GRID][MEDIA_HASH_SIDE];
+    for (uint32_t y = 0; y < MEDIA_HASH_GRID; y++) {
+        const double* cells = &grid->cells[y * MEDIA_HASH_GRID];
+
+        for (uint32_t u = 0; u < MEDIA_HASH_SIDE; u++) {
+            double sum = 0.0;
+            for (uint32_t x = 0; x < MEDIA_HASH_GRID; x++) {
+                sum += cells[x] * basis[u][x];
+            }
+
+            rows[y][u] = sum;
+        }
+    }
+
+    double coefficients[MEDIA_HASH_SIDE * MEDIA_HASH_SIDE];
+    for (uint32_t v = 0; v < MEDIA_HASH_SIDE; v++) {
+        for (uint32_t u = 0; u < MEDIA_HASH_SIDE; u++) {
+            double sum = 0.0;
+            for (uint32_t y = 0; y < MEDIA_HASH_GRID; y++) {
+                sum += basis[v][y] * rows[y][u];
+            }
+
+            coefficients[v * MEDIA_HASH_SIDE + u] = sum;
+        }
+    }
+
+    // median of an even count is the mean of both middle ones
+    double sorted[MEDIA_HASH_SIDE * MEDIA_HASH_SIDE];
+    memcpy(sorted, coefficients, sizeof(sorted));
+
+    for (uint32_t i = 1; i < MEDIA_HASH_SIDE * MEDIA_HASH_SIDE; i++) {
+        double value = sorted[i];
+        uint32_t j = i;
+
+        for (; j > 0 && sorted[j - 1] > value; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+
+        sorted[j] = value;
+    }
+
+    uint32_t middle = MEDIA_HASH_SIDE * MEDIA_HASH_SIDE / 2;
+    double median = (sorted[middle - 1] + sorted[middle]) / 2;
+
+    uint64_t hash = 0;
+    for (uint32_t i = 0; i < MEDIA_HASH_SIDE * MEDIA_HASH_SIDE; i++) {
+        hash = hash << 1 | (coefficients[i] > median);
+    }
+
+    return hash;
+}
+
+uint32_t media_hash_distance(uint64_t a, uint64_t b) {
+    uint64_t v = a ^ b;
+
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+
+    return (uint32_t) ((v * 0x0101010101010101ULL) >> 56);
+}
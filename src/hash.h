@@ -0,0 +1,52 @@
+#ifndef MEDIA_HASH_GUARD_HEADER
+#define MEDIA_HASH_GUARD_HEADER
+
+#include <stdint.h>
+#include <stddef.h>
+
+// largest side of the grids hashes are taken from, pHash runs its DCT over a grid this big
+#define MEDIA_HASH_GRID 32
+// side of the DCT coefficients pHash keeps, and of the aHash grid
+#define MEDIA_HASH_SIDE 8
+
+// mean luma of cells of an image split in columns x rows, filled one source row at a time
+struct media_hash_grid {
+    uint32_t columns;
+    uint32_t rows;
+    // source pixels [x0, x1) and rows [y0, y1) of every column and row, they overlap
+    // when the image is smaller than the grid
+    uint32_t x0[MEDIA_HASH_GRID];
+    uint32_t x1[MEDIA_HASH_GRID];
+    uint32_t y0[MEDIA_HASH_GRID];
+    uint32_t y1[MEDIA_HASH_GRID];
+    double cells[MEDIA_HASH_GRID * MEDIA_HASH_GRID];
+};
+
+// empty grid of up to MEDIA_HASH_GRID columns and rows over a width x height image
+void media_hash_grid_init(struct media_hash_grid* grid, uint32_t columns, uint32_t rows,
+                          uint32_t width, uint32_t height);
+
+// adds source row y given prefix sums of its luma, prefix[x] is the sum of pixels before x
+void media_hash_grid_row(struct media_hash_grid* grid, const double* prefix, uint32_t y);
+
+// adds the sums of other, a grid over the same image and of the same size, into grid
+void media_hash_grid_merge(struct media_hash_grid* grid, const struct media_hash_grid* other);
+
+// sums of cells to means, once every row was added
+void media_hash_grid_end(struct media_hash_grid* grid);
+
+// bits are set from the top left cell down, most significant first
+
+// 8 x 8 means of a MEDIA_HASH_GRID grid, set if above their mean
+uint64_t media_ahash(const struct media_hash_grid* grid);
+
+// 9 x 8 grid, set if a cell is brighter than the one on its left
+uint64_t media_dhash(const struct media_hash_grid* grid);
+
+// 8 x 8 lowest frequencies of the DCT of a MEDIA_HASH_GRID grid, set if above their median
+uint64_t media_phash(const struct media_hash_grid* grid);
+
+// bits that differ between a and b
+uint32_t media_hash_distance(uint64_t a, uint64_t b);
+
+#endif // MEDIA_HASH_GUARD_HEADER
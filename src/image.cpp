@@ -8,6 +8,14 @@ media::ImagePNG::ImagePNG(image_color_type type, uint32_t width, uint32_t height
     image = image_png_create(type, width, height);
 }
 
+media::ImagePNG::ImagePNG(const ImagePNG& image) {
+    this->image = image.image != NULL ? image_png_copy(image.image) : NULL;
+}
+
+media::ImagePNG::ImagePNG(ImagePNG&& image) noexcept : image(image.image) {
+    image.image = NULL;
+}
+
 media::ImagePNG::~ImagePNG() {
     if (image != NULL) {
         image_png_close(image);
@@ -27,6 +35,33 @@ bool media::ImagePNG::open(const std::string& path) {
     return image != NULL;
 }
 
+bool media::ImagePNG::openExpanded(const std::string& path) {
+    if (image != NULL) {
+        image_png_close(image);
+    }
+
+    image = image_png_open_expanded(path.c_str());
+    return image != NULL;
+}
+
+bool media::ImagePNG::open(const std::string& path, const image_decode_options& options) {
+    if (image != NULL) {
+        image_png_close(image);
+    }
+
+    image = image_png_open_with(path.c_str(), &options);
+    return image != NULL;
+}
+
+bool media::ImagePNG::openRegion(const std::string& path, const image_rect& rect) {
+    if (image != NULL) {
+        image_png_close(image);
+    }
+
+    image = image_png_open_region(path.c_str(), rect);
+    return image != NULL;
+}
+
 image_dimension media::ImagePNG::getDimension() const {
     image_dimension dimension{0, 0};
 
@@ -45,6 +80,76 @@ void media::ImagePNG::setDimension(const image_dimension &dimension) {
     image_png_set_dimension(image, dimension);
 }
 
+bool media::ImagePNG::resize(uint32_t width, uint32_t height, image_resize_filter filter) {
+    return image != NULL && image_png_resize(image, width, height, filter) == 0;
+}
+
+media::ImagePNG media::ImagePNG::resized(uint32_t width, uint32_t height, image_resize_filter filter) const {
+    ImagePNG copy(*this);
+
+    if (copy.image != NULL && !copy.resize(width, height, filter)) {
+        image_png_close(copy.image);
+        copy.image = NULL;
+    }
+
+    return copy;
+}
+
+bool media::ImagePNG::rotate90() {
+    return image != NULL && image_png_rotate90(image) == 0;
+}
+
+bool media::ImagePNG::rotate180() {
+    return image != NULL && image_png_rotate180(image) == 0;
+}
+
+bool media::ImagePNG::rotate270() {
+    return image != NULL && image_png_rotate270(image) == 0;
+}
+
+bool media::ImagePNG::flipH() {
+    return image != NULL && image_png_flip_h(image) == 0;
+}
+
+bool media::ImagePNG::flipV() {
+    return image != NULL && image_png_flip_v(image) == 0;
+}
+
+bool media::ImagePNG::transpose() {
+    return image != NULL && image_png_transpose(image) == 0;
+}
+
+bool media::ImagePNG::convolveSeparable(const std::vector<float>& kx, const std::vector<float>& ky) {
+    return image != NULL && image_png_convolve_separable(image, kx.data(), static_cast<uint32_t>(kx.size()),
+                                                         ky.data(), static_cast<uint32_t>(ky.size())) == 0;
+}
+
+bool media::ImagePNG::gaussianBlur(float sigma) {
+    return image != NULL && image_png_gaussian_blur(image, sigma) == 0;
+}
+
+bool media::ImagePNG::unsharpMask(float sigma, float amount, uint32_t threshold) {
+    return image != NULL && image_png_unsharp_mask(image, sigma, amount, threshold) == 0;
+}
+
+bool media::ImagePNG::getResizeLinear() const {
+    uint8_t linear = 0;
+
+    if (image != NULL) {
+        image_png_get_resize_linear(image, &linear);
+    }
+
+    return linear != 0;
+}
+
+void media::ImagePNG::setResizeLinear(bool linear) {
+    if (image == NULL) {
+        return;
+    }
+
+    image_png_set_resize_linear(image, linear ? 1 : 0);
+}
+
 image_color_type media::ImagePNG::getColor() const {
     image_color_type type;
 
@@ -55,12 +160,12 @@ image_color_type media::ImagePNG::getColor() const {
     return type;
 }
 
-void media::ImagePNG::setColor(image_color_type type) {
+bool media::ImagePNG::setColor(image_color_type type) {
     if (image == NULL) {
-        return;
+        return false;
     }
 
-    image_png_set_color(image, type);
+    return image_png_set_color(image, type) == 0;
 }
 
 uint32_t media::ImagePNG::getGamma() const {
@@ -245,6 +350,148 @@ void media::ImagePNG::setPixel(uint32_t x, uint32_t y, const image_color& color)
     image_png_set_pixel(image, x, y, color);
 }
 
+bool media::ImagePNG::fill(const image_color& color) {
+    return image != NULL && image_png_fill(image, color) == 0;
+}
+
+bool media::ImagePNG::fillRect(const image_rect& rect, const image_color& color) {
+    return image != NULL && image_png_fill_rect(image, rect, color) == 0;
+}
+
+bool media::ImagePNG::blit(uint32_t x, uint32_t y, const ImagePNG& src, const image_rect& rect) {
+    return image != NULL && src.image != NULL && image_png_blit(image, x, y, src.image, rect) == 0;
+}
+
+bool media::ImagePNG::composite(uint32_t x, uint32_t y, const ImagePNG& src, image_blend_mode mode) {
+    return image != NULL && src.image != NULL && image_png_composite(image, src.image, x, y, mode) == 0;
+}
+
+bool media::ImagePNG::premultiply() {
+    return image != NULL && image_png_premultiply(image) == 0;
+}
+
+bool media::ImagePNG::unpremultiply() {
+    return image != NULL && image_png_unpremultiply(image) == 0;
+}
+
+bool media::ImagePNG::getRow(uint32_t y, image_color_type type, void* buffer) const {
+    return image != NULL && image_png_get_row(image, y, type, buffer) == 0;
+}
+
+bool media::ImagePNG::setRow(uint32_t y, image_color_type type, const void* buffer) {
+    return image != NULL && image_png_set_row(image, y, type, buffer) == 0;
+}
+
+bool media::ImagePNG::getSpan(uint32_t x, uint32_t y, uint32_t count, image_color_type type, void* buffer) const {
+    return image != NULL && image_png_get_span(image, x, y, count, type, buffer) == 0;
+}
+
+bool media::ImagePNG::setSpan(uint32_t x, uint32_t y, uint32_t count, image_color_type type, const void* buffer) {
+    return image != NULL && image_png_set_span(image, x, y, count, type, buffer) == 0;
+}
+
+bool media::ImagePNG::getLinearRow(uint32_t y, uint16_t* buffer) const {
+    return image != NULL && image_png_get_linear_row(image, y, buffer) == 0;
+}
+
+bool media::ImagePNG::setLinearRow(uint32_t y, const uint16_t* buffer) {
+    return image != NULL && image_png_set_linear_row(image, y, buffer) == 0;
+}
+
+bool media::ImagePNG::convertToSRGB() {
+    return image != NULL && image_png_convert_to_srgb(image) == 0;
+}
+
+bool media::ImagePNG::toPlanarF32(image_tensor_layout layout, const float* mean, const float* std, float* out) const {
+    return image != NULL && image_png_to_planar_f32(image, layout, mean, std, out) == 0;
+}
+
+std::vector<uint64_t> media::ImagePNG::getHistogram(uint32_t bins) const {
+    if (image == NULL) {
+        return {};
+    }
+
+    enum image_color_type type;
+    image_png_get_color(image, &type);
+
+    // indexed images are counted as RGBA
+    uint32_t channels = (type & 0x02) != 0 ? 1 : (type == IMAGE_INDEXED_COLOR ? 4 : 3);
+    if ((type & IMAGE_ALPHA_BIT) != 0) {
+        channels++;
+    }
+
+    std::vector<uint64_t> histogram((size_t) channels * bins);
+    if (histogram.empty() || image_png_histogram(image, bins, histogram.data()) != 0) {
+        return {};
+    }
+
+    return histogram;
+}
+
+bool media::ImagePNG::getStats(image_stats& stats) const {
+    return image != NULL && image_png_stats(image, &stats) == 0;
+}
+
+bool media::ImagePNG::compare(const ImagePNG& other, image_compare_result& result) const {
+    return image != NULL && other.image != NULL && image_png_compare(image, other.image, &result) == 0;
+}
+
+bool media::ImagePNG::getHashes(image_hashes& hashes) const {
+    return image != NULL && image_png_hash(image, &hashes) == 0;
+}
+
+media::PixelView media::ImagePNG::pixels() {
+    return PixelView(image);
+}
+
+const uint32_t* media::ImagePNG::getPaletteLUT() const {
+    return image != NULL ? image_png_get_palette_lut(image) : NULL;
+}
+
+image_luma media::ImagePNG::getLuma() const {
+    image_luma luma = IMAGE_LUMA_AVERAGE;
+
+    if (image != NULL) {
+        image_png_get_luma(image, &luma);
+    }
+
+    return luma;
+}
+
+void media::ImagePNG::setLuma(image_luma luma) {
+    if (image == NULL) {
+        return;
+    }
+
+    image_png_set_luma(image, luma);
+}
+
+image_dither media::ImagePNG::getDither() const {
+    image_dither dither = IMAGE_DITHER_NONE;
+
+    if (image != NULL) {
+        image_png_get_dither(image, &dither);
+    }
+
+    return dither;
+}
+
+void media::ImagePNG::setDither(image_dither dither) {
+    if (image == NULL) {
+        return;
+    }
+
+    image_png_set_dither(image, dither);
+}
+
+void media::ImagePNG::setRestartInterval(uint32_t rows) {
+    if (image == NULL) {
+        return;
+    }
+
+    image_png_set_restart_interval(image, rows);
+}
+
 image_time media::ImagePNG::getTimestamp() const {
     image_time time{};
 
@@ -291,12 +538,74 @@ media::ImagePNG& media::ImagePNG::operator=(const ImagePNG& image) {
             image_png_close(this->image);
         }
 
-        this->image = image_png_copy(image.image);
+        this->image = image.image != NULL ? image_png_copy(image.image) : NULL;
+    }
+
+    return *this;
+}
+
+media::ImagePNG& media::ImagePNG::operator=(ImagePNG&& image) noexcept {
+    if (this != &image) {
+        if (this->image != NULL) {
+            image_png_close(this->image);
+        }
+
+        this->image = image.image;
+        image.image = NULL;
     }
 
     return *this;
 }
 
+media::PixelView::PixelView(struct image_png* image) : image(image), desc{} {
+    if (image != NULL) {
+        image_png_lock_pixels(image, &desc);
+    }
+}
+
+media::PixelView::PixelView(PixelView&& view) noexcept : image(view.image), desc(view.desc) {
+    view.image = NULL;
+    view.desc = image_pixel_desc{};
+}
+
+media::PixelView::~PixelView() {
+    if (image != NULL) {
+        image_png_unlock_pixels(image);
+    }
+}
+
+bool media::PixelView::isValid() const {
+    return image != NULL;
+}
+
+const image_pixel_desc& media::PixelView::getDesc() const {
+    return desc;
+}
+
+uint8_t* media::PixelView::data() const {
+    return desc.data;
+}
+
+uint8_t* media::PixelView::row(uint32_t y) const {
+    return desc.data + y * desc.stride;
+}
+
+size_t media::PixelView::stride() const {
+    return desc.stride;
+}
+
+uint32_t media::PixelView::width() const {
+    return desc.width;
+}
+
+uint32_t media::PixelView::height() const {
+    return desc.height;
+}
+
+uint8_t media::PixelView::pixelSize() const {
+    return desc.pixel_size;
+}
+
 image_color media::generate_color16(uint16_t red, uint16_t green, uint16_t blue, uint16_t alpha) {
     image_color color{};
 
@@ -2,6 +2,7 @@
 #define PNG_GUARD_HEADER
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define IMAGE_ALPHA_BIT 0x80
 #define IMAGE_IGNORE_ALPHA(type) (type & 0x7F)
@@ -59,6 +60,117 @@ struct image_color {
     };
 };
 
+enum image_channel_order {
+    IMAGE_ORDER_GRAY,
+    IMAGE_ORDER_GRAY_ALPHA,
+    IMAGE_ORDER_RGB,
+    IMAGE_ORDER_RGBA,
+    IMAGE_ORDER_INDEXED
+};
+
+enum image_endian {
+    IMAGE_LITTLE_ENDIAN,
+    IMAGE_BIG_ENDIAN
+};
+
+// layout of the decoded pixels as they are kept by the image
+struct image_pixel_desc {
+    uint8_t* data;
+    // bytes between the start of two consecutive rows
+    size_t stride;
+    uint32_t width;
+    uint32_t height;
+    enum image_color_type type;
+    // bytes per pixel
+    uint8_t pixel_size;
+    uint8_t channels;
+    // bits per stored sample, 8 even for 1, 2 and 4 bits images
+    uint8_t depth;
+    enum image_channel_order order;
+    // byte order of 16 bits samples
+    enum image_endian endian;
+};
+
+// weights used when a color turns into gray
+enum image_luma {
+    IMAGE_LUMA_AVERAGE,
+    IMAGE_LUMA_BT601,
+    IMAGE_LUMA_BT709
+};
+
+// how src pixels are laid over dst ones, always with Porter-Duff over alpha
+enum image_blend_mode {
+    IMAGE_BLEND_OVER,
+    IMAGE_BLEND_MULTIPLY,
+    IMAGE_BLEND_SCREEN
+};
+
+// how 16 bits samples are narrowed to 8 bits
+enum image_dither {
+    IMAGE_DITHER_NONE,
+    IMAGE_DITHER_ORDERED,
+    IMAGE_DITHER_DIFFUSION
+};
+
+// kernels of image_png_resize, wider ones are sharper and slower
+enum image_resize_filter {
+    IMAGE_FILTER_BOX,
+    IMAGE_FILTER_BILINEAR,
+    IMAGE_FILTER_LANCZOS3
+};
+
+// order of samples of a float tensor, channel planes (CHW) or interleaved pixels (HWC)
+enum image_tensor_layout {
+    IMAGE_LAYOUT_CHW,
+    IMAGE_LAYOUT_HWC
+};
+
+// summary of the samples of a channel, in the range of the image depth
+struct image_channel_stats {
+    uint16_t min;
+    uint16_t max;
+    double mean;
+    // of the whole population
+    double stddev;
+};
+
+struct image_stats {
+    // 1 gray, 2 gray and alpha, 3 RGB or 4 RGBA (indexed images)
+    uint32_t channels;
+    struct image_channel_stats channel[4];
+};
+
+struct image_rect {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+// what image_png_compare found, samples are in the range of the depth they're compared in
+struct image_compare_result {
+    // pixels with any sample different
+    uint64_t different;
+    // smallest rect holding them, width and height are 0 if there's none
+    struct image_rect bounds;
+    // largest difference of a sample
+    uint32_t max_error;
+    // over every sample, INFINITY if pixels are the same
+    double psnr;
+    // mean SSIM of luma over 8x8 windows every 4 pixels, 1 if pixels are the same
+    double ssim;
+};
+
+// 64 bits perceptual hashes of an image, close images differ in few bits (image_png_hash_distance)
+struct image_hashes {
+    // 8x8 means above the mean of the image
+    uint64_t average;
+    // 9x8 means brighter than the one on their left
+    uint64_t difference;
+    // 8x8 lowest frequencies of the DCT of 32x32 means above their median
+    uint64_t perceptual;
+};
+
 struct image_dimension {
     uint32_t width;
     uint32_t height;
@@ -73,13 +185,109 @@ struct image_time {
     uint8_t second;
 };
 
+enum image_text_action {
+    IMAGE_TEXT_SET,
+    IMAGE_TEXT_SET_ITXT,
+    IMAGE_TEXT_DELETE
+};
+
+// same meaning of fields as image_png_set_text and image_png_set_itxt,
+// except that compress -2 is handled as -1 since there is no previous entry to keep
+struct image_text_edit {
+    enum image_text_action action;
+    const char* keyword;
+    const char* text;
+    int16_t compress;
+
+    int16_t compression_flag;
+    int16_t compression_method;
+    const char* language_tag;
+    const char* translated_keyword;
+};
+
+struct image_metadata_edits {
+    uint32_t text_size;
+    struct image_text_edit* texts;
+    // if not zero, textual chunks not named in texts are dropped
+    uint8_t clear_text;
+
+    // if not zero, tIME is replaced by time, or removed if time is all set up to 0
+    uint8_t replace_time;
+    struct image_time time;
+};
+
+// ctx is the one given along with them, they must be safe to call from any thread using images
+typedef void* (*image_alloc_fn)(void* ctx, size_t size);
+typedef void* (*image_realloc_fn)(void* ctx, void* ptr, size_t size);
+typedef void (*image_free_fn)(void* ctx, void* ptr);
+
+struct image_allocator {
+    image_alloc_fn alloc;
+    image_realloc_fn realloc;
+    image_free_fn free;
+    void* ctx;
+};
+
+// how image_png_open_with decodes pixels, all set up to 0 is the same as image_png_open
+struct image_decode_options {
+    // indexed images are expanded to RGBA8 if not zero
+    uint8_t expand_palette;
+    // pixels are averaged over factor x factor blocks while rows are decoded, so only the
+    // smaller image is ever allocated. 0 and 1 keep them, indexed images are never averaged
+    uint32_t factor;
+    // if both aren't 0, factor grows up to the smallest one making the image fit in them
+    uint32_t max_width;
+    uint32_t max_height;
+    // only pixels in it are kept (before averaging), width or height 0 is the whole image.
+    // inflating stops after its last row, so chunks after it aren't read
+    struct image_rect region;
+    // the image and its chunks and metadata come from it instead of the image_png_set_allocator one if not NULL
+    const struct image_allocator* allocator;
+    // metadata comes from an arena, like after image_png_set_arena, if not zero
+    uint8_t arena;
+};
+
 struct image_png* image_png_create(enum image_color_type type, uint32_t width, uint32_t height);
 struct image_png* image_png_open(const char* path);
+// like image_png_open, but indexed images are expanded to RGBA8 while decoding
+struct image_png* image_png_open_expanded(const char* path);
+struct image_png* image_png_open_with(const char* path, const struct image_decode_options* options);
+// only the pixels of rect (clipped to the image), rows under it are neither inflated nor read
+struct image_png* image_png_open_region(const char* path, struct image_rect rect);
 void image_png_get_dimension(struct image_png* image, struct image_dimension* dimension);
 // 0 if sucess otherise another number
 int image_png_set_dimension(struct image_png* image, struct image_dimension dimension);
+// resamples pixels to the new dimension, colors are weighted by alpha. indexed images turn into RGBA8.
+// rows are split between image_png_set_threads threads. 0 if success otherwise another number
+int image_png_resize(struct image_png* image, uint32_t width, uint32_t height, enum image_resize_filter filter);
+// turns pixels clockwise into a new buffer, width and height are swapped.
+// 0 if success otherwise another number
+int image_png_rotate90(struct image_png* image);
+// in place, it can't fail
+int image_png_rotate180(struct image_png* image);
+// turns pixels counterclockwise, like image_png_rotate90
+int image_png_rotate270(struct image_png* image);
+// mirrors left and right, in place and it can't fail
+int image_png_flip_h(struct image_png* image);
+// mirrors top and bottom, in place and it can't fail
+int image_png_flip_v(struct image_png* image);
+// mirrors over the top left to bottom right diagonal, like image_png_rotate90
+int image_png_transpose(struct image_png* image);
+// weighs rows by kx and then columns by ky, of odd sizes centered on each pixel (tap size / 2), into new
+// pixels. pixels past the borders repeat the nearest one and colors are weighted by alpha, indexed images
+// turn into RGBA8. rows are split between image_png_set_threads threads. 0 if success otherwise another number
+int image_png_convolve_separable(struct image_png* image, const float* kx, uint32_t kx_size,
+                                 const float* ky, uint32_t ky_size);
+// like image_png_convolve_separable with a gaussian kernel, 3 box blurs from sigma 4 up. sigma 0 does nothing.
+// 0 if success otherwise another number
+int image_png_gaussian_blur(struct image_png* image, float sigma);
+// adds amount times the difference with image_png_gaussian_blur to color samples differing by threshold
+// or more (in samples of the depth of the image). 0 if success otherwise another number
+int image_png_unsharp_mask(struct image_png* image, float sigma, float amount, uint32_t threshold);
 void image_png_get_color(struct image_png* image, enum image_color_type* type);
-void image_png_set_color(struct image_png* image, enum image_color_type type);
+// converts every pixel to the new type, in place when pixels do not grow
+// 0 if success otherwise another number
+int image_png_set_color(struct image_png* image, enum image_color_type type);
 void image_png_get_gamma(struct image_png* image, uint32_t* gamma);
 void image_png_set_gamma(struct image_png* image, uint32_t gamma);
 void image_png_get_sbit(struct image_png* image, struct image_color* color);
@@ -104,13 +312,130 @@ void image_png_get_keys(struct image_png* image, char*** out_keywords, uint32_t*
 void image_png_del_text(struct image_png* image, const char* keyword);
 void image_png_get_palette(struct image_png* image, uint16_t* psize, struct image_color** ppalette);
 void image_png_set_palette(struct image_png* image, uint16_t size, struct image_color* pallete);
+// 256 packed RGBA8 pixels of PLTE with tRNS alpha applied, without copies.
+// it's valid until palette changes or image is closed, NULL if it couldn't be allocated
+const uint32_t* image_png_get_palette_lut(struct image_png* image);
 void image_png_get_pixel(struct image_png* image, uint32_t x, uint32_t y, struct image_color* color);
 void image_png_set_pixel(struct image_png* image, uint32_t x, uint32_t y, struct image_color color);
+// buffer holds pixels packed as type (alpha only if IMAGE_ALPHA_BIT), 16 bits samples in native endian.
+// rows and spans are converted from/to the image color as a whole, spans are clipped to the width.
+// indexed pixels are read through the palette, but only indexes can be written.
+// 0 if success otherwise another number
+int image_png_get_row(struct image_png* image, uint32_t y, enum image_color_type type, void* buffer);
+int image_png_set_row(struct image_png* image, uint32_t y, enum image_color_type type, const void* buffer);
+int image_png_get_span(struct image_png* image, uint32_t x, uint32_t y, uint32_t count,
+                       enum image_color_type type, void* buffer);
+int image_png_set_span(struct image_png* image, uint32_t x, uint32_t y, uint32_t count,
+                       enum image_color_type type, const void* buffer);
+// 16 bits linear light samples of row y in the channels of the image, alpha is only widened.
+// the sRGB curve is used if there is sRGB or no gAMA, otherwise gAMA. indexed images aren't supported
+// 0 if success otherwise another number
+int image_png_get_linear_row(struct image_png* image, uint32_t y, uint16_t* buffer);
+// encodes linear samples of image_png_get_linear_row back into row y
+int image_png_set_linear_row(struct image_png* image, uint32_t y, const uint16_t* buffer);
+// converts pixels (or the palette) from the space given by iCCP (matrix/TRC profiles), or cHRM and gAMA,
+// to sRGB, then those chunks are replaced by sRGB. images already in sRGB are kept as they are.
+// 0 if success otherwise another number
+int image_png_convert_to_srgb(struct image_png* image);
+// samples as (sample / max - mean[c]) / std[c] floats with the channels of the image, indexed ones as RGBA.
+// out holds width * height * channels floats, mean and std can be NULL (0 and 1).
+// 0 if success otherwise another number
+int image_png_to_planar_f32(struct image_png* image, enum image_tensor_layout layout,
+                            const float* mean, const float* std, float* out);
+// counts samples of every channel in bins equal ranges, the bin of a sample is sample * bins >> depth.
+// histogram has channels x bins counts, channel after channel in the order of image_stats, and
+// bins goes from 1 up to 256 for 8 bits images and 65536 for 16 bits ones. indexed images are counted
+// as RGBA8. rows are split between image_png_set_threads threads. 0 if success otherwise another number
+int image_png_histogram(struct image_png* image, uint32_t bins, uint64_t* histogram);
+// min, max, mean and standard deviation of every channel, like image_png_histogram.
+// 0 if success otherwise another number
+int image_png_stats(struct image_png* image, struct image_stats* stats);
+// compares pixels of two images of the same dimension, returning as soon as rows are the same.
+// different types are compared as RGBA of the deepest one and indexed ones through their palettes.
+// rows are split between image_png_set_threads threads. 0 if success otherwise another number
+int image_png_compare(struct image_png* a, struct image_png* b, struct image_compare_result* result);
+// hashes of the luma of the image in a single pass over rows, alpha is left out.
+// rows are split between image_png_set_threads threads. 0 if success otherwise another number
+int image_png_hash(struct image_png* image, struct image_hashes* hashes);
+// a single one of image_png_hash, convenience wrappers costing about the same: only the grid of that hash
+// is built, but the pass over the luma of every row is the same, so image_png_hash is cheaper for several
+// of them. 0 if success otherwise another number
+int image_png_ahash(struct image_png* image, uint64_t* hash);
+int image_png_dhash(struct image_png* image, uint64_t* hash);
+int image_png_phash(struct image_png* image, uint64_t* hash);
+// like image_png_hash over a file, averaged while rows are decoded so the whole image is never held.
+// 0 if success otherwise another number
+int image_png_hash_file(const char* path, struct image_hashes* hashes);
+// image_png_hash_file of count files split between image_png_set_threads threads, hashes of files
+// that couldn't be hashed are set up to 0. return how many of them there were
+uint32_t image_png_hash_files(const char* const* paths, uint32_t count, struct image_hashes* hashes);
+// bits that differ between two hashes
+uint32_t image_png_hash_distance(uint64_t a, uint64_t b);
+// image_png_hash_distance between hash and each of count hashes
+void image_png_hash_distances(uint64_t hash, const uint64_t* hashes, uint32_t count, uint32_t* distances);
+// threads used by whole image loops like image_png_to_planar_f32, 1 by default
+void image_png_set_threads(uint32_t threads);
+// allocator of images created or opened from now on, for the image itself, its pixels, chunks read,
+// metadata (palette, tRNS, iCCP and texts), rows being decoded, the list of IDAT bands and scratch rows
+// of color, blit, composite, stats, compare, hash and tensor calls, which may come from several threads
+// at once. any NULL function restores malloc, realloc and free. pixels ask for up to row alignment + 2
+// more bytes to be aligned. buffers handed over (image_png_tobytes, texts, keywords, palettes) are still
+// freed with free, and chunks being encoded, deflated bands and rows of resize and filter workers still
+// come from malloc
+void image_png_set_allocator(image_alloc_fn alloc, image_realloc_fn realloc, image_free_fn free, void* ctx);
+// if not zero, metadata of images created or opened from now on is bumped from blocks of their
+// allocator, freed at once by image_png_close instead of one by one. 0 by default
+void image_png_set_arena(uint8_t arena);
+// color is converted once to the image color, rect is clipped to the image.
+// 0 if success otherwise another number
+int image_png_fill(struct image_png* image, struct image_color color);
+int image_png_fill_rect(struct image_png* image, struct image_rect rect, struct image_color color);
+// copies rect of src into dst at x,y converting colors if they differ, clipped to both images.
+// src and dst can be the same image. 0 if success otherwise another number
+int image_png_blit(struct image_png* dst, uint32_t x, uint32_t y, struct image_png* src, struct image_rect rect);
+// blends the whole src over dst at x,y with straight alpha, clipped to dst. src can be any color,
+// dst any but indexed. 0 if success otherwise another number
+int image_png_composite(struct image_png* dst, struct image_png* src, uint32_t x, uint32_t y,
+                        enum image_blend_mode mode);
+// scales colors by alpha in place and back, only images with alpha.
+// 0 if success otherwise another number
+int image_png_premultiply(struct image_png* image);
+int image_png_unpremultiply(struct image_png* image);
+// rows start at alignment bytes boundaries (power of two up to 4096) and are at least stride bytes
+// apart, stride 0 is the row size rounded up to alignment. pixels are kept, 0 if success otherwise another number
+int image_png_set_row_layout(struct image_png* image, uint32_t alignment, size_t stride);
+// alignment of rows for images created or opened from now on, 1 by default (packed rows)
+void image_png_set_default_row_alignment(uint32_t alignment);
+// direct access to pixels without copies, desc can be NULL. returned pointer is desc data
+// and it's valid until unlock or any change of dimension or color
+uint8_t* image_png_lock_pixels(struct image_png* image, struct image_pixel_desc* desc);
+// pixels may have been written meanwhile, so all of them are encoded again in next save
+void image_png_unlock_pixels(struct image_png* image);
+void image_png_get_luma(struct image_png* image, enum image_luma* luma);
+// used by color and row conversions, IMAGE_LUMA_AVERAGE by default
+void image_png_set_luma(struct image_png* image, enum image_luma luma);
+void image_png_get_dither(struct image_png* image, enum image_dither* dither);
+// used when image_png_set_color goes from 16 to 8 bits, IMAGE_DITHER_NONE (rounding) by default.
+// ordered is a 8x8 Bayer matrix and diffusion is Floyd-Steinberg
+void image_png_set_dither(struct image_png* image, enum image_dither dither);
+void image_png_get_resize_linear(struct image_png* image, uint8_t* linear);
+// if not zero, image_png_resize blends linear light (see image_png_get_linear_row), 0 by default
+void image_png_set_resize_linear(struct image_png* image, uint8_t linear);
+// keeps a deflate restart point every rows scanlines, so next saves only compress again
+// the bands touched meanwhile. 0 disables it (default)
+void image_png_set_restart_interval(struct image_png* image, uint32_t rows);
 void image_png_get_timestamp(struct image_png* image, struct image_time* time);
 void image_png_set_timestamp(struct image_png* image, struct image_time time);
 struct image_png* image_png_copy(struct image_png* image);
+// *pbytes is NULL and *psize 0 if pixels couldn't be encoded
 void image_png_tobytes(struct image_png* image, uint8_t** pbytes, uint32_t* psize);
+// nothing is left at path if the image couldn't be encoded
 void image_png_save(struct image_png* image, const char* path);
+// streams in_path into out_path replacing only textual and time chunks, other chunks
+// including IDAT are copied byte by byte without decoding. it's written to out_path + ".rewrite"
+// first and renamed over out_path once complete, so both paths can be the same file.
+// 0 if success otherwise another number, out_path is left as it was then
+int image_png_rewrite_metadata(const char* in_path, const char* out_path, const struct image_metadata_edits* edits);
 void image_png_close(struct image_png* image);
 
 struct image_jpeg* image_jpeg_open(const char* path);
@@ -13,21 +13,72 @@ extern "C" {
 
 namespace media {
 
+    // locked pixels of an ImagePNG, they are unlocked when the view goes away
+    class PixelView {
+        struct image_png* image;
+        image_pixel_desc desc;
+        public:
+        explicit PixelView(struct image_png* image);
+        PixelView(PixelView&& view) noexcept;
+        PixelView(const PixelView&) = delete;
+        ~PixelView();
+
+        PixelView& operator=(const PixelView&) = delete;
+
+        bool isValid() const;
+        const image_pixel_desc& getDesc() const;
+
+        uint8_t* data() const;
+        uint8_t* row(uint32_t y) const;
+        size_t stride() const;
+        uint32_t width() const;
+        uint32_t height() const;
+        uint8_t pixelSize() const;
+    };
+
     class ImagePNG {
         struct image_png* image;
         public:
         explicit ImagePNG(const std::string& path);
         ImagePNG(image_color_type type, uint32_t width, uint32_t height);
+        ImagePNG(const ImagePNG& image);
+        ImagePNG(ImagePNG&& image) noexcept;
         ~ImagePNG();
 
         bool isLoaded() const;
         bool open(const std::string& path);
+        // indexed images come as RGBA8
+        bool openExpanded(const std::string& path);
+        // e.g. downscaled while decoding, see image_decode_options
+        bool open(const std::string& path, const image_decode_options& options);
+        // only rect is decoded, see image_png_open_region
+        bool openRegion(const std::string& path, const image_rect& rect);
 
         image_dimension getDimension() const;
         void setDimension(const image_dimension& dimension);
 
+        bool resize(uint32_t width, uint32_t height, image_resize_filter filter = IMAGE_FILTER_LANCZOS3);
+        // copy with the new dimension, not loaded if it failed
+        ImagePNG resized(uint32_t width, uint32_t height, image_resize_filter filter = IMAGE_FILTER_LANCZOS3) const;
+
+        // clockwise
+        bool rotate90();
+        bool rotate180();
+        bool rotate270();
+        bool flipH();
+        bool flipV();
+        bool transpose();
+
+        // kernels of odd sizes, see image_png_convolve_separable
+        bool convolveSeparable(const std::vector<float>& kx, const std::vector<float>& ky);
+        bool gaussianBlur(float sigma);
+        bool unsharpMask(float sigma, float amount, uint32_t threshold = 0);
+
+        bool getResizeLinear() const;
+        void setResizeLinear(bool linear);
+
         image_color_type getColor() const;
-        void setColor(image_color_type type);
+        bool setColor(image_color_type type);
 
         uint32_t getGamma() const;
         void setGamma(uint32_t gamma);
@@ -52,6 +103,49 @@ namespace media {
         image_color getPixel(uint32_t x, uint32_t y) const;
         void setPixel(uint32_t x, uint32_t y, const image_color& color);
 
+        bool fill(const image_color& color);
+        bool fillRect(const image_rect& rect, const image_color& color);
+        bool blit(uint32_t x, uint32_t y, const ImagePNG& src, const image_rect& rect);
+        bool composite(uint32_t x, uint32_t y, const ImagePNG& src, image_blend_mode mode = IMAGE_BLEND_OVER);
+        bool premultiply();
+        bool unpremultiply();
+
+        bool getRow(uint32_t y, image_color_type type, void* buffer) const;
+        bool setRow(uint32_t y, image_color_type type, const void* buffer);
+        bool getSpan(uint32_t x, uint32_t y, uint32_t count, image_color_type type, void* buffer) const;
+        bool setSpan(uint32_t x, uint32_t y, uint32_t count, image_color_type type, const void* buffer);
+
+        // 16 bits linear light samples with the channels of the image
+        bool getLinearRow(uint32_t y, uint16_t* buffer) const;
+        bool setLinearRow(uint32_t y, const uint16_t* buffer);
+
+        // pixels in the space of iCCP or cHRM and gAMA turn into sRGB
+        bool convertToSRGB();
+
+        // width * height * channels normalized floats, mean and std can be NULL
+        bool toPlanarF32(image_tensor_layout layout, const float* mean, const float* std, float* out) const;
+
+        // channels * bins counts, empty if it failed, see image_png_histogram
+        std::vector<uint64_t> getHistogram(uint32_t bins) const;
+        bool getStats(image_stats& stats) const;
+        // both must be loaded, see image_png_compare
+        bool compare(const ImagePNG& other, image_compare_result& result) const;
+        // see image_png_hash
+        bool getHashes(image_hashes& hashes) const;
+
+        // 256 packed RGBA8 pixels with tRNS applied, NULL if not loaded
+        const uint32_t* getPaletteLUT() const;
+
+        image_luma getLuma() const;
+        void setLuma(image_luma luma);
+
+        image_dither getDither() const;
+        void setDither(image_dither dither);
+
+        void setRestartInterval(uint32_t rows);
+
+        PixelView pixels();
+
         image_time getTimestamp() const;
         void setTimestamp(const image_time& time);
 
@@ -59,8 +153,128 @@ namespace media {
         void save(const std::string& path) const;
 
         ImagePNG& operator=(const ImagePNG& image);
+        ImagePNG& operator=(ImagePNG&& image) noexcept;
+    };
+
+    // pixel layouts for ImageView, type is the only image color they can view
+    struct RGB8 {
+        static constexpr image_color_type type = IMAGE_RGBA8_COLOR;
+        uint8_t red, green, blue;
+    };
+
+    struct RGBA8 {
+        static constexpr image_color_type type = static_cast<image_color_type>(IMAGE_RGBA8_COLOR | IMAGE_ALPHA_BIT);
+        uint8_t red, green, blue, alpha;
+    };
+
+    struct Gray8 {
+        static constexpr image_color_type type = IMAGE_GRAY8_COLOR;
+        uint8_t gray;
     };
 
+    struct GrayA8 {
+        static constexpr image_color_type type = static_cast<image_color_type>(IMAGE_GRAY8_COLOR | IMAGE_ALPHA_BIT);
+        uint8_t gray, alpha;
+    };
+
+    struct RGB16 {
+        static constexpr image_color_type type = IMAGE_RGBA16_COLOR;
+        uint16_t red, green, blue;
+    };
+
+    struct RGBA16 {
+        static constexpr image_color_type type = static_cast<image_color_type>(IMAGE_RGBA16_COLOR | IMAGE_ALPHA_BIT);
+        uint16_t red, green, blue, alpha;
+    };
+
+    struct Gray16 {
+        static constexpr image_color_type type = IMAGE_GRAY16_COLOR;
+        uint16_t gray;
+    };
+
+    struct GrayA16 {
+        static constexpr image_color_type type = static_cast<image_color_type>(IMAGE_GRAY16_COLOR | IMAGE_ALPHA_BIT);
+        uint16_t gray, alpha;
+    };
+
+    struct Indexed8 {
+        static constexpr image_color_type type = IMAGE_INDEXED_COLOR;
+        uint8_t index;
+    };
+
+    // pixels of an image seen as Pixel, the color is only checked when the view is created
+    template <typename Pixel>
+    class ImageView {
+        PixelView view;
+        public:
+        class Row {
+            Pixel* first;
+            Pixel* last;
+            public:
+            Row(Pixel* first, Pixel* last) : first(first), last(last) {}
+
+            Pixel* begin() const { return first; }
+            Pixel* end() const { return last; }
+            uint32_t size() const { return static_cast<uint32_t>(last - first); }
+            Pixel& operator[](uint32_t x) const { return first[x]; }
+        };
+
+        class RowIterator {
+            const ImageView* owner;
+            uint32_t y;
+            public:
+            RowIterator(const ImageView* owner, uint32_t y) : owner(owner), y(y) {}
+
+            Row operator*() const { return owner->row(y); }
+            RowIterator& operator++() { y++; return *this; }
+            bool operator!=(const RowIterator& other) const { return y != other.y; }
+        };
+
+        class Rows {
+            const ImageView* owner;
+            public:
+            explicit Rows(const ImageView* owner) : owner(owner) {}
+
+            RowIterator begin() const { return RowIterator(owner, 0); }
+            RowIterator end() const { return RowIterator(owner, owner->height()); }
+        };
+
+        explicit ImageView(ImagePNG& image)
+            : view(image.isLoaded() && image.getColor() == Pixel::type ? image.pixels() : PixelView(nullptr)) {}
+
+        bool isValid() const { return view.isValid(); }
+        uint32_t width() const { return view.width(); }
+        uint32_t height() const { return view.height(); }
+
+        Row row(uint32_t y) const {
+            Pixel* first = reinterpret_cast<Pixel*>(view.row(y));
+            return Row(first, first + view.width());
+        }
+
+        Rows rows() const { return Rows(this); }
+
+        Pixel& operator()(uint32_t x, uint32_t y) const {
+            return reinterpret_cast<Pixel*>(view.row(y))[x];
+        }
+
+        template <typename Function>
+        void forEach(Function&& function) const {
+            for (uint32_t y = 0; y < view.height(); y++) {
+                Pixel* pixel = reinterpret_cast<Pixel*>(view.row(y));
+                Pixel* last = pixel + view.width();
+
+                for (; pixel != last; pixel++) {
+                    function(*pixel);
+                }
+            }
+        }
+    };
+
+    static_assert(sizeof(RGB8) == 3 && sizeof(RGBA8) == 4 && sizeof(Gray8) == 1 && sizeof(GrayA8) == 2,
+                  "8 bits pixels need to be packed");
+    static_assert(sizeof(RGB16) == 6 && sizeof(RGBA16) == 8 && sizeof(Gray16) == 2 && sizeof(GrayA16) == 4,
+                  "16 bits pixels need to be packed");
+
     image_color generate_color16(uint16_t red, uint16_t green, uint16_t blue, uint16_t alpha);
     image_color generate_color16(uint16_t red, uint16_t green, uint16_t blue);
     image_color generate_color16(uint16_t grey, uint16_t alpha);
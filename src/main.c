@@ -19,20 +19,22 @@ void test_sample() {
 
     printf("sample.png:\n width: %d\n height: %d\n color: %d\n depth: %d\n", dimension.width, dimension.height, color_type, depth);
 
+    uint8_t* row = malloc(sizeof(uint8_t) * dimension.width * 4);
+
     for (uint32_t y = 0; y < dimension.height; y++) {
+        if (image_png_get_row(image, y, IMAGE_RGBA8_COLOR | IMAGE_ALPHA_BIT, row) != 0) {
+            printf("Error, no handling color type: %d\n", color_type);
+            break;
+        }
+
         for (uint32_t x = 0; x < dimension.width; x++) {
-            struct image_color color;
-            image_png_get_pixel(image, x, y, &color);
-            if (IMAGE_IGNORE_ALPHA(color.type) == IMAGE_RGBA16_COLOR) {
-                printf("Pixel at %d,%d: T: %d RGBA: %02X%02X%02X%02X\n", x, y, (uint8_t) color.type, (uint8_t) color.rgba16.red, (uint8_t) color.rgba16.green, (uint8_t) color.rgba16.blue, (uint8_t) color.rgba16.alpha);
-            } else if (IMAGE_IGNORE_ALPHA(color.type) == IMAGE_RGBA8_COLOR) {
-                printf("Pixel at %d,%d: T: %d RGBA: %02X%02X%02X%02X\n", x, y, color.type, color.rgba8.red, color.rgba8.green, color.rgba8.blue, color.rgba8.alpha);
-            } else {
-                printf("Error, no handling color type: %d\n", color.type);
-            }
+            uint8_t* pixel = &row[x * 4];
+            printf("Pixel at %d,%d: RGBA: %02X%02X%02X%02X\n", x, y, pixel[0], pixel[1], pixel[2], pixel[3]);
         }
     }
 
+    free(row);
+
     image_png_close(image);
 }
 
@@ -0,0 +1,324 @@
+#include "orient.h"
+#include "utils.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// pixels per side of tiles, 32 rows of 32 RGBA16 pixels are 8 KiB on each side
+#define MEDIA_ORIENT_TILE 32
+
+// bytes exchanged at once by media_swap_rows
+#define MEDIA_ORIENT_CHUNK 256
+
+// state shared by the threads of media_transpose
+struct _media_orient_job {
+    uint32_t pixel_size;
+    // not zero if dst rows and dst columns go backwards
+    uint8_t reverse_rows;
+    uint8_t reverse_columns;
+
+    const uint8_t* src;
+    size_t src_stride;
+    uint32_t width;
+    uint32_t height;
+
+    uint8_t* dst;
+    size_t dst_stride;
+};
+
+// moves a block of size x size pixels, rows of src are src_step bytes apart and the transposed
+// ones go dst_step bytes apart. steps may be negative to walk backwards
+typedef void (*_media_orient_block_fn)(const uint8_t* src, ptrdiff_t src_step, uint8_t* dst, ptrdiff_t dst_step);
+
+static void _media_transpose_rows(void* context, size_t begin, size_t end);
+static void _media_transpose_tile(const struct _media_orient_job* job, uint32_t x0, uint32_t y0,
+                                  uint32_t width, uint32_t height);
+static inline void _media_copy_pixel(uint8_t* dst, const uint8_t* src, uint32_t size);
+static _media_orient_block_fn _media_block_kernel(uint32_t pixel_size, uint32_t* size);
+
+#ifdef __SSE2__
+static void _media_block_8x8_8(const uint8_t* src, ptrdiff_t src_step, uint8_t* dst, ptrdiff_t dst_step);
+static void _media_block_8x8_16(const uint8_t* src, ptrdiff_t src_step, uint8_t* dst, ptrdiff_t dst_step);
+static void _media_block_4x4_32(const uint8_t* src, ptrdiff_t src_step, uint8_t* dst, ptrdiff_t dst_step);
+static void _media_block_2x2_64(const uint8_t* src, ptrdiff_t src_step, uint8_t* dst, ptrdiff_t dst_step);
+static inline __m128i _media_reverse_vector(__m128i v, uint32_t pixel_size);
+#endif
+
+void media_transpose(enum media_orientation orientation, enum media_pixel_format format, uint32_t threads,
+                     const uint8_t* src, size_t src_stride, uint32_t width, uint32_t height,
+                     uint8_t* dst, size_t dst_stride) {
+    struct _media_orient_job job = {0};
+    job.pixel_size = media_pixel_size(format);
+    // pixel (x, y) lands on row x and column y of dst unless they're reversed
+    job.reverse_rows = orientation == MEDIA_ORIENT_ROTATE_270;
+    job.reverse_columns = orientation == MEDIA_ORIENT_ROTATE_90;
+
+    job.src = src;
+    job.src_stride = src_stride;
+    job.width = width;
+    job.height = height;
+
+    job.dst = dst;
+    job.dst_stride = dst_stride;
+
+    size_t tile_rows = (height + MEDIA_ORIENT_TILE - 1) / MEDIA_ORIENT_TILE;
+    media_parallel_for(tile_rows, threads, _media_transpose_rows, &job);
+}
+
+void media_reverse_row(enum media_pixel_format format, uint8_t* row, uint32_t count) {
+    uint32_t pixel_size = media_pixel_size(format);
+
+    // first and last pixels still to be exchanged
+    size_t left = 0;
+    size_t right = count;
+
+#ifdef __SSE2__
+    if (pixel_size == 1 || pixel_size == 2 || pixel_size == 4 || pixel_size == 8) {
+        size_t lanes = 16 / pixel_size;
+
+        // a vector from each end trades places while they don't meet
+        while (right - left >= lanes * 2) {
+            __m128i* a = (__m128i*) &row[left * pixel_size];
+            __m128i* b = (__m128i*) &row[(right - lanes) * pixel_size];
+
+            __m128i va = _mm_loadu_si128(a);
+            __m128i vb = _mm_loadu_si128(b);
+            _mm_storeu_si128(a, _media_reverse_vector(vb, pixel_size));
+            _mm_storeu_si128(b, _media_reverse_vector(va, pixel_size));
+
+            left += lanes;
+            right -= lanes;
+        }
+    }
+#endif
+
+    uint8_t pixel[8];
+    while (right - left >= 2) {
+        right--;
+
+        _media_copy_pixel(pixel, &row[left * pixel_size], pixel_size);
+        _media_copy_pixel(&row[left * pixel_size], &row[right * pixel_size], pixel_size);
+        _media_copy_pixel(&row[right * pixel_size], pixel, pixel_size);
+
+        left++;
+    }
+}
+
+void media_swap_rows(uint8_t* a, uint8_t* b, size_t size) {
+    uint8_t chunk[MEDIA_ORIENT_CHUNK];
+
+    for (size_t i = 0; i < size; i += MEDIA_ORIENT_CHUNK) {
+        size_t n = size - i < MEDIA_ORIENT_CHUNK ? size - i : MEDIA_ORIENT_CHUNK;
+
+        memcpy(chunk, &a[i], n);
+        memcpy(&a[i], &b[i], n);
+        memcpy(&b[i], chunk, n);
+    }
+}
+
+static void _media_transpose_rows(void* context, size_t begin, size_t end) {
+    const struct _media_orient_job* job = context;
+
+    for (size_t tile_y = begin; tile_y < end; tile_y++) {
+        uint32_t y0 = (uint32_t) tile_y * MEDIA_ORIENT_TILE;
+        uint32_t height = job->height - y0 < MEDIA_ORIENT_TILE ? job->height - y0 : MEDIA_ORIENT_TILE;
+
+        for (uint32_t x0 = 0; x0 < job->width; x0 += MEDIA_ORIENT_TILE) {
+            uint32_t width = job->width - x0 < MEDIA_ORIENT_TILE ? job->width - x0 : MEDIA_ORIENT_TILE;
+            _media_transpose_tile(job, x0, y0, width, height);
+        }
+    }
+}
+
+static void _media_transpose_tile(const struct _media_orient_job* job, uint32_t x0, uint32_t y0,
+                                  uint32_t width, uint32_t height) {
+    uint32_t pixel_size = job->pixel_size;
+    ptrdiff_t dst_step = job->reverse_rows ? -(ptrdiff_t) job->dst_stride : (ptrdiff_t) job->dst_stride;
+
+    // pixels out of blocks (tiles at the right and bottom edges) are moved one by one
+    uint32_t block = 1;
+    _media_orient_block_fn kernel = _media_block_kernel(pixel_size, &block);
+
+    uint32_t block_width = kernel != NULL ? width / block * block : 0;
+    uint32_t block_height = kernel != NULL ? height / block * block : 0;
+
+    for (uint32_t y = y0; y < y0 + block_height; y += block) {
+        // with reversed columns the block is read bottom up, so its dst rows still go left to right
+        uint32_t first_y = job->reverse_columns ? y + block - 1 : y;
+        ptrdiff_t src_step = job->reverse_columns ? -(ptrdiff_t) job->src_stride : (ptrdiff_t) job->src_stride;
+        uint32_t dst_x = job->reverse_columns ? job->height - 1 - first_y : first_y;
+
+        for (uint32_t x = x0; x < x0 + block_width; x += block) {
+            uint32_t dst_y = job->reverse_rows ? job->width - 1 - x : x;
+
+            kernel(&job->src[first_y * job->src_stride + (size_t) x * pixel_size], src_step,
+                   &job->dst[dst_y * job->dst_stride + (size_t) dst_x * pixel_size], dst_step);
+        }
+    }
+
+    for (uint32_t y = y0; y < y0 + height; y++) {
+        const uint8_t* src_row = &job->src[y * job->src_stride];
+        uint32_t dst_x = job->reverse_columns ? job->height - 1 - y : y;
+
+        // the block part of rows covered by blocks is already done
+        uint32_t x = y < y0 + block_height ? x0 + block_width : x0;
+
+        for (; x < x0 + width; x++) {
+            uint32_t dst_y = job->reverse_rows ? job->width - 1 - x : x;
+
+            _media_copy_pixel(&job->dst[dst_y * job->dst_stride + (size_t) dst_x * pixel_size],
+                              &src_row[(size_t) x * pixel_size], pixel_size);
+        }
+    }
+}
+
+static inline void _media_copy_pixel(uint8_t* dst, const uint8_t* src, uint32_t size) {
+    // constant sizes let memcpy become a single move
+    switch (size) {
+        case 1: *dst = *src; break;
+        case 2: memcpy(dst, src, 2); break;
+        case 3: memcpy(dst, src, 3); break;
+        case 4: memcpy(dst, src, 4); break;
+        case 6: memcpy(dst, src, 6); break;
+        case 8: memcpy(dst, src, 8); break;
+        default: memcpy(dst, src, size); break;
+    }
+}
+
+static _media_orient_block_fn _media_block_kernel(uint32_t pixel_size, uint32_t* size) {
+#ifdef __SSE2__
+    switch (pixel_size) {
+        case 1: *size = 8; return _media_block_8x8_8;
+        case 2: *size = 8; return _media_block_8x8_16;
+        case 4: *size = 4; return _media_block_4x4_32;
+        case 8: *size = 2; return _media_block_2x2_64;
+    }
+#endif
+
+    // RGB pixels don't fit lanes, they're moved one by one
+    (void) pixel_size;
+    *size = 1;
+    return NULL;
+}
+
+#ifdef __SSE2__
+static void _media_block_8x8_8(const uint8_t* src, ptrdiff_t src_step, uint8_t* dst, ptrdiff_t dst_step) {
+    __m128i r0 = _mm_loadl_epi64((const __m128i*) &src[0 * src_step]);
+    __m128i r1 = _mm_loadl_epi64((const __m128i*) &src[1 * src_step]);
+    __m128i r2 = _mm_loadl_epi64((const __m128i*) &src[2 * src_step]);
+    __m128i r3 = _mm_loadl_epi64((const __m128i*) &src[3 * src_step]);
+    __m128i r4 = _mm_loadl_epi64((const __m128i*) &src[4 * src_step]);
+    __m128i r5 = _mm_loadl_epi64((const __m128i*) &src[5 * src_step]);
+    __m128i r6 = _mm_loadl_epi64((const __m128i*) &src[6 * src_step]);
+    __m128i r7 = _mm_loadl_epi64((const __m128i*) &src[7 * src_step]);
+
+    // pairs of rows interleaved, then fours, then columns of eight
+    __m128i a01 = _mm_unpacklo_epi8(r0, r1);
+    __m128i a23 = _mm_unpacklo_epi8(r2, r3);
+    __m128i a45 = _mm_unpacklo_epi8(r4, r5);
+    __m128i a67 = _mm_unpacklo_epi8(r6, r7);
+
+    __m128i b0 = _mm_unpacklo_epi16(a01, a23);
+    __m128i b1 = _mm_unpackhi_epi16(a01, a23);
+    __m128i b2 = _mm_unpacklo_epi16(a45, a67);
+    __m128i b3 = _mm_unpackhi_epi16(a45, a67);
+
+    __m128i c01 = _mm_unpacklo_epi32(b0, b2);
+    __m128i c23 = _mm_unpackhi_epi32(b0, b2);
+    __m128i c45 = _mm_unpacklo_epi32(b1, b3);
+    __m128i c67 = _mm_unpackhi_epi32(b1, b3);
+
+    _mm_storel_epi64((__m128i*) &dst[0 * dst_step], c01);
+    _mm_storel_epi64((__m128i*) &dst[1 * dst_step], _mm_unpackhi_epi64(c01, c01));
+    _mm_storel_epi64((__m128i*) &dst[2 * dst_step], c23);
+    _mm_storel_epi64((__m128i*) &dst[3 * dst_step], _mm_unpackhi_epi64(c23, c23));
+    _mm_storel_epi64((__m128i*) &dst[4 * dst_step], c45);
+    _mm_storel_epi64((__m128i*) &dst[5 * dst_step], _mm_unpackhi_epi64(c45, c45));
+    _mm_storel_epi64((__m128i*) &dst[6 * dst_step], c67);
+    _mm_storel_epi64((__m128i*) &dst[7 * dst_step], _mm_unpackhi_epi64(c67, c67));
+}
+
+static void _media_block_8x8_16(const uint8_t* src, ptrdiff_t src_step, uint8_t* dst, ptrdiff_t dst_step) {
+    __m128i r0 = _mm_loadu_si128((const __m128i*) &src[0 * src_step]);
+    __m128i r1 = _mm_loadu_si128((const __m128i*) &src[1 * src_step]);
+    __m128i r2 = _mm_loadu_si128((const __m128i*) &src[2 * src_step]);
+    __m128i r3 = _mm_loadu_si128((const __m128i*) &src[3 * src_step]);
+    __m128i r4 = _mm_loadu_si128((const __m128i*) &src[4 * src_step]);
+    __m128i r5 = _mm_loadu_si128((const __m128i*) &src[5 * src_step]);
+    __m128i r6 = _mm_loadu_si128((const __m128i*) &src[6 * src_step]);
+    __m128i r7 = _mm_loadu_si128((const __m128i*) &src[7 * src_step]);
+
+    __m128i a0 = _mm_unpacklo_epi16(r0, r1);
+    __m128i a1 = _mm_unpackhi_epi16(r0, r1);
+    __m128i a2 = _mm_unpacklo_epi16(r2, r3);
+    __m128i a3 = _mm_unpackhi_epi16(r2, r3);
+    __m128i a4 = _mm_unpacklo_epi16(r4, r5);
+    __m128i a5 = _mm_unpackhi_epi16(r4, r5);
+    __m128i a6 = _mm_unpacklo_epi16(r6, r7);
+    __m128i a7 = _mm_unpackhi_epi16(r6, r7);
+
+    // columns of the top four rows (b0..b3) and of the bottom four (b4..b7), two in each
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+    __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+    __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+    __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+    __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+    _mm_storeu_si128((__m128i*) &dst[0 * dst_step], _mm_unpacklo_epi64(b0, b4));
+    _mm_storeu_si128((__m128i*) &dst[1 * dst_step], _mm_unpackhi_epi64(b0, b4));
+    _mm_storeu_si128((__m128i*) &dst[2 * dst_step], _mm_unpacklo_epi64(b1, b5));
+    _mm_storeu_si128((__m128i*) &dst[3 * dst_step], _mm_unpackhi_epi64(b1, b5));
+    _mm_storeu_si128((__m128i*) &dst[4 * dst_step], _mm_unpacklo_epi64(b2, b6));
+    _mm_storeu_si128((__m128i*) &dst[5 * dst_step], _mm_unpackhi_epi64(b2, b6));
+    _mm_storeu_si128((__m128i*) &dst[6 * dst_step], _mm_unpacklo_epi64(b3, b7));
+    _mm_storeu_si128((__m128i*) &dst[7 * dst_step], _mm_unpackhi_epi64(b3, b7));
+}
+
+static void _media_block_4x4_32(const uint8_t* src, ptrdiff_t src_step, uint8_t* dst, ptrdiff_t dst_step) {
+    __m128i r0 = _mm_loadu_si128((const __m128i*) &src[0 * src_step]);
+    __m128i r1 = _mm_loadu_si128((const __m128i*) &src[1 * src_step]);
+    __m128i r2 = _mm_loadu_si128((const __m128i*) &src[2 * src_step]);
+    __m128i r3 = _mm_loadu_si128((const __m128i*) &src[3 * src_step]);
+
+    __m128i a0 = _mm_unpacklo_epi32(r0, r1);
+    __m128i a1 = _mm_unpackhi_epi32(r0, r1);
+    __m128i a2 = _mm_unpacklo_epi32(r2, r3);
+    __m128i a3 = _mm_unpackhi_epi32(r2, r3);
+
+    _mm_storeu_si128((__m128i*) &dst[0 * dst_step], _mm_unpacklo_epi64(a0, a2));
+    _mm_storeu_si128((__m128i*) &dst[1 * dst_step], _mm_unpackhi_epi64(a0, a2));
+    _mm_storeu_si128((__m128i*) &dst[2 * dst_step], _mm_unpacklo_epi64(a1, a3));
+    _mm_storeu_si128((__m128i*) &dst[3 * dst_step], _mm_unpackhi_epi64(a1, a3));
+}
+
+static void _media_block_2x2_64(const uint8_t* src, ptrdiff_t src_step, uint8_t* dst, ptrdiff_t dst_step) {
+    __m128i r0 = _mm_loadu_si128((const __m128i*) &src[0 * src_step]);
+    __m128i r1 = _mm_loadu_si128((const __m128i*) &src[1 * src_step]);
+
+    _mm_storeu_si128((__m128i*) &dst[0 * dst_step], _mm_unpacklo_epi64(r0, r1));
+    _mm_storeu_si128((__m128i*) &dst[1 * dst_step], _mm_unpackhi_epi64(r0, r1));
+}
+
+static inline __m128i _media_reverse_vector(__m128i v, uint32_t pixel_size) {
+    switch (pixel_size) {
+        case 1: {
+            // words reversed, then both bytes of each one
+            v = _media_reverse_vector(v, 2);
+            return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        }
+        case 2: {
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+            return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+        }
+        case 4: return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+        default: return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+    }
+}
+#endif
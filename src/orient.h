@@ -0,0 +1,31 @@
+#ifndef MEDIA_ORIENT_GUARD_HEADER
+#define MEDIA_ORIENT_GUARD_HEADER
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pixel.h"
+
+// turns that swap width and height, clockwise as seen on screen
+enum media_orientation {
+    // pixel (x, y) goes to (y, x)
+    MEDIA_ORIENT_TRANSPOSE,
+    MEDIA_ORIENT_ROTATE_90,
+    MEDIA_ORIENT_ROTATE_270
+};
+
+// writes src pixels in format (any) turned by orientation into dst, which is height pixels wide
+// and width rows tall. it walks tiles small enough for both sides to stay in cache, each one
+// moved by blocks transposed in registers, and tile rows are split between threads.
+// src and dst must not overlap
+void media_transpose(enum media_orientation orientation, enum media_pixel_format format, uint32_t threads,
+                     const uint8_t* src, size_t src_stride, uint32_t width, uint32_t height,
+                     uint8_t* dst, size_t dst_stride);
+
+// reverses the order of count pixels of a row in format, in place
+void media_reverse_row(enum media_pixel_format format, uint8_t* row, uint32_t count);
+
+// exchanges size bytes of two rows that don't overlap
+void media_swap_rows(uint8_t* a, uint8_t* b, size_t size);
+
+#endif // MEDIA_ORIENT_GUARD_HEADER
@@ -0,0 +1,1143 @@
+#include "pixel.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+// pixels converted per pass when going through the generic RGBA16 path
+#define MEDIA_CONVERT_CHUNK 256
+
+typedef void (*_media_convert_fn)(const uint8_t* src, uint8_t* dst, size_t count);
+typedef void (*_media_luma_fn)(const uint8_t* src, uint8_t* dst, size_t count, const int16_t* weights);
+
+// red, green and blue weights in 1.15 fixed point, each row sums 32768
+static const int16_t MEDIA_LUMA_WEIGHTS[MEDIA_LUMA_SIZE][3] = {
+    [MEDIA_LUMA_AVERAGE] = {10923, 10923, 10922},
+    [MEDIA_LUMA_BT601] = {9798, 19235, 3735},
+    [MEDIA_LUMA_BT709] = {6966, 23436, 2366}
+};
+
+static inline uint16_t _media_widen8(uint8_t value) {
+    return value * 257;
+}
+
+static inline uint8_t _media_narrow16(uint16_t value) {
+    return (value * 255 + 32895) >> 16;
+}
+
+// same for 8 and 16 bits samples, rounded to nearest
+static inline uint32_t _media_luma(const int16_t* weights, uint32_t red, uint32_t green, uint32_t blue) {
+    return (weights[0] * red + weights[1] * green + weights[2] * blue + 16384) >> 15;
+}
+
+// all direct kernels load a whole pixel before storing it and never store ahead of what they
+// have read, so the ones not growing pixels are safe in place
+
+static void _media_rgba8_to_rgb8(const uint8_t* src, uint8_t* dst, size_t count) {
+    size_t i = 0;
+
+#ifdef __SSSE3__
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    // stores are 16 bytes wide, keep 4 spare bytes at the end of dst
+    for (; i + 6 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*) &src[i * 4]);
+        _mm_storeu_si128((__m128i*) &dst[i * 3], _mm_shuffle_epi8(pixels, shuffle));
+    }
+#endif
+
+    for (; i < count; i++) {
+        uint8_t red = src[i * 4];
+        uint8_t green = src[i * 4 + 1];
+        uint8_t blue = src[i * 4 + 2];
+
+        dst[i * 3] = red;
+        dst[i * 3 + 1] = green;
+        dst[i * 3 + 2] = blue;
+    }
+}
+
+static void _media_rgb8_to_rgba8(const uint8_t* src, uint8_t* dst, size_t count) {
+    size_t i = 0;
+
+#ifdef __SSSE3__
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+
+    // loads are 16 bytes wide, keep 4 spare bytes at the end of src
+    for (; i + 6 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*) &src[i * 3]);
+        pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha);
+        _mm_storeu_si128((__m128i*) &dst[i * 4], pixels);
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst[i * 4] = src[i * 3];
+        dst[i * 4 + 1] = src[i * 3 + 1];
+        dst[i * 4 + 2] = src[i * 3 + 2];
+        dst[i * 4 + 3] = 0xFF;
+    }
+}
+
+static void _media_ga8_to_rgba8(const uint8_t* src, uint8_t* dst, size_t count) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 8 <= count; i += 8) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*) &src[i * 2]);
+        // gray into both bytes of the low half, alpha stays in the high one
+        __m128i gray = _mm_and_si128(pixels, _mm_set1_epi16(0xFF));
+        __m128i gg = _mm_or_si128(gray, _mm_slli_epi16(gray, 8));
+
+        _mm_storeu_si128((__m128i*) &dst[i * 4], _mm_unpacklo_epi16(gg, pixels));
+        _mm_storeu_si128((__m128i*) &dst[i * 4 + 16], _mm_unpackhi_epi16(gg, pixels));
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst[i * 4] = src[i * 2];
+        dst[i * 4 + 1] = src[i * 2];
+        dst[i * 4 + 2] = src[i * 2];
+        dst[i * 4 + 3] = src[i * 2 + 1];
+    }
+}
+
+static void _media_ga8_to_rgb8(const uint8_t* src, uint8_t* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i * 3] = src[i * 2];
+        dst[i * 3 + 1] = src[i * 2];
+        dst[i * 3 + 2] = src[i * 2];
+    }
+}
+
+static void _media_ga8_to_g8(const uint8_t* src, uint8_t* dst, size_t count) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i mask = _mm_set1_epi16(0xFF);
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i low = _mm_and_si128(_mm_loadu_si128((const __m128i*) &src[i * 2]), mask);
+        __m128i high = _mm_and_si128(_mm_loadu_si128((const __m128i*) &src[i * 2 + 16]), mask);
+        _mm_storeu_si128((__m128i*) &dst[i], _mm_packus_epi16(low, high));
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst[i] = src[i * 2];
+    }
+}
+
+static void _media_g8_to_rgba8(const uint8_t* src, uint8_t* dst, size_t count) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i gray = _mm_loadu_si128((const __m128i*) &src[i]);
+        __m128i low = _mm_unpacklo_epi8(gray, gray);
+        __m128i high = _mm_unpackhi_epi8(gray, gray);
+
+        _mm_storeu_si128((__m128i*) &dst[i * 4], _mm_or_si128(_mm_unpacklo_epi16(low, low), alpha));
+        _mm_storeu_si128((__m128i*) &dst[i * 4 + 16], _mm_or_si128(_mm_unpackhi_epi16(low, low), alpha));
+        _mm_storeu_si128((__m128i*) &dst[i * 4 + 32], _mm_or_si128(_mm_unpacklo_epi16(high, high), alpha));
+        _mm_storeu_si128((__m128i*) &dst[i * 4 + 48], _mm_or_si128(_mm_unpackhi_epi16(high, high), alpha));
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst[i * 4] = src[i];
+        dst[i * 4 + 1] = src[i];
+        dst[i * 4 + 2] = src[i];
+        dst[i * 4 + 3] = 0xFF;
+    }
+}
+
+static void _media_g8_to_rgb8(const uint8_t* src, uint8_t* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i * 3] = src[i];
+        dst[i * 3 + 1] = src[i];
+        dst[i * 3 + 2] = src[i];
+    }
+}
+
+static void _media_g8_to_ga8(const uint8_t* src, uint8_t* dst, size_t count) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i alpha = _mm_set1_epi8((char) 0xFF);
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i gray = _mm_loadu_si128((const __m128i*) &src[i]);
+        _mm_storeu_si128((__m128i*) &dst[i * 2], _mm_unpacklo_epi8(gray, alpha));
+        _mm_storeu_si128((__m128i*) &dst[i * 2 + 16], _mm_unpackhi_epi8(gray, alpha));
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst[i * 2] = src[i];
+        dst[i * 2 + 1] = 0xFF;
+    }
+}
+
+// 8 bits to 16 bits keeping the layout, v * 257 is the byte repeated twice
+static void _media_widen_samples(const uint8_t* src, uint8_t* dst, size_t count) {
+    uint16_t* dst16 = (uint16_t*) dst;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= count; i += 16) {
+        __m128i samples = _mm_loadu_si128((const __m128i*) &src[i]);
+        _mm_storeu_si128((__m128i*) &dst16[i], _mm_unpacklo_epi8(samples, samples));
+        _mm_storeu_si128((__m128i*) &dst16[i + 8], _mm_unpackhi_epi8(samples, samples));
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst16[i] = _media_widen8(src[i]);
+    }
+}
+
+// 16 bits to 8 bits keeping the layout, rounded to nearest
+static void _media_narrow_samples(const uint8_t* src, uint8_t* dst, size_t count) {
+    const uint16_t* src16 = (const uint16_t*) src;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i half = _mm_set1_epi16(128);
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i low = _mm_loadu_si128((const __m128i*) &src16[i]);
+        __m128i high = _mm_loadu_si128((const __m128i*) &src16[i + 8]);
+
+        // (v + 128 - ((v + 128) >> 8)) >> 8 without leaving 16 bits lanes
+        __m128i low_q = _mm_add_epi16(_mm_srli_epi16(low, 8), _mm_and_si128(_mm_srli_epi16(low, 7), one));
+        __m128i high_q = _mm_add_epi16(_mm_srli_epi16(high, 8), _mm_and_si128(_mm_srli_epi16(high, 7), one));
+        low = _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(low, low_q), half), 8);
+        high = _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(high, high_q), half), 8);
+
+        _mm_storeu_si128((__m128i*) &dst[i], _mm_packus_epi16(low, high));
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst[i] = _media_narrow16(src16[i]);
+    }
+}
+
+static void _media_g8_to_g16(const uint8_t* src, uint8_t* dst, size_t count) {
+    _media_widen_samples(src, dst, count);
+}
+
+static void _media_ga8_to_ga16(const uint8_t* src, uint8_t* dst, size_t count) {
+    _media_widen_samples(src, dst, count * 2);
+}
+
+static void _media_rgb8_to_rgb16(const uint8_t* src, uint8_t* dst, size_t count) {
+    _media_widen_samples(src, dst, count * 3);
+}
+
+static void _media_rgba8_to_rgba16(const uint8_t* src, uint8_t* dst, size_t count) {
+    _media_widen_samples(src, dst, count * 4);
+}
+
+static void _media_g16_to_g8(const uint8_t* src, uint8_t* dst, size_t count) {
+    _media_narrow_samples(src, dst, count);
+}
+
+static void _media_ga16_to_ga8(const uint8_t* src, uint8_t* dst, size_t count) {
+    _media_narrow_samples(src, dst, count * 2);
+}
+
+static void _media_rgb16_to_rgb8(const uint8_t* src, uint8_t* dst, size_t count) {
+    _media_narrow_samples(src, dst, count * 3);
+}
+
+static void _media_rgba16_to_rgba8(const uint8_t* src, uint8_t* dst, size_t count) {
+    _media_narrow_samples(src, dst, count * 4);
+}
+
+// direct kernels, pairs not here go through RGBA16
+static const _media_convert_fn MEDIA_CONVERTERS[MEDIA_PIXEL_FORMAT_SIZE][MEDIA_PIXEL_FORMAT_SIZE] = {
+    [MEDIA_PIXEL_RGBA8][MEDIA_PIXEL_RGB8] = _media_rgba8_to_rgb8,
+    [MEDIA_PIXEL_RGB8][MEDIA_PIXEL_RGBA8] = _media_rgb8_to_rgba8,
+    [MEDIA_PIXEL_GA8][MEDIA_PIXEL_RGBA8] = _media_ga8_to_rgba8,
+    [MEDIA_PIXEL_GA8][MEDIA_PIXEL_RGB8] = _media_ga8_to_rgb8,
+    [MEDIA_PIXEL_GA8][MEDIA_PIXEL_G8] = _media_ga8_to_g8,
+    [MEDIA_PIXEL_G8][MEDIA_PIXEL_RGBA8] = _media_g8_to_rgba8,
+    [MEDIA_PIXEL_G8][MEDIA_PIXEL_RGB8] = _media_g8_to_rgb8,
+    [MEDIA_PIXEL_G8][MEDIA_PIXEL_GA8] = _media_g8_to_ga8,
+
+    [MEDIA_PIXEL_G8][MEDIA_PIXEL_G16] = _media_g8_to_g16,
+    [MEDIA_PIXEL_GA8][MEDIA_PIXEL_GA16] = _media_ga8_to_ga16,
+    [MEDIA_PIXEL_RGB8][MEDIA_PIXEL_RGB16] = _media_rgb8_to_rgb16,
+    [MEDIA_PIXEL_RGBA8][MEDIA_PIXEL_RGBA16] = _media_rgba8_to_rgba16,
+    [MEDIA_PIXEL_G16][MEDIA_PIXEL_G8] = _media_g16_to_g8,
+    [MEDIA_PIXEL_GA16][MEDIA_PIXEL_GA8] = _media_ga16_to_ga8,
+    [MEDIA_PIXEL_RGB16][MEDIA_PIXEL_RGB8] = _media_rgb16_to_rgb8,
+    [MEDIA_PIXEL_RGBA16][MEDIA_PIXEL_RGBA8] = _media_rgba16_to_rgba8,
+};
+
+#ifdef __SSE2__
+// gray of 4 pixels held as 16 bits lanes (r, g, b, a), two pixels per register.
+// 16 bits samples come biased by -32768 so they fit signed lanes, bias adds it back
+static inline __m128i _media_luma4_epi32(__m128i pixels01, __m128i pixels23, __m128i weights, __m128i bias) {
+    __m128 sums01 = _mm_castsi128_ps(_mm_madd_epi16(pixels01, weights));
+    __m128 sums23 = _mm_castsi128_ps(_mm_madd_epi16(pixels23, weights));
+
+    // red + green sums are even lanes, blue + alpha * 0 are the odd ones
+    __m128i even = _mm_castps_si128(_mm_shuffle_ps(sums01, sums23, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i odd = _mm_castps_si128(_mm_shuffle_ps(sums01, sums23, _MM_SHUFFLE(3, 1, 3, 1)));
+
+    return _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(even, odd), bias), 15);
+}
+
+static inline __m128i _media_luma_weights(const int16_t* weights) {
+    return _mm_setr_epi16(weights[0], weights[1], weights[2], 0, weights[0], weights[1], weights[2], 0);
+}
+
+// 8 bits grays of 4 RGBA8 pixels
+static inline __m128i _media_luma_rgba8(__m128i pixels, __m128i weights) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi32(16384);
+
+    return _media_luma4_epi32(_mm_unpacklo_epi8(pixels, zero), _mm_unpackhi_epi8(pixels, zero), weights, bias);
+}
+
+// 16 bits grays of 4 RGBA16 pixels
+static inline __m128i _media_luma_rgba16(__m128i pixels01, __m128i pixels23, __m128i weights) {
+    const __m128i sign = _mm_set1_epi16((short) 0x8000);
+    const __m128i bias = _mm_set1_epi32((1 << 30) + 16384);
+
+    return _media_luma4_epi32(_mm_xor_si128(pixels01, sign), _mm_xor_si128(pixels23, sign), weights, bias);
+}
+
+// packs 8 values between 0 and 65535 into 16 bits lanes
+static inline __m128i _media_packu16_epi32(__m128i low, __m128i high) {
+    const __m128i half = _mm_set1_epi32(32768);
+
+    __m128i packed = _mm_packs_epi32(_mm_sub_epi32(low, half), _mm_sub_epi32(high, half));
+    return _mm_xor_si128(packed, _mm_set1_epi16((short) 0x8000));
+}
+#endif
+
+static void _media_rgba8_to_g8(const uint8_t* src, uint8_t* dst, size_t count, const int16_t* weights) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i lanes = _media_luma_weights(weights);
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i gray0 = _media_luma_rgba8(_mm_loadu_si128((const __m128i*) &src[i * 4]), lanes);
+        __m128i gray1 = _media_luma_rgba8(_mm_loadu_si128((const __m128i*) &src[i * 4 + 16]), lanes);
+        __m128i gray2 = _media_luma_rgba8(_mm_loadu_si128((const __m128i*) &src[i * 4 + 32]), lanes);
+        __m128i gray3 = _media_luma_rgba8(_mm_loadu_si128((const __m128i*) &src[i * 4 + 48]), lanes);
+
+        __m128i low = _mm_packs_epi32(gray0, gray1);
+        __m128i high = _mm_packs_epi32(gray2, gray3);
+        _mm_storeu_si128((__m128i*) &dst[i], _mm_packus_epi16(low, high));
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst[i] = _media_luma(weights, src[i * 4], src[i * 4 + 1], src[i * 4 + 2]);
+    }
+}
+
+static void _media_rgba8_to_ga8(const uint8_t* src, uint8_t* dst, size_t count, const int16_t* weights) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i lanes = _media_luma_weights(weights);
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i pixels0 = _mm_loadu_si128((const __m128i*) &src[i * 4]);
+        __m128i pixels1 = _mm_loadu_si128((const __m128i*) &src[i * 4 + 16]);
+
+        __m128i gray = _mm_packs_epi32(_media_luma_rgba8(pixels0, lanes), _media_luma_rgba8(pixels1, lanes));
+        __m128i alpha = _mm_packs_epi32(_mm_srli_epi32(pixels0, 24), _mm_srli_epi32(pixels1, 24));
+
+        _mm_storeu_si128((__m128i*) &dst[i * 2], _mm_or_si128(gray, _mm_slli_epi16(alpha, 8)));
+    }
+#endif
+
+    for (; i < count; i++) {
+        uint8_t gray = _media_luma(weights, src[i * 4], src[i * 4 + 1], src[i * 4 + 2]);
+        uint8_t alpha = src[i * 4 + 3];
+
+        dst[i * 2] = gray;
+        dst[i * 2 + 1] = alpha;
+    }
+}
+
+static void _media_rgb8_to_g8(const uint8_t* src, uint8_t* dst, size_t count, const int16_t* weights) {
+    size_t i = 0;
+
+#ifdef __SSSE3__
+    const __m128i lanes = _media_luma_weights(weights);
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+
+    // loads are 16 bytes wide, keep 4 spare bytes at the end of src
+    for (; i + 6 <= count; i += 4) {
+        __m128i pixels = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) &src[i * 3]), shuffle);
+        __m128i gray = _media_luma_rgba8(pixels, lanes);
+
+        gray = _mm_packus_epi16(_mm_packs_epi32(gray, gray), gray);
+        uint32_t packed = _mm_cvtsi128_si32(gray);
+        memcpy(&dst[i], &packed, sizeof(uint32_t));
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst[i] = _media_luma(weights, src[i * 3], src[i * 3 + 1], src[i * 3 + 2]);
+    }
+}
+
+static void _media_rgb8_to_ga8(const uint8_t* src, uint8_t* dst, size_t count, const int16_t* weights) {
+    for (size_t i = 0; i < count; i++) {
+        uint8_t gray = _media_luma(weights, src[i * 3], src[i * 3 + 1], src[i * 3 + 2]);
+
+        dst[i * 2] = gray;
+        dst[i * 2 + 1] = 0xFF;
+    }
+}
+
+static void _media_rgba16_to_g16(const uint8_t* src, uint8_t* dst, size_t count, const int16_t* weights) {
+    const uint16_t* src16 = (const uint16_t*) src;
+    uint16_t* dst16 = (uint16_t*) dst;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i lanes = _media_luma_weights(weights);
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i pixels0 = _mm_loadu_si128((const __m128i*) &src16[i * 4]);
+        __m128i pixels1 = _mm_loadu_si128((const __m128i*) &src16[i * 4 + 8]);
+        __m128i pixels2 = _mm_loadu_si128((const __m128i*) &src16[i * 4 + 16]);
+        __m128i pixels3 = _mm_loadu_si128((const __m128i*) &src16[i * 4 + 24]);
+
+        __m128i low = _media_luma_rgba16(pixels0, pixels1, lanes);
+        __m128i high = _media_luma_rgba16(pixels2, pixels3, lanes);
+        _mm_storeu_si128((__m128i*) &dst16[i], _media_packu16_epi32(low, high));
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst16[i] = _media_luma(weights, src16[i * 4], src16[i * 4 + 1], src16[i * 4 + 2]);
+    }
+}
+
+static void _media_rgba16_to_ga16(const uint8_t* src, uint8_t* dst, size_t count, const int16_t* weights) {
+    const uint16_t* src16 = (const uint16_t*) src;
+    uint16_t* dst16 = (uint16_t*) dst;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i lanes = _media_luma_weights(weights);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i pixels01 = _mm_loadu_si128((const __m128i*) &src16[i * 4]);
+        __m128i pixels23 = _mm_loadu_si128((const __m128i*) &src16[i * 4 + 8]);
+
+        __m128i gray = _media_luma_rgba16(pixels01, pixels23, lanes);
+        // alpha is the top 16 bits of every pixel
+        __m128 alpha01 = _mm_castsi128_ps(_mm_srli_epi64(pixels01, 48));
+        __m128 alpha23 = _mm_castsi128_ps(_mm_srli_epi64(pixels23, 48));
+        __m128i alpha = _mm_castps_si128(_mm_shuffle_ps(alpha01, alpha23, _MM_SHUFFLE(2, 0, 2, 0)));
+
+        _mm_storeu_si128((__m128i*) &dst16[i * 2], _mm_or_si128(gray, _mm_slli_epi32(alpha, 16)));
+    }
+#endif
+
+    for (; i < count; i++) {
+        uint16_t gray = _media_luma(weights, src16[i * 4], src16[i * 4 + 1], src16[i * 4 + 2]);
+        uint16_t alpha = src16[i * 4 + 3];
+
+        dst16[i * 2] = gray;
+        dst16[i * 2 + 1] = alpha;
+    }
+}
+
+static void _media_rgb16_to_g16(const uint8_t* src, uint8_t* dst, size_t count, const int16_t* weights) {
+    const uint16_t* src16 = (const uint16_t*) src;
+    uint16_t* dst16 = (uint16_t*) dst;
+
+    for (size_t i = 0; i < count; i++) {
+        dst16[i] = _media_luma(weights, src16[i * 3], src16[i * 3 + 1], src16[i * 3 + 2]);
+    }
+}
+
+static void _media_rgb16_to_ga16(const uint8_t* src, uint8_t* dst, size_t count, const int16_t* weights) {
+    const uint16_t* src16 = (const uint16_t*) src;
+    uint16_t* dst16 = (uint16_t*) dst;
+
+    for (size_t i = 0; i < count; i++) {
+        uint16_t gray = _media_luma(weights, src16[i * 3], src16[i * 3 + 1], src16[i * 3 + 2]);
+
+        dst16[i * 2] = gray;
+        dst16[i * 2 + 1] = 0xFFFF;
+    }
+}
+
+// color to gray kernels of the same depth
+static const _media_luma_fn MEDIA_LUMA_CONVERTERS[MEDIA_PIXEL_FORMAT_SIZE][MEDIA_PIXEL_FORMAT_SIZE] = {
+    [MEDIA_PIXEL_RGBA8][MEDIA_PIXEL_G8] = _media_rgba8_to_g8,
+    [MEDIA_PIXEL_RGBA8][MEDIA_PIXEL_GA8] = _media_rgba8_to_ga8,
+    [MEDIA_PIXEL_RGB8][MEDIA_PIXEL_G8] = _media_rgb8_to_g8,
+    [MEDIA_PIXEL_RGB8][MEDIA_PIXEL_GA8] = _media_rgb8_to_ga8,
+    [MEDIA_PIXEL_RGBA16][MEDIA_PIXEL_G16] = _media_rgba16_to_g16,
+    [MEDIA_PIXEL_RGBA16][MEDIA_PIXEL_GA16] = _media_rgba16_to_ga16,
+    [MEDIA_PIXEL_RGB16][MEDIA_PIXEL_G16] = _media_rgb16_to_g16,
+    [MEDIA_PIXEL_RGB16][MEDIA_PIXEL_GA16] = _media_rgb16_to_ga16,
+};
+
+static void _media_unpack_rgba16(enum media_pixel_format format, const uint8_t* src, uint16_t* rgba, size_t count) {
+    const uint16_t* src16 = (const uint16_t*) src;
+    uint32_t channels = media_pixel_channels(format);
+
+    if (media_pixel_depth(format) == 8) {
+        for (size_t i = 0; i < count; i++) {
+            const uint8_t* pixel = &src[i * channels];
+            uint16_t* out = &rgba[i * 4];
+
+            if (channels >= 3) {
+                out[0] = _media_widen8(pixel[0]);
+                out[1] = _media_widen8(pixel[1]);
+                out[2] = _media_widen8(pixel[2]);
+            } else {
+                out[0] = out[1] = out[2] = _media_widen8(pixel[0]);
+            }
+
+            out[3] = channels == 2 || channels == 4 ? _media_widen8(pixel[channels - 1]) : 0xFFFF;
+        }
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            const uint16_t* pixel = &src16[i * channels];
+            uint16_t* out = &rgba[i * 4];
+
+            if (channels >= 3) {
+                out[0] = pixel[0];
+                out[1] = pixel[1];
+                out[2] = pixel[2];
+            } else {
+                out[0] = out[1] = out[2] = pixel[0];
+            }
+
+            out[3] = channels == 2 || channels == 4 ? pixel[channels - 1] : 0xFFFF;
+        }
+    }
+}
+
+static void _media_pack_rgba16(enum media_pixel_format format, const uint16_t* rgba, uint8_t* dst, size_t count,
+                               const int16_t* weights) {
+    uint16_t* dst16 = (uint16_t*) dst;
+    uint32_t channels = media_pixel_channels(format);
+    int has_alpha = channels == 2 || channels == 4;
+
+    for (size_t i = 0; i < count; i++) {
+        const uint16_t* pixel = &rgba[i * 4];
+        uint16_t samples[4];
+        uint32_t next = 0;
+
+        if (channels >= 3) {
+            samples[next++] = pixel[0];
+            samples[next++] = pixel[1];
+            samples[next++] = pixel[2];
+        } else {
+            samples[next++] = _media_luma(weights, pixel[0], pixel[1], pixel[2]);
+        }
+
+        if (has_alpha) {
+            samples[next++] = pixel[3];
+        }
+
+        if (media_pixel_depth(format) == 8) {
+            for (uint32_t j = 0; j < channels; j++) {
+                dst[i * channels + j] = _media_narrow16(samples[j]);
+            }
+        } else {
+            memcpy(&dst16[i * channels], samples, sizeof(uint16_t) * channels);
+        }
+    }
+}
+
+void media_swap16(uint8_t* data, size_t count) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 8 <= count; i += 8) {
+        __m128i samples = _mm_loadu_si128((const __m128i*) &data[i * 2]);
+        samples = _mm_or_si128(_mm_slli_epi16(samples, 8), _mm_srli_epi16(samples, 8));
+        _mm_storeu_si128((__m128i*) &data[i * 2], samples);
+    }
+#endif
+
+    for (; i < count; i++) {
+        uint8_t byte = data[i * 2];
+        data[i * 2] = data[i * 2 + 1];
+        data[i * 2 + 1] = byte;
+    }
+}
+
+void media_fill_row(uint8_t* dst, const uint8_t* pixel, uint32_t pixel_size, size_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    if (pixel_size == 1) {
+        memset(dst, pixel[0], count);
+        return;
+    }
+
+    size_t i = 0;
+
+#ifdef __SSE2__
+    if (pixel_size == 2 || pixel_size == 4 || pixel_size == 8) {
+        __m128i pattern;
+
+        if (pixel_size == 2) {
+            uint16_t value;
+            memcpy(&value, pixel, sizeof(uint16_t));
+            pattern = _mm_set1_epi16(value);
+        } else if (pixel_size == 4) {
+            uint32_t value;
+            memcpy(&value, pixel, sizeof(uint32_t));
+            pattern = _mm_set1_epi32(value);
+        } else {
+            uint64_t value;
+            memcpy(&value, pixel, sizeof(uint64_t));
+            pattern = _mm_set1_epi64x(value);
+        }
+
+        size_t per_store = 16 / pixel_size;
+        for (; i + per_store <= count; i += per_store) {
+            _mm_storeu_si128((__m128i*) &dst[i * pixel_size], pattern);
+        }
+    }
+#endif
+
+    if (i == 0) {
+        // odd sizes: fill doubling what is already written
+        memcpy(dst, pixel, pixel_size);
+        i = 1;
+
+        while (i * 2 <= count) {
+            memcpy(&dst[i * pixel_size], dst, i * pixel_size);
+            i *= 2;
+        }
+
+        memcpy(&dst[i * pixel_size], dst, (count - i) * pixel_size);
+        return;
+    }
+
+    for (; i < count; i++) {
+        memcpy(&dst[i * pixel_size], pixel, pixel_size);
+    }
+}
+
+int media_convert_row(enum media_pixel_format src_format, const uint8_t* src,
+                      enum media_pixel_format dst_format, uint8_t* dst, size_t count,
+                      enum media_luma luma) {
+    if (src_format == dst_format) {
+        memmove(dst, src, count * media_pixel_size(src_format));
+        return 0;
+    }
+
+    // indexes are meaningless without a palette
+    if (src_format == MEDIA_PIXEL_INDEXED8 || dst_format == MEDIA_PIXEL_INDEXED8) {
+        return 1;
+    }
+
+    const int16_t* weights = MEDIA_LUMA_WEIGHTS[luma < MEDIA_LUMA_SIZE ? luma : MEDIA_LUMA_AVERAGE];
+
+    _media_luma_fn luma_converter = MEDIA_LUMA_CONVERTERS[src_format][dst_format];
+    if (luma_converter != NULL) {
+        luma_converter(src, dst, count, weights);
+        return 0;
+    }
+
+    _media_convert_fn converter = MEDIA_CONVERTERS[src_format][dst_format];
+    if (converter != NULL) {
+        converter(src, dst, count);
+        return 0;
+    }
+
+    uint16_t rgba[MEDIA_CONVERT_CHUNK * 4];
+    uint32_t src_size = media_pixel_size(src_format);
+    uint32_t dst_size = media_pixel_size(dst_format);
+
+    for (size_t i = 0; i < count; i += MEDIA_CONVERT_CHUNK) {
+        size_t chunk = count - i < MEDIA_CONVERT_CHUNK ? count - i : MEDIA_CONVERT_CHUNK;
+
+        _media_unpack_rgba16(src_format, src + i * src_size, rgba, chunk);
+        _media_pack_rgba16(dst_format, rgba, dst + i * dst_size, chunk, weights);
+    }
+
+    return 0;
+}
+
+void media_expand_indexed(const uint8_t* src, const uint32_t* lut, uint8_t* dst, size_t count) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // there is no gather worth it for 256 entries, 4 lookups build one store instead
+    for (; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_setr_epi32((int) lut[src[i]], (int) lut[src[i + 1]],
+                                        (int) lut[src[i + 2]], (int) lut[src[i + 3]]);
+        _mm_storeu_si128((__m128i*) &dst[i * 4], pixels);
+    }
+#endif
+
+    for (; i < count; i++) {
+        memcpy(&dst[i * 4], &lut[src[i]], sizeof(uint32_t));
+    }
+}
+
+int media_convert_indexed(const uint8_t* src, const uint32_t* lut,
+                          enum media_pixel_format dst_format, uint8_t* dst, size_t count,
+                          enum media_luma luma) {
+    if (dst_format == MEDIA_PIXEL_INDEXED8) {
+        memmove(dst, src, count);
+        return 0;
+    }
+
+    if (dst_format == MEDIA_PIXEL_RGBA8) {
+        media_expand_indexed(src, lut, dst, count);
+        return 0;
+    }
+
+    uint32_t rgba[MEDIA_CONVERT_CHUNK];
+    uint32_t dst_size = media_pixel_size(dst_format);
+
+    for (size_t i = 0; i < count; i += MEDIA_CONVERT_CHUNK) {
+        size_t chunk = count - i < MEDIA_CONVERT_CHUNK ? count - i : MEDIA_CONVERT_CHUNK;
+
+        media_expand_indexed(src + i, lut, (uint8_t*) rgba, chunk);
+        media_convert_row(MEDIA_PIXEL_RGBA8, (const uint8_t*) rgba, dst_format, dst + i * dst_size, chunk, luma);
+    }
+
+    return 0;
+}
+
+// thresholds of ordered dither, from 0 to 63
+static const uint8_t MEDIA_BAYER[8][8] = {
+    { 0, 32,  8, 40,  2, 34, 10, 42},
+    {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44,  4, 36, 14, 46,  6, 38},
+    {60, 28, 52, 20, 62, 30, 54, 22},
+    { 3, 35, 11, 43,  1, 33,  9, 41},
+    {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47,  7, 39, 13, 45,  5, 37},
+    {63, 31, 55, 23, 61, 29, 53, 21}
+};
+
+// (value * 255 + threshold) >> 16, threshold between 0 and 65535 is 32895 when rounding
+static void _media_narrow_ordered(const uint16_t* src, uint8_t* dst, size_t count, uint32_t channels, uint32_t y) {
+    // thresholds of every sample repeat each 8 pixels
+    uint16_t thresholds[8 * 4];
+    uint32_t period = 8 * channels;
+
+    for (uint32_t i = 0; i < period; i++) {
+        thresholds[i] = MEDIA_BAYER[y & 7][i / channels] * 1024 + 512;
+    }
+
+    size_t samples = count * channels;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i factor = _mm_set1_epi16(255);
+    const __m128i sign = _mm_set1_epi16((short) 0x8000);
+
+    // period is a multiple of 8 so each load of thresholds is contiguous
+    for (; i + 8 <= samples; i += 8) {
+        __m128i values = _mm_loadu_si128((const __m128i*) &src[i]);
+        __m128i threshold = _mm_loadu_si128((const __m128i*) &thresholds[i % period]);
+
+        __m128i low = _mm_mullo_epi16(values, factor);
+        __m128i high = _mm_mulhi_epu16(values, factor);
+        __m128i sum = _mm_add_epi16(low, threshold);
+        // unsigned sum < low means it carried into the high half
+        __m128i carry = _mm_cmpgt_epi16(_mm_xor_si128(low, sign), _mm_xor_si128(sum, sign));
+
+        __m128i result = _mm_sub_epi16(high, carry);
+        _mm_storel_epi64((__m128i*) &dst[i], _mm_packus_epi16(result, result));
+    }
+#endif
+
+    for (; i < samples; i++) {
+        dst[i] = ((uint32_t) src[i] * 255 + thresholds[i % period]) >> 16;
+    }
+}
+
+static void _media_narrow_diffusion(const uint16_t* src, uint8_t* dst, size_t count, uint32_t channels,
+                                    uint32_t y, int32_t* errors) {
+    // one pixel of margin at both sides, errors are 16 times the actual ones
+    size_t row_size = (count + 2) * channels;
+    int32_t* current = &errors[(y & 1) * row_size];
+    int32_t* next = &errors[((y + 1) & 1) * row_size];
+
+    memset(next, 0, sizeof(int32_t) * row_size);
+
+    for (size_t x = 0; x < count; x++) {
+        for (uint32_t c = 0; c < channels; c++) {
+            size_t i = x * channels + c;
+            size_t e = i + channels;
+
+            int32_t value = src[i] + current[e] / 16;
+            value = value < 0 ? 0 : value > 65535 ? 65535 : value;
+
+            uint8_t narrow = ((uint32_t) value * 255 + 32895) >> 16;
+            int32_t error = value - narrow * 257;
+
+            dst[i] = narrow;
+            current[e + channels] += error * 7;
+            next[e - channels] += error * 3;
+            next[e] += error * 5;
+            next[e + channels] += error;
+        }
+    }
+}
+
+void media_narrow_dither(enum media_dither dither, const uint16_t* src, uint8_t* dst, size_t count,
+                         uint32_t channels, uint32_t y, int32_t* errors) {
+    switch (dither) {
+        case MEDIA_DITHER_ORDERED: {
+            _media_narrow_ordered(src, dst, count, channels, y);
+            break;
+        }
+        case MEDIA_DITHER_DIFFUSION: {
+            _media_narrow_diffusion(src, dst, count, channels, y, errors);
+            break;
+        }
+        default: {
+            _media_narrow_samples((const uint8_t*) src, dst, count * channels);
+            break;
+        }
+    }
+}
+
+// rounded value / max, exact for every product of two samples
+static inline uint32_t _media_div_max(uint64_t value, uint32_t max) {
+    if (max == 255) {
+        uint32_t rounded = value + 128;
+        return (rounded + (rounded >> 8)) >> 8;
+    }
+
+    uint64_t rounded = value + 32768;
+    return (rounded + (rounded >> 16)) >> 16;
+}
+
+static inline uint32_t _media_load_sample(const uint8_t* pixels, size_t i, uint32_t depth) {
+    return depth == 8 ? pixels[i] : ((const uint16_t*) pixels)[i];
+}
+
+static inline void _media_store_sample(uint8_t* pixels, size_t i, uint32_t depth, uint32_t value) {
+    if (depth == 8) {
+        pixels[i] = value;
+    } else {
+        ((uint16_t*) pixels)[i] = value;
+    }
+}
+
+// straight alpha in and out, samples go from 0 to max
+static inline void _media_blend_pixel(const uint32_t* src, uint32_t* dst, uint32_t max, enum media_blend mode) {
+    uint32_t src_alpha = src[3];
+    uint32_t dst_alpha = dst[3];
+
+    // a transparent source leaves dst as it is in every mode
+    if (src_alpha == 0) {
+        return;
+    }
+
+    uint32_t inverse_alpha = max - src_alpha;
+    uint32_t alpha = src_alpha + _media_div_max((uint64_t) dst_alpha * inverse_alpha, max);
+
+    for (uint32_t c = 0; c < 3; c++) {
+        // premultiplied
+        uint32_t s = _media_div_max((uint64_t) src[c] * src_alpha, max);
+        uint32_t d = _media_div_max((uint64_t) dst[c] * dst_alpha, max);
+        uint32_t color = 0;
+
+        switch (mode) {
+            case MEDIA_BLEND_OVER: {
+                color = s + _media_div_max((uint64_t) d * inverse_alpha, max);
+                break;
+            }
+            case MEDIA_BLEND_MULTIPLY: {
+                color = _media_div_max((uint64_t) s * d, max)
+                        + _media_div_max((uint64_t) s * (max - dst_alpha), max)
+                        + _media_div_max((uint64_t) d * inverse_alpha, max);
+                break;
+            }
+            case MEDIA_BLEND_SCREEN: {
+                color = s + d - _media_div_max((uint64_t) s * d, max);
+                break;
+            }
+        }
+
+        // back to straight alpha, opaque results don't need it
+        if (alpha != max) {
+            color = ((uint64_t) color * max + alpha / 2) / alpha;
+        }
+
+        dst[c] = color < max ? color : max;
+    }
+
+    dst[3] = alpha;
+}
+
+#ifdef __SSE2__
+// 4 samples starting at src[i] as floats
+static inline __m128 _media_load4_f32(const uint8_t* src, size_t i, uint32_t depth) {
+    if (depth == 8) {
+        int32_t samples;
+        memcpy(&samples, &src[i], sizeof(int32_t));
+
+        __m128i wide = _mm_unpacklo_epi8(_mm_cvtsi32_si128(samples), _mm_setzero_si128());
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(wide, _mm_setzero_si128()));
+    }
+
+    __m128i samples = _mm_loadl_epi64((const __m128i*) &src[i * 2]);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(samples, _mm_setzero_si128()));
+}
+#endif
+
+int media_row_to_f32(enum media_pixel_format format, const uint8_t* src, size_t count,
+                     const float* scale, const float* bias, float* dst, size_t channel_step, size_t pixel_step) {
+    if (format == MEDIA_PIXEL_INDEXED8) {
+        return 1;
+    }
+
+    uint32_t channels = media_pixel_channels(format);
+    uint32_t depth = media_pixel_depth(format);
+    size_t x = 0;
+
+#ifdef __SSE2__
+    if (channel_step == 1 && pixel_step == channels) {
+        // interleaved out: samples stay in order, scale and bias repeat each 12 (3 * 4 lanes)
+        float scales[12];
+        float biases[12];
+
+        for (uint32_t i = 0; i < 12; i++) {
+            scales[i] = scale[i % channels];
+            biases[i] = bias[i % channels];
+        }
+
+        size_t samples = count * channels;
+        size_t i = 0;
+
+        for (; i + 12 <= samples; i += 12) {
+            for (uint32_t j = 0; j < 12; j += 4) {
+                __m128 values = _media_load4_f32(src, i + j, depth);
+                values = _mm_add_ps(_mm_mul_ps(values, _mm_loadu_ps(&scales[j])), _mm_loadu_ps(&biases[j]));
+                _mm_storeu_ps(&dst[i + j], values);
+            }
+        }
+
+        x = i / channels;
+    } else if (channels == 4 && pixel_step == 1) {
+        // planes out of RGBA: 4 pixels are transposed into 4 lanes of each channel
+        __m128 scales[4];
+        __m128 biases[4];
+
+        for (uint32_t c = 0; c < 4; c++) {
+            scales[c] = _mm_set1_ps(scale[c]);
+            biases[c] = _mm_set1_ps(bias[c]);
+        }
+
+        for (; x + 4 <= count; x += 4) {
+            __m128 rows[4];
+
+            for (uint32_t j = 0; j < 4; j++) {
+                rows[j] = _media_load4_f32(src, (x + j) * 4, depth);
+            }
+
+            _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+
+            for (uint32_t c = 0; c < 4; c++) {
+                __m128 values = _mm_add_ps(_mm_mul_ps(rows[c], scales[c]), biases[c]);
+                _mm_storeu_ps(&dst[c * channel_step + x], values);
+            }
+        }
+    }
+#endif
+
+    for (; x < count; x++) {
+        for (uint32_t c = 0; c < channels; c++) {
+            float value = depth == 8 ? src[x * channels + c] : ((const uint16_t*) src)[x * channels + c];
+            dst[c * channel_step + x * pixel_step] = value * scale[c] + bias[c];
+        }
+    }
+
+    return 0;
+}
+
+#ifdef __SSE2__
+// rounded x / 255 of 16 bits lanes holding products of two 8 bits samples
+static inline __m128i _media_div255_epi16(__m128i value) {
+    __m128i rounded = _mm_add_epi16(value, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(rounded, _mm_srli_epi16(rounded, 8)), 8);
+}
+
+// alpha of 2 RGBA pixels in 16 bits lanes broadcast to their 4 lanes
+static inline __m128i _media_alpha_epi16(__m128i pixels) {
+    pixels = _mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_shufflehi_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+// 2 RGBA8 pixels in 16 bits lanes scaled by their alpha, alpha itself is kept
+static inline __m128i _media_premultiply_epi16(__m128i pixels) {
+    const __m128i alpha_lanes = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+    __m128i factors = _mm_or_si128(_mm_andnot_si128(alpha_lanes, _media_alpha_epi16(pixels)),
+                                   _mm_and_si128(alpha_lanes, _mm_set1_epi16(255)));
+
+    return _media_div255_epi16(_mm_mullo_epi16(pixels, factors));
+}
+
+// src over 2 opaque dst RGBA8 pixels in 16 bits lanes, as _media_blend_pixel does it
+static inline __m128i _media_over_opaque_epi16(__m128i src, __m128i dst) {
+    __m128i inverse_alpha = _mm_sub_epi16(_mm_set1_epi16(255), _media_alpha_epi16(src));
+    __m128i color = _mm_add_epi16(_media_premultiply_epi16(src),
+                                  _media_div255_epi16(_mm_mullo_epi16(dst, inverse_alpha)));
+
+    return _mm_or_si128(color, _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255));
+}
+#endif
+
+int media_premultiply_row(enum media_pixel_format format, uint8_t* pixels, size_t count) {
+    uint32_t channels = media_pixel_channels(format);
+    uint32_t depth = media_pixel_depth(format);
+
+    if (format == MEDIA_PIXEL_INDEXED8 || (channels != 2 && channels != 4)) {
+        return 1;
+    }
+
+    uint32_t max = depth == 8 ? 255 : 65535;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    if (format == MEDIA_PIXEL_RGBA8) {
+        const __m128i zero = _mm_setzero_si128();
+
+        for (; i + 4 <= count; i += 4) {
+            __m128i block = _mm_loadu_si128((const __m128i*) &pixels[i * 4]);
+            __m128i low = _media_premultiply_epi16(_mm_unpacklo_epi8(block, zero));
+            __m128i high = _media_premultiply_epi16(_mm_unpackhi_epi8(block, zero));
+
+            _mm_storeu_si128((__m128i*) &pixels[i * 4], _mm_packus_epi16(low, high));
+        }
+    }
+#endif
+
+    for (; i < count; i++) {
+        size_t base = i * channels;
+        uint32_t alpha = _media_load_sample(pixels, base + channels - 1, depth);
+
+        for (uint32_t c = 0; c + 1 < channels; c++) {
+            uint32_t value = _media_load_sample(pixels, base + c, depth);
+            _media_store_sample(pixels, base + c, depth, _media_div_max((uint64_t) value * alpha, max));
+        }
+    }
+
+    return 0;
+}
+
+int media_unpremultiply_row(enum media_pixel_format format, uint8_t* pixels, size_t count) {
+    uint32_t channels = media_pixel_channels(format);
+    uint32_t depth = media_pixel_depth(format);
+
+    if (format == MEDIA_PIXEL_INDEXED8 || (channels != 2 && channels != 4)) {
+        return 1;
+    }
+
+    uint32_t max = depth == 8 ? 255 : 65535;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t base = i * channels;
+        uint32_t alpha = _media_load_sample(pixels, base + channels - 1, depth);
+
+        // nothing to undo
+        if (alpha == max) {
+            continue;
+        }
+
+        for (uint32_t c = 0; c + 1 < channels; c++) {
+            uint64_t value = _media_load_sample(pixels, base + c, depth);
+            uint64_t color = alpha != 0 ? (value * max + alpha / 2) / alpha : 0;
+
+            _media_store_sample(pixels, base + c, depth, color < max ? color : max);
+        }
+    }
+
+    return 0;
+}
+
+int media_composite_row(enum media_pixel_format format, const uint8_t* src, uint8_t* dst, size_t count,
+                        enum media_blend mode) {
+    if (format != MEDIA_PIXEL_RGBA8 && format != MEDIA_PIXEL_RGBA16) {
+        return 1;
+    }
+
+    uint32_t depth = media_pixel_depth(format);
+    uint32_t max = depth == 8 ? 255 : 65535;
+    size_t i = 0;
+
+    while (i < count) {
+#ifdef __SSE2__
+        // the usual watermark case: over an opaque background needs no division at all
+        if (format == MEDIA_PIXEL_RGBA8 && mode == MEDIA_BLEND_OVER && i + 4 <= count) {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i opaque = _mm_set1_epi32((int) 0xFF000000);
+
+            __m128i to = _mm_loadu_si128((const __m128i*) &dst[i * 4]);
+            __m128i is_opaque = _mm_cmpeq_epi32(_mm_and_si128(to, opaque), opaque);
+
+            if (_mm_movemask_epi8(is_opaque) == 0xFFFF) {
+                __m128i from = _mm_loadu_si128((const __m128i*) &src[i * 4]);
+                __m128i low = _media_over_opaque_epi16(_mm_unpacklo_epi8(from, zero), _mm_unpacklo_epi8(to, zero));
+                __m128i high = _media_over_opaque_epi16(_mm_unpackhi_epi8(from, zero), _mm_unpackhi_epi8(to, zero));
+
+                _mm_storeu_si128((__m128i*) &dst[i * 4], _mm_packus_epi16(low, high));
+                i += 4;
+                continue;
+            }
+        }
+#endif
+
+        uint32_t from[4];
+        uint32_t to[4];
+
+        for (uint32_t c = 0; c < 4; c++) {
+            from[c] = _media_load_sample(src, i * 4 + c, depth);
+            to[c] = _media_load_sample(dst, i * 4 + c, depth);
+        }
+
+        _media_blend_pixel(from, to, max, mode);
+
+        for (uint32_t c = 0; c < 4; c++) {
+            _media_store_sample(dst, i * 4 + c, depth, to[c]);
+        }
+
+        i++;
+    }
+
+    return 0;
+}
+
+int media_can_convert(enum media_pixel_format src_format, enum media_pixel_format dst_format) {
+    if (src_format == dst_format) {
+        return 0;
+    }
+
+    return src_format == MEDIA_PIXEL_INDEXED8 || dst_format == MEDIA_PIXEL_INDEXED8;
+}
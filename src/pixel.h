@@ -0,0 +1,128 @@
+#ifndef MEDIA_PIXEL_GUARD_HEADER
+#define MEDIA_PIXEL_GUARD_HEADER
+
+#include <stdint.h>
+#include <stddef.h>
+
+// packed pixel layouts the row kernels work with,
+// 16 bits samples are always in native endian
+enum media_pixel_format {
+    MEDIA_PIXEL_G8,
+    MEDIA_PIXEL_GA8,
+    MEDIA_PIXEL_RGB8,
+    MEDIA_PIXEL_RGBA8,
+    MEDIA_PIXEL_G16,
+    MEDIA_PIXEL_GA16,
+    MEDIA_PIXEL_RGB16,
+    MEDIA_PIXEL_RGBA16,
+    MEDIA_PIXEL_INDEXED8,
+
+    MEDIA_PIXEL_FORMAT_SIZE
+};
+
+// weights used when color turns into gray
+enum media_luma {
+    MEDIA_LUMA_AVERAGE,
+    MEDIA_LUMA_BT601,
+    MEDIA_LUMA_BT709,
+
+    MEDIA_LUMA_SIZE
+};
+
+// how a source pixel is laid over a destination one, as in Porter-Duff over
+// with the multiply and screen blend functions of W3C compositing
+enum media_blend {
+    MEDIA_BLEND_OVER,
+    MEDIA_BLEND_MULTIPLY,
+    MEDIA_BLEND_SCREEN
+};
+
+// how 16 bits samples are narrowed to 8 bits
+enum media_dither {
+    // rounded to nearest
+    MEDIA_DITHER_NONE,
+    // 8x8 Bayer matrix thresholds
+    MEDIA_DITHER_ORDERED,
+    // Floyd-Steinberg error diffusion
+    MEDIA_DITHER_DIFFUSION
+};
+
+static inline uint32_t media_pixel_channels(enum media_pixel_format format) {
+    static const uint8_t CHANNELS[MEDIA_PIXEL_FORMAT_SIZE] = {1, 2, 3, 4, 1, 2, 3, 4, 1};
+    return CHANNELS[format];
+}
+
+static inline uint32_t media_pixel_depth(enum media_pixel_format format) {
+    return format >= MEDIA_PIXEL_G16 && format <= MEDIA_PIXEL_RGBA16 ? 16 : 8;
+}
+
+// in bytes
+static inline uint32_t media_pixel_size(enum media_pixel_format format) {
+    return media_pixel_channels(format) * media_pixel_depth(format) / 8;
+}
+
+// 16 bits format with the same channels of format
+static inline enum media_pixel_format media_pixel_wide_format(enum media_pixel_format format) {
+    switch (format) {
+        case MEDIA_PIXEL_G8: return MEDIA_PIXEL_G16;
+        case MEDIA_PIXEL_GA8: return MEDIA_PIXEL_GA16;
+        case MEDIA_PIXEL_RGB8: return MEDIA_PIXEL_RGB16;
+        case MEDIA_PIXEL_RGBA8: return MEDIA_PIXEL_RGBA16;
+        default: return format;
+    }
+}
+
+// swaps bytes of count 16 bits samples in place
+void media_swap16(uint8_t* data, size_t count);
+
+// repeats pixel of pixel_size bytes count times in dst
+void media_fill_row(uint8_t* dst, const uint8_t* pixel, uint32_t pixel_size, size_t count);
+
+// converts count pixels from src to dst, same format is a plain copy.
+// color to gray uses luma weights.
+// if dst pixels are not bigger than src ones, it can be done in place (dst == src),
+// otherwise src and dst must not overlap.
+// return 0 if success, otherwise another number if there is no converter between them
+int media_convert_row(enum media_pixel_format src_format, const uint8_t* src,
+                      enum media_pixel_format dst_format, uint8_t* dst, size_t count,
+                      enum media_luma luma);
+
+// expands count 8 bits indexes through lut, every entry is a RGBA8 pixel packed
+// in memory order. lut must have 256 entries
+void media_expand_indexed(const uint8_t* src, const uint32_t* lut, uint8_t* dst, size_t count);
+
+// like media_convert_row from INDEXED8, indexes are expanded through lut first.
+// src and dst must not overlap
+// return 0 if success, otherwise another number
+int media_convert_indexed(const uint8_t* src, const uint32_t* lut,
+                          enum media_pixel_format dst_format, uint8_t* dst, size_t count,
+                          enum media_luma luma);
+
+// narrows count pixels of channels 16 bits samples to 8 bits, row y of an image.
+// diffusion carries its error between rows in errors, 2 * (count + 2) * channels
+// zeroed ints for the whole image, and rows must come in order
+void media_narrow_dither(enum media_dither dither, const uint16_t* src, uint8_t* dst, size_t count,
+                         uint32_t channels, uint32_t y, int32_t* errors);
+
+// samples of count pixels to sample * scale[c] + bias[c] floats, c being the channel.
+// sample c of pixel x goes to dst[c * channel_step + x * pixel_step], so planes are
+// channel_step = plane size, pixel_step = 1 and interleaved ones channel_step = 1, pixel_step = channels
+// return 0 if success, otherwise another number (e.g. INDEXED8)
+int media_row_to_f32(enum media_pixel_format format, const uint8_t* src, size_t count,
+                     const float* scale, const float* bias, float* dst, size_t channel_step, size_t pixel_step);
+
+// scales color samples by alpha in place, GA and RGBA formats of any depth.
+// return 0 if success, otherwise another number
+int media_premultiply_row(enum media_pixel_format format, uint8_t* pixels, size_t count);
+// undo media_premultiply_row, colors of fully transparent pixels become 0
+int media_unpremultiply_row(enum media_pixel_format format, uint8_t* pixels, size_t count);
+
+// blends count src pixels over dst ones, both in format with straight alpha (RGBA8 or RGBA16).
+// return 0 if success, otherwise another number
+int media_composite_row(enum media_pixel_format format, const uint8_t* src, uint8_t* dst, size_t count,
+                        enum media_blend mode);
+
+// return 0 if there is a converter from src_format to dst_format, otherwise another number
+int media_can_convert(enum media_pixel_format src_format, enum media_pixel_format dst_format);
+
+#endif // MEDIA_PIXEL_GUARD_HEADER
@@ -1,6 +1,15 @@
 #include "image.h"
 #include "../zlib/zlib.h"
 #include "utils.h"
+#include "pixel.h"
+#include "gamma.h"
+#include "color.h"
+#include "resize.h"
+#include "orient.h"
+#include "stats.h"
+#include "compare.h"
+#include "hash.h"
+#include "convolve.h"
 
 #include <stdint.h>
 #include <stdio.h>
@@ -9,6 +18,8 @@
 #include <math.h>
 
 static const char PNG_FILE_HEADER[9] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A, 0x00};
+// appended to the output path of image_png_rewrite_metadata while it's being written
+static const char PNG_REWRITE_SUFFIX[] = ".rewrite";
 static const uint8_t PNG_BITS_TYPE[7][17] = {
     {0, 8, 8, 0, 8, 0, 0, 0,  8, 0, 0, 0, 0, 0, 0, 0, 16},
     {0, 0, 0, 0, 0, 0, 0, 0,  0, 0, 0, 0, 0, 0, 0, 0,  0},
@@ -19,6 +30,21 @@ static const uint8_t PNG_BITS_TYPE[7][17] = {
     {0, 0, 0, 0, 0, 0, 0, 0, 32, 0, 0, 0, 0, 0, 0, 0, 64}
 };
 
+// image_png_hash_file averages pixels down to at most 256 x 256 while decoding, far over the hash grids
+static const struct image_decode_options PNG_HASH_DECODE = {1, 0, 256, 256, {0, 0, 0, 0}, NULL, 0};
+// hashes computed by _png_hash, average and perceptual ones share the MEDIA_HASH_GRID grid
+static const uint8_t PNG_HASH_AVERAGE = 0x01;
+static const uint8_t PNG_HASH_DIFFERENCE = 0x02;
+static const uint8_t PNG_HASH_PERCEPTUAL = 0x04;
+static const uint8_t PNG_HASH_GRID = 0x05;
+static const uint8_t PNG_HASH_ALL = 0x07;
+
+// first arena block of an image, next ones double up to PNG_ARENA_MAX_BLOCK unless an allocation needs more
+static const size_t PNG_ARENA_BLOCK = 4096;
+static const size_t PNG_ARENA_MAX_BLOCK = 65536;
+// arena allocations start at this boundary, right after their capacity
+static const size_t PNG_ARENA_ALIGN = 16;
+
 struct image_png_chunk {
     uint32_t length;
     char type[5];
@@ -156,6 +182,60 @@ struct image_png_chunk_IDAT {
     enum image_png_idat_type type;
     size_t size;
     uint8_t* data;
+
+    // only for PIXELS, 16 bits samples are in native endian, SCANLINES keep PNG byte order.
+    // rows start every stride bytes and at alignment boundaries.
+    // min_stride is the one asked for, 0 means as tight as alignment allows
+    size_t stride;
+    uint32_t alignment;
+    size_t min_stride;
+};
+
+// alignment of pixel rows for new images
+static uint32_t png_default_alignment = 1;
+// threads used by whole image loops, e.g. tensor export
+static uint32_t png_threads = 1;
+
+// a region metadata is bumped from, its bytes follow it
+struct png_arena_block {
+    struct png_arena_block* next;
+    size_t size;
+    size_t used;
+};
+
+// where an image allocates from, metadata is bumped from blocks of functions if arena isn't 0
+struct png_allocator {
+    struct image_allocator functions;
+    uint8_t arena;
+    // newest block first, all of them go away in image_png_close
+    struct png_arena_block* blocks;
+};
+
+static void* _png_std_alloc(void* ctx, size_t size);
+static void* _png_std_realloc(void* ctx, void* ptr, size_t size);
+static void _png_std_free(void* ctx, void* ptr);
+
+// allocator of new images
+static struct png_allocator png_default_allocator = {
+    {_png_std_alloc, _png_std_realloc, _png_std_free, NULL}, 0, NULL
+};
+
+// a band of rows deflated on its own and closed by a full flush, so it can be
+// reused as is in later saves while its rows are not touched
+struct png_idat_band {
+    uint8_t dirty;
+    // adler32 and size of the band scanlines before compression
+    uint32_t adler;
+    size_t raw_size;
+    size_t size;
+    uint8_t* data;
+};
+
+struct png_idat_bands {
+    // rows per band, restart points are disabled if 0
+    uint32_t rows;
+    uint32_t size;
+    struct png_idat_band* list;
 };
 
 struct image_png {
@@ -181,12 +261,21 @@ struct image_png {
 
     // IDAT needs to be in PIXELS instead of SCANLINES
     struct image_png_chunk_IDAT idat;
+    // compressed IDAT segments from the last save
+    struct png_idat_bands bands;
+    // how colors turn into gray on conversions
+    enum image_luma luma;
+    // how 16 bits turn into 8 bits on color conversions
+    enum image_dither dither;
+    // resizes weight linear light instead of encoded samples if not zero
+    uint8_t resize_linear;
+    // PLTE and tRNS merged as packed RGBA8, NULL until some expansion needs it
+    uint32_t* palette_lut;
+    // the image, chunks read and metadata come from it
+    struct png_allocator allocator;
 };
 
 static inline uint32_t convert_int_be(uint32_t value);
-static void _png_convert_color(struct image_color* color, enum image_color_type type);
-
-static void _png_copy_chunk(struct image_png_chunk* src, struct image_png_chunk* dest);
 
 static inline void _png_generate_crc32(struct image_png_chunk* chunk);
 // return 0 if it's alright otherwise another number if corrupted
@@ -198,23 +287,29 @@ static inline void _png_populate_chunk(struct image_png_chunk* chunk, size_t byt
 // ihdr can be null, just checking if chunk is an IHDR valid
 static int _png_read_chunk_IHDR(struct image_png_chunk* chunk, struct image_png_chunk_IHDR* ihdr);
 // return 0 if sucess, otherwise another number
-static int _png_read_chunk_PLTE(struct image_png_chunk* chunk, struct image_png_chunk_PLTE* plte);
+static int _png_read_chunk_PLTE(struct png_allocator* allocator, struct image_png_chunk* chunk,
+                                struct image_png_chunk_PLTE* plte);
 // return 0 if success, also type is gonna be 8BITS by default, check _png_convert_chunk_tRNS
-static int _png_read_chunk_tRNS(struct image_png_chunk* chunk, struct image_png_chunk_tRNS* trns);
+static int _png_read_chunk_tRNS(struct png_allocator* allocator, struct image_png_chunk* chunk,
+                                struct image_png_chunk_tRNS* trns);
 // return 0 if success, otherise another number
 static int _png_read_chunk_cHRM(struct image_png_chunk* chunk, struct image_png_chunk_cHRM* chrm);
 // return 0 if success, otherise another number
 static int _png_read_chunk_gAMA(struct image_png_chunk* chunk, struct image_png_chunk_gAMA* gama);
-static int _png_read_chunk_iCCP(struct image_png_chunk* chunk, struct image_png_chunk_iCCP* iccp);
+static int _png_read_chunk_iCCP(struct png_allocator* allocator, struct image_png_chunk* chunk,
+                                struct image_png_chunk_iCCP* iccp);
 static int _png_read_chunk_sBIT(struct image_png_chunk* chunk, struct image_png_chunk_sBIT* sbit);
 static int _png_read_chunk_sRGB(struct image_png_chunk* chunk, struct image_png_chunk_sRGB* srgb);
-static int _png_read_chunk_tEXt(struct image_png_chunk* chunk, struct image_png_chunk_tEXt* text);
-static int _png_read_chunk_zTXt(struct image_png_chunk* chunk, struct image_png_chunk_zTXt* ztxt);
-static int _png_read_chunk_iTXt(struct image_png_chunk* chunk, struct image_png_chunk_iTXt* itxt);
+// texts are always allocated, whatever text pointers had before
+static int _png_read_chunk_tEXt(struct png_allocator* allocator, struct image_png_chunk* chunk,
+                                struct image_png_chunk_tEXt* text);
+static int _png_read_chunk_zTXt(struct png_allocator* allocator, struct image_png_chunk* chunk,
+                                struct image_png_chunk_zTXt* ztxt);
+static int _png_read_chunk_iTXt(struct png_allocator* allocator, struct image_png_chunk* chunk,
+                                struct image_png_chunk_iTXt* itxt);
 // return 0 if success, otherwise another number
 static int _png_read_chunk_tIME(struct image_png_chunk* chunk, struct image_png_chunk_tIME* time);
 // this is only based in zlib and it'll write in IDAT chunk as SCANLINES
-static int _png_read_chunk_IDAT(struct image_png_chunk* chunk, struct image_png_chunk_IDAT* idat);
 
 static void _png_write_chunk_IHDR(struct image_png_chunk_IHDR* ihdr, struct image_png_chunk* chunk);
 static void _png_write_chunk_PLTE(struct image_png_chunk_PLTE* plte, struct image_png_chunk* chunk);
@@ -231,12 +326,26 @@ static void _png_write_chunk_iTXt(struct image_png_chunk_iTXt* itxt, struct imag
 static void _png_write_chunk_tIME(struct image_png_chunk_tIME* time, struct image_png_chunk* chunk);
 // this is only based in zlib, also it needs that IDAT chunk be in SCANLINES
 static void _png_write_chunk_IDAT(struct image_png_chunk_IDAT* idat, struct image_png_chunk* chunk);
+// like _png_write_chunk_IDAT but only deflating bands touched since last time, IDAT needs to be in PIXELS.
+// bands that couldn't be deflated stay dirty. return 0 if success, otherwise another number
+static int _png_write_chunk_IDAT_bands(struct png_allocator* allocator, struct image_png_chunk_IHDR* ihdr,
+                                       struct image_png_chunk_IDAT* idat, struct png_idat_bands* bands,
+                                       struct image_png_chunk* chunk);
 
-static void _png_convert_chunk_tRNS(struct image_png_chunk_tRNS* trns,
+static void _png_convert_chunk_tRNS(struct png_allocator* allocator, struct image_png_chunk_tRNS* trns,
                                     enum image_png_trns_type type);
-static void _png_convert_chunk_IDAT(struct image_png_chunk_IHDR* ihdr,
-                                    struct image_png_chunk_IDAT* idat,
-                                    enum image_png_idat_type type);
+// bytes between rows of PIXELS, at least a row and min_stride, rounded up to the alignment of idat
+static size_t _png_stride(struct image_png_chunk_IHDR* ihdr, struct image_png_chunk_IDAT* idat);
+// sets stride and size of PIXELS according to its alignment and allocates them zeroed through allocator,
+// data is replaced without being freed. return 0 if success, otherwise another number
+static int _png_alloc_pixels(struct png_allocator* allocator, struct image_png_chunk_IHDR* ihdr,
+                             struct image_png_chunk_IDAT* idat);
+// undo PNG filter of one scanline, prior is the previous row already unfiltered or NULL
+static void _png_defilter_row(uint8_t filter, const uint8_t* scanline, const uint8_t* prior,
+                              uint8_t* row, size_t size, uint32_t bpp);
+// PIXELS of idat into new SCANLINES, pixels are left to the caller and idat is only changed if
+// it succeeds. return 0 if success, otherwise another number
+static int _png_IDAT_to_scanlines(struct image_png_chunk_IHDR* ihdr, struct image_png_chunk_IDAT* idat);
 
 static inline enum image_png_sbit_type _png_color_to_sbit(uint8_t color);
 
@@ -246,7 +355,7 @@ static inline int _png_check_sbit(struct image_png_chunk_sBIT* sbit);
 // return 0 if no time, otherwise any number if there is time
 static inline int _png_check_time(struct image_png_chunk_tIME* time);
 
-static void _png_add_text(struct png_textual_list* list,
+static void _png_add_text(struct png_allocator* allocator, struct png_textual_list* list,
                           struct png_textual_data* textual);
 
 static void _png_get_text(struct png_textual_list* list,
@@ -254,11 +363,260 @@ static void _png_get_text(struct png_textual_list* list,
                           struct png_textual_data** out_textual,
                           uint32_t* index);
 
-static void _png_sub_text(struct png_textual_list* list,
+static void _png_sub_text(struct png_allocator* allocator, struct png_textual_list* list,
                           const char* keyword);
 
-// just if IDAT chunk is not used anymore
-static inline void _png_free_chunk_IDAT(struct image_png_chunk_IDAT* idat);
+// just if IDAT chunk is not used anymore, its PIXELS came from _png_alloc_pixels with allocator
+static inline void _png_free_chunk_IDAT(struct png_allocator* allocator, struct image_png_chunk_IDAT* idat);
+
+// drop every compressed band, e.g. when dimension or color changes
+static void _png_reset_bands(struct png_allocator* allocator, struct png_idat_bands* bands);
+// mark bands covering rows [y, y + rows) to be deflated again
+static inline void _png_touch_rows(struct image_png* image, uint32_t y, uint32_t rows);
+
+// return 0 if success, otherwise another number
+static int _png_fwrite_chunk(FILE* file, struct image_png_chunk* chunk);
+// return NULL if keyword is not edited
+static const struct image_text_edit* _png_find_text_edit(const struct image_metadata_edits* edits,
+                                                         const char* keyword);
+// return 0 if success, otherwise another number
+static int _png_fwrite_metadata_edits(FILE* file, const struct image_metadata_edits* edits);
+// reads past size bytes of file, return 0 if success otherwise another number if it ends before
+static int _png_fskip(FILE* file, size_t size);
+
+static inline enum media_pixel_format _png_ihdr_format(struct image_png_chunk_IHDR* ihdr);
+static inline enum media_pixel_format _png_color_format(enum image_color_type type);
+static inline enum media_luma _png_luma(struct image_png* image);
+// converts a row of the image width, dithered through wide and errors if wide isn't NULL
+static void _png_convert_row(struct image_png* image, enum media_pixel_format src_format, const uint8_t* src,
+                             enum media_pixel_format dst_format, uint8_t* dst, uint32_t y,
+                             uint16_t* wide, int32_t* errors);
+// builds palette_lut if needed, indexes past the palette are opaque black
+static const uint32_t* _png_palette_lut(struct image_png* image);
+static inline void _png_drop_palette_lut(struct image_png* image);
+// tables of the transfer function the image is encoded with, given back with media_gamma_release.
+// NULL if they couldn't be allocated
+static const struct media_gamma* _png_gamma(struct image_png* image);
+static void _png_clear_trns(struct png_allocator* allocator, struct image_png_chunk_tRNS* trns);
+// bytes of a row of pixels, there is no filter byte in PIXELS
+static inline size_t _png_row_size(struct image_png_chunk_IHDR* ihdr);
+static inline uint8_t* _png_row(struct image_png* image, uint32_t y);
+// swaps 16 bits samples of a row between PNG byte order and native endian, if they differ
+static inline void _png_swap_row16(struct image_png_chunk_IHDR* ihdr, uint8_t* row, size_t size);
+// color as it's kept in pixels, return 0 if success otherwise another number
+static int _png_color_to_pixel(struct image_png* image, struct image_color* color, uint8_t* pixel);
+
+static struct image_png* _png_open(const char* path, const struct image_decode_options* options);
+
+// IDAT inflated while its chunks are read, every scanline goes to pixels once it's complete,
+// so only the chunk being read and two scanlines are kept besides pixels
+struct png_decoder {
+    z_stream stream;
+    uint8_t ready;
+    // nothing else is inflated, either the stream ended, it's corrupted or all rows are there
+    uint8_t done;
+
+    // rows as they are in the file
+    struct image_png_chunk_IHDR ihdr;
+    size_t row_size;
+    uint32_t pixel_size;
+    // filter byte and row being inflated, filled bytes so far
+    uint8_t* scanline;
+    size_t filled;
+    // current and prior rows defiltered, in PNG byte order
+    uint8_t* rows;
+    uint32_t y;
+
+    // only these pixels are kept, rows past it aren't inflated
+    struct image_rect region;
+    // the rest of the file isn't read once region is done
+    uint8_t stop_early;
+
+    // indexes are expanded to RGBA8 through it if not NULL
+    const uint32_t* lut;
+    // rows as they reach pixels, once swapped and expanded
+    enum media_pixel_format format;
+    // pixels are averaged over factor x factor blocks if it's over 1, through one row of sums
+    uint32_t factor;
+    uint64_t* sums;
+    uint8_t* native;
+
+    // the buffers above come from the allocator of the image being decoded
+    struct png_allocator* allocator;
+};
+
+// allocates pixels for the output of options and starts inflating, image has IHDR and PLTE.
+// return 0 if success, otherwise another number
+static int _png_decoder_init(struct png_decoder* decoder, struct image_png* image,
+                             const struct image_decode_options* options);
+// inflates data of an IDAT chunk, rows are defiltered and stored as they come
+static void _png_decoder_feed(struct png_decoder* decoder, struct image_png* image, uint8_t* data, size_t size);
+// a complete scanline to pixels
+static void _png_decoder_row(struct png_decoder* decoder, struct image_png* image);
+// flushes rows still being averaged and frees the decoder, image can be NULL to only free it
+static void _png_decoder_end(struct png_decoder* decoder, struct image_png* image);
+
+// rows of an image being written as floats, shared by the threads of image_png_to_planar_f32
+struct png_tensor_job {
+    struct image_png* image;
+    enum media_pixel_format format;
+    const uint32_t* lut;
+    float scale[4];
+    float bias[4];
+    float* out;
+    size_t channel_step;
+    size_t pixel_step;
+    size_t row_step;
+    // set by any range that couldn't allocate its rows
+    volatile uint8_t failed;
+};
+
+// media_range_fn writing rows [begin, end) of a png_tensor_job
+static void _png_tensor_rows(void* context, size_t begin, size_t end);
+
+// rows of an image measured by image_png_histogram or image_png_stats, split in parts
+// that are filled on their own and added up once every thread is done
+struct png_stats_job {
+    struct image_png* image;
+    enum media_pixel_format format;
+    const uint32_t* lut;
+    uint32_t parts;
+    uint32_t bins;
+    // parts x channels x bins counts or parts stats, only one of them isn't NULL
+    uint64_t* histograms;
+    struct media_stats* stats;
+    // set by any part that couldn't allocate its rows
+    volatile uint8_t failed;
+};
+
+// media_range_fn filling parts [begin, end) of a png_stats_job
+static void _png_stats_parts(void* context, size_t begin, size_t end);
+// job for image, indexed pixels are measured as RGBA8 through the palette.
+// return 0 if success, otherwise another number
+static int _png_stats_job(struct image_png* image, struct png_stats_job* job);
+
+// two images compared by image_png_compare, rows are split in parts like png_stats_job
+struct png_compare_job {
+    struct image_png* images[2];
+    // formats of both images (RGBA8 for indexed ones) and the one they're compared in
+    enum media_pixel_format formats[2];
+    enum media_pixel_format format;
+    const uint32_t* luts[2];
+    uint32_t parts;
+    // largest sample of format
+    double max;
+
+    // every part
+    struct media_diff* diffs;
+    double* ssims;
+    uint64_t* windows;
+    // set by any part that couldn't allocate its rows
+    volatile uint8_t failed;
+};
+
+// media_range_fn filling parts [begin, end) of a png_compare_job
+static void _png_compare_parts(void* context, size_t begin, size_t end);
+// row y of image i of job in the format they're compared in, through scratch if it must be converted
+static const uint8_t* _png_compare_row(struct png_compare_job* job, uint32_t i, uint32_t y, uint8_t* scratch);
+// luma sums of MEDIA_SSIM_BLOCK rows from y into band, luma holds MEDIA_SSIM_BLOCK rows of each image
+static void _png_compare_band(struct png_compare_job* job, uint32_t y, uint8_t** scratch, float** luma,
+                              struct media_ssim_band* band);
+
+// rows of an image hashed by image_png_hash, split in parts like png_stats_job
+struct png_hash_job {
+    struct image_png* image;
+    enum media_pixel_format format;
+    const uint32_t* lut;
+    uint32_t parts;
+    // PNG_HASH_* bits of the hashes wanted, only grids they need are built
+    uint8_t kinds;
+    // a MEDIA_HASH_GRID x MEDIA_HASH_GRID grid (ahash, phash) and a 9 x 8 one (dhash) for every part
+    struct media_hash_grid* grids;
+    // set by any part that couldn't allocate its rows
+    volatile uint8_t failed;
+};
+
+// files hashed by image_png_hash_files
+struct png_hash_files_job {
+    const char* const* paths;
+    struct image_hashes* hashes;
+    uint8_t* failed;
+};
+
+// media_range_fn filling parts [begin, end) of a png_hash_job
+static void _png_hash_parts(void* context, size_t begin, size_t end);
+// image_png_hash with rows split between threads, only the PNG_HASH_* kinds are computed and the rest
+// of hashes is 0. return 0 if success, otherwise another number
+static int _png_hash(struct image_png* image, uint32_t threads, uint8_t kinds, struct image_hashes* hashes);
+// media_range_fn hashing files [begin, end) of a png_hash_files_job
+static void _png_hash_files(void* context, size_t begin, size_t end);
+
+// rows of a color image being converted to sRGB by image_png_convert_to_srgb
+struct png_color_job {
+    struct image_png* image;
+    enum media_pixel_format format;
+    const struct media_color_transform* transform;
+};
+
+// media_range_fn converting rows [begin, end) of a png_color_job
+static void _png_color_rows(void* context, size_t begin, size_t end);
+// space pixels are encoded in, from iCCP if it's a matrix/TRC profile, otherwise cHRM and gAMA
+// falling back to sRGB primaries and curve. return 0 if success, otherwise another number
+static int _png_color_space(struct image_png* image, struct media_color_space* space);
+
+// pixels turned by orientation into a new buffer with width and height swapped.
+// return 0 if success, otherwise another number
+static int _png_transpose(struct image_png* image, enum media_orientation orientation);
+
+// what _png_filter runs over the pixels of an image
+struct png_filter {
+    // media_convolve if kx isn't NULL
+    const float* kx;
+    uint32_t kx_size;
+    const float* ky;
+    uint32_t ky_size;
+    // otherwise media_gaussian_blur, or media_unsharp_mask if sharpen isn't 0
+    float sigma;
+    uint8_t sharpen;
+    float amount;
+    uint32_t threshold;
+};
+
+// filter from the pixels into new ones, indexed images turn into RGBA8 first.
+// return 0 if success, otherwise another number
+static int _png_filter(struct image_png* image, const struct png_filter* filter);
+
+// indexes can't be blended, so pixels of an indexed image are expanded through the palette into new
+// RGB8 ones (RGBA8 if there is tRNS) set in ihdr and idat, the image is left as it is. others are kept.
+// return 0 if success, otherwise another number
+static int _png_expand_palette(struct image_png* image, struct image_png_chunk_IHDR* ihdr,
+                               struct image_png_chunk_IDAT* idat);
+// frees pixels of the image and takes ihdr and idat instead, alpha of an indexed image is in them now
+static void _png_replace_pixels(struct image_png* image, struct image_png_chunk_IHDR* ihdr,
+                                struct image_png_chunk_IDAT* idat);
+
+// allocator of functions (or malloc, realloc and free if any is NULL) without blocks yet
+static struct png_allocator _png_make_allocator(const struct image_allocator* functions, uint8_t arena);
+static inline void* _png_malloc(struct png_allocator* allocator, size_t size);
+static inline void* _png_realloc(struct png_allocator* allocator, void* ptr, size_t size);
+// count zeroed items of size bytes, NULL if they overflow
+static inline void* _png_calloc(struct png_allocator* allocator, size_t count, size_t size);
+// ptr can be NULL
+static inline void _png_free(struct png_allocator* allocator, void* ptr);
+// size bytes at an alignment bytes boundary (power of two up to 4096, 0 is 1) inside a block of the
+// allocator alignment bytes larger, how far they're from its start is kept in the 2 bytes before them
+static uint8_t* _png_aligned_alloc(struct png_allocator* allocator, size_t alignment, size_t size);
+// ptr can be NULL
+static void _png_aligned_free(struct png_allocator* allocator, uint8_t* ptr);
+// metadata goes through these, bumped from arena blocks if arena isn't 0. they can't be freed on their
+// own there, except the last one, and they're only released by _png_arena_release
+static void* _png_meta_alloc(struct png_allocator* allocator, size_t size);
+static void* _png_meta_realloc(struct png_allocator* allocator, void* ptr, size_t size);
+static void _png_meta_free(struct png_allocator* allocator, void* ptr);
+// up to size chars of text with a null terminator
+static char* _png_meta_strndup(struct png_allocator* allocator, const char* text, size_t size);
+static inline char* _png_meta_strdup(struct png_allocator* allocator, const char* text);
+static void _png_arena_release(struct png_allocator* allocator);
 
 typedef void (*_png_pixel_fn)(struct image_png_chunk_IHDR*, void*, struct image_color*);
 
@@ -268,7 +626,13 @@ static void _png_get_pixel(struct image_png_chunk_IHDR* ihdr, void* pixel, struc
 static void _png_set_pixel(struct image_png_chunk_IHDR* ihdr, void* pixel, struct image_color* color);
 
 struct image_png* image_png_create(enum image_color_type type, uint32_t width, uint32_t height) {
-    struct image_png* image = malloc(sizeof(struct image_png));
+    struct png_allocator allocator = png_default_allocator;
+    struct image_png* image = _png_malloc(&allocator, sizeof(struct image_png));
+    if (image == NULL) {
+        return NULL;
+    }
+
+    image->allocator = allocator;
 
     struct image_png_chunk_IHDR* ihdr = &image->ihdr;
     ihdr->width = width;
@@ -297,7 +661,7 @@ struct image_png* image_png_create(enum image_color_type type, uint32_t width, u
     ihdr->interlace = 0;
 
     image->plte.size = 0;
-    image->plte.pallete = malloc(0);
+    image->plte.pallete = NULL;
 
     image->trns.type = PNG_tRNS_8BITS;
     image->trns.size = 0;
@@ -314,16 +678,51 @@ struct image_png* image_png_create(enum image_color_type type, uint32_t width, u
     image->sbit.type = _png_color_to_sbit(ihdr->color);
 
     struct image_png_chunk_IDAT* idat = &image->idat;
-    idat->type = PNG_IDAT_PIXELS;
-    uint32_t pixel_size = PNG_BITS_TYPE[ihdr->color][ihdr->depth] / 8;
-    idat->size = width * height * pixel_size;
-    idat->data = malloc(sizeof(uint8_t) * idat->size);
-    memset(idat->data, 0, sizeof(uint8_t) * idat->size);
+    idat->alignment = png_default_alignment;
+    idat->min_stride = 0;
+    if (_png_alloc_pixels(&image->allocator, ihdr, idat) != 0) {
+        _png_free(&image->allocator, image);
+        return NULL;
+    }
+
+    memset(&image->bands, 0, sizeof(struct png_idat_bands));
+    image->luma = IMAGE_LUMA_AVERAGE;
+    image->dither = IMAGE_DITHER_NONE;
+    image->resize_linear = 0;
+    image->palette_lut = NULL;
 
     return image;
 }
 
 struct image_png* image_png_open(const char* path) {
+    struct image_decode_options options = {0};
+    return _png_open(path, &options);
+}
+
+struct image_png* image_png_open_expanded(const char* path) {
+    struct image_decode_options options = {0};
+    options.expand_palette = 1;
+
+    return _png_open(path, &options);
+}
+
+struct image_png* image_png_open_with(const char* path, const struct image_decode_options* options) {
+    return _png_open(path, options);
+}
+
+struct image_png* image_png_open_region(const char* path, struct image_rect rect) {
+    struct image_decode_options options = {0};
+    options.region = rect;
+
+    // an empty rect would be the whole image
+    if (rect.width == 0 || rect.height == 0) {
+        return NULL;
+    }
+
+    return _png_open(path, &options);
+}
+
+static struct image_png* _png_open(const char* path, const struct image_decode_options* options) {
     FILE* file = fopen(path, "r");
     if (file == NULL) {
         return NULL;
@@ -339,13 +738,32 @@ struct image_png* image_png_open(const char* path) {
         return NULL;
     }
 
-    struct image_png* image = malloc(sizeof(struct image_png));
+    struct png_allocator allocator = png_default_allocator;
+    if (options->allocator != NULL) {
+        allocator = _png_make_allocator(options->allocator, allocator.arena);
+    }
+    allocator.arena |= options->arena;
+
+    struct image_png* image = _png_malloc(&allocator, sizeof(struct image_png));
+    if (image == NULL) {
+        fclose(file);
+        return NULL;
+    }
+
+    image->allocator = allocator;
     image->plte.size = 0;
-    image->plte.pallete = malloc(0);
+    image->plte.pallete = NULL;
     image->trns.type = PNG_tRNS_8BITS;
     image->trns.size = 0;
     image->trns.data_8bits = NULL;
     image->idat.data = NULL;
+    image->idat.alignment = png_default_alignment;
+    image->idat.min_stride = 0;
+    memset(&image->bands, 0, sizeof(struct png_idat_bands));
+    image->luma = IMAGE_LUMA_AVERAGE;
+    image->dither = IMAGE_DITHER_NONE;
+    image->resize_linear = 0;
+    image->palette_lut = NULL;
     memset(&image->chrm, 0, sizeof(struct image_png_chunk_cHRM));
     memset(&image->gama, 0, sizeof(struct image_png_chunk_gAMA));
     memset(&image->iccp, 0, sizeof(struct image_png_chunk_iCCP));
@@ -354,8 +772,12 @@ struct image_png* image_png_open(const char* path) {
     memset(&image->textual_list, 0, sizeof(struct png_textual_list));
     memset(&image->time, 0, sizeof(struct image_png_chunk_tIME));
 
-    struct image_png_chunk idat_chunk;
-    memset(&idat_chunk, 0, sizeof(struct image_png_chunk));
+    struct png_decoder decoder;
+    memset(&decoder, 0, sizeof(struct png_decoder));
+
+    // chunks are read one after another into the same buffer, grown as needed
+    uint8_t* buffer = NULL;
+    size_t capacity = 0;
 
     uint32_t location = 0;
     struct image_png_chunk chunk;
@@ -363,6 +785,7 @@ struct image_png* image_png_open(const char* path) {
         if (feof(file)) {
             // Error, IEND wasn't found!
 
+            _png_decoder_end(&decoder, NULL);
             image_png_close(image);
             image = NULL;
             break;
@@ -375,14 +798,27 @@ struct image_png* image_png_open(const char* path) {
 
         fread(chunk.type, sizeof(char), 4, file);
 
-        chunk.data = malloc(sizeof(uint8_t) * chunk.length);
+        if (buffer == NULL || chunk.length > capacity) {
+            size_t size = chunk.length > 0 ? chunk.length : 1;
+            uint8_t* grown = _png_realloc(&allocator, buffer, sizeof(uint8_t) * size);
+
+            if (grown == NULL) {
+                _png_decoder_end(&decoder, NULL);
+                image_png_close(image);
+                image = NULL;
+                break;
+            }
+
+            buffer = grown;
+            capacity = size;
+        }
+
+        chunk.data = buffer;
         fread(chunk.data, sizeof(uint8_t), chunk.length, file);
 
         fread(&chunk.crc, sizeof(uint32_t), 1, file);
         chunk.crc = convert_int_be(chunk.crc);
 
-        printf("Chunk: %d %s\n", chunk.length, chunk.type);
-
         int invalid = 0;
 
         if (strcmp(chunk.type, "IHDR") == 0) {
@@ -393,20 +829,21 @@ struct image_png* image_png_open(const char* path) {
                 invalid = 1;
             }
         } else if (strcmp(chunk.type, "PLTE") == 0) {
-            int plte_ret = _png_read_chunk_PLTE(&chunk, &image->plte);
+            int plte_ret = _png_read_chunk_PLTE(&image->allocator, &chunk, &image->plte);
 
-            if (location == 0 || idat_chunk.length > 0 || plte_ret != 0) {
+            if (location == 0 || decoder.ready || plte_ret != 0) {
                 // PLTE is before than IHDR, IDAT was read before than PLTE or PLTE is invalid
                 invalid = 1;
             }
         } else if (strcmp(chunk.type, "tRNS") == 0) {
-            int trns_ret = _png_read_chunk_tRNS(&chunk, &image->trns);
+            int trns_ret = _png_read_chunk_tRNS(&image->allocator, &chunk, &image->trns);
+            _png_drop_palette_lut(image);
             uint8_t color = image->ihdr.color;
             
-            if (location == 0 || idat_chunk.length > 0 || trns_ret != 0) {
+            if (location == 0 || decoder.ready || trns_ret != 0) {
                 invalid = 1;
             } else if (color == 0 || color == 2) {
-                _png_convert_chunk_tRNS(&image->trns, PNG_tRNS_16BITS);
+                _png_convert_chunk_tRNS(&image->allocator, &image->trns, PNG_tRNS_16BITS);
             }
         } else if (strcmp(chunk.type, "cHRM") == 0) {
             int chrm_ret = _png_read_chunk_cHRM(&chunk, &image->chrm);
@@ -421,7 +858,7 @@ struct image_png* image_png_open(const char* path) {
                 invalid = 1;
             }
         } else if (strcmp(chunk.type, "iCCP") == 0) {
-            int iccp_ret = _png_read_chunk_iCCP(&chunk, &image->iccp);
+            int iccp_ret = _png_read_chunk_iCCP(&image->allocator, &chunk, &image->iccp);
 
             if (location == 0 || iccp_ret != 0) {
                 invalid = 1;
@@ -440,7 +877,7 @@ struct image_png* image_png_open(const char* path) {
             }
         } else if (strcmp(chunk.type, "tEXt") == 0) {
             struct image_png_chunk_tEXt text;
-            int text_ret = _png_read_chunk_tEXt(&chunk, &text);
+            int text_ret = _png_read_chunk_tEXt(&image->allocator, &chunk, &text);
 
             if (location == 0 || text_ret != 0) {
                 invalid = 1;
@@ -449,11 +886,11 @@ struct image_png* image_png_open(const char* path) {
                 data.type = PNG_TEXTUAL_UNCOMPRESSED;
                 memcpy(&data.data.text, &text, sizeof(struct image_png_chunk_tEXt));
 
-                _png_add_text(&image->textual_list, &data);
+                _png_add_text(&image->allocator, &image->textual_list, &data);
             }
         } else if (strcmp(chunk.type, "zTXt") == 0) {
             struct image_png_chunk_zTXt ztxt;
-            int ztxt_ret = _png_read_chunk_zTXt(&chunk, &ztxt);
+            int ztxt_ret = _png_read_chunk_zTXt(&image->allocator, &chunk, &ztxt);
 
             if (location == 0 || ztxt_ret != 0) {
                 invalid = 1;
@@ -462,11 +899,11 @@ struct image_png* image_png_open(const char* path) {
                 data.type = PNG_TEXTUAL_COMPRESSED;
                 memcpy(&data.data.ztxt, &ztxt, sizeof(struct image_png_chunk_zTXt));
 
-                _png_add_text(&image->textual_list, &data);
+                _png_add_text(&image->allocator, &image->textual_list, &data);
             }
         } else if (strcmp(chunk.type, "iTXt") == 0) {
             struct image_png_chunk_iTXt itxt;
-            int itxt_ret = _png_read_chunk_iTXt(&chunk, &itxt);
+            int itxt_ret = _png_read_chunk_iTXt(&image->allocator, &chunk, &itxt);
 
             if (location == 0 || itxt_ret != 0) {
                 invalid = 1;
@@ -475,7 +912,7 @@ struct image_png* image_png_open(const char* path) {
                 data.type = PNG_TEXTUAL_INTERNATIONAL;
                 memcpy(&data.data.itxt, &itxt, sizeof(struct image_png_chunk_iTXt));
 
-                _png_add_text(&image->textual_list, &data);
+                _png_add_text(&image->allocator, &image->textual_list, &data);
             }
         } else if (strcmp(chunk.type, "tIME") == 0) {
             int time_ret = _png_read_chunk_tIME(&chunk, &image->time);
@@ -484,42 +921,42 @@ struct image_png* image_png_open(const char* path) {
                 invalid = 1;
             }
         } else if (strcmp(chunk.type, "IDAT") == 0) {
-            if (idat_chunk.length > 0) {
-
-                uint32_t old_size = idat_chunk.length;
-
-                idat_chunk.length += chunk.length;
-                idat_chunk.data = realloc(idat_chunk.data, sizeof(uint8_t) * idat_chunk.length);
-
-                memcpy(idat_chunk.data + old_size, chunk.data, chunk.length);
-            } else {
-                _png_copy_chunk(&chunk, &idat_chunk);
-            }
-
-            if (location == 0) {
-                // IDAT is before than IHDR
+            if (location == 0 || _png_check_crc32(&chunk)) {
+                // IDAT is before than IHDR or corrupted
                 invalid = 1;
+            } else if (!decoder.ready && _png_decoder_init(&decoder, image, options) != 0) {
+                invalid = 1;
+            } else {
+                _png_decoder_feed(&decoder, image, chunk.data, chunk.length);
             }
         }
 
-        free(chunk.data);
-
         if (invalid != 0) {
+            _png_decoder_end(&decoder, NULL);
             image_png_close(image);
             image = NULL;
             break;
         }
 
         location++;
+
+        // region has all its rows, the rest of the file isn't even read
+        if (decoder.done && decoder.stop_early) {
+            break;
+        }
     } while (strcmp(chunk.type, "IEND") != 0);
 
-    if (image != NULL) {
-        image->sbit.type = _png_color_to_sbit(image->ihdr.color);
+    _png_free(&allocator, buffer);
 
-        _png_read_chunk_IDAT(&idat_chunk, &image->idat);
-        _png_convert_chunk_IDAT(&image->ihdr, &image->idat, PNG_IDAT_PIXELS);
+    // without IDAT, pixels are still there all set up to 0
+    if (image != NULL && !decoder.ready && _png_decoder_init(&decoder, image, options) != 0) {
+        image_png_close(image);
+        image = NULL;
+    }
 
-        free(idat_chunk.data);
+    if (image != NULL) {
+        _png_decoder_end(&decoder, image);
+        image->sbit.type = _png_color_to_sbit(image->ihdr.color);
     }
 
     fclose(file);
@@ -533,26 +970,210 @@ void image_png_get_dimension(struct image_png* image, struct image_dimension* di
 }
 
 int image_png_set_dimension(struct image_png* image, struct image_dimension dimension) {
-    image->ihdr.width = dimension.width;
-    image->ihdr.height = dimension.height;
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+    struct image_png_chunk_IDAT* idat = &image->idat;
+
+    struct image_png_chunk_IHDR old_ihdr = *ihdr;
+    struct image_png_chunk_IDAT old_idat = *idat;
+
+    ihdr->width = dimension.width;
+    ihdr->height = dimension.height;
 
-    uint32_t old_size = image->idat.size;
-    uint8_t* old_pixels = image->idat.data;
+    // if allocation fails
+    if (_png_alloc_pixels(&image->allocator, ihdr, idat) != 0) {
+        *ihdr = old_ihdr;
+        *idat = old_idat;
+        return 1;
+    }
+
+    // keep the pixels both dimensions have in common
+    uint32_t rows = old_ihdr.height < ihdr->height ? old_ihdr.height : ihdr->height;
+    size_t row_size = _png_row_size(old_ihdr.width < ihdr->width ? &old_ihdr : ihdr);
+    for (uint32_t y = 0; y < rows; y++) {
+        memcpy(idat->data + y * idat->stride, old_idat.data + y * old_idat.stride, row_size);
+    }
+
+    _png_free_chunk_IDAT(&image->allocator, &old_idat);
+
+    _png_reset_bands(&image->allocator, &image->bands);
+
+    return 0;
+}
 
-    uint32_t pixel_size = PNG_BITS_TYPE[image->ihdr.color][image->ihdr.depth] / 8;
-    image->idat.size = dimension.width * dimension.height * pixel_size;
-    image->idat.data = realloc(image->idat.data, sizeof(uint8_t) * image->idat.size);
+int image_png_resize(struct image_png* image, uint32_t width, uint32_t height, enum image_resize_filter filter) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+    struct image_png_chunk_IDAT* idat = &image->idat;
 
-    // if realloc fails
-    if (image->idat.data == NULL) {
-        image->idat.size = old_size;
-        image->idat.data = old_pixels;
+    if (width == 0 || height == 0) {
         return 1;
     }
 
+    if (width == ihdr->width && height == ihdr->height) {
+        return 0;
+    }
+
+    const struct media_gamma* gamma = NULL;
+    if (image->resize_linear) {
+        gamma = _png_gamma(image);
+
+        if (gamma == NULL) {
+            return 2;
+        }
+    }
+
+    enum media_filter media_filter = MEDIA_FILTER_BILINEAR;
+    switch (filter) {
+        case IMAGE_FILTER_BOX: media_filter = MEDIA_FILTER_BOX; break;
+        case IMAGE_FILTER_BILINEAR: media_filter = MEDIA_FILTER_BILINEAR; break;
+        case IMAGE_FILTER_LANCZOS3: media_filter = MEDIA_FILTER_LANCZOS3; break;
+    }
+
+    // pixels resized from, the image is only changed once everything is allocated
+    struct image_png_chunk_IHDR src_ihdr;
+    struct image_png_chunk_IDAT src_idat;
+
+    if (_png_expand_palette(image, &src_ihdr, &src_idat) != 0) {
+        media_gamma_release(gamma);
+        return 2;
+    }
+
+    struct image_png_chunk_IHDR new_ihdr = src_ihdr;
+    new_ihdr.width = width;
+    new_ihdr.height = height;
+
+    struct image_png_chunk_IDAT new_idat = src_idat;
+    if (_png_alloc_pixels(&image->allocator, &new_ihdr, &new_idat) != 0) {
+        if (src_idat.data != idat->data) {
+            _png_free_chunk_IDAT(&image->allocator, &src_idat);
+        }
+
+        media_gamma_release(gamma);
+        return 2;
+    }
+
+    int ret = media_resize(_png_ihdr_format(&src_ihdr), media_filter, gamma, png_threads,
+                           src_idat.data, src_idat.stride, src_ihdr.width, src_ihdr.height,
+                           new_idat.data, new_idat.stride, width, height);
+    media_gamma_release(gamma);
+
+    if (src_idat.data != idat->data) {
+        _png_free_chunk_IDAT(&image->allocator, &src_idat);
+    }
+
+    if (ret != 0) {
+        _png_free_chunk_IDAT(&image->allocator, &new_idat);
+        return 3;
+    }
+
+    _png_replace_pixels(image, &new_ihdr, &new_idat);
+
+    return 0;
+}
+
+int image_png_rotate90(struct image_png* image) {
+    return _png_transpose(image, MEDIA_ORIENT_ROTATE_90);
+}
+
+int image_png_rotate180(struct image_png* image) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+    enum media_pixel_format format = _png_ihdr_format(ihdr);
+    size_t row_size = _png_row_size(ihdr);
+
+    // the top and bottom rows trade places reversed, the middle one is only reversed
+    for (uint32_t y = 0; y < (ihdr->height + 1) / 2; y++) {
+        uint8_t* top = _png_row(image, y);
+        uint8_t* bottom = _png_row(image, ihdr->height - 1 - y);
+
+        if (top != bottom) {
+            media_swap_rows(top, bottom, row_size);
+            media_reverse_row(format, bottom, ihdr->width);
+        }
+
+        media_reverse_row(format, top, ihdr->width);
+    }
+
+    _png_touch_rows(image, 0, ihdr->height);
+
+    return 0;
+}
+
+int image_png_rotate270(struct image_png* image) {
+    return _png_transpose(image, MEDIA_ORIENT_ROTATE_270);
+}
+
+int image_png_flip_h(struct image_png* image) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+    enum media_pixel_format format = _png_ihdr_format(ihdr);
+
+    for (uint32_t y = 0; y < ihdr->height; y++) {
+        media_reverse_row(format, _png_row(image, y), ihdr->width);
+    }
+
+    _png_touch_rows(image, 0, ihdr->height);
+
+    return 0;
+}
+
+int image_png_flip_v(struct image_png* image) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+    size_t row_size = _png_row_size(ihdr);
+
+    for (uint32_t y = 0; y < ihdr->height / 2; y++) {
+        media_swap_rows(_png_row(image, y), _png_row(image, ihdr->height - 1 - y), row_size);
+    }
+
+    _png_touch_rows(image, 0, ihdr->height);
+
     return 0;
 }
 
+int image_png_transpose(struct image_png* image) {
+    return _png_transpose(image, MEDIA_ORIENT_TRANSPOSE);
+}
+
+int image_png_convolve_separable(struct image_png* image, const float* kx, uint32_t kx_size,
+                                 const float* ky, uint32_t ky_size) {
+    if ((kx_size & 1) == 0 || (ky_size & 1) == 0) {
+        return 1;
+    }
+
+    struct png_filter filter;
+    memset(&filter, 0, sizeof(struct png_filter));
+    filter.kx = kx;
+    filter.kx_size = kx_size;
+    filter.ky = ky;
+    filter.ky_size = ky_size;
+
+    return _png_filter(image, &filter);
+}
+
+int image_png_gaussian_blur(struct image_png* image, float sigma) {
+    if (!(sigma > 0)) {
+        return 0;
+    }
+
+    struct png_filter filter;
+    memset(&filter, 0, sizeof(struct png_filter));
+    filter.sigma = sigma;
+
+    return _png_filter(image, &filter);
+}
+
+int image_png_unsharp_mask(struct image_png* image, float sigma, float amount, uint32_t threshold) {
+    if (!(sigma > 0) || amount == 0) {
+        return 0;
+    }
+
+    struct png_filter filter;
+    memset(&filter, 0, sizeof(struct png_filter));
+    filter.sigma = sigma;
+    filter.sharpen = 1;
+    filter.amount = amount;
+    filter.threshold = threshold;
+
+    return _png_filter(image, &filter);
+}
+
 void image_png_get_color(struct image_png* image, enum image_color_type* type) {
     uint8_t color = image->ihdr.color;
     uint8_t depth = image->ihdr.depth;
@@ -594,7 +1215,7 @@ void image_png_get_color(struct image_png* image, enum image_color_type* type) {
     }
 }
 
-void image_png_set_color(struct image_png* image, enum image_color_type type) {
+int image_png_set_color(struct image_png* image, enum image_color_type type) {
     struct image_png_chunk_IHDR* ihdr = &image->ihdr;
     struct image_png_chunk_IDAT* idat = &image->idat;
 
@@ -620,37 +1241,94 @@ void image_png_set_color(struct image_png* image, enum image_color_type type) {
 
     // it didn't change anything
     if (color == ihdr->color && depth == ihdr->depth) {
-        return;
+        return 0;
     }
 
-    // now do a copy of actual pixel colors to convert them
-    // to the new type
+    struct image_png_chunk_IHDR new_ihdr = *ihdr;
+    new_ihdr.color = color;
+    new_ihdr.depth = depth;
 
-    struct image_color* color_pixels = malloc(sizeof(struct image_color) * ihdr->width * ihdr->height);
-    for (uint32_t y = 0; y < ihdr->height; y++) {
-        for (uint32_t x = 0; x < ihdr->width; x++) {
-            image_png_get_pixel(image, x, y, &color_pixels[x + y * ihdr->width]);
+    enum media_pixel_format src_format = _png_ihdr_format(ihdr);
+    enum media_pixel_format dst_format = _png_ihdr_format(&new_ihdr);
+    // indexes can be expanded through the palette, but not the other way around
+    if (src_format != MEDIA_PIXEL_INDEXED8 && media_can_convert(src_format, dst_format) != 0) {
+        return 1;
+    }
+
+    // 16 bits to 8 bits may be dithered, through a 16 bits row with the new channels
+    uint16_t* wide = NULL;
+    int32_t* errors = NULL;
+
+    if (image->dither != IMAGE_DITHER_NONE && src_format != MEDIA_PIXEL_INDEXED8
+        && ihdr->depth == 16 && depth == 8) {
+        uint32_t channels = media_pixel_channels(dst_format);
+
+        wide = _png_malloc(&image->allocator, sizeof(uint16_t) * ihdr->width * channels);
+        errors = _png_calloc(&image->allocator, 2 * ((size_t) ihdr->width + 2) * channels, sizeof(int32_t));
+
+        if (wide == NULL || errors == NULL) {
+            _png_free(&image->allocator, wide);
+            _png_free(&image->allocator, errors);
+            return 2;
         }
     }
 
-    ihdr->color = color;
-    ihdr->depth = depth;
+    if (src_format == MEDIA_PIXEL_INDEXED8) {
+        const uint32_t* lut = _png_palette_lut(image);
+        struct image_png_chunk_IDAT old_idat = *idat;
 
-    image->sbit.type = _png_color_to_sbit(image->ihdr.color);
+        if (lut == NULL || _png_alloc_pixels(&image->allocator, &new_ihdr, idat) != 0) {
+            *idat = old_idat;
+            return 2;
+        }
 
-    uint32_t pixel_size = PNG_BITS_TYPE[ihdr->color][ihdr->depth];
-    idat->size = ihdr->width * ihdr->height * pixel_size;
-    idat->data = realloc(idat->data, sizeof(uint8_t) * idat->size);
+        for (uint32_t y = 0; y < ihdr->height; y++) {
+            media_convert_indexed(old_idat.data + y * old_idat.stride, lut,
+                                  dst_format, idat->data + y * idat->stride, ihdr->width, _png_luma(image));
+        }
 
-    for (uint32_t y = 0; y < ihdr->height; y++) {
-        for (uint32_t x = 0; x < ihdr->width; x++) {
-            struct image_color color_pixel = color_pixels[x + y * ihdr->width];
-            _png_convert_color(&color_pixel, type);
-            image_png_set_pixel(image, x, y, color_pixel);
+        _png_free_chunk_IDAT(&image->allocator, &old_idat);
+
+        // alpha is in the pixels now
+        _png_clear_trns(&image->allocator, &image->trns);
+    } else if (media_pixel_size(dst_format) <= media_pixel_size(src_format)) {
+        // rows only shrink so every one can be converted in place, top to bottom
+        size_t stride = _png_stride(&new_ihdr, idat);
+
+        for (uint32_t y = 0; y < ihdr->height; y++) {
+            _png_convert_row(image, src_format, idat->data + y * idat->stride,
+                             dst_format, idat->data + y * stride, y, wide, errors);
+        }
+
+        idat->stride = stride;
+        idat->size = stride * ihdr->height;
+    } else {
+        struct image_png_chunk_IDAT old_idat = *idat;
+
+        if (_png_alloc_pixels(&image->allocator, &new_ihdr, idat) != 0) {
+            *idat = old_idat;
+            _png_free(&image->allocator, wide);
+            _png_free(&image->allocator, errors);
+            return 2;
+        }
+
+        for (uint32_t y = 0; y < ihdr->height; y++) {
+            _png_convert_row(image, src_format, old_idat.data + y * old_idat.stride,
+                             dst_format, idat->data + y * idat->stride, y, wide, errors);
         }
+
+        _png_free_chunk_IDAT(&image->allocator, &old_idat);
     }
 
-    free(color_pixels);
+    _png_free(&image->allocator, wide);
+    _png_free(&image->allocator, errors);
+
+    *ihdr = new_ihdr;
+    image->sbit.type = _png_color_to_sbit(ihdr->color);
+
+    _png_reset_bands(&image->allocator, &image->bands);
+
+    return 0;
 }
 
 void image_png_get_gamma(struct image_png* image, uint32_t* gamma) {
@@ -765,15 +1443,16 @@ void image_png_set_text(struct image_png* image, const char* keyword, const char
         }
 
         if (text != NULL) {
+            struct png_allocator* allocator = &image->allocator;
             size_t size = strlen(text) + 1;
             char* ptext;
 
             if (textual->type == PNG_TEXTUAL_UNCOMPRESSED) {
-                ptext = textual->data.text.text = realloc(textual->data.text.text, sizeof(char) * size);
+                ptext = textual->data.text.text = _png_meta_realloc(allocator, textual->data.text.text, sizeof(char) * size);
             } else if (textual->type == PNG_TEXTUAL_COMPRESSED) {
-                ptext = textual->data.ztxt.text = realloc(textual->data.ztxt.text, sizeof(char) * size);
+                ptext = textual->data.ztxt.text = _png_meta_realloc(allocator, textual->data.ztxt.text, sizeof(char) * size);
             } else if (textual->type == PNG_TEXTUAL_INTERNATIONAL) {
-                ptext = textual->data.itxt.text = realloc(textual->data.itxt.text, sizeof(char) * size);
+                ptext = textual->data.itxt.text = _png_meta_realloc(allocator, textual->data.itxt.text, sizeof(char) * size);
             }
 
             memcpy(ptext, text, size);
@@ -789,9 +1468,7 @@ void image_png_set_text(struct image_png* image, const char* keyword, const char
 
         char* pkeyword;
 
-        size_t size = strlen(text) + 1;
-        char* ptext = malloc(sizeof(char) * size);
-        memcpy(ptext, text, size);
+        char* ptext = _png_meta_strdup(&image->allocator, text);
 
         if (compress >= 0) {
             pkeyword = ztxt_stack.keyword;
@@ -812,12 +1489,13 @@ void image_png_set_text(struct image_png* image, const char* keyword, const char
         // make sure about null terminator
         text_stack.keyword[strlen(text_stack.keyword)] = '\0';
  
-        _png_add_text(&image->textual_list, &data);
+        _png_add_text(&image->allocator, &image->textual_list, &data);
     }
 }
 
 void image_png_set_itxt(struct image_png* image, const char* keyword, int16_t compression_flag, int16_t compression_method,
                         const char* language_tag, const char* translated_keyword, const char* text) {
+    struct png_allocator* allocator = &image->allocator;
     struct png_textual_data* textual;
     _png_get_text(&image->textual_list, keyword, &textual, NULL);
 
@@ -829,9 +1507,10 @@ void image_png_set_itxt(struct image_png* image, const char* keyword, int16_t co
             itxt.compression_flag = 0;
             itxt.compression_method = 0;
 
-            itxt.language_tag = strdup("");
-            itxt.translated_keyword = strdup("");
-            itxt.text = strdup(textual->data.itxt.text);
+            // text moves as it is
+            itxt.language_tag = _png_meta_strdup(allocator, "");
+            itxt.translated_keyword = _png_meta_strdup(allocator, "");
+            itxt.text = textual->data.text.text;
 
             textual->type = PNG_TEXTUAL_INTERNATIONAL;
             memcpy(&textual->data.itxt, &itxt, sizeof(struct image_png_chunk_iTXt));
@@ -842,9 +1521,9 @@ void image_png_set_itxt(struct image_png* image, const char* keyword, int16_t co
             itxt.compression_flag = 0;
             itxt.compression_method = textual->data.ztxt.compression + 1;
 
-            itxt.language_tag = strdup("");
-            itxt.translated_keyword = strdup("");
-            itxt.text = strdup(textual->data.ztxt.text);
+            itxt.language_tag = _png_meta_strdup(allocator, "");
+            itxt.translated_keyword = _png_meta_strdup(allocator, "");
+            itxt.text = textual->data.ztxt.text;
 
             textual->type = PNG_TEXTUAL_INTERNATIONAL;
             memcpy(&textual->data.itxt, &itxt, sizeof(struct image_png_chunk_iTXt));
@@ -859,18 +1538,18 @@ void image_png_set_itxt(struct image_png* image, const char* keyword, int16_t co
         }
 
         if (language_tag != NULL) {
-            free(textual->data.itxt.language_tag);
-            textual->data.itxt.language_tag = strdup(language_tag);
+            _png_meta_free(allocator, textual->data.itxt.language_tag);
+            textual->data.itxt.language_tag = _png_meta_strdup(allocator, language_tag);
         }
 
         if (translated_keyword != NULL) {
-            free(textual->data.itxt.translated_keyword);
-            textual->data.itxt.translated_keyword = strdup(translated_keyword);
+            _png_meta_free(allocator, textual->data.itxt.translated_keyword);
+            textual->data.itxt.translated_keyword = _png_meta_strdup(allocator, translated_keyword);
         }
 
         if (text != NULL) {
-            free(textual->data.itxt.text);
-            textual->data.itxt.text = strdup(text);
+            _png_meta_free(allocator, textual->data.itxt.text);
+            textual->data.itxt.text = _png_meta_strdup(allocator, text);
         }
     } else {
         if (language_tag == NULL) {
@@ -893,11 +1572,11 @@ void image_png_set_itxt(struct image_png* image, const char* keyword, int16_t co
         itxt->compression_flag = compression_flag;
         itxt->compression_method = compression_method;
 
-        itxt->language_tag = strdup(language_tag);
-        itxt->translated_keyword = strdup(translated_keyword);
-        itxt->text = strdup(text);
+        itxt->language_tag = _png_meta_strdup(allocator, language_tag);
+        itxt->translated_keyword = _png_meta_strdup(allocator, translated_keyword);
+        itxt->text = _png_meta_strdup(allocator, text);
 
-        _png_add_text(&image->textual_list, &data);
+        _png_add_text(allocator, &image->textual_list, &data);
     }
 }
 
@@ -1029,13 +1708,13 @@ void image_png_get_keys(struct image_png* image, char*** out_keywords, uint32_t*
 }
 
 void image_png_del_text(struct image_png* image, const char* keyword) {
-    _png_sub_text(&image->textual_list, keyword);
+    _png_sub_text(&image->allocator, &image->textual_list, keyword);
 }
 
 void image_png_get_palette(struct image_png* image, uint16_t* psize, struct image_color** ppalette) {
     uint16_t size = image->plte.size;
-    struct image_color* pallete = malloc(sizeof(struct image_color) * 3 * size);
-    memcpy(pallete, image->plte.pallete, sizeof(struct image_color) * 3 * size);
+    struct image_color* pallete = malloc(sizeof(struct image_color) * size);
+    memcpy(pallete, image->plte.pallete, sizeof(struct image_color) * size);
 
     *psize = size;
     *ppalette = pallete;
@@ -1048,1289 +1727,3547 @@ void image_png_set_palette(struct image_png* image, uint16_t size, struct image_
 
     struct image_png_chunk_PLTE* plte = &image->plte;
 
+    _png_drop_palette_lut(image);
+
     if (size > 0) {
         plte->size = size;
-        plte->pallete = realloc(plte->pallete, sizeof(struct image_color) * 3 * size);
-        memcpy(&plte->pallete, pallete, sizeof(struct image_color) * 3 * size);
+        plte->pallete = _png_meta_realloc(&image->allocator, plte->pallete, sizeof(struct image_color) * size);
+        memcpy(plte->pallete, pallete, sizeof(struct image_color) * size);
     } else if (image->ihdr.color == 3) {
         // if indexed, it needs at least to have 1 pallete
 
         plte->size = 1;
-        plte->pallete = realloc(plte->pallete, sizeof(struct image_color));
+        plte->pallete = _png_meta_realloc(&image->allocator, plte->pallete, sizeof(struct image_color));
         memset(plte->pallete, 0, sizeof(struct image_color));
     }
 }
 
+const uint32_t* image_png_get_palette_lut(struct image_png* image) {
+    return _png_palette_lut(image);
+}
+
 void image_png_get_pixel(struct image_png* image, uint32_t x, uint32_t y, struct image_color* color) {
     _png_execute_pixel(image, x, y, _png_get_pixel, color);
 }
 
 void image_png_set_pixel(struct image_png* image, uint32_t x, uint32_t y, struct image_color color) {
     _png_execute_pixel(image, x, y, _png_set_pixel, &color);
+    _png_touch_rows(image, y, 1);
 }
 
-void image_png_get_timestamp(struct image_png* image, struct image_time* time) {
-    time->year = image->time.year;
-    time->month = image->time.month;
-    time->day = image->time.day;
-    time->hour = image->time.hour;
-    time->minute = image->time.minute;
-    time->second = image->time.second;
+void image_png_get_luma(struct image_png* image, enum image_luma* luma) {
+    *luma = image->luma;
 }
 
-void image_png_set_timestamp(struct image_png* image, struct image_time time) {
-    image->time.year = time.year;
-    image->time.month = time.month;
-    image->time.day = time.day;
-    image->time.hour = time.hour;
-    image->time.minute = time.minute;
-    image->time.second = time.second;
+void image_png_set_luma(struct image_png* image, enum image_luma luma) {
+    image->luma = luma;
 }
 
-struct image_png* image_png_copy(struct image_png* image) {
-    struct image_png* copy_image = malloc(sizeof(struct image_png));
+void image_png_get_dither(struct image_png* image, enum image_dither* dither) {
+    *dither = image->dither;
+}
 
-    if (copy_image != NULL) {
-        memcpy(&copy_image->ihdr, &image->ihdr, sizeof(struct image_png_chunk_IHDR));
+void image_png_set_dither(struct image_png* image, enum image_dither dither) {
+    image->dither = dither;
+}
 
-        copy_image->plte.size = image->plte.size;
-        copy_image->plte.pallete = malloc(sizeof(struct image_color) * copy_image->plte.size);
-        memcpy(copy_image->plte.pallete, image->plte.pallete, sizeof(struct image_color) * copy_image->plte.size);
+void image_png_get_resize_linear(struct image_png* image, uint8_t* linear) {
+    *linear = image->resize_linear;
+}
 
-        copy_image->trns.type = image->trns.type;
-        copy_image->trns.size = image->trns.size;
-        switch (copy_image->trns.type) {
-            case PNG_tRNS_8BITS: {
-                copy_image->trns.data_8bits = malloc(sizeof(uint8_t) * copy_image->trns.size);
-                memcpy(copy_image->trns.data_8bits, image->trns.data_8bits, sizeof(uint8_t) * copy_image->trns.size);
-                break;
-            }
-            case PNG_tRNS_16BITS: {
-                copy_image->trns.data_16bits = malloc(sizeof(uint16_t) * copy_image->trns.size);
-                memcpy(copy_image->trns.data_16bits, image->trns.data_16bits, sizeof(uint16_t) * copy_image->trns.size);
-                break;
-            }
-        }
+void image_png_set_resize_linear(struct image_png* image, uint8_t linear) {
+    image->resize_linear = linear;
+}
 
-        memcpy(&copy_image->chrm, &image->chrm, sizeof(struct image_png_chunk_cHRM));
-        memcpy(&copy_image->gama, &image->gama, sizeof(struct image_png_chunk_gAMA));
+void image_png_set_restart_interval(struct image_png* image, uint32_t rows) {
+    if (image->bands.rows == rows) {
+        return;
+    }
 
-        strncpy(copy_image->iccp.name, image->iccp.name, 80);
-        copy_image->iccp.compression = image->iccp.compression;
-        copy_image->iccp.size = image->iccp.size;
-        copy_image->iccp.data = malloc(sizeof(uint8_t) * copy_image->iccp.size);
-        memcpy(copy_image->iccp.data, image->iccp.data, sizeof(uint8_t) * copy_image->iccp.size);
-
-        memcpy(&copy_image->sbit, &image->sbit, sizeof(struct image_png_chunk_sBIT));
-        memcpy(&copy_image->srgb, &image->srgb, sizeof(struct image_png_chunk_sRGB));
-
-        copy_image->textual_list.size = image->textual_list.size;
-        copy_image->textual_list.list = malloc(sizeof(struct image_png_chunk_tEXt) * copy_image->textual_list.size);
-        for (uint32_t i = 0; i < copy_image->textual_list.size; i++) {
-            struct png_textual_data* textual = &image->textual_list.list[i];
-            struct png_textual_data* copy_textual = &copy_image->textual_list.list[i];
-
-            copy_textual->type = textual->type;
+    _png_reset_bands(&image->allocator, &image->bands);
+    image->bands.rows = rows;
+}
 
-            if (textual->type == PNG_TEXTUAL_UNCOMPRESSED) {
-                struct image_png_chunk_tEXt* text = &textual->data.text;
-                struct image_png_chunk_tEXt* copy_text = &copy_textual->data.text;
+int image_png_fill(struct image_png* image, struct image_color color) {
+    struct image_rect rect = {0, 0, image->ihdr.width, image->ihdr.height};
+    return image_png_fill_rect(image, rect, color);
+}
 
-                strncpy(copy_text->keyword, text->keyword, 80);
-                size_t size = strlen(copy_text->text) + 1;
-                copy_text->text = malloc(sizeof(char) * size);
-                memcpy(copy_text->text, text->text, size);
-            } else if (textual->type == PNG_TEXTUAL_COMPRESSED) {
-                struct image_png_chunk_zTXt* ztxt = &textual->data.ztxt;
-                struct image_png_chunk_zTXt* copy_ztxt = &copy_textual->data.ztxt;
+int image_png_fill_rect(struct image_png* image, struct image_rect rect, struct image_color color) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
 
-                strncpy(copy_ztxt->keyword, ztxt->keyword, 80);
-                copy_ztxt->compression = ztxt->compression; 
-                size_t size = strlen(copy_ztxt->text) + 1;
-                copy_ztxt->text = malloc(sizeof(char) * size);
-                memcpy(copy_ztxt->text, ztxt->text, size);
-            } else if (textual->type == PNG_TEXTUAL_INTERNATIONAL) {
-                struct image_png_chunk_iTXt* itxt = &textual->data.itxt;
-                struct image_png_chunk_iTXt* copy_itxt = &copy_textual->data.itxt;
+    if (rect.x >= ihdr->width || rect.y >= ihdr->height) {
+        return 0;
+    }
 
-                strncpy(copy_itxt->keyword, itxt->keyword, 80);
-                copy_itxt->compression_flag = itxt->compression_flag;
-                copy_itxt->compression_method = itxt->compression_method;
-                copy_itxt->language_tag = strdup(itxt->language_tag);
-                copy_itxt->translated_keyword = strdup(itxt->translated_keyword);
-                copy_itxt->text = strdup(itxt->text);
-            }
-        }
+    if (rect.width > ihdr->width - rect.x) {
+        rect.width = ihdr->width - rect.x;
+    }
 
-        memcpy(&copy_image->time, &image->time, sizeof(struct image_png_chunk_tIME));
+    if (rect.height > ihdr->height - rect.y) {
+        rect.height = ihdr->height - rect.y;
+    }
 
-        copy_image->idat.type = image->idat.type;
-        copy_image->idat.size = image->idat.size;
-        copy_image->idat.data = malloc(sizeof(uint8_t) * copy_image->idat.size);
-        memcpy(copy_image->idat.data, image->idat.data, sizeof(uint8_t) * copy_image->idat.size);
+    if (rect.width == 0 || rect.height == 0) {
+        return 0;
     }
 
-    return copy_image;
-}
+    uint8_t pixel[8];
+    if (_png_color_to_pixel(image, &color, pixel) != 0) {
+        return 1;
+    }
 
-static inline void _png_addcapicity_tobytes(uint32_t* chunk_size, struct image_png_chunk** pchunks) {
-    *chunk_size += 1;
-    *pchunks = realloc(*pchunks, *chunk_size * sizeof(struct image_png_chunk));
-    memset(&(*pchunks)[*chunk_size - 1], 0, sizeof(struct image_png_chunk)); 
-}
+    uint32_t pixel_size = media_pixel_size(_png_ihdr_format(ihdr));
+    size_t span_size = (size_t) rect.width * pixel_size;
 
-void image_png_tobytes(struct image_png* image, uint8_t** pbytes, uint32_t* psize) {
-    uint32_t size = 8;
-    uint8_t* bytes = malloc(sizeof(uint8_t) * 8);
+    // first row is filled, the rest is a copy of it
+    uint8_t* first = _png_row(image, rect.y) + (size_t) rect.x * pixel_size;
+    media_fill_row(first, pixel, pixel_size, rect.width);
 
-    memcpy(bytes, PNG_FILE_HEADER, sizeof(uint8_t) * 8);
+    for (uint32_t y = 1; y < rect.height; y++) {
+        memcpy(_png_row(image, rect.y + y) + (size_t) rect.x * pixel_size, first, span_size);
+    }
 
-    uint32_t next_chunk = 0;
+    _png_touch_rows(image, rect.y, rect.height);
 
-    uint32_t chunk_size = 3;
-    struct image_png_chunk* chunks = malloc(chunk_size * sizeof(struct image_png_chunk));
-    memset(chunks, 0, sizeof(struct image_png_chunk) * chunk_size);
+    return 0;
+}
 
-    _png_write_chunk_IHDR(&image->ihdr, &chunks[next_chunk++]);
+int image_png_blit(struct image_png* dst, uint32_t x, uint32_t y, struct image_png* src, struct image_rect rect) {
+    struct image_png_chunk_IHDR* src_ihdr = &src->ihdr;
+    struct image_png_chunk_IHDR* dst_ihdr = &dst->ihdr;
 
-    if (_png_check_chrm(&image->chrm)) {
-        _png_addcapicity_tobytes(&chunk_size, &chunks);
-        _png_write_chunk_cHRM(&image->chrm, &chunks[next_chunk++]);
-    }
- 
-    if (image->gama.gamma != 0) {
-        _png_addcapicity_tobytes(&chunk_size, &chunks);
-        _png_write_chunk_gAMA(&image->gama, &chunks[next_chunk++]);
+    if (rect.x >= src_ihdr->width || rect.y >= src_ihdr->height || x >= dst_ihdr->width || y >= dst_ihdr->height) {
+        return 0;
     }
 
-    if (_png_check_iccp(&image->iccp)) {
-        _png_addcapicity_tobytes(&chunk_size, &chunks);
-        _png_write_chunk_iCCP(&image->iccp, &chunks[next_chunk++]);
-    }
+    uint32_t width = src_ihdr->width - rect.x < rect.width ? src_ihdr->width - rect.x : rect.width;
+    uint32_t height = src_ihdr->height - rect.y < rect.height ? src_ihdr->height - rect.y : rect.height;
 
-    if (_png_check_sbit(&image->sbit)) {
-        _png_addcapicity_tobytes(&chunk_size, &chunks);
-        _png_write_chunk_sBIT(&image->sbit, &chunks[next_chunk++]);
+    if (width > dst_ihdr->width - x) {
+        width = dst_ihdr->width - x;
     }
 
-    if (image->srgb.rendering < 4) {
-        _png_addcapicity_tobytes(&chunk_size, &chunks);
-        _png_write_chunk_sRGB(&image->srgb, &chunks[next_chunk++]);
+    if (height > dst_ihdr->height - y) {
+        height = dst_ihdr->height - y;
     }
 
-    for (uint32_t i = 0; i < image->textual_list.size; i++) {
-        _png_addcapicity_tobytes(&chunk_size, &chunks);
-
-        struct png_textual_data* textual = &image->textual_list.list[i];
-        if (textual->type == PNG_TEXTUAL_UNCOMPRESSED) {
-            _png_write_chunk_tEXt(&textual->data.text, &chunks[next_chunk++]);
-        } else if (textual->type == PNG_TEXTUAL_COMPRESSED) {
-            _png_write_chunk_zTXt(&textual->data.ztxt, &chunks[next_chunk++]);
-        } else if (textual->type == PNG_TEXTUAL_INTERNATIONAL) {
-            _png_write_chunk_iTXt(&textual->data.itxt, &chunks[next_chunk++]);
-        }
+    if (width == 0 || height == 0) {
+        return 0;
     }
 
-    uint8_t color = image->ihdr.color;
-    int requiresPallete = color == 3 || ((color == 2 || color == 6) && image->plte.size > 0) ? 1 : 0;
-    if (requiresPallete != 0) {
-        _png_addcapicity_tobytes(&chunk_size, &chunks);
-        _png_write_chunk_PLTE(&image->plte, &chunks[next_chunk++]);
-    }
+    enum media_pixel_format src_format = _png_ihdr_format(src_ihdr);
+    enum media_pixel_format dst_format = _png_ihdr_format(dst_ihdr);
 
-    if (image->trns.size > 0) {
-        _png_addcapicity_tobytes(&chunk_size, &chunks);
+    // going bottom-up keeps overlapping rows of the same image unread before being written
+    int bottom_up = src == dst && y > rect.y;
 
-        enum image_png_trns_type trns_type = image->trns.type;
-        _png_convert_chunk_tRNS(&image->trns, PNG_tRNS_8BITS);
-        _png_write_chunk_tRNS(&image->trns, &chunks[next_chunk++]);
-        _png_convert_chunk_tRNS(&image->trns, trns_type);
-    }
+    if (src_format == dst_format) {
+        uint32_t pixel_size = media_pixel_size(src_format);
+        size_t span_size = (size_t) width * pixel_size;
 
-    if (_png_check_time(&image->time) != 0) {
-        _png_addcapicity_tobytes(&chunk_size, &chunks);
-        _png_write_chunk_tIME(&image->time, &chunks[next_chunk++]);
-    }
+        for (uint32_t i = 0; i < height; i++) {
+            uint32_t row = bottom_up ? height - 1 - i : i;
 
-    _png_convert_chunk_IDAT(&image->ihdr, &image->idat, PNG_IDAT_SCANLINES);
-    _png_write_chunk_IDAT(&image->idat, &chunks[next_chunk++]);
-    _png_convert_chunk_IDAT(&image->ihdr, &image->idat, PNG_IDAT_PIXELS);
+            uint8_t* from = _png_row(src, rect.y + row) + (size_t) rect.x * pixel_size;
+            uint8_t* to = _png_row(dst, y + row) + (size_t) x * pixel_size;
+            memmove(to, from, span_size);
+        }
 
-    struct image_png_chunk* iend = &chunks[next_chunk];
-    iend->length = 0;
-    strcpy(iend->type, "IEND");
-    iend->data = NULL;
-    iend->crc = MEDIA_CRC32(media_update_crc32(MEDIA_CRC32_DEFAULT, (uint8_t*) "IEND", 4));
+        _png_touch_rows(dst, y, height);
+        return 0;
+    }
 
-    for (uint32_t i = 0; i < chunk_size; i++) {
-        struct image_png_chunk* chunk = &chunks[i];
+    // different colors go through a native row in the destination color
+    enum image_color_type type = IMAGE_RGBA8_COLOR;
+    image_png_get_color(dst, &type);
 
-        chunk->length = convert_int_be(chunk->length);
-        size += sizeof(uint32_t);
-        bytes = realloc(bytes, sizeof(uint8_t) * size);
-        memcpy(bytes + size - sizeof(uint32_t), &chunk->length, sizeof(uint32_t));
-        chunk->length = convert_int_be(chunk->length);
+    uint8_t* buffer = _png_malloc(&dst->allocator, sizeof(uint8_t) * width * media_pixel_size(dst_format));
+    if (buffer == NULL) {
+        return 4;
+    }
 
-        size += sizeof(uint8_t) * 4;
-        bytes = realloc(bytes, sizeof(uint8_t) * size);
-        memcpy(bytes + size - sizeof(uint8_t) * 4, chunk->type, sizeof(uint8_t) * 4);
+    int ret = 0;
 
-        size += sizeof(uint8_t) * chunk->length;
-        bytes = realloc(bytes, sizeof(uint8_t) * size);
-        memcpy(bytes + size - sizeof(uint8_t) * chunk->length, chunk->data, sizeof(uint8_t) * chunk->length);
- 
-        chunk->crc = convert_int_be(chunk->crc);
-        size += sizeof(uint32_t);
-        bytes = realloc(bytes, sizeof(uint8_t) * size);
-        memcpy(bytes + size - sizeof(uint32_t), &chunk->crc, sizeof(uint32_t));
-        chunk->crc = convert_int_be(chunk->crc);
+    for (uint32_t i = 0; i < height && ret == 0; i++) {
+        uint32_t row = bottom_up ? height - 1 - i : i;
 
-        free(chunk->data);
+        ret = image_png_get_span(src, rect.x, rect.y + row, width, type, buffer);
+        if (ret == 0) {
+            ret = image_png_set_span(dst, x, y + row, width, type, buffer);
+        }
     }
 
-    free(chunks);
+    _png_free(&dst->allocator, buffer);
 
-    *pbytes = bytes;
-    *psize = size;
+    return ret;
 }
 
-void image_png_save(struct image_png* image, const char* path) {
-    FILE* file = fopen(path, "w+");
-    if (file == NULL) {
-        // Error, it could not create or truct file
-        return;
-    }
+int image_png_premultiply(struct image_png* image) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+    enum media_pixel_format format = _png_ihdr_format(ihdr);
 
-    uint32_t size;
-    uint8_t* bytes;
-    image_png_tobytes(image, &bytes, &size);
+    for (uint32_t y = 0; y < ihdr->height; y++) {
+        if (media_premultiply_row(format, _png_row(image, y), ihdr->width) != 0) {
+            return 1;
+        }
+    }
 
-    fwrite(bytes, sizeof(uint8_t), size, file);
-    fclose(file);
+    _png_touch_rows(image, 0, ihdr->height);
 
-    free(bytes);
+    return 0;
 }
 
-void image_png_close(struct image_png* image) {
-    if (image->trns.type == PNG_tRNS_8BITS) {
-        free(image->trns.data_8bits);
-    } else if (image->trns.type == PNG_tRNS_16BITS) {
-        free(image->trns.data_16bits);
-    }
-
-    for (size_t i = 0; i < image->textual_list.size; i++) {
-        struct png_textual_data* textual = &image->textual_list.list[i];
+int image_png_unpremultiply(struct image_png* image) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+    enum media_pixel_format format = _png_ihdr_format(ihdr);
 
-        if (textual->type == PNG_TEXTUAL_UNCOMPRESSED) {
-            free(textual->data.text.text);
-        } else if (textual->type == PNG_TEXTUAL_COMPRESSED) {
-            free(textual->data.ztxt.text);
-        } else if (textual->type == PNG_TEXTUAL_INTERNATIONAL) {
-            free(textual->data.itxt.language_tag);
-            free(textual->data.itxt.translated_keyword);
-            free(textual->data.itxt.text);
+    for (uint32_t y = 0; y < ihdr->height; y++) {
+        if (media_unpremultiply_row(format, _png_row(image, y), ihdr->width) != 0) {
+            return 1;
         }
     }
-    free(image->textual_list.list);
-
-    free(image->iccp.data);
-    free(image->plte.pallete);
-    free(image->idat.data);
-    free(image);
-}
 
-static inline uint32_t convert_int_be(uint32_t value) {
-    if (media_actual_endian() == MEDIA_BIG_ENDIAN) {
-        // no need to shift
-        return value;
-    }
+    _png_touch_rows(image, 0, ihdr->height);
 
-    uint8_t* bytes = (uint8_t *) &value;
-    return bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+    return 0;
 }
 
-static inline uint16_t convert_short_be(uint16_t value) {
-    if (media_actual_endian() == MEDIA_BIG_ENDIAN) {
-        // no need to shift
-        return value;
+int image_png_composite(struct image_png* dst, struct image_png* src, uint32_t x, uint32_t y,
+                        enum image_blend_mode mode) {
+    struct image_png_chunk_IHDR* src_ihdr = &src->ihdr;
+    struct image_png_chunk_IHDR* dst_ihdr = &dst->ihdr;
+
+    enum media_pixel_format dst_format = _png_ihdr_format(dst_ihdr);
+    if (dst_format == MEDIA_PIXEL_INDEXED8) {
+        return 1;
     }
 
-    uint8_t* bytes = (uint8_t *) &value;
-    return bytes[0] << 8 | bytes[1];
-}
+    if (x >= dst_ihdr->width || y >= dst_ihdr->height) {
+        return 0;
+    }
 
-inline static uint16_t twice16(uint8_t value) {
-    return (value << 8) | value;
-}
+    uint32_t width = dst_ihdr->width - x < src_ihdr->width ? dst_ihdr->width - x : src_ihdr->width;
+    uint32_t height = dst_ihdr->height - y < src_ihdr->height ? dst_ihdr->height - y : src_ihdr->height;
 
-static void _png_convert_color(struct image_color* color, enum image_color_type type) {
-    if (color->type == type) {
-        return;
+    enum media_blend blend = MEDIA_BLEND_OVER;
+    switch (mode) {
+        case IMAGE_BLEND_OVER: blend = MEDIA_BLEND_OVER; break;
+        case IMAGE_BLEND_MULTIPLY: blend = MEDIA_BLEND_MULTIPLY; break;
+        case IMAGE_BLEND_SCREEN: blend = MEDIA_BLEND_SCREEN; break;
     }
 
-    struct image_color new_color;
-    new_color.type = type;
-
-    switch (IMAGE_IGNORE_ALPHA(color->type)) {
-        case IMAGE_RGBA8_COLOR:
-        case IMAGE_RGBA16_COLOR: {
-            switch (IMAGE_IGNORE_ALPHA(type)) {
-                case IMAGE_RGBA8_COLOR: {
-                    if (IMAGE_IGNORE_ALPHA(color->type) == IMAGE_RGBA16_COLOR) {
-                        new_color.rgba8.red = color->rgba16.red & 0xFF;
-                        new_color.rgba8.green = color->rgba16.green & 0xFF;
-                        new_color.rgba8.blue = color->rgba16.blue & 0xFF;
-                        new_color.rgba8.alpha = color->rgba16.alpha & 0xFF;
-                    }
+    // blending works on straight RGBA of the destination depth
+    int wide = dst_ihdr->depth == 16;
+    enum image_color_type type = (wide ? IMAGE_RGBA16_COLOR : IMAGE_RGBA8_COLOR) | IMAGE_ALPHA_BIT;
+    enum media_pixel_format format = wide ? MEDIA_PIXEL_RGBA16 : MEDIA_PIXEL_RGBA8;
+    size_t span_size = (size_t) width * media_pixel_size(format);
 
-                    break;
-                }
-                case IMAGE_RGBA16_COLOR: {
-                    if (IMAGE_IGNORE_ALPHA(color->type) == IMAGE_RGBA8_COLOR) {
-                        new_color.rgba16.red = twice16(color->rgba8.red);
-                        new_color.rgba16.green = twice16(color->rgba8.green);
-                        new_color.rgba16.blue = twice16(color->rgba8.blue);
-                        new_color.rgba16.alpha = twice16(color->rgba8.alpha);
-                    }
+    uint8_t* from = _png_malloc(&dst->allocator, sizeof(uint8_t) * span_size);
+    // other colors are blended in a copy of the span
+    uint8_t* to = dst_format != format ? _png_malloc(&dst->allocator, sizeof(uint8_t) * span_size) : NULL;
 
-                    break;
-                }
-                case IMAGE_GRAY8_COLOR: {
-                    if (IMAGE_IGNORE_ALPHA(color->type) == IMAGE_RGBA8_COLOR) {
-                        new_color.ga8.gray = (color->rgba8.red + color->rgba8.green + color->rgba8.blue) / 3;
-                        new_color.ga8.alpha = color->rgba8.alpha;
-                    } else if (IMAGE_IGNORE_ALPHA(color->type) == IMAGE_RGBA16_COLOR) {
-                        new_color.ga8.gray = (color->rgba16.red & 0xFF + color->rgba16.green & 0xFF + color->rgba16.blue & 0xFF) / 3;
-                        new_color.ga8.alpha = color->rgba16.alpha & 0xFF;
-                    }
+    if (from == NULL || (dst_format != format && to == NULL)) {
+        _png_free(&dst->allocator, from);
+        _png_free(&dst->allocator, to);
+        return 2;
+    }
 
-                    break;
-                }
-                case IMAGE_GRAY16_COLOR: {
-                    if (IMAGE_IGNORE_ALPHA(color->type) == IMAGE_RGBA8_COLOR) {
-                        new_color.ga16.gray = twice16((color->rgba8.red + color->rgba8.green + color->rgba8.blue) / 3);
-                        new_color.ga16.alpha = twice16(color->rgba8.alpha);
-                    } else if (IMAGE_IGNORE_ALPHA(color->type) == IMAGE_RGBA16_COLOR) {
-                        new_color.ga16.gray = twice16((color->rgba16.red & 0xFF + color->rgba16.green & 0xFF + color->rgba16.blue & 0xFF) / 3);
-                        new_color.ga16.alpha = color->rgba16.alpha;
-                    }
+    // going bottom-up keeps rows of the same image unread before being written
+    int bottom_up = src == dst && y > 0;
+    int ret = 0;
 
-                    break;
-                }
-            }
+    for (uint32_t i = 0; i < height && ret == 0; i++) {
+        uint32_t row = bottom_up ? height - 1 - i : i;
 
+        ret = image_png_get_span(src, 0, row, width, type, from);
+        if (ret != 0) {
             break;
         }
-        case IMAGE_GRAY8_COLOR:
-        case IMAGE_GRAY16_COLOR: {
-            switch (IMAGE_IGNORE_ALPHA(type)) {
-                case IMAGE_RGBA8_COLOR: {
-                    if (IMAGE_IGNORE_ALPHA(color->type) == IMAGE_GRAY8_COLOR) {
-                        new_color.rgba8.red = color->ga8.gray;
-                        new_color.rgba8.green = color->ga8.gray;
-                        new_color.rgba8.blue = color->ga8.gray;
-                        new_color.rgba8.alpha = color->ga8.alpha;
-                    } else if (IMAGE_IGNORE_ALPHA(color->type) == IMAGE_GRAY16_COLOR) {
-                        new_color.rgba8.red = color->ga16.gray & 0xFF;
-                        new_color.rgba8.green = color->ga16.gray & 0xFF;
-                        new_color.rgba8.blue = color->ga16.gray & 0xFF;
-                        new_color.rgba8.alpha = color->ga16.alpha & 0xFF;
-                    }
-
-                    break;
-                }
-                case IMAGE_RGBA16_COLOR: {
-                    if (IMAGE_IGNORE_ALPHA(color->type) == IMAGE_GRAY8_COLOR) {
-                        new_color.rgba16.red = twice16(color->ga8.gray);
-                        new_color.rgba16.green = twice16(color->ga8.gray);
-                        new_color.rgba16.blue = twice16(color->ga8.gray);
-                        new_color.rgba16.alpha = twice16(color->ga8.alpha);
-                    } else if (IMAGE_IGNORE_ALPHA(color->type) == IMAGE_GRAY16_COLOR) {
-                        new_color.rgba16.red = twice16(color->ga16.gray);
-                        new_color.rgba16.green = twice16(color->ga16.gray);
-                        new_color.rgba16.blue = twice16(color->ga16.gray);
-                        new_color.rgba16.alpha = twice16(color->ga16.alpha);
-                    }
-
-                    break;
-                }
-                case IMAGE_GRAY8_COLOR: {
-                    if (IMAGE_IGNORE_ALPHA(color->type) == IMAGE_GRAY16_COLOR) {
-                        new_color.ga8.gray = color->ga16.gray & 0xFF;
-                        new_color.ga8.alpha = color->ga16.alpha & 0xFF;
-                    }
-
-                    break;
-                }
-                case IMAGE_GRAY16_COLOR: {
-                    if (IMAGE_IGNORE_ALPHA(color->type) == IMAGE_GRAY8_COLOR) {
-                        new_color.ga16.gray = twice16(color->ga8.gray);
-                        new_color.ga16.alpha = twice16(color->ga8.alpha);
-                    }
-
-                    break;
-                }
-            }
 
-            break;
+        if (to == NULL) {
+            uint8_t* pixels = _png_row(dst, y + row) + (size_t) x * media_pixel_size(format);
+            media_composite_row(format, from, pixels, width, blend);
+            continue;
         }
-    }
-
-    *color = new_color;
-}
 
-static void _png_copy_chunk(struct image_png_chunk* src, struct image_png_chunk* dest) {
-    dest->length = src->length;
-    strcpy(dest->type, src->type);
-    if (dest->data == NULL) {
-        dest->data = malloc(sizeof(uint8_t) * src->length);
-    } else {
-        dest->data = realloc(dest->data, sizeof(uint8_t) * src->length); 
+        ret = image_png_get_span(dst, x, y + row, width, type, to);
+        if (ret == 0) {
+            media_composite_row(format, from, to, width, blend);
+            ret = image_png_set_span(dst, x, y + row, width, type, to);
+        }
     }
-    memcpy(dest->data, src->data, sizeof(uint8_t) * src->length);
-    dest->crc = src->crc;
-}
 
-static inline uint32_t _png_get_chunk_crc32(struct image_png_chunk* chunk) {
-    uint32_t crc = MEDIA_CRC32_DEFAULT;
-    crc = media_update_crc32(crc, (uint8_t *) chunk->type, 4);
-    crc = media_update_crc32(crc, chunk->data, chunk->length);
+    _png_free(&dst->allocator, from);
+    _png_free(&dst->allocator, to);
 
-    return MEDIA_CRC32(crc);
-}
+    _png_touch_rows(dst, y, height);
 
-static inline void _png_generate_crc32(struct image_png_chunk* chunk) {
-    chunk->crc = _png_get_chunk_crc32(chunk); 
+    return ret;
 }
 
-static inline int _png_check_crc32(struct image_png_chunk* chunk) {
-    return chunk->crc != _png_get_chunk_crc32(chunk);
-}
+int image_png_set_row_layout(struct image_png* image, uint32_t alignment, size_t stride) {
+    struct image_png_chunk_IDAT* idat = &image->idat;
 
-static inline void _png_populate_chunk(struct image_png_chunk* chunk, size_t bytes) {
-    if (chunk->data == NULL) {
-        chunk->data = malloc(bytes);
-    } else {
-        chunk->data = realloc(chunk->data, bytes);
+    if (alignment == 0) {
+        alignment = 1;
     }
-}
 
-static int _png_read_chunk_IHDR(struct image_png_chunk* chunk, struct image_png_chunk_IHDR* ihdr) {
-    if (chunk == NULL || chunk->length != 13 || strcmp(chunk->type, "IHDR") != 0) {
+    // it must be a power of two
+    if ((alignment & (alignment - 1)) != 0 || alignment > 4096) {
         return 1;
     }
 
-    if (_png_check_crc32(chunk)) {
+    struct image_png_chunk_IDAT old_idat = *idat;
+
+    idat->alignment = alignment;
+    idat->min_stride = stride;
+
+    if (_png_alloc_pixels(&image->allocator, &image->ihdr, idat) != 0) {
+        *idat = old_idat;
         return 2;
     }
 
-    struct image_png_chunk_IHDR def_ihdr;
-    if (ihdr == NULL) {
-        ihdr = &def_ihdr;
+    size_t row_size = _png_row_size(&image->ihdr);
+    for (uint32_t y = 0; y < image->ihdr.height; y++) {
+        memcpy(idat->data + y * idat->stride, old_idat.data + y * old_idat.stride, row_size);
     }
 
-    memcpy(ihdr, chunk->data, 13);
-    ihdr->width = convert_int_be(ihdr->width);
-    ihdr->height = convert_int_be(ihdr->height);
+    _png_free_chunk_IDAT(&image->allocator, &old_idat);
 
     return 0;
 }
 
-static int _png_read_chunk_PLTE(struct image_png_chunk* chunk, struct image_png_chunk_PLTE* plte) {
-    if (chunk == NULL || strcmp(chunk->type, "PLTE") != 0 || chunk->length % 3 != 0 || chunk->length / 3 > 256) {
-        return 1;
+void image_png_set_default_row_alignment(uint32_t alignment) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > 4096) {
+        alignment = 1;
     }
 
-    if (_png_check_crc32(chunk)) {
+    png_default_alignment = alignment;
+}
+
+uint8_t* image_png_lock_pixels(struct image_png* image, struct image_pixel_desc* desc) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+
+    if (desc != NULL) {
+        enum media_pixel_format format = _png_ihdr_format(ihdr);
+
+        desc->data = image->idat.data;
+        desc->stride = image->idat.stride;
+        desc->width = ihdr->width;
+        desc->height = ihdr->height;
+        image_png_get_color(image, &desc->type);
+        desc->pixel_size = media_pixel_size(format);
+        desc->channels = media_pixel_channels(format);
+        // low depths are kept a byte per sample
+        desc->depth = media_pixel_depth(format);
+
+        switch (ihdr->color) {
+            case 0: desc->order = IMAGE_ORDER_GRAY; break;
+            case 2: desc->order = IMAGE_ORDER_RGB; break;
+            case 3: desc->order = IMAGE_ORDER_INDEXED; break;
+            case 4: desc->order = IMAGE_ORDER_GRAY_ALPHA; break;
+            case 6: desc->order = IMAGE_ORDER_RGBA; break;
+        }
+
+        desc->endian = media_actual_endian() == MEDIA_BIG_ENDIAN ? IMAGE_BIG_ENDIAN : IMAGE_LITTLE_ENDIAN;
+    }
+
+    return image->idat.data;
+}
+
+void image_png_unlock_pixels(struct image_png* image) {
+    _png_touch_rows(image, 0, image->ihdr.height);
+}
+
+int image_png_get_row(struct image_png* image, uint32_t y, enum image_color_type type, void* buffer) {
+    return image_png_get_span(image, 0, y, image->ihdr.width, type, buffer);
+}
+
+int image_png_set_row(struct image_png* image, uint32_t y, enum image_color_type type, const void* buffer) {
+    return image_png_set_span(image, 0, y, image->ihdr.width, type, buffer);
+}
+
+int image_png_get_linear_row(struct image_png* image, uint32_t y, uint16_t* buffer) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+
+    // out of bounds
+    if (y >= ihdr->height) {
         return 2;
     }
 
-    if (plte == NULL) {
-        return 0;
+    const struct media_gamma* gamma = _png_gamma(image);
+    if (gamma == NULL) {
+        return 3;
     }
 
-    plte->size = chunk->length / 3;
+    int ret = media_gamma_to_linear(gamma, _png_ihdr_format(ihdr), _png_row(image, y), buffer, ihdr->width);
+    media_gamma_release(gamma);
 
-    plte->pallete = malloc(sizeof(struct image_color) * plte->size);
-    for (uint16_t i = 0; i < plte->size; i++) {
-        struct image_color* color = &plte->pallete[i];
+    return ret;
+}
 
-        color->type = IMAGE_RGBA8_COLOR;
-        color->rgba8.red = chunk->data[i * 3];
-        color->rgba8.green = chunk->data[i * 3 + 1];
-        color->rgba8.blue = chunk->data[i * 3 + 2];
-        color->rgba8.alpha = 0;
+int image_png_set_linear_row(struct image_png* image, uint32_t y, const uint16_t* buffer) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+
+    // out of bounds
+    if (y >= ihdr->height) {
+        return 2;
+    }
+
+    const struct media_gamma* gamma = _png_gamma(image);
+    if (gamma == NULL) {
+        return 3;
+    }
+
+    int ret = media_gamma_from_linear(gamma, _png_ihdr_format(ihdr), buffer, _png_row(image, y), ihdr->width);
+    media_gamma_release(gamma);
+
+    if (ret != 0) {
+        return ret;
     }
 
+    _png_touch_rows(image, y, 1);
+
     return 0;
 }
 
-static int _png_read_chunk_tRNS(struct image_png_chunk* chunk, struct image_png_chunk_tRNS* trns) {
-    if (chunk == NULL || strcmp(chunk->type, "tRNS") != 0) {
+int image_png_convert_to_srgb(struct image_png* image) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+
+    // already sRGB, or there is nothing telling otherwise
+    if (image->srgb.rendering <= 3
+        || (!_png_check_iccp(&image->iccp) && !_png_check_chrm(&image->chrm) && image->gama.gamma == 0)) {
+        return 0;
+    }
+
+    struct media_color_space src;
+    struct media_color_space dst;
+
+    if (_png_color_space(image, &src) != 0) {
         return 1;
     }
 
-    if (_png_check_crc32(chunk)) {
+    media_color_space_srgb(&dst);
+
+    const struct media_color_transform* transform = media_color_transform_get(&src, &dst);
+    if (transform == NULL) {
         return 2;
     }
 
-    if (trns == NULL) {
-        return 0;
-    }
+    enum media_pixel_format format = _png_ihdr_format(ihdr);
 
-    // free some pointer if trns has some size
-    if (trns->size > 0) {
-        if (trns->type == PNG_tRNS_8BITS) {
-            free(trns->data_8bits);
-        } else if (trns->type == PNG_tRNS_16BITS) {
-            free(trns->data_16bits);
+    if (format == MEDIA_PIXEL_INDEXED8) {
+        // only the palette has colors
+        struct image_png_chunk_PLTE* plte = &image->plte;
+
+        for (uint16_t i = 0; i < plte->size; i++) {
+            struct image_color* color = &plte->pallete[i];
+            uint8_t rgb[3] = {color->rgba8.red, color->rgba8.green, color->rgba8.blue};
+
+            media_color_transform_row(transform, MEDIA_PIXEL_RGB8, rgb, 1);
+
+            color->rgba8.red = rgb[0];
+            color->rgba8.green = rgb[1];
+            color->rgba8.blue = rgb[2];
+        }
+
+        _png_drop_palette_lut(image);
+    } else if (media_pixel_channels(format) >= 3) {
+        struct png_color_job job = {image, format, transform};
+        media_parallel_for(ihdr->height, png_threads, _png_color_rows, &job);
+    } else {
+        // gray has no primaries, only its curve changes
+        uint16_t* linear = _png_malloc(&image->allocator, sizeof(uint16_t) * 2 * ihdr->width);
+        if (linear == NULL) {
+            media_color_transform_release(transform);
+            return 2;
+        }
+
+        for (uint32_t y = 0; y < ihdr->height; y++) {
+            uint8_t* row = _png_row(image, y);
+
+            media_gamma_to_linear(transform->decode, format, row, linear, ihdr->width);
+            media_gamma_from_linear(transform->encode, format, linear, row, ihdr->width);
         }
+
+        _png_free(&image->allocator, linear);
     }
 
-    trns->type = PNG_tRNS_8BITS;
-    trns->size = chunk->length;
-    trns->data_8bits = malloc(sizeof(uint8_t) * trns->size);
-    memcpy(trns->data_8bits, chunk->data, chunk->length);
+    media_color_transform_release(transform);
+
+    if (format != MEDIA_PIXEL_INDEXED8) {
+        _png_touch_rows(image, 0, ihdr->height);
+    }
+
+    memset(&image->chrm, 0, sizeof(struct image_png_chunk_cHRM));
+    _png_meta_free(&image->allocator, image->iccp.data);
+    memset(&image->iccp, 0, sizeof(struct image_png_chunk_iCCP));
+    image->gama.gamma = 0;
+    // perceptual
+    image->srgb.rendering = 0;
 
     return 0;
 }
 
-static int _png_read_chunk_cHRM(struct image_png_chunk* chunk, struct image_png_chunk_cHRM* chrm) {
-    if (chunk == NULL || strcmp(chunk->type, "cHRM") != 0 || chunk->length != 32) {
-        return 1;
+int image_png_to_planar_f32(struct image_png* image, enum image_tensor_layout layout,
+                            const float* mean, const float* std, float* out) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+
+    struct png_tensor_job job;
+    job.image = image;
+    job.format = _png_ihdr_format(ihdr);
+    job.lut = NULL;
+    job.out = out;
+    job.failed = 0;
+
+    if (job.format == MEDIA_PIXEL_INDEXED8) {
+        job.lut = _png_palette_lut(image);
+        if (job.lut == NULL) {
+            return 2;
+        }
+
+        job.format = MEDIA_PIXEL_RGBA8;
     }
 
-    if (_png_check_crc32(chunk)) {
-        return 2;
+    uint32_t channels = media_pixel_channels(job.format);
+    float max = media_pixel_depth(job.format) == 8 ? 255.0f : 65535.0f;
+
+    for (uint32_t c = 0; c < channels; c++) {
+        float deviation = std != NULL ? std[c] : 1.0f;
+        if (deviation == 0.0f) {
+            return 1;
+        }
+
+        job.scale[c] = 1.0f / (max * deviation);
+        job.bias[c] = mean != NULL ? -mean[c] / deviation : 0.0f;
     }
 
-    if (chrm == NULL) {
-        return 0;
+    if (layout == IMAGE_LAYOUT_CHW) {
+        job.channel_step = (size_t) ihdr->width * ihdr->height;
+        job.pixel_step = 1;
+        job.row_step = ihdr->width;
+    } else {
+        job.channel_step = 1;
+        job.pixel_step = channels;
+        job.row_step = (size_t) ihdr->width * channels;
     }
 
-    memcpy(chrm, chunk->data, sizeof(uint8_t) * 32);
-    chrm->white_px = convert_int_be(chrm->white_px);
-    chrm->white_py = convert_int_be(chrm->white_py);
-    chrm->red_x = convert_int_be(chrm->red_x);
-    chrm->red_y = convert_int_be(chrm->red_y);
-    chrm->green_x = convert_int_be(chrm->green_x);
-    chrm->green_y = convert_int_be(chrm->green_y);
-    chrm->blue_x = convert_int_be(chrm->blue_x);
-    chrm->blue_y = convert_int_be(chrm->blue_y);
+    media_parallel_for(ihdr->height, png_threads, _png_tensor_rows, &job);
 
-    return 0;
+    return job.failed ? 2 : 0;
 }
 
-static int _png_read_chunk_gAMA(struct image_png_chunk* chunk, struct image_png_chunk_gAMA* gama) {
-    if (chunk == NULL || strcmp(chunk->type, "gAMA") != 0 || chunk->length != 4) {
+int image_png_histogram(struct image_png* image, uint32_t bins, uint64_t* histogram) {
+    struct png_stats_job job;
+    if (_png_stats_job(image, &job) != 0) {
+        return 2;
+    }
+
+    if (bins == 0 || bins > (1u << media_pixel_depth(job.format))) {
         return 1;
     }
 
-    if (_png_check_crc32(chunk)) {
+    size_t plane = (size_t) media_pixel_channels(job.format) * bins;
+    job.bins = bins;
+    job.histograms = _png_calloc(&image->allocator, plane * job.parts, sizeof(uint64_t));
+
+    if (job.histograms == NULL) {
         return 2;
     }
 
-    if (gama == NULL) {
-        return 0;
+    media_parallel_for(job.parts, png_threads, _png_stats_parts, &job);
+
+    memset(histogram, 0, plane * sizeof(uint64_t));
+    for (uint32_t part = 0; part < job.parts; part++) {
+        for (size_t i = 0; i < plane; i++) {
+            histogram[i] += job.histograms[part * plane + i];
+        }
     }
 
-    memcpy(gama, chunk->data, sizeof(uint8_t) * 4);
-    gama->gamma = convert_int_be(gama->gamma);
+    _png_free(&image->allocator, job.histograms);
 
-    return 0;
+    return job.failed ? 2 : 0;
 }
 
-static int _png_read_chunk_iCCP(struct image_png_chunk* chunk, struct image_png_chunk_iCCP* iccp) {
-    if (chunk == NULL || strcmp(chunk->type, "iCCP") != 0) {
-        return 1;
+int image_png_stats(struct image_png* image, struct image_stats* stats) {
+    struct png_stats_job job;
+    if (_png_stats_job(image, &job) != 0) {
+        return 2;
     }
 
-    if (_png_check_crc32(chunk)) {
+    job.stats = _png_malloc(&image->allocator, sizeof(struct media_stats) * job.parts);
+    if (job.stats == NULL) {
         return 2;
     }
 
-    if (iccp == NULL) {
-        return 0;
+    media_parallel_for(job.parts, png_threads, _png_stats_parts, &job);
+
+    struct media_stats total;
+    media_stats_init(&total, job.format);
+
+    for (uint32_t part = 0; part < job.parts; part++) {
+        media_stats_merge(&total, &job.stats[part]);
     }
 
-    strncpy(iccp->name, (const char*) chunk->data, 80);
-    size_t name_length = strlen(iccp->name) + 1;
-    iccp->compression = chunk->data[name_length];
-    iccp->size = chunk->length - name_length - 1;
-    iccp->data = malloc(sizeof(uint8_t) * iccp->size);
-    memcpy(iccp->data, &chunk->data[name_length + 1], iccp->size);
+    _png_free(&image->allocator, job.stats);
+
+    if (job.failed) {
+        return 2;
+    }
+
+    memset(stats, 0, sizeof(struct image_stats));
+    stats->channels = total.channels;
+
+    for (uint32_t c = 0; c < total.channels && total.count > 0; c++) {
+        struct image_channel_stats* channel = &stats->channel[c];
+        double mean = (double) total.sum[c] / total.count;
+        double variance = (double) total.squares[c] / total.count - mean * mean;
+
+        channel->min = (uint16_t) total.min[c];
+        channel->max = (uint16_t) total.max[c];
+        channel->mean = mean;
+        channel->stddev = variance > 0.0 ? sqrt(variance) : 0.0;
+    }
 
     return 0;
 }
 
-static int _png_read_chunk_sBIT(struct image_png_chunk* chunk, struct image_png_chunk_sBIT* sbit) {
-    if (chunk == NULL || strcmp(chunk->type, "sBIT") != 0) {
+int image_png_compare(struct image_png* a, struct image_png* b, struct image_compare_result* result) {
+    struct image_png_chunk_IHDR* ihdr = &a->ihdr;
+
+    if (ihdr->width != b->ihdr.width || ihdr->height != b->ihdr.height) {
         return 1;
     }
 
-    if (_png_check_crc32(chunk)) {
-        return 2;
-    }
+    memset(result, 0, sizeof(struct image_compare_result));
+    result->psnr = INFINITY;
+    result->ssim = 1.0;
 
-    if (sbit == NULL) {
+    if (ihdr->width == 0 || ihdr->height == 0) {
         return 0;
     }
 
-    switch (chunk->length) {
-        case 1: {
-            sbit->type = PNG_sBIT_GREY;
-            sbit->grey = chunk->data[0];
-            break;
+    struct png_compare_job job;
+    memset(&job, 0, sizeof(struct png_compare_job));
+    job.images[0] = a;
+    job.images[1] = b;
+
+    for (uint32_t i = 0; i < 2; i++) {
+        job.formats[i] = _png_ihdr_format(&job.images[i]->ihdr);
+
+        if (job.formats[i] == MEDIA_PIXEL_INDEXED8) {
+            job.luts[i] = _png_palette_lut(job.images[i]);
+            if (job.luts[i] == NULL) {
+                return 2;
+            }
         }
-        case 2: {
-            sbit->type = PNG_sBIT_GREYALPHA;
-            sbit->grey = chunk->data[0];
-            sbit->alpha = chunk->data[1];
-            break;
+    }
+
+    // same pixels with the same palette need no metric
+    if (job.formats[0] == job.formats[1]
+        && (job.luts[0] == NULL || memcmp(job.luts[0], job.luts[1], 256 * sizeof(uint32_t)) == 0)) {
+        size_t row_size = _png_row_size(ihdr);
+        uint32_t y = 0;
+
+        while (y < ihdr->height && memcmp(_png_row(a, y), _png_row(b, y), row_size) == 0) {
+            y++;
         }
-        case 3: {
-            sbit->type = PNG_sBIT_RGB_OR_INDEXED;
-            sbit->red = chunk->data[0];
-            sbit->green = chunk->data[1];
-            sbit->blue = chunk->data[2];
-            break;
+
+        if (y == ihdr->height) {
+            return 0;
         }
-        case 4: {
-            sbit->type = PNG_sBIT_RGBALPHA;
-            sbit->red = chunk->data[0];
-            sbit->green = chunk->data[1];
-            sbit->blue = chunk->data[2];
-            sbit->alpha = chunk->data[3];
-            break;
+    }
+
+    for (uint32_t i = 0; i < 2; i++) {
+        job.formats[i] = job.luts[i] != NULL ? MEDIA_PIXEL_RGBA8 : job.formats[i];
+    }
+
+    // different formats meet in RGBA of the deepest one
+    job.format = job.formats[0];
+    if (job.formats[0] != job.formats[1]) {
+        uint8_t wide = media_pixel_depth(job.formats[0]) == 16 || media_pixel_depth(job.formats[1]) == 16;
+        job.format = wide ? MEDIA_PIXEL_RGBA16 : MEDIA_PIXEL_RGBA8;
+    }
+
+    job.max = media_pixel_depth(job.format) == 16 ? 65535.0 : 255.0;
+    job.parts = png_threads < ihdr->height ? png_threads : ihdr->height;
+
+    job.diffs = _png_malloc(&a->allocator, sizeof(struct media_diff) * job.parts);
+    job.ssims = _png_calloc(&a->allocator, job.parts, sizeof(double));
+    job.windows = _png_calloc(&a->allocator, job.parts, sizeof(uint64_t));
+
+    if (job.diffs != NULL && job.ssims != NULL && job.windows != NULL) {
+        media_parallel_for(job.parts, png_threads, _png_compare_parts, &job);
+    } else {
+        job.failed = 1;
+    }
+
+    struct media_diff diff;
+    media_diff_init(&diff);
+
+    double ssim = 0.0;
+    uint64_t windows = 0;
+
+    for (uint32_t part = 0; part < job.parts && !job.failed; part++) {
+        media_diff_merge(&diff, &job.diffs[part]);
+        ssim += job.ssims[part];
+        windows += job.windows[part];
+    }
+
+    _png_free(&a->allocator, job.diffs);
+    _png_free(&a->allocator, job.ssims);
+    _png_free(&a->allocator, job.windows);
+
+    if (job.failed) {
+        return 2;
+    }
+
+    // images smaller than a window are a single one
+    if (windows == 0) {
+        struct png_allocator* allocator = &a->allocator;
+        float* luma[2] = {_png_malloc(allocator, sizeof(float) * ihdr->width),
+                          _png_malloc(allocator, sizeof(float) * ihdr->width)};
+        uint8_t* scratch[2] = {_png_malloc(allocator, (size_t) ihdr->width * 8),
+                               _png_malloc(allocator, (size_t) ihdr->width * 8)};
+        double sums[4] = {0.0, 0.0, 0.0, 0.0};
+
+        if (luma[0] != NULL && luma[1] != NULL && scratch[0] != NULL && scratch[1] != NULL) {
+            for (uint32_t y = 0; y < ihdr->height; y++) {
+                for (uint32_t i = 0; i < 2; i++) {
+                    media_luma_row(job.format, _png_compare_row(&job, i, y, scratch[i]), ihdr->width, luma[i]);
+                }
+
+                for (uint32_t x = 0; x < ihdr->width; x++) {
+                    sums[0] += luma[0][x];
+                    sums[1] += luma[1][x];
+                    sums[2] += (double) luma[0][x] * luma[0][x] + (double) luma[1][x] * luma[1][x];
+                    sums[3] += (double) luma[0][x] * luma[1][x];
+                }
+            }
+
+            ssim = media_ssim(sums[0], sums[1], sums[2], sums[3], (double) ihdr->width * ihdr->height, job.max);
+            windows = 1;
+        } else {
+            job.failed = 1;
+        }
+
+        for (uint32_t i = 0; i < 2; i++) {
+            _png_free(allocator, luma[i]);
+            _png_free(allocator, scratch[i]);
         }
+
+        if (job.failed) {
+            return 2;
+        }
+    }
+
+    result->different = diff.pixels;
+    result->max_error = diff.max_error;
+
+    if (diff.pixels > 0) {
+        result->bounds.x = diff.min_x;
+        result->bounds.y = diff.min_y;
+        result->bounds.width = diff.max_x - diff.min_x + 1;
+        result->bounds.height = diff.max_y - diff.min_y + 1;
+    }
+
+    if (diff.squares > 0) {
+        double samples = (double) ihdr->width * ihdr->height * media_pixel_channels(job.format);
+        double mse = diff.squares / samples;
+
+        result->psnr = 10.0 * log10(job.max * job.max / mse);
     }
 
+    result->ssim = windows > 0 ? ssim / windows : 1.0;
+
     return 0;
 }
 
-static int _png_read_chunk_sRGB(struct image_png_chunk* chunk, struct image_png_chunk_sRGB* srgb) {
-    if (chunk == NULL || strcmp(chunk->type, "sRGB") != 0 || chunk->length != 1) {
+int image_png_hash(struct image_png* image, struct image_hashes* hashes) {
+    return _png_hash(image, png_threads, PNG_HASH_ALL, hashes);
+}
+
+int image_png_ahash(struct image_png* image, uint64_t* hash) {
+    struct image_hashes hashes;
+    int status = _png_hash(image, png_threads, PNG_HASH_AVERAGE, &hashes);
+
+    *hash = hashes.average;
+    return status;
+}
+
+int image_png_dhash(struct image_png* image, uint64_t* hash) {
+    struct image_hashes hashes;
+    int status = _png_hash(image, png_threads, PNG_HASH_DIFFERENCE, &hashes);
+
+    *hash = hashes.difference;
+    return status;
+}
+
+int image_png_phash(struct image_png* image, uint64_t* hash) {
+    struct image_hashes hashes;
+    int status = _png_hash(image, png_threads, PNG_HASH_PERCEPTUAL, &hashes);
+
+    *hash = hashes.perceptual;
+    return status;
+}
+
+int image_png_hash_file(const char* path, struct image_hashes* hashes) {
+    memset(hashes, 0, sizeof(struct image_hashes));
+
+    struct image_png* image = _png_open(path, &PNG_HASH_DECODE);
+    if (image == NULL) {
         return 1;
     }
-    
-    if (_png_check_crc32(chunk)) {
+
+    // threads are already split between files by image_png_hash_files
+    int status = _png_hash(image, 1, PNG_HASH_ALL, hashes);
+    image_png_close(image);
+
+    return status != 0 ? 2 : 0;
+}
+
+uint32_t image_png_hash_files(const char* const* paths, uint32_t count, struct image_hashes* hashes) {
+    struct png_hash_files_job job;
+    job.paths = paths;
+    job.hashes = hashes;
+    job.failed = calloc(count > 0 ? count : 1, sizeof(uint8_t));
+
+    if (job.failed == NULL) {
+        memset(hashes, 0, sizeof(struct image_hashes) * count);
+        return count;
+    }
+
+    media_parallel_for(count, png_threads, _png_hash_files, &job);
+
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        failed += job.failed[i];
+    }
+
+    free(job.failed);
+
+    return failed;
+}
+
+uint32_t image_png_hash_distance(uint64_t a, uint64_t b) {
+    return media_hash_distance(a, b);
+}
+
+void image_png_hash_distances(uint64_t hash, const uint64_t* hashes, uint32_t count, uint32_t* distances) {
+    for (uint32_t i = 0; i < count; i++) {
+        distances[i] = media_hash_distance(hash, hashes[i]);
+    }
+}
+
+void image_png_set_threads(uint32_t threads) {
+    png_threads = threads != 0 ? threads : 1;
+}
+
+void image_png_set_allocator(image_alloc_fn alloc, image_realloc_fn realloc, image_free_fn free, void* ctx) {
+    struct image_allocator functions = {alloc, realloc, free, ctx};
+    png_default_allocator = _png_make_allocator(&functions, png_default_allocator.arena);
+}
+
+void image_png_set_arena(uint8_t arena) {
+    png_default_allocator.arena = arena;
+}
+
+int image_png_get_span(struct image_png* image, uint32_t x, uint32_t y, uint32_t count,
+                       enum image_color_type type, void* buffer) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+
+    // out of bounds
+    if (x >= ihdr->width || y >= ihdr->height) {
         return 2;
     }
 
-    if (srgb == NULL) {
-        return 0;
+    if (count > ihdr->width - x) {
+        count = ihdr->width - x;
+    }
+
+    enum media_pixel_format format = _png_ihdr_format(ihdr);
+    uint32_t pixel_size = media_pixel_size(format);
+    uint8_t* pixels = _png_row(image, y) + (size_t) x * pixel_size;
+
+    if (format == MEDIA_PIXEL_INDEXED8) {
+        const uint32_t* lut = _png_palette_lut(image);
+        if (lut == NULL) {
+            return 3;
+        }
+
+        return media_convert_indexed(pixels, lut, _png_color_format(type), buffer, count, _png_luma(image));
+    }
+
+    return media_convert_row(format, pixels, _png_color_format(type), buffer, count, _png_luma(image));
+}
+
+int image_png_set_span(struct image_png* image, uint32_t x, uint32_t y, uint32_t count,
+                       enum image_color_type type, const void* buffer) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+
+    // out of bounds
+    if (x >= ihdr->width || y >= ihdr->height) {
+        return 2;
+    }
+
+    if (count > ihdr->width - x) {
+        count = ihdr->width - x;
+    }
+
+    enum media_pixel_format format = _png_ihdr_format(ihdr);
+    uint32_t pixel_size = media_pixel_size(format);
+    uint8_t* pixels = _png_row(image, y) + (size_t) x * pixel_size;
+
+    int ret = media_convert_row(_png_color_format(type), buffer, format, pixels, count, _png_luma(image));
+    if (ret != 0) {
+        return ret;
+    }
+
+    _png_touch_rows(image, y, 1);
+
+    return 0;
+}
+
+void image_png_get_timestamp(struct image_png* image, struct image_time* time) {
+    time->year = image->time.year;
+    time->month = image->time.month;
+    time->day = image->time.day;
+    time->hour = image->time.hour;
+    time->minute = image->time.minute;
+    time->second = image->time.second;
+}
+
+void image_png_set_timestamp(struct image_png* image, struct image_time time) {
+    image->time.year = time.year;
+    image->time.month = time.month;
+    image->time.day = time.day;
+    image->time.hour = time.hour;
+    image->time.minute = time.minute;
+    image->time.second = time.second;
+}
+
+struct image_png* image_png_copy(struct image_png* image) {
+    // same allocator, with blocks of its own
+    struct png_allocator allocator = _png_make_allocator(&image->allocator.functions, image->allocator.arena);
+    struct image_png* copy_image = _png_malloc(&allocator, sizeof(struct image_png));
+
+    if (copy_image != NULL) {
+        copy_image->allocator = allocator;
+        struct png_allocator* copy_allocator = &copy_image->allocator;
+
+        memcpy(&copy_image->ihdr, &image->ihdr, sizeof(struct image_png_chunk_IHDR));
+
+        copy_image->plte.size = image->plte.size;
+        copy_image->plte.pallete = NULL;
+        if (copy_image->plte.size > 0) {
+            copy_image->plte.pallete = _png_meta_alloc(copy_allocator, sizeof(struct image_color) * copy_image->plte.size);
+            memcpy(copy_image->plte.pallete, image->plte.pallete, sizeof(struct image_color) * copy_image->plte.size);
+        }
+
+        copy_image->trns.type = image->trns.type;
+        copy_image->trns.size = image->trns.size;
+        copy_image->trns.data_8bits = NULL;
+        if (copy_image->trns.size > 0) {
+            switch (copy_image->trns.type) {
+                case PNG_tRNS_8BITS: {
+                    copy_image->trns.data_8bits = _png_meta_alloc(copy_allocator, sizeof(uint8_t) * copy_image->trns.size);
+                    memcpy(copy_image->trns.data_8bits, image->trns.data_8bits, sizeof(uint8_t) * copy_image->trns.size);
+                    break;
+                }
+                case PNG_tRNS_16BITS: {
+                    copy_image->trns.data_16bits = _png_meta_alloc(copy_allocator, sizeof(uint16_t) * copy_image->trns.size);
+                    memcpy(copy_image->trns.data_16bits, image->trns.data_16bits, sizeof(uint16_t) * copy_image->trns.size);
+                    break;
+                }
+            }
+        }
+
+        memcpy(&copy_image->chrm, &image->chrm, sizeof(struct image_png_chunk_cHRM));
+        memcpy(&copy_image->gama, &image->gama, sizeof(struct image_png_chunk_gAMA));
+
+        strncpy(copy_image->iccp.name, image->iccp.name, 80);
+        copy_image->iccp.compression = image->iccp.compression;
+        copy_image->iccp.size = image->iccp.size;
+        copy_image->iccp.data = NULL;
+        if (copy_image->iccp.size > 0) {
+            copy_image->iccp.data = _png_meta_alloc(copy_allocator, sizeof(uint8_t) * copy_image->iccp.size);
+            memcpy(copy_image->iccp.data, image->iccp.data, sizeof(uint8_t) * copy_image->iccp.size);
+        }
+
+        memcpy(&copy_image->sbit, &image->sbit, sizeof(struct image_png_chunk_sBIT));
+        memcpy(&copy_image->srgb, &image->srgb, sizeof(struct image_png_chunk_sRGB));
+
+        copy_image->textual_list.size = image->textual_list.size;
+        copy_image->textual_list.list = NULL;
+        if (copy_image->textual_list.size > 0) {
+            size_t size = sizeof(struct png_textual_data) * copy_image->textual_list.size;
+            copy_image->textual_list.list = _png_meta_alloc(copy_allocator, size);
+        }
+
+        for (uint32_t i = 0; i < copy_image->textual_list.size; i++) {
+            struct png_textual_data* textual = &image->textual_list.list[i];
+            struct png_textual_data* copy_textual = &copy_image->textual_list.list[i];
+
+            copy_textual->type = textual->type;
+
+            if (textual->type == PNG_TEXTUAL_UNCOMPRESSED) {
+                struct image_png_chunk_tEXt* text = &textual->data.text;
+                struct image_png_chunk_tEXt* copy_text = &copy_textual->data.text;
+
+                strncpy(copy_text->keyword, text->keyword, 80);
+                copy_text->text = _png_meta_strdup(copy_allocator, text->text);
+            } else if (textual->type == PNG_TEXTUAL_COMPRESSED) {
+                struct image_png_chunk_zTXt* ztxt = &textual->data.ztxt;
+                struct image_png_chunk_zTXt* copy_ztxt = &copy_textual->data.ztxt;
+
+                strncpy(copy_ztxt->keyword, ztxt->keyword, 80);
+                copy_ztxt->compression = ztxt->compression; 
+                copy_ztxt->text = _png_meta_strdup(copy_allocator, ztxt->text);
+            } else if (textual->type == PNG_TEXTUAL_INTERNATIONAL) {
+                struct image_png_chunk_iTXt* itxt = &textual->data.itxt;
+                struct image_png_chunk_iTXt* copy_itxt = &copy_textual->data.itxt;
+
+                strncpy(copy_itxt->keyword, itxt->keyword, 80);
+                copy_itxt->compression_flag = itxt->compression_flag;
+                copy_itxt->compression_method = itxt->compression_method;
+                copy_itxt->language_tag = _png_meta_strdup(copy_allocator, itxt->language_tag);
+                copy_itxt->translated_keyword = _png_meta_strdup(copy_allocator, itxt->translated_keyword);
+                copy_itxt->text = _png_meta_strdup(copy_allocator, itxt->text);
+            }
+        }
+
+        memcpy(&copy_image->time, &image->time, sizeof(struct image_png_chunk_tIME));
+
+        copy_image->idat.type = image->idat.type;
+        copy_image->idat.size = image->idat.size;
+        copy_image->idat.stride = image->idat.stride;
+        copy_image->idat.alignment = image->idat.alignment;
+        copy_image->idat.min_stride = image->idat.min_stride;
+        copy_image->idat.data = _png_aligned_alloc(copy_allocator, copy_image->idat.alignment,
+                                                   sizeof(uint8_t) * copy_image->idat.size);
+        memcpy(copy_image->idat.data, image->idat.data, sizeof(uint8_t) * copy_image->idat.size);
+
+        memset(&copy_image->bands, 0, sizeof(struct png_idat_bands));
+        copy_image->bands.rows = image->bands.rows;
+        copy_image->luma = image->luma;
+        copy_image->dither = image->dither;
+        copy_image->resize_linear = image->resize_linear;
+        copy_image->palette_lut = NULL;
+    }
+
+    return copy_image;
+}
+
+static inline void _png_addcapicity_tobytes(uint32_t* chunk_size, struct image_png_chunk** pchunks) {
+    *chunk_size += 1;
+    *pchunks = realloc(*pchunks, *chunk_size * sizeof(struct image_png_chunk));
+    memset(&(*pchunks)[*chunk_size - 1], 0, sizeof(struct image_png_chunk)); 
+}
+
+void image_png_tobytes(struct image_png* image, uint8_t** pbytes, uint32_t* psize) {
+    uint32_t size = 8;
+    uint8_t* bytes = malloc(sizeof(uint8_t) * 8);
+
+    memcpy(bytes, PNG_FILE_HEADER, sizeof(uint8_t) * 8);
+
+    uint32_t next_chunk = 0;
+
+    uint32_t chunk_size = 3;
+    struct image_png_chunk* chunks = malloc(chunk_size * sizeof(struct image_png_chunk));
+    memset(chunks, 0, sizeof(struct image_png_chunk) * chunk_size);
+
+    _png_write_chunk_IHDR(&image->ihdr, &chunks[next_chunk++]);
+
+    if (_png_check_chrm(&image->chrm)) {
+        _png_addcapicity_tobytes(&chunk_size, &chunks);
+        _png_write_chunk_cHRM(&image->chrm, &chunks[next_chunk++]);
+    }
+ 
+    if (image->gama.gamma != 0) {
+        _png_addcapicity_tobytes(&chunk_size, &chunks);
+        _png_write_chunk_gAMA(&image->gama, &chunks[next_chunk++]);
+    }
+
+    if (_png_check_iccp(&image->iccp)) {
+        _png_addcapicity_tobytes(&chunk_size, &chunks);
+        _png_write_chunk_iCCP(&image->iccp, &chunks[next_chunk++]);
+    }
+
+    if (_png_check_sbit(&image->sbit)) {
+        _png_addcapicity_tobytes(&chunk_size, &chunks);
+        _png_write_chunk_sBIT(&image->sbit, &chunks[next_chunk++]);
+    }
+
+    if (image->srgb.rendering < 4) {
+        _png_addcapicity_tobytes(&chunk_size, &chunks);
+        _png_write_chunk_sRGB(&image->srgb, &chunks[next_chunk++]);
+    }
+
+    for (uint32_t i = 0; i < image->textual_list.size; i++) {
+        _png_addcapicity_tobytes(&chunk_size, &chunks);
+
+        struct png_textual_data* textual = &image->textual_list.list[i];
+        if (textual->type == PNG_TEXTUAL_UNCOMPRESSED) {
+            _png_write_chunk_tEXt(&textual->data.text, &chunks[next_chunk++]);
+        } else if (textual->type == PNG_TEXTUAL_COMPRESSED) {
+            _png_write_chunk_zTXt(&textual->data.ztxt, &chunks[next_chunk++]);
+        } else if (textual->type == PNG_TEXTUAL_INTERNATIONAL) {
+            _png_write_chunk_iTXt(&textual->data.itxt, &chunks[next_chunk++]);
+        }
+    }
+
+    uint8_t color = image->ihdr.color;
+    int requiresPallete = color == 3 || ((color == 2 || color == 6) && image->plte.size > 0) ? 1 : 0;
+    if (requiresPallete != 0) {
+        _png_addcapicity_tobytes(&chunk_size, &chunks);
+        _png_write_chunk_PLTE(&image->plte, &chunks[next_chunk++]);
+    }
+
+    if (image->trns.size > 0) {
+        _png_addcapicity_tobytes(&chunk_size, &chunks);
+
+        enum image_png_trns_type trns_type = image->trns.type;
+        _png_convert_chunk_tRNS(&image->allocator, &image->trns, PNG_tRNS_8BITS);
+        _png_write_chunk_tRNS(&image->trns, &chunks[next_chunk++]);
+        _png_convert_chunk_tRNS(&image->allocator, &image->trns, trns_type);
+    }
+
+    if (_png_check_time(&image->time) != 0) {
+        _png_addcapicity_tobytes(&chunk_size, &chunks);
+        _png_write_chunk_tIME(&image->time, &chunks[next_chunk++]);
+    }
+
+    int failed = 0;
+
+    if (image->bands.rows != 0) {
+        failed = _png_write_chunk_IDAT_bands(&image->allocator, &image->ihdr, &image->idat, &image->bands,
+                                             &chunks[next_chunk++]);
+    } else {
+        // scanlines go through a copy of IDAT, so pixels are never given up
+        struct image_png_chunk_IDAT scanlines = image->idat;
+
+        failed = _png_IDAT_to_scanlines(&image->ihdr, &scanlines);
+        if (failed == 0) {
+            _png_write_chunk_IDAT(&scanlines, &chunks[next_chunk++]);
+            free(scanlines.data);
+        }
+    }
+
+    if (failed != 0) {
+        for (uint32_t i = 0; i < chunk_size; i++) {
+            free(chunks[i].data);
+        }
+
+        free(chunks);
+        free(bytes);
+
+        *pbytes = NULL;
+        *psize = 0;
+        return;
+    }
+
+    struct image_png_chunk* iend = &chunks[next_chunk];
+    iend->length = 0;
+    strcpy(iend->type, "IEND");
+    iend->data = NULL;
+    iend->crc = MEDIA_CRC32(media_update_crc32(MEDIA_CRC32_DEFAULT, (uint8_t*) "IEND", 4));
+
+    for (uint32_t i = 0; i < chunk_size; i++) {
+        struct image_png_chunk* chunk = &chunks[i];
+
+        chunk->length = convert_int_be(chunk->length);
+        size += sizeof(uint32_t);
+        bytes = realloc(bytes, sizeof(uint8_t) * size);
+        memcpy(bytes + size - sizeof(uint32_t), &chunk->length, sizeof(uint32_t));
+        chunk->length = convert_int_be(chunk->length);
+
+        size += sizeof(uint8_t) * 4;
+        bytes = realloc(bytes, sizeof(uint8_t) * size);
+        memcpy(bytes + size - sizeof(uint8_t) * 4, chunk->type, sizeof(uint8_t) * 4);
+
+        size += sizeof(uint8_t) * chunk->length;
+        bytes = realloc(bytes, sizeof(uint8_t) * size);
+        memcpy(bytes + size - sizeof(uint8_t) * chunk->length, chunk->data, sizeof(uint8_t) * chunk->length);
+ 
+        chunk->crc = convert_int_be(chunk->crc);
+        size += sizeof(uint32_t);
+        bytes = realloc(bytes, sizeof(uint8_t) * size);
+        memcpy(bytes + size - sizeof(uint32_t), &chunk->crc, sizeof(uint32_t));
+        chunk->crc = convert_int_be(chunk->crc);
+
+        free(chunk->data);
+    }
+
+    free(chunks);
+
+    *pbytes = bytes;
+    *psize = size;
+}
+
+void image_png_save(struct image_png* image, const char* path) {
+    FILE* file = fopen(path, "w+");
+    if (file == NULL) {
+        // Error, it could not create or truct file
+        return;
+    }
+
+    uint32_t size;
+    uint8_t* bytes;
+    image_png_tobytes(image, &bytes, &size);
+
+    if (bytes == NULL) {
+        fclose(file);
+        remove(path);
+        return;
+    }
+
+    fwrite(bytes, sizeof(uint8_t), size, file);
+    fclose(file);
+
+    free(bytes);
+}
+
+int image_png_rewrite_metadata(const char* in_path, const char* out_path, const struct image_metadata_edits* edits) {
+    FILE* in = fopen(in_path, "rb");
+    if (in == NULL) {
+        return 1;
+    }
+
+    // check file header
+    char header[9] = {0};
+    if (fread(header, sizeof(char), 8, in) != 8 || strcmp(header, PNG_FILE_HEADER) != 0) {
+        fclose(in);
+        return 2;
+    }
+
+    // written next to out_path and only renamed over it once complete, so out_path can be in_path
+    size_t path_size = strlen(out_path);
+    char* temp_path = malloc(path_size + sizeof(PNG_REWRITE_SUFFIX));
+    if (temp_path == NULL) {
+        fclose(in);
+        return 6;
+    }
+
+    memcpy(temp_path, out_path, path_size);
+    memcpy(temp_path + path_size, PNG_REWRITE_SUFFIX, sizeof(PNG_REWRITE_SUFFIX));
+
+    // a leftover of another rewrite isn't overwritten
+    FILE* out = fopen(temp_path, "wbx");
+    if (out == NULL) {
+        free(temp_path);
+        fclose(in);
+        return 3;
+    }
+
+    int ret = 0;
+    int edits_written = 0;
+    char type[5] = {0};
+
+    if (fwrite(PNG_FILE_HEADER, sizeof(uint8_t), 8, out) != 8) {
+        ret = 5;
+    }
+
+    while (ret == 0 && strcmp(type, "IEND") != 0) {
+        uint32_t length;
+        if (fread(&length, sizeof(uint32_t), 1, in) != 1 || fread(type, sizeof(char), 4, in) != 4) {
+            // Error, IEND wasn't found!
+            ret = 4;
+            break;
+        }
+        length = convert_int_be(length);
+
+        // PNG lengths never go past 2^31 - 1
+        if (length > 0x7FFFFFFF) {
+            ret = 4;
+            break;
+        }
+
+        // new textual data goes before IDAT, so readers stopping at pixels still see it
+        if (edits_written == 0 && (strcmp(type, "IDAT") == 0 || strcmp(type, "IEND") == 0)) {
+            if (_png_fwrite_metadata_edits(out, edits) != 0) {
+                ret = 5;
+                break;
+            }
+
+            edits_written = 1;
+        }
+
+        uint32_t be_length = convert_int_be(length);
+
+        if (strcmp(type, "tEXt") == 0 || strcmp(type, "zTXt") == 0 || strcmp(type, "iTXt") == 0) {
+            // data and crc are needed anyway for a possible pass through
+            uint8_t* data = malloc(sizeof(uint8_t) * ((size_t) length + 4));
+            if (data == NULL) {
+                ret = 6;
+                break;
+            }
+
+            if (fread(data, sizeof(uint8_t), (size_t) length + 4, in) != (size_t) length + 4) {
+                free(data);
+                ret = 4;
+                break;
+            }
+
+            // keyword ends at the first null inside the chunk data, if any
+            char keyword[80] = {0};
+            size_t keyword_size = length < 79 ? length : 79;
+            const uint8_t* end = memchr(data, '\0', keyword_size);
+            memcpy(keyword, data, end != NULL ? (size_t) (end - data) : keyword_size);
+
+            if (edits->clear_text == 0 && _png_find_text_edit(edits, keyword) == NULL) {
+                int written = fwrite(&be_length, sizeof(uint32_t), 1, out) == 1
+                    && fwrite(type, sizeof(char), 4, out) == 4
+                    && fwrite(data, sizeof(uint8_t), (size_t) length + 4, out) == (size_t) length + 4;
+
+                if (!written) {
+                    ret = 5;
+                }
+            }
+
+            free(data);
+        } else if (strcmp(type, "tIME") == 0 && edits->replace_time != 0) {
+            if (_png_fskip(in, (size_t) length + 4) != 0) {
+                ret = 4;
+            }
+        } else {
+            if (fwrite(&be_length, sizeof(uint32_t), 1, out) != 1 || fwrite(type, sizeof(char), 4, out) != 4) {
+                ret = 5;
+                break;
+            }
+
+            if (media_copy_file_range(in, out, (size_t) length + 4) != 0) {
+                ret = 4;
+                break;
+            }
+        }
+    }
+
+    fclose(in);
+
+    if (fflush(out) != 0 && ret == 0) {
+        ret = 5;
+    }
+
+    if (fclose(out) != 0 && ret == 0) {
+        ret = 5;
+    }
+
+    if (ret == 0 && rename(temp_path, out_path) != 0) {
+        ret = 5;
+    }
+
+    if (ret != 0) {
+        remove(temp_path);
+    }
+
+    free(temp_path);
+
+    return ret;
+}
+
+void image_png_close(struct image_png* image) {
+    struct png_allocator allocator = image->allocator;
+
+    // arena metadata goes away with its blocks
+    if (!allocator.arena) {
+        _png_clear_trns(&allocator, &image->trns);
+
+        for (size_t i = 0; i < image->textual_list.size; i++) {
+            struct png_textual_data* textual = &image->textual_list.list[i];
+
+            if (textual->type == PNG_TEXTUAL_UNCOMPRESSED) {
+                _png_free(&allocator, textual->data.text.text);
+            } else if (textual->type == PNG_TEXTUAL_COMPRESSED) {
+                _png_free(&allocator, textual->data.ztxt.text);
+            } else if (textual->type == PNG_TEXTUAL_INTERNATIONAL) {
+                _png_free(&allocator, textual->data.itxt.language_tag);
+                _png_free(&allocator, textual->data.itxt.translated_keyword);
+                _png_free(&allocator, textual->data.itxt.text);
+            }
+        }
+        _png_free(&allocator, image->textual_list.list);
+
+        _png_free(&allocator, image->iccp.data);
+        _png_free(&allocator, image->plte.pallete);
+        _png_free(&allocator, image->palette_lut);
+    }
+
+    _png_free_chunk_IDAT(&allocator, &image->idat);
+    _png_reset_bands(&allocator, &image->bands);
+    _png_arena_release(&allocator);
+    _png_free(&allocator, image);
+}
+
+static inline uint32_t convert_int_be(uint32_t value) {
+    if (media_actual_endian() == MEDIA_BIG_ENDIAN) {
+        // no need to shift
+        return value;
+    }
+
+    uint8_t* bytes = (uint8_t *) &value;
+    return bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+}
+
+static inline uint16_t convert_short_be(uint16_t value) {
+    if (media_actual_endian() == MEDIA_BIG_ENDIAN) {
+        // no need to shift
+        return value;
+    }
+
+    uint8_t* bytes = (uint8_t *) &value;
+    return bytes[0] << 8 | bytes[1];
+}
+
+static inline uint32_t _png_get_chunk_crc32(struct image_png_chunk* chunk) {
+    uint32_t crc = MEDIA_CRC32_DEFAULT;
+    crc = media_update_crc32(crc, (uint8_t *) chunk->type, 4);
+    crc = media_update_crc32(crc, chunk->data, chunk->length);
+
+    return MEDIA_CRC32(crc);
+}
+
+static inline void _png_generate_crc32(struct image_png_chunk* chunk) {
+    chunk->crc = _png_get_chunk_crc32(chunk); 
+}
+
+static inline int _png_check_crc32(struct image_png_chunk* chunk) {
+    return chunk->crc != _png_get_chunk_crc32(chunk);
+}
+
+static inline void _png_populate_chunk(struct image_png_chunk* chunk, size_t bytes) {
+    if (chunk->data == NULL) {
+        chunk->data = malloc(bytes);
+    } else {
+        chunk->data = realloc(chunk->data, bytes);
+    }
+}
+
+static int _png_read_chunk_IHDR(struct image_png_chunk* chunk, struct image_png_chunk_IHDR* ihdr) {
+    if (chunk == NULL || chunk->length != 13 || strcmp(chunk->type, "IHDR") != 0) {
+        return 1;
+    }
+
+    if (_png_check_crc32(chunk)) {
+        return 2;
+    }
+
+    struct image_png_chunk_IHDR def_ihdr;
+    if (ihdr == NULL) {
+        ihdr = &def_ihdr;
+    }
+
+    memcpy(ihdr, chunk->data, 13);
+    ihdr->width = convert_int_be(ihdr->width);
+    ihdr->height = convert_int_be(ihdr->height);
+
+    return 0;
+}
+
+static int _png_read_chunk_PLTE(struct png_allocator* allocator, struct image_png_chunk* chunk,
+                                struct image_png_chunk_PLTE* plte) {
+    if (chunk == NULL || strcmp(chunk->type, "PLTE") != 0 || chunk->length % 3 != 0 || chunk->length / 3 > 256) {
+        return 1;
+    }
+
+    if (_png_check_crc32(chunk)) {
+        return 2;
+    }
+
+    if (plte == NULL) {
+        return 0;
+    }
+
+    plte->size = chunk->length / 3;
+
+    _png_meta_free(allocator, plte->pallete);
+    plte->pallete = _png_meta_alloc(allocator, sizeof(struct image_color) * plte->size);
+    for (uint16_t i = 0; i < plte->size; i++) {
+        struct image_color* color = &plte->pallete[i];
+
+        color->type = IMAGE_RGBA8_COLOR;
+        color->rgba8.red = chunk->data[i * 3];
+        color->rgba8.green = chunk->data[i * 3 + 1];
+        color->rgba8.blue = chunk->data[i * 3 + 2];
+        color->rgba8.alpha = 0;
+    }
+
+    return 0;
+}
+
+static int _png_read_chunk_tRNS(struct png_allocator* allocator, struct image_png_chunk* chunk,
+                                struct image_png_chunk_tRNS* trns) {
+    if (chunk == NULL || strcmp(chunk->type, "tRNS") != 0) {
+        return 1;
+    }
+
+    if (_png_check_crc32(chunk)) {
+        return 2;
+    }
+
+    if (trns == NULL) {
+        return 0;
+    }
+
+    // free some pointer if trns has some size
+    if (trns->size > 0) {
+        if (trns->type == PNG_tRNS_8BITS) {
+            _png_meta_free(allocator, trns->data_8bits);
+        } else if (trns->type == PNG_tRNS_16BITS) {
+            _png_meta_free(allocator, trns->data_16bits);
+        }
+    }
+
+    trns->type = PNG_tRNS_8BITS;
+    trns->size = chunk->length;
+    trns->data_8bits = _png_meta_alloc(allocator, sizeof(uint8_t) * trns->size);
+    memcpy(trns->data_8bits, chunk->data, chunk->length);
+
+    return 0;
+}
+
+static int _png_read_chunk_cHRM(struct image_png_chunk* chunk, struct image_png_chunk_cHRM* chrm) {
+    if (chunk == NULL || strcmp(chunk->type, "cHRM") != 0 || chunk->length != 32) {
+        return 1;
+    }
+
+    if (_png_check_crc32(chunk)) {
+        return 2;
+    }
+
+    if (chrm == NULL) {
+        return 0;
+    }
+
+    memcpy(chrm, chunk->data, sizeof(uint8_t) * 32);
+    chrm->white_px = convert_int_be(chrm->white_px);
+    chrm->white_py = convert_int_be(chrm->white_py);
+    chrm->red_x = convert_int_be(chrm->red_x);
+    chrm->red_y = convert_int_be(chrm->red_y);
+    chrm->green_x = convert_int_be(chrm->green_x);
+    chrm->green_y = convert_int_be(chrm->green_y);
+    chrm->blue_x = convert_int_be(chrm->blue_x);
+    chrm->blue_y = convert_int_be(chrm->blue_y);
+
+    return 0;
+}
+
+static int _png_read_chunk_gAMA(struct image_png_chunk* chunk, struct image_png_chunk_gAMA* gama) {
+    if (chunk == NULL || strcmp(chunk->type, "gAMA") != 0 || chunk->length != 4) {
+        return 1;
+    }
+
+    if (_png_check_crc32(chunk)) {
+        return 2;
+    }
+
+    if (gama == NULL) {
+        return 0;
+    }
+
+    memcpy(gama, chunk->data, sizeof(uint8_t) * 4);
+    gama->gamma = convert_int_be(gama->gamma);
+
+    return 0;
+}
+
+static int _png_read_chunk_iCCP(struct png_allocator* allocator, struct image_png_chunk* chunk,
+                                struct image_png_chunk_iCCP* iccp) {
+    if (chunk == NULL || strcmp(chunk->type, "iCCP") != 0) {
+        return 1;
+    }
+
+    if (_png_check_crc32(chunk)) {
+        return 2;
+    }
+
+    if (iccp == NULL) {
+        return 0;
+    }
+
+    strncpy(iccp->name, (const char*) chunk->data, 80);
+    size_t name_length = strlen(iccp->name) + 1;
+    iccp->compression = chunk->data[name_length];
+    iccp->size = chunk->length - name_length - 1;
+    _png_meta_free(allocator, iccp->data);
+    iccp->data = _png_meta_alloc(allocator, sizeof(uint8_t) * iccp->size);
+    memcpy(iccp->data, &chunk->data[name_length + 1], iccp->size);
+
+    return 0;
+}
+
+static int _png_read_chunk_sBIT(struct image_png_chunk* chunk, struct image_png_chunk_sBIT* sbit) {
+    if (chunk == NULL || strcmp(chunk->type, "sBIT") != 0) {
+        return 1;
+    }
+
+    if (_png_check_crc32(chunk)) {
+        return 2;
+    }
+
+    if (sbit == NULL) {
+        return 0;
+    }
+
+    switch (chunk->length) {
+        case 1: {
+            sbit->type = PNG_sBIT_GREY;
+            sbit->grey = chunk->data[0];
+            break;
+        }
+        case 2: {
+            sbit->type = PNG_sBIT_GREYALPHA;
+            sbit->grey = chunk->data[0];
+            sbit->alpha = chunk->data[1];
+            break;
+        }
+        case 3: {
+            sbit->type = PNG_sBIT_RGB_OR_INDEXED;
+            sbit->red = chunk->data[0];
+            sbit->green = chunk->data[1];
+            sbit->blue = chunk->data[2];
+            break;
+        }
+        case 4: {
+            sbit->type = PNG_sBIT_RGBALPHA;
+            sbit->red = chunk->data[0];
+            sbit->green = chunk->data[1];
+            sbit->blue = chunk->data[2];
+            sbit->alpha = chunk->data[3];
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int _png_read_chunk_sRGB(struct image_png_chunk* chunk, struct image_png_chunk_sRGB* srgb) {
+    if (chunk == NULL || strcmp(chunk->type, "sRGB") != 0 || chunk->length != 1) {
+        return 1;
+    }
+    
+    if (_png_check_crc32(chunk)) {
+        return 2;
+    }
+
+    if (srgb == NULL) {
+        return 0;
+    }
+
+    srgb->rendering = chunk->data[0];
+
+    return 0;
+}
+
+static int _png_read_chunk_tEXt(struct png_allocator* allocator, struct image_png_chunk* chunk,
+                                struct image_png_chunk_tEXt* text) {
+    if (chunk == NULL || strcmp(chunk->type, "tEXt") != 0) {
+        return 1;
+    }
+    
+    if (_png_check_crc32(chunk)) {
+        return 2;
+    }
+
+    if (text == NULL) {
+        return 0;
+    }
+
+    strncpy(text->keyword, (char*) chunk->data, 80);
+    size_t size = chunk->length - strlen(text->keyword);
+
+    text->text = _png_meta_strndup(allocator, (char*) &chunk->data[chunk->length - size + 1], size - 1);
+
+    return 0;
+}
+
+static int _png_read_chunk_zTXt(struct png_allocator* allocator, struct image_png_chunk* chunk,
+                                struct image_png_chunk_zTXt* ztxt) {
+    if (chunk == NULL || strcmp(chunk->type, "zTXt") != 0) {
+        return 1;
+    }
+
+    if (_png_check_crc32(chunk)) {
+        return 2;
+    }
+
+    if (ztxt == NULL) {
+        return 0;
+    }
+
+    strncpy(ztxt->keyword, (char*) chunk->data, 80);
+    size_t keyword_length = strlen(ztxt->keyword) + 1;
+    ztxt->compression = chunk->data[keyword_length];
+
+    size_t compressed_size = chunk->length - keyword_length - 1;
+    uint8_t* text;
+    size_t size;
+    media_zlib_inflate(chunk->data + keyword_length + 1, compressed_size, &text, &size);
+
+    // with a null-terminator
+    ztxt->text = _png_meta_strndup(allocator, (char*) text, size);
+    free(text);
+
+    return 0;
+}
+
+static int _png_read_chunk_iTXt(struct png_allocator* allocator, struct image_png_chunk* chunk,
+                                struct image_png_chunk_iTXt* itxt) {
+    if (chunk == NULL || strcmp(chunk->type, "iTXt") != 0) {
+        return 1;
+    }
+
+    if (_png_check_crc32(chunk)) {
+        return 2;
+    }
+
+    if (itxt == NULL) {
+        return 0;
+    }
+
+    size_t next = 0;
+
+    strncpy(itxt->keyword, (char*) chunk->data, 80);
+    next += strlen(itxt->keyword) + 1;
+
+    itxt->compression_flag = chunk->data[next++];
+    itxt->compression_method = chunk->data[next++];
+
+    itxt->language_tag = _png_meta_strdup(allocator, (char*) chunk->data + next);
+    next += strlen(itxt->language_tag) + 1;
+
+    itxt->translated_keyword = _png_meta_strdup(allocator, (char*) chunk->data + next);
+    next += strlen(itxt->translated_keyword) + 1;
+
+    itxt->text = _png_meta_strndup(allocator, (char*) chunk->data + next, chunk->length - next);
+
+    return 0;
+}
+
+static int _png_read_chunk_tIME(struct image_png_chunk* chunk, struct image_png_chunk_tIME* time) {
+    if (chunk == NULL || strcmp(chunk->type, "tIME") != 0 || chunk->length != 7) {
+        return 1;
+    }
+    
+    if (_png_check_crc32(chunk)) {
+        return 2;
+    }
+
+    if (time == NULL) {
+        return 0;
+    }
+
+    memcpy(time, chunk->data, sizeof(uint8_t) * 7);
+    time->year = convert_short_be(time->year);
+
+    return 0;
+}
+
+static void _png_write_chunk_IHDR(struct image_png_chunk_IHDR* ihdr, struct image_png_chunk* chunk) {
+    chunk->length = 13;
+    strcpy(chunk->type, "IHDR");
+    _png_populate_chunk(chunk, sizeof(uint8_t) * 13);
+
+    ihdr->width = convert_int_be(ihdr->width);
+    ihdr->height = convert_int_be(ihdr->height);
+
+    memcpy(chunk->data, ihdr, sizeof(uint8_t) * 13);
+
+    ihdr->width = convert_int_be(ihdr->width);
+    ihdr->height = convert_int_be(ihdr->height);
+
+    _png_generate_crc32(chunk);
+}
+
+static void _png_write_chunk_PLTE(struct image_png_chunk_PLTE* plte, struct image_png_chunk* chunk) {
+    uint16_t size = plte->size > 256 ? 256 : plte->size;
+    chunk->length = size * 3;
+    strcpy(chunk->type, "PLTE");
+    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+
+    for (uint16_t i = 0; i < size; i++) {
+        struct image_color* color = &plte->pallete[i];
+
+        chunk->data[i * 3] = color->rgba8.red;
+        chunk->data[i * 3 + 1] = color->rgba8.green;
+        chunk->data[i * 3 + 2] = color->rgba8.blue;
+    }
+
+    _png_generate_crc32(chunk);
+}
+
+static void _png_write_chunk_tRNS(struct image_png_chunk_tRNS* trns, struct image_png_chunk* chunk) {
+    chunk->length = trns->size;
+    strcpy(chunk->type, "tRNS");
+    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+
+    memcpy(chunk->data, trns->data_8bits, sizeof(uint8_t) * chunk->length);
+
+    _png_generate_crc32(chunk);
+}
+
+static void _png_write_chunk_cHRM(struct image_png_chunk_cHRM* chrm, struct image_png_chunk* chunk) {
+    chunk->length = 32;
+    strcpy(chunk->type, "cHRM");
+    _png_populate_chunk(chunk, sizeof(uint8_t) * 32);
+
+    chrm->white_px = convert_int_be(chrm->white_px);
+    chrm->white_py = convert_int_be(chrm->white_py);
+    chrm->red_x = convert_int_be(chrm->red_x);
+    chrm->red_y = convert_int_be(chrm->red_y);
+    chrm->green_x = convert_int_be(chrm->green_x);
+    chrm->green_y = convert_int_be(chrm->green_y);
+    chrm->blue_x = convert_int_be(chrm->blue_x);
+    chrm->blue_y = convert_int_be(chrm->blue_y);
+
+    memcpy(chunk->data, chrm, sizeof(uint8_t) * 32);
+
+    chrm->white_px = convert_int_be(chrm->white_px);
+    chrm->white_py = convert_int_be(chrm->white_py);
+    chrm->red_x = convert_int_be(chrm->red_x);
+    chrm->red_y = convert_int_be(chrm->red_y);
+    chrm->green_x = convert_int_be(chrm->green_x);
+    chrm->green_y = convert_int_be(chrm->green_y);
+    chrm->blue_x = convert_int_be(chrm->blue_x);
+    chrm->blue_y = convert_int_be(chrm->blue_y);
+
+    _png_generate_crc32(chunk);
+}
+
+static void _png_write_chunk_gAMA(struct image_png_chunk_gAMA* gama, struct image_png_chunk* chunk) {
+    chunk->length = 4;
+    strcpy(chunk->type, "gAMA");
+    _png_populate_chunk(chunk, sizeof(uint8_t) * 4);
+
+    gama->gamma = convert_int_be(gama->gamma);
+    memcpy(chunk->data, gama, sizeof(uint8_t) * 4);
+    gama->gamma = convert_int_be(gama->gamma);
+
+    _png_generate_crc32(chunk);
+}
+
+static void _png_write_chunk_iCCP(struct image_png_chunk_iCCP* iccp, struct image_png_chunk* chunk) {
+    chunk->length = strlen(iccp->name) + iccp->size + 2;
+    strcpy(chunk->type, "iCCP");
+    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+
+    strncpy((char*) chunk->data, iccp->name, chunk->length - iccp->size - 1);
+    size_t name_length = strlen(iccp->name) + 1;
+    chunk->data[name_length] = iccp->compression;
+    memcpy(&chunk->data[name_length + 1], iccp->data, iccp->size);
+
+    _png_generate_crc32(chunk);
+}
+
+static void _png_write_chunk_sBIT(struct image_png_chunk_sBIT* sbit, struct image_png_chunk* chunk) {
+    strcpy(chunk->type, "sBIT");
+
+    switch (sbit->type) {
+        case PNG_sBIT_GREY:
+        case PNG_sBIT_GREYALPHA: {
+            chunk->length = sbit->type == PNG_sBIT_GREYALPHA ? 2 : 1;
+            _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+
+            chunk->data[0] = sbit->grey;
+            if (sbit->type == PNG_sBIT_GREYALPHA) {
+                chunk->data[1] = sbit->alpha;
+            }
+
+            break;
+        }
+        case PNG_sBIT_RGB_OR_INDEXED:
+        case PNG_sBIT_RGBALPHA: {
+            chunk->length = sbit->type == PNG_sBIT_RGBALPHA ? 4 : 3;
+            _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+
+            chunk->data[0] = sbit->red;
+            chunk->data[1] = sbit->green;
+            chunk->data[2] = sbit->blue;
+            if (sbit->type == PNG_sBIT_RGBALPHA) {
+                chunk->data[3] = sbit->alpha;
+            }
+
+            break;
+        }
+    }
+
+    _png_generate_crc32(chunk);
+}
+
+static void _png_write_chunk_sRGB(struct image_png_chunk_sRGB* srgb, struct image_png_chunk* chunk) {
+    chunk->length = 1;
+    strcpy(chunk->type, "sRGB");
+    _png_populate_chunk(chunk, sizeof(uint8_t));
+
+    chunk->data[0] = srgb->rendering;
+
+    _png_generate_crc32(chunk);
+}
+
+static void _png_write_chunk_tEXt(struct image_png_chunk_tEXt* text, struct image_png_chunk* chunk) {
+    // null-terminator should not be included
+    size_t size = strlen(text->text);
+    chunk->length = strlen(text->keyword) + size + 1;
+    strcpy(chunk->type, "tEXt");
+    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+
+    memcpy(chunk->data, text->keyword, chunk->length - size);
+    memcpy(&chunk->data[chunk->length - size], text->text, size);
+
+    _png_generate_crc32(chunk);
+}
+
+static void _png_write_chunk_zTXt(struct image_png_chunk_zTXt* ztxt, struct image_png_chunk* chunk) {
+    chunk->length = strlen(ztxt->keyword) + 2;
+    strcpy(chunk->type, "zTXt");
+    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+
+    strncpy((char*) chunk->data, ztxt->keyword, chunk->length - 1);
+    size_t keyword_length = chunk->length - 1;
+    chunk->data[keyword_length] = ztxt->compression;
+
+    uint8_t* compressed;
+    size_t compressed_size;
+    // null terminator is not included in this deflate
+    media_zlib_deflate((uint8_t*) ztxt->text, strlen(ztxt->text), &compressed, &compressed_size, Z_BEST_COMPRESSION);
+
+    chunk->length += compressed_size;
+    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+    memcpy(&chunk->data[keyword_length + 1], compressed, compressed_size);
+    
+    free(compressed);
+
+    _png_generate_crc32(chunk);
+}
+
+static void _png_write_chunk_iTXt(struct image_png_chunk_iTXt* itxt, struct image_png_chunk* chunk) {
+    size_t keyword_length = strlen(itxt->keyword) + 1;
+    size_t language_tag_length = strlen(itxt->language_tag) + 1;
+    size_t translated_keyword_length = strlen(itxt->translated_keyword) + 1;
+    size_t text_length = strlen(itxt->text);
+
+    chunk->length = keyword_length + language_tag_length + translated_keyword_length + text_length + 2;
+    strcpy(chunk->type, "iTXt");
+    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+
+    size_t next = 0;
+
+    strncpy((char*) chunk->data, itxt->keyword, keyword_length);
+    next += keyword_length;
+
+    chunk->data[next++] = itxt->compression_flag;
+    chunk->data[next++] = itxt->compression_method;
+
+    memcpy(chunk->data + next, itxt->language_tag, language_tag_length);
+    next += language_tag_length;
+
+    memcpy(chunk->data + next, itxt->translated_keyword, translated_keyword_length);
+    next += translated_keyword_length;
+
+    memcpy(chunk->data + next, itxt->text, text_length);
+
+    _png_generate_crc32(chunk);
+}
+
+static void _png_write_chunk_tIME(struct image_png_chunk_tIME* time, struct image_png_chunk* chunk) {
+    chunk->length = 7;
+    strcpy(chunk->type, "tIME");
+    _png_populate_chunk(chunk, sizeof(uint8_t) * 7);
+
+    time->year = convert_short_be(time->year);
+    memcpy(chunk->data, time, sizeof(uint8_t) * 7);
+    time->year = convert_short_be(time->year);
+
+    _png_generate_crc32(chunk);
+}
+
+static void _png_write_chunk_IDAT(struct image_png_chunk_IDAT* idat, struct image_png_chunk* chunk) {
+    strcpy(chunk->type, "IDAT");
+
+    if (chunk->data != NULL) {
+        free(chunk->data);
+    }
+
+    size_t length;
+    media_zlib_deflate(idat->data, idat->size, &chunk->data, &length, Z_BEST_COMPRESSION);
+    chunk->length = length;
+
+    _png_generate_crc32(chunk);
+}
+
+static int _png_write_chunk_IDAT_bands(struct png_allocator* allocator, struct image_png_chunk_IHDR* ihdr,
+                                       struct image_png_chunk_IDAT* idat, struct png_idat_bands* bands,
+                                       struct image_png_chunk* chunk) {
+    // zlib header for deflate with 32K window and best compression
+    static const uint8_t ZLIB_HEADER[2] = {0x78, 0xDA};
+    // final deflate block with fixed huffman codes and nothing else than end-of-block
+    static const uint8_t DEFLATE_FINAL_BLOCK[2] = {0x03, 0x00};
+
+    uint32_t pixel_size = PNG_BITS_TYPE[ihdr->color][ihdr->depth] / 8;
+    size_t row_size = (size_t) ihdr->width * pixel_size;
+    uint32_t size = (ihdr->height + bands->rows - 1) / bands->rows;
+
+    if (bands->size != size) {
+        _png_reset_bands(allocator, bands);
+
+        bands->list = _png_malloc(allocator, sizeof(struct png_idat_band) * size);
+        if (bands->list == NULL) {
+            return 1;
+        }
+
+        bands->size = size;
+        memset(bands->list, 0, sizeof(struct png_idat_band) * size);
+
+        for (uint32_t i = 0; i < size; i++) {
+            bands->list[i].dirty = 1;
+        }
+    }
+
+    uint8_t* scanlines = _png_malloc(allocator, sizeof(uint8_t) * (row_size + 1) * bands->rows);
+    if (scanlines == NULL) {
+        return 1;
+    }
+
+    int ret = 0;
+
+    for (uint32_t i = 0; i < size; i++) {
+        struct png_idat_band* band = &bands->list[i];
+        if (band->dirty == 0) {
+            continue;
+        }
+
+        uint32_t first_row = i * bands->rows;
+        uint32_t rows = ihdr->height - first_row < bands->rows ? ihdr->height - first_row : bands->rows;
+
+        // encoder only writes filter 0, so the first scanline of a band never
+        // depends on the band above and bands stay independent of each other
+        for (uint32_t y = 0; y < rows; y++) {
+            uint8_t* scanline = &scanlines[y * (row_size + 1)];
+            scanline[0] = 0;
+            memcpy(scanline + 1, &idat->data[(first_row + y) * idat->stride], row_size);
+            _png_swap_row16(ihdr, scanline + 1, row_size);
+        }
+
+        band->raw_size = (row_size + 1) * rows;
+        band->adler = adler32(adler32(0, NULL, 0), scanlines, band->raw_size);
+
+        free(band->data);
+        if (media_zlib_deflate_raw(scanlines, band->raw_size, &band->data, &band->size, Z_BEST_COMPRESSION) != 0) {
+            ret = 2;
+            continue;
+        }
+
+        band->dirty = 0;
+    }
+
+    _png_free(allocator, scanlines);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    size_t length = sizeof(ZLIB_HEADER) + sizeof(DEFLATE_FINAL_BLOCK) + sizeof(uint32_t);
+    for (uint32_t i = 0; i < size; i++) {
+        length += bands->list[i].size;
+    }
+
+    strcpy(chunk->type, "IDAT");
+    chunk->length = length;
+    _png_populate_chunk(chunk, sizeof(uint8_t) * length);
+    if (chunk->data == NULL) {
+        return 1;
+    }
+
+    size_t next = 0;
+    memcpy(chunk->data, ZLIB_HEADER, sizeof(ZLIB_HEADER));
+    next += sizeof(ZLIB_HEADER);
+
+    uint32_t adler = adler32(0, NULL, 0);
+    for (uint32_t i = 0; i < size; i++) {
+        struct png_idat_band* band = &bands->list[i];
+
+        memcpy(chunk->data + next, band->data, band->size);
+        next += band->size;
+
+        adler = adler32_combine(adler, band->adler, band->raw_size);
+    }
+
+    memcpy(chunk->data + next, DEFLATE_FINAL_BLOCK, sizeof(DEFLATE_FINAL_BLOCK));
+    next += sizeof(DEFLATE_FINAL_BLOCK);
+
+    adler = convert_int_be(adler);
+    memcpy(chunk->data + next, &adler, sizeof(uint32_t));
+
+    _png_generate_crc32(chunk);
+
+    return 0;
+}
+
+static void _png_convert_chunk_tRNS(struct png_allocator* allocator, struct image_png_chunk_tRNS* trns,
+                                    enum image_png_trns_type type) {
+    // nothing to do
+    if (trns->type == type) {
+        return;
+    }
+
+    switch (type) {
+        case PNG_tRNS_8BITS: {
+            uint8_t* data_8bits = _png_meta_alloc(allocator, sizeof(uint8_t) * trns->size * 2);
+
+            for (size_t i = 0; i < trns->size; i++) {
+                uint16_t byte = convert_int_be(trns->data_16bits[i]);
+
+                data_8bits[i * 2] = byte;
+                data_8bits[i * 2 + 1] = (byte >> 8) & 0xFF;
+            }
+
+            _png_meta_free(allocator, trns->data_16bits);
+            trns->data_8bits = data_8bits;
+            break;
+        }
+        case PNG_tRNS_16BITS: {
+            uint16_t* data_16bits = _png_meta_alloc(allocator, sizeof(uint16_t) * trns->size / 2);
+
+            for (size_t i = 0; i < trns->size; i++) {
+                data_16bits[i] = convert_int_be(trns->data_8bits[i * 2] | (trns->data_8bits[i * 2 + 1] >> 8));
+            }
+            
+            _png_meta_free(allocator, trns->data_8bits);
+            trns->data_16bits = data_16bits;
+            break;
+        }
+    }
+}
+
+static int _png_IDAT_to_scanlines(struct image_png_chunk_IHDR* ihdr, struct image_png_chunk_IDAT* idat) {
+    uint8_t* pixels = idat->data;
+    size_t row_size = _png_row_size(ihdr);
+    size_t size = (row_size + 1) * ihdr->height;
+
+    uint8_t* scanlines = malloc(sizeof(uint8_t) * size);
+    if (scanlines == NULL) {
+        return 1;
+    }
+
+    idat->type = PNG_IDAT_SCANLINES;
+    idat->size = size;
+    idat->data = scanlines;
+
+    // for now, all scanlines are filtered to 0
+
+    for (uint32_t y = 0; y < ihdr->height; y++) {
+        uint8_t* scanline = &idat->data[y * (row_size + 1)];
+
+        // set filter to scanline
+        scanline[0] = 0;
+        memcpy(scanline + 1, &pixels[y * idat->stride], row_size);
+        _png_swap_row16(ihdr, scanline + 1, row_size);
+    }
+
+    return 0;
+}
+
+static int _png_decoder_init(struct png_decoder* decoder, struct image_png* image,
+                             const struct image_decode_options* options) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+
+    decoder->ihdr = *ihdr;
+    decoder->allocator = &image->allocator;
+    decoder->pixel_size = PNG_BITS_TYPE[ihdr->color][ihdr->depth] / 8;
+    decoder->row_size = _png_row_size(ihdr);
+    decoder->format = _png_ihdr_format(ihdr);
+
+    struct image_png_chunk_IHDR new_ihdr = *ihdr;
+
+    if (options->expand_palette && ihdr->color == 3) {
+        decoder->lut = _png_palette_lut(image);
+        if (decoder->lut == NULL) {
+            return 1;
+        }
+
+        decoder->format = MEDIA_PIXEL_RGBA8;
+        new_ihdr.color = 6;
+        new_ihdr.depth = 8;
+    }
+
+    struct image_rect* region = &decoder->region;
+    *region = (struct image_rect) {0, 0, ihdr->width, ihdr->height};
+
+    if (options->region.width != 0 && options->region.height != 0) {
+        if (options->region.x >= ihdr->width || options->region.y >= ihdr->height) {
+            return 4;
+        }
+
+        *region = options->region;
+        region->width = region->width < ihdr->width - region->x ? region->width : ihdr->width - region->x;
+        region->height = region->height < ihdr->height - region->y ? region->height : ihdr->height - region->y;
+        decoder->stop_early = 1;
+    }
+
+    uint32_t factor = options->factor > 1 ? options->factor : 1;
+
+    if (options->max_width != 0 && options->max_height != 0) {
+        uint32_t fit_width = (uint32_t) (((uint64_t) region->width + options->max_width - 1) / options->max_width);
+        uint32_t fit_height = (uint32_t) (((uint64_t) region->height + options->max_height - 1) / options->max_height);
+
+        factor = fit_width > factor ? fit_width : factor;
+        factor = fit_height > factor ? fit_height : factor;
+    }
+
+    // indexes can't be averaged, so they're kept at full size
+    if (decoder->format == MEDIA_PIXEL_INDEXED8) {
+        factor = 1;
+    }
+
+    decoder->factor = factor;
+    new_ihdr.width = (uint32_t) (((uint64_t) region->width + factor - 1) / factor);
+    new_ihdr.height = (uint32_t) (((uint64_t) region->height + factor - 1) / factor);
+
+    decoder->scanline = _png_malloc(&image->allocator, decoder->row_size + 1);
+    decoder->rows = _png_calloc(&image->allocator, decoder->row_size * 2, sizeof(uint8_t));
+
+    if (factor > 1) {
+        decoder->sums = _png_calloc(&image->allocator, (size_t) new_ihdr.width * media_pixel_channels(decoder->format),
+                                    sizeof(uint64_t));
+        decoder->native = _png_malloc(&image->allocator, (size_t) region->width * media_pixel_size(decoder->format));
+    }
+
+    if (decoder->scanline == NULL || decoder->rows == NULL
+        || (factor > 1 && (decoder->sums == NULL || decoder->native == NULL))
+        || _png_alloc_pixels(&image->allocator, &new_ihdr, &image->idat) != 0) {
+        _png_decoder_end(decoder, NULL);
+        return 2;
+    }
+
+    if (inflateInit(&decoder->stream) != Z_OK) {
+        _png_decoder_end(decoder, NULL);
+        return 3;
+    }
+
+    *ihdr = new_ihdr;
+
+    if (decoder->lut != NULL) {
+        // alpha is in the pixels now
+        _png_clear_trns(&image->allocator, &image->trns);
+    }
+
+    decoder->ready = 1;
+    decoder->done = ihdr->height == 0;
+
+    return 0;
+}
+
+static void _png_decoder_feed(struct png_decoder* decoder, struct image_png* image, uint8_t* data, size_t size) {
+    z_stream* stream = &decoder->stream;
+    stream->next_in = data;
+    stream->avail_in = size;
+
+    while (!decoder->done) {
+        stream->next_out = decoder->scanline + decoder->filled;
+        stream->avail_out = decoder->row_size + 1 - decoder->filled;
+
+        int ret = inflate(stream, Z_NO_FLUSH);
+        decoder->filled = decoder->row_size + 1 - stream->avail_out;
+
+        if (decoder->filled == decoder->row_size + 1) {
+            _png_decoder_row(decoder, image);
+            decoder->filled = 0;
+        }
+
+        if (ret == Z_STREAM_END || (ret != Z_OK && ret != Z_BUF_ERROR)
+            || decoder->y == decoder->region.y + decoder->region.height) {
+            decoder->done = 1;
+        } else if (stream->avail_in == 0 && stream->avail_out != 0) {
+            // the rest of the row is in next chunks
+            break;
+        }
+    }
+}
+
+static void _png_decoder_row(struct png_decoder* decoder, struct image_png* image) {
+    size_t row_size = decoder->row_size;
+    uint32_t y = decoder->y++;
+
+    uint8_t* row = &decoder->rows[(y % 2) * row_size];
+    uint8_t* prior = y > 0 ? &decoder->rows[((y + 1) % 2) * row_size] : NULL;
+
+    _png_defilter_row(decoder->scanline[0], &decoder->scanline[1], prior, row, row_size, decoder->pixel_size);
+
+    // rows above region are only needed to defilter the next ones
+    struct image_rect* region = &decoder->region;
+    if (y < region->y) {
+        return;
+    }
+
+    y -= region->y;
+
+    // it's already in pixels without averaging, otherwise it goes through native first
+    uint8_t* native = decoder->factor > 1 ? decoder->native : _png_row(image, y);
+    const uint8_t* first = &row[(size_t) region->x * decoder->pixel_size];
+
+    if (decoder->lut != NULL) {
+        media_expand_indexed(first, decoder->lut, native, region->width);
+    } else {
+        size_t size = (size_t) region->width * decoder->pixel_size;
+
+        memcpy(native, first, size);
+        _png_swap_row16(&decoder->ihdr, native, size);
+    }
+
+    if (decoder->factor > 1) {
+        media_box_accumulate(decoder->format, native, region->width, decoder->factor, decoder->sums);
+
+        if ((y + 1) % decoder->factor == 0) {
+            media_box_resolve(decoder->format, decoder->sums, region->width, decoder->factor,
+                              decoder->factor, _png_row(image, y / decoder->factor));
+        }
+    }
+}
+
+static void _png_decoder_end(struct png_decoder* decoder, struct image_png* image) {
+    // rows of the last block, or up to where data was truncated. missing rows are left to 0
+    if (image != NULL && decoder->factor > 1 && decoder->y > decoder->region.y) {
+        uint32_t rows = decoder->y - decoder->region.y;
+
+        if (rows % decoder->factor != 0) {
+            media_box_resolve(decoder->format, decoder->sums, decoder->region.width, decoder->factor,
+                              rows % decoder->factor, _png_row(image, rows / decoder->factor));
+        }
+    }
+
+    if (decoder->ready) {
+        inflateEnd(&decoder->stream);
+    }
+
+    // nothing was allocated if the decoder never got to init
+    if (decoder->allocator != NULL) {
+        _png_free(decoder->allocator, decoder->scanline);
+        _png_free(decoder->allocator, decoder->rows);
+        _png_free(decoder->allocator, decoder->sums);
+        _png_free(decoder->allocator, decoder->native);
+    }
+    memset(decoder, 0, sizeof(struct png_decoder));
+}
+
+static size_t _png_stride(struct image_png_chunk_IHDR* ihdr, struct image_png_chunk_IDAT* idat) {
+    size_t alignment = idat->alignment != 0 ? idat->alignment : 1;
+    size_t row_size = _png_row_size(ihdr);
+
+    size_t stride = row_size > idat->min_stride ? row_size : idat->min_stride;
+    return (stride + alignment - 1) / alignment * alignment;
+}
+
+static int _png_alloc_pixels(struct png_allocator* allocator, struct image_png_chunk_IHDR* ihdr,
+                             struct image_png_chunk_IDAT* idat) {
+    size_t stride = _png_stride(ihdr, idat);
+
+    size_t size = stride * ihdr->height;
+    uint8_t* data = _png_aligned_alloc(allocator, idat->alignment, sizeof(uint8_t) * size);
+    if (data == NULL) {
+        return 1;
+    }
+
+    memset(data, 0, sizeof(uint8_t) * size);
+
+    idat->type = PNG_IDAT_PIXELS;
+    idat->stride = stride;
+    idat->size = size;
+    idat->data = data;
+
+    return 0;
+}
+
+static void _png_defilter_row(uint8_t filter, const uint8_t* scanline, const uint8_t* prior,
+                              uint8_t* row, size_t size, uint32_t bpp) {
+    size_t first = bpp < size ? bpp : size;
+
+    switch (filter) {
+        case 1: {
+            // sub
+            memcpy(row, scanline, first);
+            for (size_t i = bpp; i < size; i++) {
+                row[i] = scanline[i] + row[i - bpp];
+            }
+
+            break;
+        }
+        case 2: {
+            // up
+            if (prior == NULL) {
+                memcpy(row, scanline, size);
+                break;
+            }
+
+            for (size_t i = 0; i < size; i++) {
+                row[i] = scanline[i] + prior[i];
+            }
+
+            break;
+        }
+        case 3: {
+            // average
+            for (size_t i = 0; i < size; i++) {
+                uint32_t a = i >= bpp ? row[i - bpp] : 0;
+                uint32_t b = prior != NULL ? prior[i] : 0;
+                row[i] = scanline[i] + ((a + b) >> 1);
+            }
+
+            break;
+        }
+        case 4: {
+            // paeth
+            for (size_t i = 0; i < size; i++) {
+                int32_t a = i >= bpp ? row[i - bpp] : 0;
+                int32_t b = prior != NULL ? prior[i] : 0;
+                int32_t c = i >= bpp && prior != NULL ? prior[i - bpp] : 0;
+
+                int32_t p = a + b - c;
+                int32_t pa = abs(p - a);
+                int32_t pb = abs(p - b);
+                int32_t pc = abs(p - c);
+
+                uint8_t predictor = pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+                row[i] = scanline[i] + predictor;
+            }
+
+            break;
+        }
+        default: {
+            memcpy(row, scanline, size);
+            break;
+        }
+    }
+}
+
+static inline enum image_png_sbit_type _png_color_to_sbit(uint8_t color) {
+    switch (color) {
+        case 0: return PNG_sBIT_GREY;
+        case 2:
+        case 3: return PNG_sBIT_RGB_OR_INDEXED;
+        case 4: return PNG_sBIT_GREYALPHA;
+        case 6: return PNG_sBIT_RGBALPHA;
+    }
+
+    return PNG_sBIT_GREY;
+}
+
+static inline int _png_check_chrm(struct image_png_chunk_cHRM* chrm) {
+    return chrm->white_px != 0 || chrm->white_py != 0 || chrm->red_x != 0 || chrm->red_y != 0
+        || chrm->green_x != 0 || chrm->green_y != 0 || chrm->blue_x != 0 || chrm->blue_y != 0;
+}
+
+static inline int _png_check_iccp(struct image_png_chunk_iCCP* iccp) {
+    return strcmp(iccp->name, "") != 0 || iccp->size > 0;
+}
+
+static inline int _png_check_sbit(struct image_png_chunk_sBIT* sbit) {
+    switch (sbit->type) {
+        case PNG_sBIT_GREY: return sbit->grey != 0;
+        case PNG_sBIT_RGB_OR_INDEXED: return sbit->red != 0 || sbit->green != 0 || sbit->blue != 0;
+        case PNG_sBIT_GREYALPHA: return sbit->grey != 0 || sbit->alpha != 0;
+        case PNG_sBIT_RGBALPHA: return sbit->red != 0 || sbit->green != 0 || sbit->blue != 0 || sbit->alpha != 0;
+    }
+
+    return 0;
+}
+
+static inline int _png_check_time(struct image_png_chunk_tIME* time) {
+    return time->year != 0 || time->month != 0 || time->day != 0 || time->hour != 0 || time->minute != 0 || time->second != 0;
+}
+
+static void _png_add_text(struct png_allocator* allocator, struct png_textual_list* list,
+                          struct png_textual_data* textual) {
+    uint32_t index = list->size;
+    list->size++;
+
+    list->list = _png_meta_realloc(allocator, list->list, sizeof(struct png_textual_data) * list->size);
+
+    memcpy(&list->list[index], textual, sizeof(struct png_textual_data));
+}
+
+static void _png_get_text(struct png_textual_list* list,
+                                 const char* keyword,
+                                 struct png_textual_data** out_textual,
+                                 uint32_t* index) {
+    for (uint32_t i = 0; i < list->size; i++) {
+        struct png_textual_data* textual = &list->list[i];
+        char* keyword;
+
+        if (textual->type == PNG_TEXTUAL_UNCOMPRESSED) {
+            keyword = textual->data.text.keyword;
+        } else if (textual->type == PNG_TEXTUAL_COMPRESSED) {
+            keyword = textual->data.ztxt.keyword;
+        } else if (textual->type == PNG_TEXTUAL_INTERNATIONAL) {
+            keyword = textual->data.itxt.keyword;
+        }
+
+        if (strcmp(keyword, keyword) != 0) {
+            continue;
+        }
+
+        *out_textual = textual;
+        if (index != NULL) {
+            *index = i;
+        }
+        
+        return;
+    }
+
+    *out_textual = NULL;
+    if (index != NULL) {
+        *index = 0;
+    }
+}
+
+static void _png_sub_text(struct png_allocator* allocator, struct png_textual_list* list,
+                          const char* keyword) {
+    struct png_textual_data* textual;
+    uint32_t index;
+
+    _png_get_text(list, keyword, &textual, &index);
+
+    // not found, ignore it
+    if (textual == NULL) {
+        return;
+    }
+
+    switch (textual->type) {
+        case PNG_TEXTUAL_UNCOMPRESSED: {
+            _png_meta_free(allocator, textual->data.text.text);
+            break;
+        }
+        case PNG_TEXTUAL_COMPRESSED: {
+            _png_meta_free(allocator, textual->data.ztxt.text);
+            break;
+        }
+        case PNG_TEXTUAL_INTERNATIONAL: {
+            _png_meta_free(allocator, textual->data.itxt.language_tag);
+            _png_meta_free(allocator, textual->data.itxt.translated_keyword);
+            _png_meta_free(allocator, textual->data.itxt.text);
+            break;
+        }
+    }
+
+    list->size--;
+
+    if (list->size == 0) {
+        _png_meta_free(allocator, list->list);
+        list->list = NULL; 
+    } else if (index == list->size) {
+        list->list = _png_meta_realloc(allocator, list->list, sizeof(struct png_textual_data) * list->size);
+    } else {
+        memmove(&list->list[index], &list->list[index + 1], sizeof(struct png_textual_data) * (list->size - index));
+    }
+}
+
+static inline void _png_free_chunk_IDAT(struct png_allocator* allocator, struct image_png_chunk_IDAT* idat) {
+    _png_aligned_free(allocator, idat->data);
+}
+
+static void _png_reset_bands(struct png_allocator* allocator, struct png_idat_bands* bands) {
+    for (uint32_t i = 0; i < bands->size; i++) {
+        free(bands->list[i].data);
+    }
+
+    _png_free(allocator, bands->list);
+    bands->list = NULL;
+    bands->size = 0;
+}
+
+static inline void _png_touch_rows(struct image_png* image, uint32_t y, uint32_t rows) {
+    struct png_idat_bands* bands = &image->bands;
+    if (bands->size == 0 || rows == 0 || y >= image->ihdr.height) {
+        return;
+    }
+
+    uint32_t last = y + rows - 1 < image->ihdr.height ? y + rows - 1 : image->ihdr.height - 1;
+    for (uint32_t i = y / bands->rows; i <= last / bands->rows; i++) {
+        bands->list[i].dirty = 1;
+    }
+}
+
+static int _png_fwrite_chunk(FILE* file, struct image_png_chunk* chunk) {
+    uint32_t length = convert_int_be(chunk->length);
+    uint32_t crc = convert_int_be(chunk->crc);
+
+    int written = fwrite(&length, sizeof(uint32_t), 1, file) == 1
+        && fwrite(chunk->type, sizeof(char), 4, file) == 4
+        && fwrite(chunk->data, sizeof(uint8_t), chunk->length, file) == chunk->length
+        && fwrite(&crc, sizeof(uint32_t), 1, file) == 1;
+
+    return written ? 0 : 1;
+}
+
+static int _png_fskip(FILE* file, size_t size) {
+    uint8_t buffer[4096];
+
+    while (size > 0) {
+        size_t block = size < sizeof(buffer) ? size : sizeof(buffer);
+
+        if (fread(buffer, sizeof(uint8_t), block, file) != block) {
+            return 1;
+        }
+
+        size -= block;
+    }
+
+    return 0;
+}
+
+static const struct image_text_edit* _png_find_text_edit(const struct image_metadata_edits* edits,
+                                                         const char* keyword) {
+    for (uint32_t i = 0; i < edits->text_size; i++) {
+        if (strcmp(edits->texts[i].keyword, keyword) == 0) {
+            return &edits->texts[i];
+        }
+    }
+
+    return NULL;
+}
+
+static int _png_fwrite_metadata_edits(FILE* file, const struct image_metadata_edits* edits) {
+    int ret = 0;
+
+    for (uint32_t i = 0; i < edits->text_size && ret == 0; i++) {
+        const struct image_text_edit* edit = &edits->texts[i];
+
+        struct image_png_chunk chunk;
+        memset(&chunk, 0, sizeof(struct image_png_chunk));
+
+        char keyword[80] = {0};
+        strncpy(keyword, edit->keyword, 79);
+
+        char* text = (char*) (edit->text != NULL ? edit->text : "");
+
+        switch (edit->action) {
+            case IMAGE_TEXT_SET: {
+                if (edit->compress >= 0) {
+                    struct image_png_chunk_zTXt ztxt;
+                    memcpy(ztxt.keyword, keyword, 80);
+                    ztxt.compression = edit->compress;
+                    ztxt.text = text;
+
+                    _png_write_chunk_zTXt(&ztxt, &chunk);
+                } else {
+                    struct image_png_chunk_tEXt ptext;
+                    memcpy(ptext.keyword, keyword, 80);
+                    ptext.text = text;
+
+                    _png_write_chunk_tEXt(&ptext, &chunk);
+                }
+
+                break;
+            }
+            case IMAGE_TEXT_SET_ITXT: {
+                struct image_png_chunk_iTXt itxt;
+                memcpy(itxt.keyword, keyword, 80);
+                itxt.compression_flag = edit->compression_flag < 0 ? 0 : edit->compression_flag;
+                itxt.compression_method = edit->compression_method < 0 ? 0 : edit->compression_method;
+                itxt.language_tag = (char*) (edit->language_tag != NULL ? edit->language_tag : "");
+                itxt.translated_keyword = (char*) (edit->translated_keyword != NULL ? edit->translated_keyword : "");
+                itxt.text = text;
+
+                _png_write_chunk_iTXt(&itxt, &chunk);
+                break;
+            }
+            case IMAGE_TEXT_DELETE: {
+                continue;
+            }
+        }
+
+        ret = _png_fwrite_chunk(file, &chunk);
+        free(chunk.data);
+    }
+
+    if (ret == 0 && edits->replace_time != 0) {
+        struct image_png_chunk_tIME time;
+        time.year = edits->time.year;
+        time.month = edits->time.month;
+        time.day = edits->time.day;
+        time.hour = edits->time.hour;
+        time.minute = edits->time.minute;
+        time.second = edits->time.second;
+
+        if (_png_check_time(&time) != 0) {
+            struct image_png_chunk chunk;
+            memset(&chunk, 0, sizeof(struct image_png_chunk));
+
+            _png_write_chunk_tIME(&time, &chunk);
+            ret = _png_fwrite_chunk(file, &chunk);
+            free(chunk.data);
+        }
     }
 
-    srgb->rendering = chunk->data[0];
-
-    return 0;
+    return ret;
 }
 
-static int _png_read_chunk_tEXt(struct image_png_chunk* chunk, struct image_png_chunk_tEXt* text) {
-    if (chunk == NULL || strcmp(chunk->type, "tEXt") != 0) {
-        return 1;
+static inline enum media_pixel_format _png_ihdr_format(struct image_png_chunk_IHDR* ihdr) {
+    int wide = ihdr->depth == 16;
+
+    switch (ihdr->color) {
+        case 0: return wide ? MEDIA_PIXEL_G16 : MEDIA_PIXEL_G8;
+        case 2: return wide ? MEDIA_PIXEL_RGB16 : MEDIA_PIXEL_RGB8;
+        case 3: return MEDIA_PIXEL_INDEXED8;
+        case 4: return wide ? MEDIA_PIXEL_GA16 : MEDIA_PIXEL_GA8;
+        case 6: return wide ? MEDIA_PIXEL_RGBA16 : MEDIA_PIXEL_RGBA8;
     }
-    
-    if (_png_check_crc32(chunk)) {
-        return 2;
+
+    return MEDIA_PIXEL_G8;
+}
+
+static inline enum media_pixel_format _png_color_format(enum image_color_type type) {
+    int alpha = (type & IMAGE_ALPHA_BIT) != 0;
+
+    switch (IMAGE_IGNORE_ALPHA(type)) {
+        case IMAGE_RGBA8_COLOR: return alpha ? MEDIA_PIXEL_RGBA8 : MEDIA_PIXEL_RGB8;
+        case IMAGE_RGBA16_COLOR: return alpha ? MEDIA_PIXEL_RGBA16 : MEDIA_PIXEL_RGB16;
+        case IMAGE_GRAY8_COLOR: return alpha ? MEDIA_PIXEL_GA8 : MEDIA_PIXEL_G8;
+        case IMAGE_GRAY16_COLOR: return alpha ? MEDIA_PIXEL_GA16 : MEDIA_PIXEL_G16;
+        case IMAGE_INDEXED_COLOR: return MEDIA_PIXEL_INDEXED8;
     }
 
-    if (text == NULL) {
-        return 0;
+    return MEDIA_PIXEL_G8;
+}
+
+static inline size_t _png_row_size(struct image_png_chunk_IHDR* ihdr) {
+    return (size_t) ihdr->width * (PNG_BITS_TYPE[ihdr->color][ihdr->depth] / 8);
+}
+
+static inline enum media_luma _png_luma(struct image_png* image) {
+    switch (image->luma) {
+        case IMAGE_LUMA_BT601: return MEDIA_LUMA_BT601;
+        case IMAGE_LUMA_BT709: return MEDIA_LUMA_BT709;
+        default: return MEDIA_LUMA_AVERAGE;
     }
+}
 
-    strncpy(text->keyword, (char*) chunk->data, 80);
-    size_t size = chunk->length - strlen(text->keyword);
+static void _png_convert_row(struct image_png* image, enum media_pixel_format src_format, const uint8_t* src,
+                             enum media_pixel_format dst_format, uint8_t* dst, uint32_t y,
+                             uint16_t* wide, int32_t* errors) {
+    uint32_t width = image->ihdr.width;
 
-    if (text->text == NULL) {
-        text->text = malloc(sizeof(char) * size);
-    } else {
-        text->text = realloc(text->text, sizeof(char) * size); 
+    if (wide == NULL) {
+        media_convert_row(src_format, src, dst_format, dst, width, _png_luma(image));
+        return;
     }
 
-    memcpy(text->text, &chunk->data[chunk->length - size + 1], size - 1);
-    text->text[size - 1] = '\0';
+    enum media_dither dither = image->dither == IMAGE_DITHER_ORDERED ? MEDIA_DITHER_ORDERED : MEDIA_DITHER_DIFFUSION;
 
-    return 0;
+    media_convert_row(src_format, src, media_pixel_wide_format(dst_format), (uint8_t*) wide, width, _png_luma(image));
+    media_narrow_dither(dither, wide, dst, width, media_pixel_channels(dst_format), y, errors);
 }
 
-static int _png_read_chunk_zTXt(struct image_png_chunk* chunk, struct image_png_chunk_zTXt* ztxt) {
-    if (chunk == NULL || strcmp(chunk->type, "zTXt") != 0) {
-        return 1;
+static const uint32_t* _png_palette_lut(struct image_png* image) {
+    if (image->palette_lut != NULL) {
+        return image->palette_lut;
     }
 
-    if (_png_check_crc32(chunk)) {
-        return 2;
+    uint32_t* lut = _png_meta_alloc(&image->allocator, sizeof(uint32_t) * 256);
+    if (lut == NULL) {
+        return NULL;
     }
 
-    if (ztxt == NULL) {
-        return 0;
-    }
+    struct image_png_chunk_PLTE* plte = &image->plte;
+    struct image_png_chunk_tRNS* trns = &image->trns;
 
-    strncpy(ztxt->keyword, (char*) chunk->data, 80);
-    size_t keyword_length = strlen(ztxt->keyword) + 1;
-    ztxt->compression = chunk->data[keyword_length];
+    for (uint32_t i = 0; i < 256; i++) {
+        uint8_t pixel[4] = {0, 0, 0, 0xFF};
 
-    size_t compressed_size = chunk->length - keyword_length - 1;
-    size_t size;
-    media_zlib_inflate(chunk->data + keyword_length + 1, compressed_size, (uint8_t**) &ztxt->text, &size);
+        if (i < plte->size) {
+            pixel[0] = plte->pallete[i].rgba8.red;
+            pixel[1] = plte->pallete[i].rgba8.green;
+            pixel[2] = plte->pallete[i].rgba8.blue;
+        }
 
-    // prepare null-terminator
-    ztxt->text = realloc(ztxt->text, sizeof(char) * (size + 1));
-    ztxt->text[size] = '\0';
+        // missing tRNS entries are opaque
+        if (trns->type == PNG_tRNS_8BITS && i < trns->size) {
+            pixel[3] = trns->data_8bits[i];
+        }
 
-    return 0;
+        memcpy(&lut[i], pixel, sizeof(uint32_t));
+    }
+
+    image->palette_lut = lut;
+
+    return lut;
 }
 
-static int _png_read_chunk_iTXt(struct image_png_chunk* chunk, struct image_png_chunk_iTXt* itxt) {
-    if (chunk == NULL || strcmp(chunk->type, "iTXt") != 0) {
-        return 1;
+static const struct media_gamma* _png_gamma(struct image_png* image) {
+    // sRGB chunk takes precedence over gAMA, and without any of them sRGB is assumed
+    if (image->srgb.rendering <= 3 || image->gama.gamma == 0) {
+        return media_gamma_get(MEDIA_GAMMA_SRGB);
     }
 
-    if (_png_check_crc32(chunk)) {
-        return 2;
-    }
+    return media_gamma_get(image->gama.gamma);
+}
 
-    if (itxt == NULL) {
-        return 0;
+static inline void _png_drop_palette_lut(struct image_png* image) {
+    _png_meta_free(&image->allocator, image->palette_lut);
+    image->palette_lut = NULL;
+}
+
+static void _png_clear_trns(struct png_allocator* allocator, struct image_png_chunk_tRNS* trns) {
+    if (trns->type == PNG_tRNS_8BITS) {
+        _png_meta_free(allocator, trns->data_8bits);
+    } else if (trns->type == PNG_tRNS_16BITS) {
+        _png_meta_free(allocator, trns->data_16bits);
     }
 
-    size_t next = 0;
+    trns->type = PNG_tRNS_8BITS;
+    trns->size = 0;
+    trns->data_8bits = NULL;
+}
 
-    strncpy(itxt->keyword, (char*) chunk->data, 80);
-    next += strlen(itxt->keyword) + 1;
+static void* _png_std_alloc(void* ctx, size_t size) {
+    (void) ctx;
+    return malloc(size);
+}
 
-    itxt->compression_flag = chunk->data[next++];
-    itxt->compression_method = chunk->data[next++];
+static void* _png_std_realloc(void* ctx, void* ptr, size_t size) {
+    (void) ctx;
+    return realloc(ptr, size);
+}
 
-    itxt->language_tag = strdup((char*) chunk->data + next);
-    next += strlen(itxt->language_tag) + 1;
+static void _png_std_free(void* ctx, void* ptr) {
+    (void) ctx;
+    free(ptr);
+}
 
-    itxt->translated_keyword= strdup((char*) chunk->data + next);
-    next += strlen(itxt->translated_keyword) + 1;
+static struct png_allocator _png_make_allocator(const struct image_allocator* functions, uint8_t arena) {
+    struct png_allocator allocator;
+    allocator.functions.alloc = _png_std_alloc;
+    allocator.functions.realloc = _png_std_realloc;
+    allocator.functions.free = _png_std_free;
+    allocator.functions.ctx = NULL;
+    allocator.arena = arena;
+    allocator.blocks = NULL;
+
+    if (functions != NULL && functions->alloc != NULL && functions->realloc != NULL && functions->free != NULL) {
+        allocator.functions = *functions;
+    }
 
-    itxt->text = strndup((char*) chunk->data + next, chunk->length - next);
+    return allocator;
+}
 
-    return 0;
+static inline void* _png_malloc(struct png_allocator* allocator, size_t size) {
+    return allocator->functions.alloc(allocator->functions.ctx, size);
 }
 
-static int _png_read_chunk_tIME(struct image_png_chunk* chunk, struct image_png_chunk_tIME* time) {
-    if (chunk == NULL || strcmp(chunk->type, "tIME") != 0 || chunk->length != 7) {
-        return 1;
-    }
-    
-    if (_png_check_crc32(chunk)) {
-        return 2;
-    }
+static inline void* _png_realloc(struct png_allocator* allocator, void* ptr, size_t size) {
+    return allocator->functions.realloc(allocator->functions.ctx, ptr, size);
+}
 
-    if (time == NULL) {
-        return 0;
+static inline void* _png_calloc(struct png_allocator* allocator, size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
     }
 
-    memcpy(time, chunk->data, sizeof(uint8_t) * 7);
-    time->year = convert_short_be(time->year);
+    void* ptr = _png_malloc(allocator, count * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, count * size);
+    }
 
-    return 0;
+    return ptr;
 }
 
-static int _png_read_chunk_IDAT(struct image_png_chunk* chunk, struct image_png_chunk_IDAT* idat) {
-    if (chunk == NULL || strcmp(chunk->type, "IDAT") != 0) {
-        return 1;
+static inline void _png_free(struct png_allocator* allocator, void* ptr) {
+    if (ptr != NULL) {
+        allocator->functions.free(allocator->functions.ctx, ptr);
     }
+}
 
-    if (_png_check_crc32(chunk)) {
-        return 2;
+static uint8_t* _png_aligned_alloc(struct png_allocator* allocator, size_t alignment, size_t size) {
+    alignment = alignment != 0 ? alignment : 1;
+
+    if (size > SIZE_MAX - alignment - sizeof(uint16_t)) {
+        return NULL;
     }
 
-    if (idat == NULL) {
-        return 0;
+    uint8_t* block = _png_malloc(allocator, size + alignment - 1 + sizeof(uint16_t));
+    if (block == NULL) {
+        return NULL;
     }
 
-    idat->type = PNG_IDAT_SCANLINES;
-    media_zlib_inflate(chunk->data, chunk->length, &idat->data, &idat->size);
+    uintptr_t start = (uintptr_t) block + sizeof(uint16_t);
+    uint8_t* data = block + ((start + alignment - 1) / alignment * alignment - (uintptr_t) block);
 
-    return 0;
+    uint16_t offset = (uint16_t) (data - block);
+    memcpy(data - sizeof(uint16_t), &offset, sizeof(uint16_t));
+
+    return data;
 }
 
-static void _png_write_chunk_IHDR(struct image_png_chunk_IHDR* ihdr, struct image_png_chunk* chunk) {
-    chunk->length = 13;
-    strcpy(chunk->type, "IHDR");
-    _png_populate_chunk(chunk, sizeof(uint8_t) * 13);
+static void _png_aligned_free(struct png_allocator* allocator, uint8_t* ptr) {
+    if (ptr != NULL) {
+        uint16_t offset;
+        memcpy(&offset, ptr - sizeof(uint16_t), sizeof(uint16_t));
 
-    ihdr->width = convert_int_be(ihdr->width);
-    ihdr->height = convert_int_be(ihdr->height);
+        _png_free(allocator, ptr - offset);
+    }
+}
 
-    memcpy(chunk->data, ihdr, sizeof(uint8_t) * 13);
+static inline size_t _png_arena_round(size_t size) {
+    return (size + PNG_ARENA_ALIGN - 1) / PNG_ARENA_ALIGN * PNG_ARENA_ALIGN;
+}
 
-    ihdr->width = convert_int_be(ihdr->width);
-    ihdr->height = convert_int_be(ihdr->height);
+static inline uint8_t* _png_arena_top(struct png_arena_block* block) {
+    return (uint8_t*) block + _png_arena_round(sizeof(struct png_arena_block)) + block->used;
+}
 
-    _png_generate_crc32(chunk);
+static inline size_t* _png_arena_capacity(void* ptr) {
+    return (size_t*) ((uint8_t*) ptr - PNG_ARENA_ALIGN);
 }
 
-static void _png_write_chunk_PLTE(struct image_png_chunk_PLTE* plte, struct image_png_chunk* chunk) {
-    uint16_t size = plte->size > 256 ? 256 : plte->size;
-    chunk->length = size * 3;
-    strcpy(chunk->type, "PLTE");
-    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+static void* _png_meta_alloc(struct png_allocator* allocator, size_t size) {
+    if (!allocator->arena) {
+        return _png_malloc(allocator, size);
+    }
 
-    for (uint16_t i = 0; i < size; i++) {
-        struct image_color* color = &plte->pallete[i];
+    size_t capacity = _png_arena_round(size);
+    size_t needed = PNG_ARENA_ALIGN + capacity;
 
-        chunk->data[i * 3] = color->rgba8.red;
-        chunk->data[i * 3 + 1] = color->rgba8.green;
-        chunk->data[i * 3 + 2] = color->rgba8.blue;
-    }
+    struct png_arena_block* block = allocator->blocks;
+    if (block == NULL || block->size - block->used < needed) {
+        // whatever is left in the current block is given up
+        size_t block_size = PNG_ARENA_BLOCK;
+        if (block != NULL) {
+            block_size = block->size * 2 < PNG_ARENA_MAX_BLOCK ? block->size * 2 : PNG_ARENA_MAX_BLOCK;
+        }
+        block_size = block_size > needed ? block_size : needed;
 
-    _png_generate_crc32(chunk);
-}
+        struct png_arena_block* next = _png_malloc(allocator, _png_arena_round(sizeof(struct png_arena_block)) + block_size);
+        if (next == NULL) {
+            return NULL;
+        }
 
-static void _png_write_chunk_tRNS(struct image_png_chunk_tRNS* trns, struct image_png_chunk* chunk) {
-    chunk->length = trns->size;
-    strcpy(chunk->type, "tRNS");
-    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+        next->next = block;
+        next->size = block_size;
+        next->used = 0;
 
-    memcpy(chunk->data, trns->data_8bits, sizeof(uint8_t) * chunk->length);
+        allocator->blocks = block = next;
+    }
 
-    _png_generate_crc32(chunk);
+    uint8_t* data = _png_arena_top(block) + PNG_ARENA_ALIGN;
+    *_png_arena_capacity(data) = capacity;
+    block->used += needed;
+
+    return data;
 }
 
-static void _png_write_chunk_cHRM(struct image_png_chunk_cHRM* chrm, struct image_png_chunk* chunk) {
-    chunk->length = 32;
-    strcpy(chunk->type, "cHRM");
-    _png_populate_chunk(chunk, sizeof(uint8_t) * 32);
+static void* _png_meta_realloc(struct png_allocator* allocator, void* ptr, size_t size) {
+    if (!allocator->arena) {
+        return _png_realloc(allocator, ptr, size);
+    }
 
-    chrm->white_px = convert_int_be(chrm->white_px);
-    chrm->white_py = convert_int_be(chrm->white_py);
-    chrm->red_x = convert_int_be(chrm->red_x);
-    chrm->red_y = convert_int_be(chrm->red_y);
-    chrm->green_x = convert_int_be(chrm->green_x);
-    chrm->green_y = convert_int_be(chrm->green_y);
-    chrm->blue_x = convert_int_be(chrm->blue_x);
-    chrm->blue_y = convert_int_be(chrm->blue_y);
+    if (ptr == NULL) {
+        return _png_meta_alloc(allocator, size);
+    }
 
-    memcpy(chunk->data, chrm, sizeof(uint8_t) * 32);
+    size_t capacity = *_png_arena_capacity(ptr);
+    if (size <= capacity) {
+        return ptr;
+    }
 
-    chrm->white_px = convert_int_be(chrm->white_px);
-    chrm->white_py = convert_int_be(chrm->white_py);
-    chrm->red_x = convert_int_be(chrm->red_x);
-    chrm->red_y = convert_int_be(chrm->red_y);
-    chrm->green_x = convert_int_be(chrm->green_x);
-    chrm->green_y = convert_int_be(chrm->green_y);
-    chrm->blue_x = convert_int_be(chrm->blue_x);
-    chrm->blue_y = convert_int_be(chrm->blue_y);
+    // the last allocation grows in place while its block has room
+    struct png_arena_block* block = allocator->blocks;
+    size_t grown = _png_arena_round(size);
+    if ((uint8_t*) ptr + capacity == _png_arena_top(block) && block->size - block->used >= grown - capacity) {
+        block->used += grown - capacity;
+        *_png_arena_capacity(ptr) = grown;
+        return ptr;
+    }
 
-    _png_generate_crc32(chunk);
+    void* moved = _png_meta_alloc(allocator, size);
+    if (moved != NULL) {
+        memcpy(moved, ptr, capacity);
+    }
+
+    return moved;
 }
 
-static void _png_write_chunk_gAMA(struct image_png_chunk_gAMA* gama, struct image_png_chunk* chunk) {
-    chunk->length = 4;
-    strcpy(chunk->type, "gAMA");
-    _png_populate_chunk(chunk, sizeof(uint8_t) * 4);
+static void _png_meta_free(struct png_allocator* allocator, void* ptr) {
+    if (!allocator->arena) {
+        _png_free(allocator, ptr);
+        return;
+    }
 
-    gama->gamma = convert_int_be(gama->gamma);
-    memcpy(chunk->data, gama, sizeof(uint8_t) * 4);
-    gama->gamma = convert_int_be(gama->gamma);
+    if (ptr == NULL) {
+        return;
+    }
 
-    _png_generate_crc32(chunk);
+    // only the last allocation gives its bytes back
+    struct png_arena_block* block = allocator->blocks;
+    size_t capacity = *_png_arena_capacity(ptr);
+    if ((uint8_t*) ptr + capacity == _png_arena_top(block)) {
+        block->used -= PNG_ARENA_ALIGN + capacity;
+    }
 }
 
-static void _png_write_chunk_iCCP(struct image_png_chunk_iCCP* iccp, struct image_png_chunk* chunk) {
-    chunk->length = strlen(iccp->name) + iccp->size + 2;
-    strcpy(chunk->type, "iCCP");
-    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+static char* _png_meta_strndup(struct png_allocator* allocator, const char* text, size_t size) {
+    const char* end = memchr(text, '\0', size);
+    size_t length = end != NULL ? (size_t) (end - text) : size;
 
-    strncpy((char*) chunk->data, iccp->name, chunk->length - iccp->size - 1);
-    size_t name_length = strlen(iccp->name) + 1;
-    chunk->data[name_length] = iccp->compression;
-    memcpy(&chunk->data[name_length + 1], iccp->data, iccp->size);
+    char* copy = _png_meta_alloc(allocator, sizeof(char) * (length + 1));
+    if (copy != NULL) {
+        memcpy(copy, text, length);
+        copy[length] = '\0';
+    }
 
-    _png_generate_crc32(chunk);
+    return copy;
 }
 
-static void _png_write_chunk_sBIT(struct image_png_chunk_sBIT* sbit, struct image_png_chunk* chunk) {
-    strcpy(chunk->type, "sBIT");
+static inline char* _png_meta_strdup(struct png_allocator* allocator, const char* text) {
+    return _png_meta_strndup(allocator, text, strlen(text));
+}
 
-    switch (sbit->type) {
-        case PNG_sBIT_GREY:
-        case PNG_sBIT_GREYALPHA: {
-            chunk->length = sbit->type == PNG_sBIT_GREYALPHA ? 2 : 1;
-            _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+static void _png_arena_release(struct png_allocator* allocator) {
+    struct png_arena_block* block = allocator->blocks;
 
-            chunk->data[0] = sbit->grey;
-            if (sbit->type == PNG_sBIT_GREYALPHA) {
-                chunk->data[1] = sbit->alpha;
-            }
+    while (block != NULL) {
+        struct png_arena_block* next = block->next;
+        _png_free(allocator, block);
+        block = next;
+    }
 
-            break;
-        }
-        case PNG_sBIT_RGB_OR_INDEXED:
-        case PNG_sBIT_RGBALPHA: {
-            chunk->length = sbit->type == PNG_sBIT_RGBALPHA ? 4 : 3;
-            _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+    allocator->blocks = NULL;
+}
 
-            chunk->data[0] = sbit->red;
-            chunk->data[1] = sbit->green;
-            chunk->data[2] = sbit->blue;
-            if (sbit->type == PNG_sBIT_RGBALPHA) {
-                chunk->data[3] = sbit->alpha;
-            }
+static void _png_tensor_rows(void* context, size_t begin, size_t end) {
+    struct png_tensor_job* job = context;
+    uint32_t width = job->image->ihdr.width;
+    uint8_t* expanded = NULL;
 
-            break;
+    if (job->lut != NULL) {
+        expanded = _png_malloc(&job->image->allocator, (size_t) width * 4);
+        if (expanded == NULL) {
+            job->failed = 1;
+            return;
         }
     }
 
-    _png_generate_crc32(chunk);
-}
+    for (size_t y = begin; y < end; y++) {
+        const uint8_t* row = _png_row(job->image, (uint32_t) y);
 
-static void _png_write_chunk_sRGB(struct image_png_chunk_sRGB* srgb, struct image_png_chunk* chunk) {
-    chunk->length = 1;
-    strcpy(chunk->type, "sRGB");
-    _png_populate_chunk(chunk, sizeof(uint8_t));
+        if (expanded != NULL) {
+            media_expand_indexed(row, job->lut, expanded, width);
+            row = expanded;
+        }
 
-    chunk->data[0] = srgb->rendering;
+        media_row_to_f32(job->format, row, width, job->scale, job->bias,
+                         &job->out[y * job->row_step], job->channel_step, job->pixel_step);
+    }
 
-    _png_generate_crc32(chunk);
+    _png_free(&job->image->allocator, expanded);
 }
 
-static void _png_write_chunk_tEXt(struct image_png_chunk_tEXt* text, struct image_png_chunk* chunk) {
-    // null-terminator should not be included
-    size_t size = strlen(text->text);
-    chunk->length = strlen(text->keyword) + size + 1;
-    strcpy(chunk->type, "tEXt");
-    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+static void _png_stats_parts(void* context, size_t begin, size_t end) {
+    struct png_stats_job* job = context;
+    struct image_png* image = job->image;
+    uint32_t width = image->ihdr.width;
+    uint32_t height = image->ihdr.height;
+    uint8_t* expanded = NULL;
+
+    if (job->lut != NULL) {
+        expanded = _png_malloc(&job->image->allocator, (size_t) width * 4);
+        if (expanded == NULL) {
+            job->failed = 1;
+            return;
+        }
+    }
 
-    memcpy(chunk->data, text->keyword, chunk->length - size);
-    memcpy(&chunk->data[chunk->length - size], text->text, size);
+    for (size_t part = begin; part < end; part++) {
+        uint32_t first = (uint32_t) ((uint64_t) height * part / job->parts);
+        uint32_t last = (uint32_t) ((uint64_t) height * (part + 1) / job->parts);
 
-    _png_generate_crc32(chunk);
-}
+        struct media_histogram histogram;
+        struct media_stats* stats = job->stats != NULL ? &job->stats[part] : NULL;
 
-static void _png_write_chunk_zTXt(struct image_png_chunk_zTXt* ztxt, struct image_png_chunk* chunk) {
-    chunk->length = strlen(ztxt->keyword) + 2;
-    strcpy(chunk->type, "zTXt");
-    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+        if (stats != NULL) {
+            media_stats_init(stats, job->format);
+        } else if (media_histogram_init(&histogram, job->format, job->bins) != 0) {
+            job->failed = 1;
+            break;
+        }
 
-    strncpy((char*) chunk->data, ztxt->keyword, chunk->length - 1);
-    size_t keyword_length = chunk->length - 1;
-    chunk->data[keyword_length] = ztxt->compression;
+        for (uint32_t y = first; y < last; y++) {
+            const uint8_t* row = _png_row(image, y);
 
-    uint8_t* compressed;
-    size_t compressed_size;
-    // null terminator is not included in this deflate
-    media_zlib_deflate((uint8_t*) ztxt->text, strlen(ztxt->text), &compressed, &compressed_size, Z_BEST_COMPRESSION);
+            if (expanded != NULL) {
+                media_expand_indexed(row, job->lut, expanded, width);
+                row = expanded;
+            }
 
-    chunk->length += compressed_size;
-    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
-    memcpy(&chunk->data[keyword_length + 1], compressed, compressed_size);
-    
-    free(compressed);
+            if (stats != NULL) {
+                media_stats_row(stats, job->format, row, width);
+            } else {
+                media_histogram_row(&histogram, row, width);
+            }
+        }
 
-    _png_generate_crc32(chunk);
+        if (stats == NULL) {
+            size_t plane = (size_t) histogram.channels * histogram.bins;
+            media_histogram_end(&histogram, &job->histograms[part * plane]);
+        }
+    }
+
+    _png_free(&image->allocator, expanded);
 }
 
-static void _png_write_chunk_iTXt(struct image_png_chunk_iTXt* itxt, struct image_png_chunk* chunk) {
-    size_t keyword_length = strlen(itxt->keyword) + 1;
-    size_t language_tag_length = strlen(itxt->language_tag) + 1;
-    size_t translated_keyword_length = strlen(itxt->translated_keyword) + 1;
-    size_t text_length = strlen(itxt->text);
+static void _png_compare_parts(void* context, size_t begin, size_t end) {
+    struct png_compare_job* job = context;
+    struct png_allocator* allocator = &job->images[0]->allocator;
+    uint32_t width = job->images[0]->ihdr.width;
+    uint32_t height = job->images[0]->ihdr.height;
+
+    // windows rows go between bands of MEDIA_SSIM_BLOCK rows, a window row for every band but the last
+    uint32_t bands = height / MEDIA_SSIM_BLOCK;
+    uint32_t window_rows = bands > 1 ? bands - 1 : 0;
+
+    uint8_t* scratch[2] = {NULL, NULL};
+    float* luma[2 * MEDIA_SSIM_BLOCK] = {NULL};
+    struct media_ssim_band band[2];
+
+    uint32_t blocks = width / MEDIA_SSIM_BLOCK;
+    band[0].blocks = blocks;
+    band[1].blocks = blocks;
+    band[0].sums = blocks >= 2 ? _png_malloc(allocator, sizeof(float) * 4 * blocks * 2) : NULL;
+    band[1].sums = band[0].sums != NULL ? &band[0].sums[4 * blocks] : NULL;
+
+    uint8_t failed = blocks >= 2 && band[0].sums == NULL;
+    for (uint32_t i = 0; i < 2; i++) {
+        scratch[i] = _png_malloc(allocator, (size_t) width * media_pixel_size(job->format));
+        failed |= scratch[i] == NULL;
+    }
 
-    chunk->length = keyword_length + language_tag_length + translated_keyword_length + text_length + 2;
-    strcpy(chunk->type, "iTXt");
-    _png_populate_chunk(chunk, sizeof(uint8_t) * chunk->length);
+    for (uint32_t i = 0; i < 2 * MEDIA_SSIM_BLOCK; i++) {
+        luma[i] = _png_malloc(allocator, sizeof(float) * width);
+        failed |= luma[i] == NULL;
+    }
 
-    size_t next = 0;
+    for (size_t part = begin; part < end && !failed; part++) {
+        struct media_diff* diff = &job->diffs[part];
+        media_diff_init(diff);
 
-    strncpy((char*) chunk->data, itxt->keyword, keyword_length);
-    next += keyword_length;
+        uint32_t first = (uint32_t) ((uint64_t) height * part / job->parts);
+        uint32_t last = (uint32_t) ((uint64_t) height * (part + 1) / job->parts);
 
-    chunk->data[next++] = itxt->compression_flag;
-    chunk->data[next++] = itxt->compression_method;
+        for (uint32_t y = first; y < last; y++) {
+            const uint8_t* a = _png_compare_row(job, 0, y, scratch[0]);
+            const uint8_t* b = _png_compare_row(job, 1, y, scratch[1]);
 
-    memcpy(chunk->data + next, itxt->language_tag, language_tag_length);
-    next += language_tag_length;
+            media_diff_row(diff, job->format, a, b, width, y);
+        }
 
-    memcpy(chunk->data + next, itxt->translated_keyword, translated_keyword_length);
-    next += translated_keyword_length;
+        if (blocks < 2) {
+            continue;
+        }
 
-    memcpy(chunk->data + next, itxt->text, text_length);
+        // each window row needs its band and the next one, the bottom band is kept for the next row
+        uint32_t first_window = (uint32_t) ((uint64_t) window_rows * part / job->parts);
+        uint32_t last_window = (uint32_t) ((uint64_t) window_rows * (part + 1) / job->parts);
 
-    _png_generate_crc32(chunk);
-}
+        if (first_window < last_window) {
+            _png_compare_band(job, first_window * MEDIA_SSIM_BLOCK, scratch, luma, &band[0]);
+        }
 
-static void _png_write_chunk_tIME(struct image_png_chunk_tIME* time, struct image_png_chunk* chunk) {
-    chunk->length = 7;
-    strcpy(chunk->type, "tIME");
-    _png_populate_chunk(chunk, sizeof(uint8_t) * 7);
+        for (uint32_t row = first_window; row < last_window; row++) {
+            struct media_ssim_band* top = &band[(row - first_window) % 2];
+            struct media_ssim_band* bottom = &band[(row - first_window + 1) % 2];
 
-    time->year = convert_short_be(time->year);
-    memcpy(chunk->data, time, sizeof(uint8_t) * 7);
-    time->year = convert_short_be(time->year);
+            _png_compare_band(job, (row + 1) * MEDIA_SSIM_BLOCK, scratch, luma, bottom);
+            job->windows[part] += media_ssim_windows(top, bottom, job->max, &job->ssims[part]);
+        }
+    }
 
-    _png_generate_crc32(chunk);
+    if (failed) {
+        job->failed = 1;
+    }
+
+    for (uint32_t i = 0; i < 2; i++) {
+        _png_free(allocator, scratch[i]);
+    }
+
+    for (uint32_t i = 0; i < 2 * MEDIA_SSIM_BLOCK; i++) {
+        _png_free(allocator, luma[i]);
+    }
+
+    _png_free(allocator, band[0].sums);
 }
 
-static void _png_write_chunk_IDAT(struct image_png_chunk_IDAT* idat, struct image_png_chunk* chunk) {
-    strcpy(chunk->type, "IDAT");
+static const uint8_t* _png_compare_row(struct png_compare_job* job, uint32_t i, uint32_t y, uint8_t* scratch) {
+    struct image_png* image = job->images[i];
+    const uint8_t* row = _png_row(image, y);
+    uint32_t width = image->ihdr.width;
 
-    if (chunk->data != NULL) {
-        free(chunk->data);
+    if (job->luts[i] != NULL) {
+        media_convert_indexed(row, job->luts[i], job->format, scratch, width, _png_luma(image));
+        return scratch;
     }
 
-    size_t length;
-    media_zlib_deflate(idat->data, idat->size, &chunk->data, &length, Z_BEST_COMPRESSION);
-    chunk->length = length;
+    if (job->formats[i] != job->format) {
+        media_convert_row(job->formats[i], row, job->format, scratch, width, _png_luma(image));
+        return scratch;
+    }
 
-    _png_generate_crc32(chunk);
+    return row;
 }
 
-static void _png_convert_chunk_tRNS(struct image_png_chunk_tRNS* trns,
-                                    enum image_png_trns_type type) {
-    // nothing to do
-    if (trns->type == type) {
-        return;
+static void _png_compare_band(struct png_compare_job* job, uint32_t y, uint8_t** scratch, float** luma,
+                              struct media_ssim_band* band) {
+    uint32_t width = job->images[0]->ihdr.width;
+
+    for (uint32_t r = 0; r < MEDIA_SSIM_BLOCK; r++) {
+        for (uint32_t i = 0; i < 2; i++) {
+            const uint8_t* row = _png_compare_row(job, i, y + r, scratch[i]);
+            media_luma_row(job->format, row, width, luma[i * MEDIA_SSIM_BLOCK + r]);
+        }
     }
 
-    switch (type) {
-        case PNG_tRNS_8BITS: {
-            uint8_t* data_8bits = malloc(sizeof(uint8_t) * trns->size * 2);
+    media_ssim_sums((const float* const*) &luma[0], (const float* const*) &luma[MEDIA_SSIM_BLOCK], band);
+}
 
-            for (size_t i = 0; i < trns->size; i++) {
-                uint16_t byte = convert_int_be(trns->data_16bits[i]);
+static int _png_stats_job(struct image_png* image, struct png_stats_job* job) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
 
-                data_8bits[i * 2] = byte;
-                data_8bits[i * 2 + 1] = (byte >> 8) & 0xFF;
-            }
+    memset(job, 0, sizeof(struct png_stats_job));
+    job->image = image;
+    job->format = _png_ihdr_format(ihdr);
 
-            free(trns->data_16bits);
-            trns->data_8bits = data_8bits;
-            break;
+    if (job->format == MEDIA_PIXEL_INDEXED8) {
+        job->lut = _png_palette_lut(image);
+        if (job->lut == NULL) {
+            return 1;
         }
-        case PNG_tRNS_16BITS: {
-            uint16_t* data_16bits = malloc(sizeof(uint16_t) * trns->size / 2);
 
-            for (size_t i = 0; i < trns->size; i++) {
-                data_16bits[i] = convert_int_be(trns->data_8bits[i * 2] | (trns->data_8bits[i * 2 + 1] >> 8));
-            }
-            
-            free(trns->data_8bits);
-            trns->data_16bits = data_16bits;
-            break;
-        }
+        job->format = MEDIA_PIXEL_RGBA8;
     }
+
+    // a part for every thread, but never empty ones
+    job->parts = png_threads < ihdr->height ? png_threads : ihdr->height;
+    job->parts = job->parts != 0 ? job->parts : 1;
+
+    return 0;
 }
 
-static void _png_IDAT_to_scanlines(struct image_png_chunk_IHDR* ihdr, struct image_png_chunk_IDAT* idat) {
-    idat->type = PNG_IDAT_SCANLINES;
+static void _png_hash_parts(void* context, size_t begin, size_t end) {
+    struct png_hash_job* job = context;
+    struct image_png* image = job->image;
+    uint32_t width = image->ihdr.width;
+    uint32_t height = image->ihdr.height;
 
-    uint32_t size = idat->size;
-    uint8_t* pixels = idat->data;
+    uint8_t* expanded = job->lut != NULL ? _png_malloc(&image->allocator, (size_t) width * 4) : NULL;
+    float* luma = _png_malloc(&image->allocator, sizeof(float) * width);
+    double* prefix = _png_malloc(&image->allocator, sizeof(double) * (width + 1));
 
-    uint32_t pixel_size = PNG_BITS_TYPE[ihdr->color][ihdr->depth] / 8;
+    if ((job->lut != NULL && expanded == NULL) || luma == NULL || prefix == NULL) {
+        job->failed = 1;
+        begin = end;
+    }
 
-    idat->size = ihdr->width * ihdr->height * pixel_size + ihdr->height;
-    idat->data = malloc(sizeof(uint8_t) * idat->size);
+    for (size_t part = begin; part < end; part++) {
+        uint32_t first = (uint32_t) ((uint64_t) height * part / job->parts);
+        uint32_t last = (uint32_t) ((uint64_t) height * (part + 1) / job->parts);
 
-    // for now, all scanlines are filtered to 0
+        struct media_hash_grid* grid = &job->grids[part * 2];
+        struct media_hash_grid* wide = &job->grids[part * 2 + 1];
+
+        if (job->kinds & PNG_HASH_GRID) {
+            media_hash_grid_init(grid, MEDIA_HASH_GRID, MEDIA_HASH_GRID, width, height);
+        }
 
-    uint64_t index = 0;
+        if (job->kinds & PNG_HASH_DIFFERENCE) {
+            media_hash_grid_init(wide, MEDIA_HASH_SIDE + 1, MEDIA_HASH_SIDE, width, height);
+        }
 
-    for (uint32_t y = 0; y < ihdr->height; y++) {
-        // set filter to scanline
-        idat->data[index++] = 0;
+        for (uint32_t y = first; y < last; y++) {
+            const uint8_t* row = _png_row(image, y);
 
-        for (uint32_t x = 0; x < ihdr->width; x++) {
-            for (uint8_t j = 0; j < pixel_size; j++) {
-                idat->data[index++] = pixels[(x + y * ihdr->width) * pixel_size + j];
+            if (expanded != NULL) {
+                media_expand_indexed(row, job->lut, expanded, width);
+                row = expanded;
+            }
+
+            media_luma_row(job->format, row, width, luma);
+
+            // cells of both grids are differences of these sums, whatever their width
+            prefix[0] = 0.0;
+            for (uint32_t x = 0; x < width; x++) {
+                prefix[x + 1] = prefix[x] + luma[x];
+            }
+
+            if (job->kinds & PNG_HASH_GRID) {
+                media_hash_grid_row(grid, prefix, y);
+            }
+
+            if (job->kinds & PNG_HASH_DIFFERENCE) {
+                media_hash_grid_row(wide, prefix, y);
             }
         }
     }
 
-    free(pixels);
+    _png_free(&image->allocator, expanded);
+    _png_free(&image->allocator, luma);
+    _png_free(&image->allocator, prefix);
 }
 
-static void _png_IDAT_to_pixels(struct image_png_chunk_IHDR* ihdr, struct image_png_chunk_IDAT* idat) {
-    idat->type = PNG_IDAT_PIXELS;
+static int _png_hash(struct image_png* image, uint32_t threads, uint8_t kinds, struct image_hashes* hashes) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+    memset(hashes, 0, sizeof(struct image_hashes));
 
-    uint32_t size = idat->size;
-    uint8_t* scanlines = idat->data;
+    if (ihdr->width == 0 || ihdr->height == 0) {
+        return 1;
+    }
 
-    uint32_t pixel_size = PNG_BITS_TYPE[ihdr->color][ihdr->depth] / 8;
+    struct png_hash_job job;
+    memset(&job, 0, sizeof(struct png_hash_job));
+    job.image = image;
+    job.kinds = kinds;
+    job.format = _png_ihdr_format(ihdr);
 
-    idat->size = ihdr->width * ihdr->height * pixel_size;
-    idat->data = malloc(sizeof(uint8_t) * idat->size);
+    if (job.format == MEDIA_PIXEL_INDEXED8) {
+        job.lut = _png_palette_lut(image);
+        if (job.lut == NULL) {
+            return 2;
+        }
 
-    uint64_t index = 0;
+        job.format = MEDIA_PIXEL_RGBA8;
+    }
 
-    for (uint32_t y = 0; y < ihdr->height; y++) {
-        uint8_t filter = scanlines[index++];
-
-        for (uint32_t x = 0; x < ihdr->width; x++) {
-            for (uint8_t j = 0; j < pixel_size; j++) {
-                uint32_t a = x > 0 ? scanlines[index - pixel_size] : 0;
-                uint32_t b = y > 0 ? scanlines[index - y * (ihdr->width + 1)] : 0;
-                uint32_t byte = scanlines[index];
-
-                switch (filter) {
-                    case 0: break;
-                    case 1: byte = (byte + a); break;
-                    case 2: byte = (byte + b); break;
-                    case 3: byte = (byte + floor(a / 2.0 + b / 2.0)); break;
-                }
+    job.parts = threads < ihdr->height ? threads : ihdr->height;
+    job.grids = _png_malloc(&image->allocator, sizeof(struct media_hash_grid) * 2 * job.parts);
 
-                byte %= 256;
+    if (job.grids == NULL) {
+        return 2;
+    }
 
-                // presave byte in scanline for future usage
-                scanlines[index++] = byte;
-                idat->data[(x + y * ihdr->width) * pixel_size + j] = byte;
-            }
+    media_parallel_for(job.parts, threads, _png_hash_parts, &job);
+
+    if (job.failed) {
+        _png_free(&image->allocator, job.grids);
+        return 2;
+    }
+
+    if (kinds & PNG_HASH_GRID) {
+        for (uint32_t part = 1; part < job.parts; part++) {
+            media_hash_grid_merge(&job.grids[0], &job.grids[part * 2]);
         }
+
+        media_hash_grid_end(&job.grids[0]);
     }
 
-    free(scanlines);
-}
+    if (kinds & PNG_HASH_DIFFERENCE) {
+        for (uint32_t part = 1; part < job.parts; part++) {
+            media_hash_grid_merge(&job.grids[1], &job.grids[part * 2 + 1]);
+        }
 
-static void _png_convert_chunk_IDAT(struct image_png_chunk_IHDR* ihdr,
-                                    struct image_png_chunk_IDAT* idat,
-                                    enum image_png_idat_type type) {
-    // nothing to do
-    if (idat->type == type) {
-        return;
+        media_hash_grid_end(&job.grids[1]);
+        hashes->difference = media_dhash(&job.grids[1]);
     }
 
-    switch (type) {
-        case PNG_IDAT_SCANLINES: _png_IDAT_to_scanlines(ihdr, idat); break;
-        case PNG_IDAT_PIXELS: _png_IDAT_to_pixels(ihdr, idat); break;
+    if (kinds & PNG_HASH_AVERAGE) {
+        hashes->average = media_ahash(&job.grids[0]);
     }
-}
 
-static inline enum image_png_sbit_type _png_color_to_sbit(uint8_t color) {
-    switch (color) {
-        case 0: return PNG_sBIT_GREY;
-        case 2:
-        case 3: return PNG_sBIT_RGB_OR_INDEXED;
-        case 4: return PNG_sBIT_GREYALPHA;
-        case 6: return PNG_sBIT_RGBALPHA;
+    if (kinds & PNG_HASH_PERCEPTUAL) {
+        hashes->perceptual = media_phash(&job.grids[0]);
     }
 
-    return PNG_sBIT_GREY;
+    _png_free(&image->allocator, job.grids);
+
+    return 0;
 }
 
-static inline int _png_check_chrm(struct image_png_chunk_cHRM* chrm) {
-    return chrm->white_px != 0 || chrm->white_py != 0 || chrm->red_x != 0 || chrm->red_y != 0
-        || chrm->green_x != 0 || chrm->green_y != 0 || chrm->blue_x != 0 || chrm->blue_y != 0;
+static void _png_hash_files(void* context, size_t begin, size_t end) {
+    struct png_hash_files_job* job = context;
+
+    for (size_t i = begin; i < end; i++) {
+        job->failed[i] = image_png_hash_file(job->paths[i], &job->hashes[i]) != 0;
+    }
 }
 
-static inline int _png_check_iccp(struct image_png_chunk_iCCP* iccp) {
-    return strcmp(iccp->name, "") != 0 || iccp->size > 0;
+static void _png_color_rows(void* context, size_t begin, size_t end) {
+    struct png_color_job* job = context;
+
+    for (size_t y = begin; y < end; y++) {
+        media_color_transform_row(job->transform, job->format, _png_row(job->image, (uint32_t) y),
+                                  job->image->ihdr.width);
+    }
 }
 
-static inline int _png_check_sbit(struct image_png_chunk_sBIT* sbit) {
-    switch (sbit->type) {
-        case PNG_sBIT_GREY: return sbit->grey != 0;
-        case PNG_sBIT_RGB_OR_INDEXED: return sbit->red != 0 || sbit->green != 0 || sbit->blue != 0;
-        case PNG_sBIT_GREYALPHA: return sbit->grey != 0 || sbit->alpha != 0;
-        case PNG_sBIT_RGBALPHA: return sbit->red != 0 || sbit->green != 0 || sbit->blue != 0 || sbit->alpha != 0;
+static int _png_transpose(struct image_png* image, enum media_orientation orientation) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+    struct image_png_chunk_IDAT* idat = &image->idat;
+
+    struct image_png_chunk_IHDR new_ihdr = *ihdr;
+    new_ihdr.width = ihdr->height;
+    new_ihdr.height = ihdr->width;
+
+    struct image_png_chunk_IDAT old_idat = *idat;
+    if (_png_alloc_pixels(&image->allocator, &new_ihdr, idat) != 0) {
+        *idat = old_idat;
+        return 1;
     }
 
+    media_transpose(orientation, _png_ihdr_format(ihdr), png_threads,
+                    old_idat.data, old_idat.stride, ihdr->width, ihdr->height,
+                    idat->data, idat->stride);
+
+    _png_free_chunk_IDAT(&image->allocator, &old_idat);
+
+    *ihdr = new_ihdr;
+    _png_reset_bands(&image->allocator, &image->bands);
+
     return 0;
 }
 
-static inline int _png_check_time(struct image_png_chunk_tIME* time) {
-    return time->year != 0 || time->month != 0 || time->day != 0 || time->hour != 0 || time->minute != 0 || time->second != 0;
-}
+static int _png_filter(struct image_png* image, const struct png_filter* filter) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+    struct image_png_chunk_IDAT* idat = &image->idat;
 
-static void _png_add_text(struct png_textual_list* list,
-                          struct png_textual_data* textual) {
-    uint32_t index = list->size;
-    list->size++;
+    if (ihdr->width == 0 || ihdr->height == 0) {
+        return 0;
+    }
+
+    // pixels filtered from, the image is only changed once the filter succeeded
+    struct image_png_chunk_IHDR src_ihdr;
+    struct image_png_chunk_IDAT src_idat;
+
+    if (_png_expand_palette(image, &src_ihdr, &src_idat) != 0) {
+        return 2;
+    }
+
+    struct image_png_chunk_IDAT new_idat = src_idat;
+    if (_png_alloc_pixels(&image->allocator, &src_ihdr, &new_idat) != 0) {
+        if (src_idat.data != idat->data) {
+            _png_free_chunk_IDAT(&image->allocator, &src_idat);
+        }
+
+        return 2;
+    }
 
-    if (list->size == 1) {
-        list->list = malloc(sizeof(struct png_textual_data));
+    enum media_pixel_format format = _png_ihdr_format(&src_ihdr);
+    uint32_t width = src_ihdr.width;
+    uint32_t height = src_ihdr.height;
+    int ret;
+
+    if (filter->kx != NULL) {
+        ret = media_convolve(format, filter->kx, filter->kx_size, filter->ky, filter->ky_size, png_threads,
+                             src_idat.data, src_idat.stride, width, height, new_idat.data, new_idat.stride);
+    } else if (filter->sharpen) {
+        ret = media_unsharp_mask(format, filter->sigma, filter->amount, filter->threshold, png_threads,
+                                 src_idat.data, src_idat.stride, width, height, new_idat.data, new_idat.stride);
     } else {
-        list->list = realloc(list->list, sizeof(struct png_textual_data) * list->size);
+        ret = media_gaussian_blur(format, filter->sigma, png_threads,
+                                  src_idat.data, src_idat.stride, width, height, new_idat.data, new_idat.stride);
     }
 
-    memcpy(&list->list[index], textual, sizeof(struct png_textual_data));
+    if (src_idat.data != idat->data) {
+        _png_free_chunk_IDAT(&image->allocator, &src_idat);
+    }
+
+    if (ret != 0) {
+        _png_free_chunk_IDAT(&image->allocator, &new_idat);
+        return 3;
+    }
+
+    _png_replace_pixels(image, &src_ihdr, &new_idat);
+
+    return 0;
 }
 
-static void _png_get_text(struct png_textual_list* list,
-                                 const char* keyword,
-                                 struct png_textual_data** out_textual,
-                                 uint32_t* index) {
-    for (uint32_t i = 0; i < list->size; i++) {
-        struct png_textual_data* textual = &list->list[i];
-        char* keyword;
+static int _png_expand_palette(struct image_png* image, struct image_png_chunk_IHDR* ihdr,
+                               struct image_png_chunk_IDAT* idat) {
+    struct image_png_chunk_IDAT* pixels = &image->idat;
 
-        if (textual->type == PNG_TEXTUAL_UNCOMPRESSED) {
-            keyword = textual->data.text.keyword;
-        } else if (textual->type == PNG_TEXTUAL_COMPRESSED) {
-            keyword = textual->data.ztxt.keyword;
-        } else if (textual->type == PNG_TEXTUAL_INTERNATIONAL) {
-            keyword = textual->data.itxt.keyword;
-        }
+    *ihdr = image->ihdr;
+    *idat = *pixels;
 
-        if (strcmp(keyword, keyword) != 0) {
-            continue;
-        }
+    if (ihdr->color != 3) {
+        return 0;
+    }
 
-        *out_textual = textual;
-        if (index != NULL) {
-            *index = i;
-        }
-        
-        return;
+    const uint32_t* lut = _png_palette_lut(image);
+
+    ihdr->color = image->trns.size > 0 ? 6 : 2;
+    ihdr->depth = 8;
+
+    if (lut == NULL || _png_alloc_pixels(&image->allocator, ihdr, idat) != 0) {
+        return 1;
     }
 
-    *out_textual = NULL;
-    if (index != NULL) {
-        *index = 0;
+    enum media_pixel_format format = _png_ihdr_format(ihdr);
+    for (uint32_t y = 0; y < ihdr->height; y++) {
+        media_convert_indexed(pixels->data + y * pixels->stride, lut, format,
+                              idat->data + y * idat->stride, ihdr->width, _png_luma(image));
     }
+
+    return 0;
 }
 
-static void _png_sub_text(struct png_textual_list* list,
-                                 const char* keyword) {
-    struct png_textual_data* textual;
-    uint32_t index;
+static void _png_replace_pixels(struct image_png* image, struct image_png_chunk_IHDR* ihdr,
+                                struct image_png_chunk_IDAT* idat) {
+    if (image->ihdr.color == 3 && ihdr->color != 3) {
+        // as image_png_set_color leaves it
+        _png_clear_trns(&image->allocator, &image->trns);
+        image->sbit.type = _png_color_to_sbit(ihdr->color);
+    }
 
-    _png_get_text(list, keyword, &textual, &index);
+    _png_free_chunk_IDAT(&image->allocator, &image->idat);
+    image->idat = *idat;
+    image->ihdr = *ihdr;
 
-    // not found, ignore it
-    if (textual == NULL) {
-        return;
-    }
+    _png_reset_bands(&image->allocator, &image->bands);
+}
 
-    switch (textual->type) {
-        case PNG_TEXTUAL_UNCOMPRESSED: {
-            free(textual->data.text.text);
-            break;
-        }
-        case PNG_TEXTUAL_COMPRESSED: {
-            free(textual->data.ztxt.text);
-            break;
-        }
-        case PNG_TEXTUAL_INTERNATIONAL: {
-            free(textual->data.itxt.language_tag);
-            free(textual->data.itxt.translated_keyword);
-            free(textual->data.itxt.text);
-            break;
+static int _png_color_space(struct image_png* image, struct media_color_space* space) {
+    struct image_png_chunk_iCCP* iccp = &image->iccp;
+
+    // profiles that can't be read fall back to cHRM and gAMA, as PNG asks for
+    if (_png_check_iccp(iccp) && iccp->compression == 0 && iccp->size > 0) {
+        uint8_t* profile;
+        size_t size;
+
+        media_zlib_inflate(iccp->data, iccp->size, &profile, &size);
+        int ret = media_color_space_from_icc(profile, size, space);
+        free(profile);
+
+        if (ret == 0) {
+            return 0;
         }
     }
 
-    list->size--;
+    uint32_t gamma = image->gama.gamma != 0 ? image->gama.gamma : MEDIA_GAMMA_SRGB;
 
-    if (list->size == 0) {
-        free(list->list);
-        list->list = NULL; 
-    } else if (index == list->size) {
-        list->list = realloc(list->list, sizeof(struct png_textual_data) * list->size);
-    } else {
-        memmove(&list->list[index], &list->list[index + 1], sizeof(struct png_textual_data) * (list->size - index));
+    if (!_png_check_chrm(&image->chrm)) {
+        media_color_space_srgb(space);
+        space->gamma = gamma;
+        return 0;
     }
+
+    struct image_png_chunk_cHRM* chrm = &image->chrm;
+
+    return media_color_space_from_xy(chrm->white_px / 100000.0, chrm->white_py / 100000.0,
+                                     chrm->red_x / 100000.0, chrm->red_y / 100000.0,
+                                     chrm->green_x / 100000.0, chrm->green_y / 100000.0,
+                                     chrm->blue_x / 100000.0, chrm->blue_y / 100000.0, gamma, space);
+}
+
+static inline uint8_t* _png_row(struct image_png* image, uint32_t y) {
+    return &image->idat.data[y * image->idat.stride];
+}
+
+static int _png_color_to_pixel(struct image_png* image, struct image_color* color, uint8_t* pixel) {
+    struct image_png_chunk_IHDR* ihdr = &image->ihdr;
+
+    // every variant of the union keeps its samples packed in channel order
+    return media_convert_row(_png_color_format(color->type), (const uint8_t*) &color->rgba8,
+                             _png_ihdr_format(ihdr), pixel, 1, _png_luma(image));
 }
 
-static inline void _png_free_chunk_IDAT(struct image_png_chunk_IDAT* idat) {
-    free(idat->data);
+static inline void _png_swap_row16(struct image_png_chunk_IHDR* ihdr, uint8_t* row, size_t size) {
+    if (ihdr->depth == 16 && media_actual_endian() == MEDIA_LITTLE_ENDIAN) {
+        media_swap16(row, size / 2);
+    }
 }
 
 static void _png_execute_pixel(struct image_png* image, uint32_t x, uint32_t y,
@@ -2342,10 +5279,10 @@ static void _png_execute_pixel(struct image_png* image, uint32_t x, uint32_t y,
     uint8_t depth = ihdr->depth;
 
     uint32_t pixel_size = PNG_BITS_TYPE[type][depth] / 8;
-    uint64_t pixel_index = (x + y * ihdr->width) * pixel_size;
+    uint64_t pixel_index = (uint64_t) y * idat->stride + (uint64_t) x * pixel_size;
 
     // out of bounds
-    if (idat->size <= pixel_index) {
+    if (x >= ihdr->width || y >= ihdr->height) {
         return;
     }
 
@@ -2437,7 +5374,7 @@ static void _png_set_pixel(struct image_png_chunk_IHDR* ihdr, void* pixel, struc
                     pixel_8bits[1] = color->ga8.alpha;
                 }
             } else if (depth == 16) {
-                pixel_16bits[0] = color->ga8.gray;
+                pixel_16bits[0] = color->ga16.gray;
 
                 // if alpha is present
                 if (ihdr->color == 4) {
@@ -0,0 +1,476 @@
+#include "resize.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// weights are Q14, every window sums 1 << 14
+#define MEDIA_RESIZE_BITS 14
+
+// samples read past the end of a row by the vector kernels
+#define MEDIA_RESIZE_PADDING 4
+
+#define MEDIA_RESIZE_PI 3.14159265358979323846
+
+// windows of every destination pixel over the source in one dimension,
+// taps is the same for all of them (rounded up to even) and unused ones weigh 0
+struct _media_resize_weights {
+    uint32_t taps;
+    uint32_t* starts;
+    int16_t* weights;
+};
+
+// state shared by the threads of both passes
+struct _media_resize_job {
+    enum media_pixel_format format;
+    enum media_pixel_format wide_format;
+    const struct media_gamma* gamma;
+    uint32_t channels;
+    uint8_t alpha;
+
+    const uint8_t* src;
+    size_t src_stride;
+    uint32_t src_width;
+    uint32_t src_height;
+
+    uint8_t* dst;
+    size_t dst_stride;
+    uint32_t dst_width;
+
+    struct _media_resize_weights horizontal;
+    struct _media_resize_weights vertical;
+
+    // every source row after the horizontal pass, stride samples apart
+    uint16_t* rows;
+    size_t rows_stride;
+
+    // set by any range that couldn't allocate its buffers
+    volatile uint8_t failed;
+};
+
+static double _media_resize_sinc(double x) {
+    if (x == 0) {
+        return 1;
+    }
+
+    x *= MEDIA_RESIZE_PI;
+    return sin(x) / x;
+}
+
+static double _media_resize_kernel(enum media_filter filter, double x) {
+    switch (filter) {
+        case MEDIA_FILTER_BOX: return x >= -0.5 && x < 0.5 ? 1 : 0;
+        case MEDIA_FILTER_BILINEAR: return fabs(x) < 1 ? 1 - fabs(x) : 0;
+        case MEDIA_FILTER_LANCZOS3: return fabs(x) < 3 ? _media_resize_sinc(x) * _media_resize_sinc(x / 3) : 0;
+    }
+
+    return 0;
+}
+
+static double _media_resize_support(enum media_filter filter) {
+    switch (filter) {
+        case MEDIA_FILTER_BOX: return 0.5;
+        case MEDIA_FILTER_BILINEAR: return 1;
+        case MEDIA_FILTER_LANCZOS3: return 3;
+    }
+
+    return 1;
+}
+
+// return 0 if success, otherwise another number
+static int _media_resize_weights_build(struct _media_resize_weights* table, enum media_filter filter,
+                                       uint32_t src_size, uint32_t dst_size) {
+    double scale = (double) src_size / dst_size;
+    // when shrinking the kernel is stretched over the source, so it averages instead of skipping
+    double stretch = scale > 1 ? scale : 1;
+    double support = _media_resize_support(filter) * stretch;
+
+    uint32_t taps = (uint32_t) ceil(support) * 2 + 1;
+    taps += taps & 1;
+
+    table->taps = taps;
+    table->starts = malloc(sizeof(uint32_t) * dst_size);
+    table->weights = calloc((size_t) dst_size * taps, sizeof(int16_t));
+    double* values = malloc(sizeof(double) * taps);
+
+    if (table->starts == NULL || table->weights == NULL || values == NULL) {
+        free(values);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < dst_size; i++) {
+        double center = (i + 0.5) * scale;
+        int64_t first = (int64_t) floor(center - support + 0.5);
+        int64_t last = (int64_t) floor(center + support + 0.5);
+
+        if (first < 0) {
+            first = 0;
+        }
+
+        if (last > src_size) {
+            last = src_size;
+        }
+
+        if (last - first > taps) {
+            last = first + taps;
+        }
+
+        // windows are moved back near the end so all the taps stay inside the source when it's wide enough
+        uint32_t start = (uint32_t) first;
+        if (start + taps > src_size) {
+            start = src_size > taps ? src_size - taps : 0;
+        }
+
+        double total = 0;
+        for (int64_t j = first; j < last; j++) {
+            values[j - first] = _media_resize_kernel(filter, (j + 0.5 - center) / stretch);
+            total += values[j - first];
+        }
+
+        int16_t* weights = &table->weights[(size_t) i * taps];
+        table->starts[i] = start;
+
+        // nearest if the window missed every sample
+        if (total == 0) {
+            int64_t nearest = (int64_t) center;
+            weights[(nearest < src_size ? nearest : src_size - 1) - start] = 1 << MEDIA_RESIZE_BITS;
+            continue;
+        }
+
+        // every tap is what the running total gains once rounded, so windows sum exactly one and
+        // rounding errors don't pile up when thousands of taps weigh less than a Q14 step each
+        double running = 0;
+        int32_t previous = 0;
+
+        for (int64_t j = first; j < last; j++) {
+            running += values[j - first];
+
+            int32_t rounded = j + 1 < last ? (int32_t) lround(running / total * (1 << MEDIA_RESIZE_BITS))
+                                           : 1 << MEDIA_RESIZE_BITS;
+
+            weights[j - start] = (int16_t) (rounded - previous);
+            previous = rounded;
+        }
+    }
+
+    free(values);
+
+    return 0;
+}
+
+static void _media_resize_weights_free(struct _media_resize_weights* table) {
+    free(table->starts);
+    free(table->weights);
+}
+
+// samples are summed as signed (sample - 32768), since windows sum one it's undone by adding 32768 back
+static inline uint16_t _media_resize_round(int32_t sum) {
+    int32_t value = (sum + (1 << (MEDIA_RESIZE_BITS - 1))) >> MEDIA_RESIZE_BITS;
+    value += 32768;
+
+    return value < 0 ? 0 : (value > 65535 ? 65535 : value);
+}
+
+#ifdef __SSE2__
+// 4 lanes of Q14 sums of biased samples to 16 bits samples, saturated
+static inline __m128i _media_resize_round_epi32(__m128i sum) {
+    return _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << (MEDIA_RESIZE_BITS - 1))), MEDIA_RESIZE_BITS);
+}
+
+// packs two rounded sums still biased by -32768 into 8 unsigned samples
+static inline __m128i _media_resize_pack_epi32(__m128i low, __m128i high) {
+    return _mm_xor_si128(_mm_packs_epi32(low, high), _mm_set1_epi16((short) 0x8000));
+}
+#endif
+
+// one source row of wide samples to dst_width pixels, src has MEDIA_RESIZE_PADDING samples after
+// the last tap and dst after its last pixel
+static void _media_resize_horizontal(const struct _media_resize_weights* table, uint32_t channels,
+                                     const uint16_t* src, uint16_t* dst, uint32_t dst_width) {
+    uint32_t taps = table->taps;
+
+    for (uint32_t x = 0; x < dst_width; x++) {
+        const uint16_t* pixels = &src[(size_t) table->starts[x] * channels];
+        const int16_t* weights = &table->weights[(size_t) x * taps];
+
+#ifdef __SSE2__
+        // every pixel is loaded and stored as 4 samples, lanes past channels are overwritten by the next pixel
+        const __m128i bias = _mm_set1_epi16((short) 0x8000);
+        __m128i sum = _mm_setzero_si128();
+
+        for (uint32_t t = 0; t < taps; t += 2) {
+            __m128i first = _mm_xor_si128(_mm_loadl_epi64((const __m128i*) &pixels[t * channels]), bias);
+            __m128i second = _mm_xor_si128(_mm_loadl_epi64((const __m128i*) &pixels[(t + 1) * channels]), bias);
+            __m128i pair = _mm_set1_epi32((int32_t) ((uint32_t) (uint16_t) weights[t + 1] << 16 | (uint16_t) weights[t]));
+
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(first, second), pair));
+        }
+
+        sum = _media_resize_round_epi32(sum);
+        _mm_storel_epi64((__m128i*) &dst[(size_t) x * channels], _media_resize_pack_epi32(sum, sum));
+#else
+        for (uint32_t c = 0; c < channels; c++) {
+            int32_t sum = 0;
+
+            for (uint32_t t = 0; t < taps; t++) {
+                sum += weights[t] * ((int32_t) pixels[t * channels + c] - 32768);
+            }
+
+            dst[(size_t) x * channels + c] = _media_resize_round(sum);
+        }
+#endif
+    }
+}
+
+// row y of the destination out of the horizontal rows, rows is scratch for a pointer per tap
+static void _media_resize_vertical(const struct _media_resize_job* job, uint32_t y, const uint16_t** rows,
+                                   uint16_t* dst) {
+    const struct _media_resize_weights* table = &job->vertical;
+    const int16_t* weights = &table->weights[(size_t) y * table->taps];
+    size_t samples = (size_t) job->dst_width * job->channels;
+    size_t i = 0;
+
+    // taps past the last row weigh 0, any row would do
+    for (uint32_t t = 0; t < table->taps; t++) {
+        uint32_t row = table->starts[y] + t;
+        rows[t] = &job->rows[(size_t) (row < job->src_height ? row : job->src_height - 1) * job->rows_stride];
+    }
+
+#ifdef __SSE2__
+    const __m128i bias = _mm_set1_epi16((short) 0x8000);
+
+    for (; i + 8 <= samples; i += 8) {
+        __m128i low = _mm_setzero_si128();
+        __m128i high = _mm_setzero_si128();
+
+        for (uint32_t t = 0; t < table->taps; t += 2) {
+            __m128i first = _mm_xor_si128(_mm_loadu_si128((const __m128i*) &rows[t][i]), bias);
+            __m128i second = _mm_xor_si128(_mm_loadu_si128((const __m128i*) &rows[t + 1][i]), bias);
+            __m128i pair = _mm_set1_epi32((int32_t) ((uint32_t) (uint16_t) weights[t + 1] << 16 | (uint16_t) weights[t]));
+
+            low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(first, second), pair));
+            high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(first, second), pair));
+        }
+
+        __m128i values = _media_resize_pack_epi32(_media_resize_round_epi32(low), _media_resize_round_epi32(high));
+        _mm_storeu_si128((__m128i*) &dst[i], values);
+    }
+#endif
+
+    for (; i < samples; i++) {
+        int32_t sum = 0;
+
+        for (uint32_t t = 0; t < table->taps; t++) {
+            sum += weights[t] * ((int32_t) rows[t][i] - 32768);
+        }
+
+        dst[i] = _media_resize_round(sum);
+    }
+}
+
+// media_range_fn of the horizontal pass over source rows [begin, end)
+static void _media_resize_rows(void* context, size_t begin, size_t end) {
+    struct _media_resize_job* job = context;
+
+    // taps of the last pixels may go past the width when the source is narrower than a window
+    size_t samples = ((size_t) job->src_width + job->horizontal.taps) * job->channels + MEDIA_RESIZE_PADDING;
+    uint16_t* wide = calloc(samples, sizeof(uint16_t));
+
+    if (wide == NULL) {
+        job->failed = 1;
+        return;
+    }
+
+    for (size_t y = begin; y < end; y++) {
+        const uint8_t* row = &job->src[y * job->src_stride];
+
+        if (job->gamma != NULL) {
+            media_gamma_to_linear(job->gamma, job->format, row, wide, job->src_width);
+        } else {
+            media_convert_row(job->format, row, job->wide_format, (uint8_t*) wide, job->src_width, MEDIA_LUMA_AVERAGE);
+        }
+
+        if (job->alpha) {
+            media_premultiply_row(job->wide_format, (uint8_t*) wide, job->src_width);
+        }
+
+        _media_resize_horizontal(&job->horizontal, job->channels, wide, &job->rows[y * job->rows_stride],
+                                 job->dst_width);
+    }
+
+    free(wide);
+}
+
+// media_range_fn of the vertical pass over destination rows [begin, end)
+static void _media_resize_columns(void* context, size_t begin, size_t end) {
+    struct _media_resize_job* job = context;
+    uint16_t* wide = malloc(sizeof(uint16_t) * job->dst_width * job->channels);
+    // taps grow with the shrink ratio, so they can't be on the stack
+    const uint16_t** rows = malloc(sizeof(const uint16_t*) * job->vertical.taps);
+
+    if (wide == NULL || rows == NULL) {
+        free(wide);
+        free(rows);
+        job->failed = 1;
+        return;
+    }
+
+    for (size_t y = begin; y < end; y++) {
+        uint8_t* row = &job->dst[y * job->dst_stride];
+
+        _media_resize_vertical(job, (uint32_t) y, rows, wide);
+
+        if (job->alpha) {
+            media_unpremultiply_row(job->wide_format, (uint8_t*) wide, job->dst_width);
+        }
+
+        if (job->gamma != NULL) {
+            media_gamma_from_linear(job->gamma, job->format, wide, row, job->dst_width);
+        } else {
+            media_convert_row(job->wide_format, (const uint8_t*) wide, job->format, row, job->dst_width,
+                              MEDIA_LUMA_AVERAGE);
+        }
+    }
+
+    free(wide);
+    free(rows);
+}
+
+int media_resize(enum media_pixel_format format, enum media_filter filter, const struct media_gamma* gamma,
+                 uint32_t threads, const uint8_t* src, size_t src_stride, uint32_t src_width, uint32_t src_height,
+                 uint8_t* dst, size_t dst_stride, uint32_t dst_width, uint32_t dst_height) {
+    if (format == MEDIA_PIXEL_INDEXED8) {
+        return 1;
+    }
+
+    if (src_width == 0 || src_height == 0 || dst_width == 0 || dst_height == 0) {
+        return 2;
+    }
+
+    struct _media_resize_job job;
+    memset(&job, 0, sizeof(struct _media_resize_job));
+
+    job.format = format;
+    job.wide_format = media_pixel_wide_format(format);
+    job.gamma = gamma;
+    job.channels = media_pixel_channels(format);
+    job.alpha = job.channels == 2 || job.channels == 4;
+    job.src = src;
+    job.src_stride = src_stride;
+    job.src_width = src_width;
+    job.src_height = src_height;
+    job.dst = dst;
+    job.dst_stride = dst_stride;
+    job.dst_width = dst_width;
+    job.rows_stride = (size_t) dst_width * job.channels + MEDIA_RESIZE_PADDING;
+
+    int ret = 0;
+
+    if (_media_resize_weights_build(&job.horizontal, filter, src_width, dst_width) != 0
+        || _media_resize_weights_build(&job.vertical, filter, src_height, dst_height) != 0) {
+        ret = 3;
+    }
+
+    if (ret == 0) {
+        job.rows = malloc(sizeof(uint16_t) * job.rows_stride * src_height);
+        ret = job.rows == NULL ? 3 : 0;
+    }
+
+    if (ret == 0) {
+        media_parallel_for(src_height, threads, _media_resize_rows, &job);
+    }
+
+    if (ret == 0 && !job.failed) {
+        media_parallel_for(dst_height, threads, _media_resize_columns, &job);
+    }
+
+    if (ret == 0 && job.failed) {
+        ret = 3;
+    }
+
+    free(job.rows);
+    _media_resize_weights_free(&job.horizontal);
+    _media_resize_weights_free(&job.vertical);
+
+    return ret;
+}
+
+void media_box_accumulate(enum media_pixel_format format, const uint8_t* src, uint32_t count, uint32_t factor,
+                          uint64_t* sums) {
+    uint32_t channels = media_pixel_channels(format);
+    uint32_t colors = channels == 2 || channels == 4 ? channels - 1 : channels;
+    uint32_t depth = media_pixel_depth(format);
+
+    for (uint32_t x = 0; x < count; x += factor) {
+        uint32_t last = x + factor < count ? x + factor : count;
+
+        for (uint32_t i = x; i < last; i++) {
+            uint32_t samples[4] = {0};
+
+            for (uint32_t c = 0; c < channels; c++) {
+                samples[c] = depth == 8 ? src[i * channels + c] : ((const uint16_t*) src)[i * channels + c];
+            }
+
+            if (colors != channels) {
+                uint32_t alpha = samples[colors];
+
+                for (uint32_t c = 0; c < colors; c++) {
+                    sums[c] += (uint64_t) samples[c] * alpha;
+                }
+
+                sums[colors] += alpha;
+            } else {
+                for (uint32_t c = 0; c < channels; c++) {
+                    sums[c] += samples[c];
+                }
+            }
+        }
+
+        sums += channels;
+    }
+}
+
+void media_box_resolve(enum media_pixel_format format, uint64_t* sums, uint32_t count, uint32_t factor,
+                       uint32_t rows, uint8_t* dst) {
+    uint32_t channels = media_pixel_channels(format);
+    uint32_t colors = channels == 2 || channels == 4 ? channels - 1 : channels;
+    uint32_t depth = media_pixel_depth(format);
+    uint32_t width = (count + factor - 1) / factor;
+
+    for (uint32_t x = 0; x < width; x++) {
+        uint64_t* pixel = &sums[x * channels];
+        uint32_t columns = count - x * factor < factor ? count - x * factor : factor;
+        uint64_t area = (uint64_t) columns * rows;
+        uint32_t values[4];
+
+        if (colors != channels) {
+            // colors were weighted by alpha, so alpha sum is what they are averaged over
+            uint64_t alpha = pixel[colors];
+
+            for (uint32_t c = 0; c < colors; c++) {
+                values[c] = alpha != 0 ? (uint32_t) ((pixel[c] + alpha / 2) / alpha) : 0;
+            }
+
+            values[colors] = (uint32_t) ((alpha + area / 2) / area);
+        } else {
+            for (uint32_t c = 0; c < channels; c++) {
+                values[c] = (uint32_t) ((pixel[c] + area / 2) / area);
+            }
+        }
+
+        for (uint32_t c = 0; c < channels; c++) {
+            if (depth == 8) {
+                dst[x * channels + c] = (uint8_t) values[c];
+            } else {
+                ((uint16_t*) dst)[x * channels + c] = (uint16_t) values[c];
+            }
+
+            pixel[c] = 0;
+        }
+    }
+}
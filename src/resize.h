@@ -0,0 +1,39 @@
+#ifndef MEDIA_RESIZE_GUARD_HEADER
+#define MEDIA_RESIZE_GUARD_HEADER
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pixel.h"
+#include "gamma.h"
+
+// kernels of the resamplers, wider ones are sharper and slower
+enum media_filter {
+    // area average when shrinking, nearest when growing
+    MEDIA_FILTER_BOX,
+    // triangle (tent) of radius 1
+    MEDIA_FILTER_BILINEAR,
+    // windowed sinc of radius 3
+    MEDIA_FILTER_LANCZOS3
+};
+
+// resamples src pixels into dst ones, both in format (any but INDEXED8) with rows stride bytes apart.
+// it's done in two separable passes through 16 bits samples and Q14 weights, colors are weighted
+// by alpha and, if gamma isn't NULL, by linear light instead of encoded values.
+// rows are split between threads. src and dst must not overlap.
+// return 0 if success, otherwise another number
+int media_resize(enum media_pixel_format format, enum media_filter filter, const struct media_gamma* gamma,
+                 uint32_t threads, const uint8_t* src, size_t src_stride, uint32_t src_width, uint32_t src_height,
+                 uint8_t* dst, size_t dst_stride, uint32_t dst_width, uint32_t dst_height);
+
+// adds count pixels of a row in format into sums of the factor pixels wide columns they fall in,
+// (count + factor - 1) / factor * channels of them. with alpha, colors are added weighted by it
+void media_box_accumulate(enum media_pixel_format format, const uint8_t* src, uint32_t count, uint32_t factor,
+                          uint64_t* sums);
+
+// averages sums of media_box_accumulate over rows added into pixels of a row of dst and zeroes them,
+// count is the pixels of the source row
+void media_box_resolve(enum media_pixel_format format, uint64_t* sums, uint32_t count, uint32_t factor,
+                       uint32_t rows, uint8_t* dst);
+
+#endif // MEDIA_RESIZE_GUARD_HEADER
@@ -0,0 +1,335 @@
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// vectors summed into 32 bits lanes before they're moved to 64 bits ones, 65535 * 32768 fits 31 bits
+#define MEDIA_STATS_FLUSH 32768
+
+#ifdef __SSE2__
+// running lanes of 8 samples of 16 bits. vectors of 1, 2 and 4 channels have the same layout,
+// RGB ones repeat every 3 vectors so each phase has its own lanes
+struct _media_stats_lanes {
+    // biased by 0x8000 for signed compares
+    __m128i min[3];
+    __m128i max[3];
+    // lanes 0 to 3 and 4 to 7
+    __m128i sum[3][2];
+    // lanes 0 and 2, 1 and 3, 4 and 6, 5 and 7
+    __m128i squares[3][4];
+};
+
+// rows of whole blocks of vectors, return the samples done (a multiple of channels)
+static size_t _media_stats_sse2(struct media_stats* stats, uint8_t wide, const uint8_t* row, size_t samples);
+static inline void _media_stats_add(struct _media_stats_lanes* lanes, uint32_t phase, __m128i v);
+static void _media_stats_flush(struct media_stats* stats, struct _media_stats_lanes* lanes, uint32_t period);
+#endif
+
+static inline void _media_stats_sample(struct media_stats* stats, uint32_t channel, uint32_t sample);
+static void _media_histogram_fold(struct media_histogram* histogram);
+// 8 bits samples that are their own bins, pixels go through the ways in turn
+static inline void _media_histogram_bytes(uint32_t* counts, size_t plane, const uint8_t* row, uint32_t count,
+                                          uint32_t channels);
+static void _media_histogram_binned(uint32_t* counts, size_t plane, const uint8_t* row, uint32_t count,
+                                    uint32_t channels, uint32_t bins, uint32_t depth);
+
+void media_stats_init(struct media_stats* stats, enum media_pixel_format format) {
+    memset(stats, 0, sizeof(struct media_stats));
+    stats->channels = media_pixel_channels(format);
+
+    for (uint32_t c = 0; c < 4; c++) {
+        stats->min[c] = UINT32_MAX;
+    }
+}
+
+void media_stats_row(struct media_stats* stats, enum media_pixel_format format, const uint8_t* row, uint32_t count) {
+    uint32_t channels = stats->channels;
+    uint8_t wide = media_pixel_depth(format) == 16;
+    size_t samples = (size_t) count * channels;
+    size_t done = 0;
+
+#ifdef __SSE2__
+    done = _media_stats_sse2(stats, wide, row, samples);
+#endif
+
+    for (size_t x = done / channels; x < count; x++) {
+        for (uint32_t c = 0; c < channels; c++) {
+            size_t i = x * channels + c;
+            _media_stats_sample(stats, c, wide ? ((const uint16_t*) row)[i] : row[i]);
+        }
+    }
+
+    stats->count += count;
+}
+
+void media_stats_merge(struct media_stats* stats, const struct media_stats* other) {
+    for (uint32_t c = 0; c < stats->channels; c++) {
+        stats->min[c] = other->min[c] < stats->min[c] ? other->min[c] : stats->min[c];
+        stats->max[c] = other->max[c] > stats->max[c] ? other->max[c] : stats->max[c];
+        stats->sum[c] += other->sum[c];
+        stats->squares[c] += other->squares[c];
+    }
+
+    stats->count += other->count;
+}
+
+int media_histogram_init(struct media_histogram* histogram, enum media_pixel_format format, uint32_t bins) {
+    memset(histogram, 0, sizeof(struct media_histogram));
+
+    uint32_t depth = media_pixel_depth(format);
+    if (bins == 0 || bins > (1u << depth)) {
+        return 1;
+    }
+
+    histogram->channels = media_pixel_channels(format);
+    histogram->depth = depth;
+    histogram->bins = bins;
+
+    size_t plane = (size_t) histogram->channels * bins;
+    histogram->counts = calloc(plane * MEDIA_HISTOGRAM_WAYS, sizeof(uint32_t));
+    histogram->totals = calloc(plane, sizeof(uint64_t));
+
+    if (histogram->counts == NULL || histogram->totals == NULL) {
+        media_histogram_end(histogram, NULL);
+        return 2;
+    }
+
+    return 0;
+}
+
+void media_histogram_row(struct media_histogram* histogram, const uint8_t* row, uint32_t count) {
+    if (histogram->pending + count > UINT32_MAX) {
+        _media_histogram_fold(histogram);
+    }
+
+    histogram->pending += count;
+
+    uint32_t channels = histogram->channels;
+    uint32_t bins = histogram->bins;
+    uint32_t depth = histogram->depth;
+    size_t plane = (size_t) channels * bins;
+    uint32_t* counts = histogram->counts;
+
+    // channels are constants in every call, so their loops unroll
+    switch (depth == 8 && bins == 256 ? channels : 0) {
+        case 1: _media_histogram_bytes(counts, plane, row, count, 1); break;
+        case 2: _media_histogram_bytes(counts, plane, row, count, 2); break;
+        case 3: _media_histogram_bytes(counts, plane, row, count, 3); break;
+        case 4: _media_histogram_bytes(counts, plane, row, count, 4); break;
+        default: _media_histogram_binned(counts, plane, row, count, channels, bins, depth); break;
+    }
+}
+
+void media_histogram_end(struct media_histogram* histogram, uint64_t* out) {
+    if (out != NULL && histogram->counts != NULL && histogram->totals != NULL) {
+        _media_histogram_fold(histogram);
+
+        size_t plane = (size_t) histogram->channels * histogram->bins;
+        for (size_t i = 0; i < plane; i++) {
+            out[i] += histogram->totals[i];
+        }
+    }
+
+    free(histogram->counts);
+    free(histogram->totals);
+    histogram->counts = NULL;
+    histogram->totals = NULL;
+}
+
+static inline void _media_stats_sample(struct media_stats* stats, uint32_t channel, uint32_t sample) {
+    stats->min[channel] = sample < stats->min[channel] ? sample : stats->min[channel];
+    stats->max[channel] = sample > stats->max[channel] ? sample : stats->max[channel];
+    stats->sum[channel] += sample;
+    stats->squares[channel] += (uint64_t) sample * sample;
+}
+
+static inline void _media_histogram_bytes(uint32_t* counts, size_t plane, const uint8_t* row, uint32_t count,
+                                          uint32_t channels) {
+    uint32_t* way0 = &counts[0 * plane];
+    uint32_t* way1 = &counts[1 * plane];
+    uint32_t* way2 = &counts[2 * plane];
+    uint32_t* way3 = &counts[3 * plane];
+    uint32_t x = 0;
+
+    for (; x + MEDIA_HISTOGRAM_WAYS <= count; x += MEDIA_HISTOGRAM_WAYS) {
+        const uint8_t* pixels = &row[(size_t) x * channels];
+
+        for (uint32_t c = 0; c < channels; c++) {
+            way0[c * 256 + pixels[0 * channels + c]]++;
+            way1[c * 256 + pixels[1 * channels + c]]++;
+            way2[c * 256 + pixels[2 * channels + c]]++;
+            way3[c * 256 + pixels[3 * channels + c]]++;
+        }
+    }
+
+    for (; x < count; x++) {
+        for (uint32_t c = 0; c < channels; c++) {
+            way0[c * 256 + row[(size_t) x * channels + c]]++;
+        }
+    }
+}
+
+static void _media_histogram_binned(uint32_t* counts, size_t plane, const uint8_t* row, uint32_t count,
+                                    uint32_t channels, uint32_t bins, uint32_t depth) {
+    const uint16_t* samples = (const uint16_t*) row;
+
+    for (uint32_t x = 0; x < count; x++) {
+        uint32_t* way = &counts[(x % MEDIA_HISTOGRAM_WAYS) * plane];
+        size_t first = (size_t) x * channels;
+
+        for (uint32_t c = 0; c < channels; c++) {
+            uint32_t sample = depth == 8 ? row[first + c] : samples[first + c];
+            way[c * bins + ((sample * bins) >> depth)]++;
+        }
+    }
+}
+
+static void _media_histogram_fold(struct media_histogram* histogram) {
+    size_t plane = (size_t) histogram->channels * histogram->bins;
+
+    for (uint32_t way = 0; way < MEDIA_HISTOGRAM_WAYS; way++) {
+        uint32_t* counts = &histogram->counts[way * plane];
+
+        for (size_t i = 0; i < plane; i++) {
+            histogram->totals[i] += counts[i];
+        }
+
+        memset(counts, 0, plane * sizeof(uint32_t));
+    }
+
+    histogram->pending = 0;
+}
+
+#ifdef __SSE2__
+static size_t _media_stats_sse2(struct media_stats* stats, uint8_t wide, const uint8_t* row, size_t samples) {
+    uint32_t period = stats->channels == 3 ? 3 : 1;
+    // samples of a block, each phase gets 1 vector of 16 bits samples or 2 of 8 bits
+    size_t step = (wide ? 8 : 16) * period;
+    size_t blocks = samples / step;
+
+    if (blocks == 0) {
+        return 0;
+    }
+
+    struct _media_stats_lanes lanes;
+    for (uint32_t p = 0; p < period; p++) {
+        lanes.min[p] = _mm_set1_epi16(0x7FFF);
+        lanes.max[p] = _mm_set1_epi16(-0x8000);
+
+        for (uint32_t i = 0; i < 2; i++) {
+            lanes.sum[p][i] = _mm_setzero_si128();
+        }
+
+        for (uint32_t i = 0; i < 4; i++) {
+            lanes.squares[p][i] = _mm_setzero_si128();
+        }
+    }
+
+    __m128i zero = _mm_setzero_si128();
+    size_t block_size = step * (wide ? 2 : 1);
+    uint32_t pending = 0;
+
+    for (size_t b = 0; b < blocks; b++) {
+        const uint8_t* block = &row[b * block_size];
+
+        // phases are constants in every branch, so lanes stay in registers
+        if (wide && period == 1) {
+            _media_stats_add(&lanes, 0, _mm_loadu_si128((const __m128i*) block));
+        } else if (wide) {
+            _media_stats_add(&lanes, 0, _mm_loadu_si128((const __m128i*) &block[0]));
+            _media_stats_add(&lanes, 1, _mm_loadu_si128((const __m128i*) &block[16]));
+            _media_stats_add(&lanes, 2, _mm_loadu_si128((const __m128i*) &block[32]));
+        } else if (period == 1) {
+            __m128i v = _mm_loadu_si128((const __m128i*) block);
+            _media_stats_add(&lanes, 0, _mm_unpacklo_epi8(v, zero));
+            _media_stats_add(&lanes, 0, _mm_unpackhi_epi8(v, zero));
+        } else {
+            // 48 samples are vectors 0 to 5 of the block, phases 0, 1, 2, 0, 1, 2
+            __m128i v0 = _mm_loadu_si128((const __m128i*) &block[0]);
+            __m128i v1 = _mm_loadu_si128((const __m128i*) &block[16]);
+            __m128i v2 = _mm_loadu_si128((const __m128i*) &block[32]);
+
+            _media_stats_add(&lanes, 0, _mm_unpacklo_epi8(v0, zero));
+            _media_stats_add(&lanes, 1, _mm_unpackhi_epi8(v0, zero));
+            _media_stats_add(&lanes, 2, _mm_unpacklo_epi8(v1, zero));
+            _media_stats_add(&lanes, 0, _mm_unpackhi_epi8(v1, zero));
+            _media_stats_add(&lanes, 1, _mm_unpacklo_epi8(v2, zero));
+            _media_stats_add(&lanes, 2, _mm_unpackhi_epi8(v2, zero));
+        }
+
+        if (++pending == MEDIA_STATS_FLUSH) {
+            _media_stats_flush(stats, &lanes, period);
+            pending = 0;
+        }
+    }
+
+    _media_stats_flush(stats, &lanes, period);
+
+    // lane j of phase p holds samples of channel (8p + j) % channels
+    for (uint32_t p = 0; p < period; p++) {
+        uint16_t min[8];
+        uint16_t max[8];
+        uint64_t squares[8];
+
+        _mm_storeu_si128((__m128i*) min, lanes.min[p]);
+        _mm_storeu_si128((__m128i*) max, lanes.max[p]);
+        _mm_storeu_si128((__m128i*) &squares[0], _mm_unpacklo_epi64(lanes.squares[p][0], lanes.squares[p][1]));
+        _mm_storeu_si128((__m128i*) &squares[2], _mm_unpackhi_epi64(lanes.squares[p][0], lanes.squares[p][1]));
+        _mm_storeu_si128((__m128i*) &squares[4], _mm_unpacklo_epi64(lanes.squares[p][2], lanes.squares[p][3]));
+        _mm_storeu_si128((__m128i*) &squares[6], _mm_unpackhi_epi64(lanes.squares[p][2], lanes.squares[p][3]));
+
+        for (uint32_t j = 0; j < 8; j++) {
+            uint32_t c = (8 * p + j) % stats->channels;
+            uint32_t lane_min = min[j] ^ 0x8000;
+            uint32_t lane_max = max[j] ^ 0x8000;
+
+            stats->min[c] = lane_min < stats->min[c] ? lane_min : stats->min[c];
+            stats->max[c] = lane_max > stats->max[c] ? lane_max : stats->max[c];
+            stats->squares[c] += squares[j];
+        }
+    }
+
+    return blocks * step;
+}
+
+static inline void _media_stats_add(struct _media_stats_lanes* lanes, uint32_t phase, __m128i v) {
+    __m128i biased = _mm_xor_si128(v, _mm_set1_epi16(-0x8000));
+    lanes->min[phase] = _mm_min_epi16(lanes->min[phase], biased);
+    lanes->max[phase] = _mm_max_epi16(lanes->max[phase], biased);
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_unpacklo_epi16(v, zero);
+    __m128i hi = _mm_unpackhi_epi16(v, zero);
+
+    lanes->sum[phase][0] = _mm_add_epi32(lanes->sum[phase][0], lo);
+    lanes->sum[phase][1] = _mm_add_epi32(lanes->sum[phase][1], hi);
+
+    // squares of 16 bits fit 32 bits, they're added as 64 bits
+    __m128i lo_odd = _mm_srli_epi64(lo, 32);
+    __m128i hi_odd = _mm_srli_epi64(hi, 32);
+
+    lanes->squares[phase][0] = _mm_add_epi64(lanes->squares[phase][0], _mm_mul_epu32(lo, lo));
+    lanes->squares[phase][1] = _mm_add_epi64(lanes->squares[phase][1], _mm_mul_epu32(lo_odd, lo_odd));
+    lanes->squares[phase][2] = _mm_add_epi64(lanes->squares[phase][2], _mm_mul_epu32(hi, hi));
+    lanes->squares[phase][3] = _mm_add_epi64(lanes->squares[phase][3], _mm_mul_epu32(hi_odd, hi_odd));
+}
+
+static void _media_stats_flush(struct media_stats* stats, struct _media_stats_lanes* lanes, uint32_t period) {
+    for (uint32_t p = 0; p < period; p++) {
+        uint32_t sum[8];
+        _mm_storeu_si128((__m128i*) &sum[0], lanes->sum[p][0]);
+        _mm_storeu_si128((__m128i*) &sum[4], lanes->sum[p][1]);
+
+        for (uint32_t j = 0; j < 8; j++) {
+            stats->sum[(8 * p + j) % stats->channels] += sum[j];
+        }
+
+        lanes->sum[p][0] = _mm_setzero_si128();
+        lanes->sum[p][1] = _mm_setzero_si128();
+    }
+}
+#endif
@@ -0,0 +1,57 @@
+#ifndef MEDIA_STATS_GUARD_HEADER
+#define MEDIA_STATS_GUARD_HEADER
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pixel.h"
+
+// copies of every histogram bin, consecutive pixels count into different ones so
+// runs of the same sample don't wait on each other's stores
+#define MEDIA_HISTOGRAM_WAYS 4
+
+// sums of samples of every channel, filled row by row and merged between threads
+struct media_stats {
+    uint32_t channels;
+    // pixels added
+    uint64_t count;
+    uint32_t min[4];
+    uint32_t max[4];
+    uint64_t sum[4];
+    // exact up to 2^32 pixels of 16 bits samples
+    uint64_t squares[4];
+};
+
+// samples of every channel counted in bins equal ranges, bin of a sample is sample * bins >> depth
+struct media_histogram {
+    uint32_t channels;
+    uint32_t depth;
+    uint32_t bins;
+    // MEDIA_HISTOGRAM_WAYS x channels x bins, folded into totals before they could overflow
+    uint32_t* counts;
+    uint64_t* totals;
+    // pixels added to counts since they were folded
+    uint64_t pending;
+};
+
+// empty stats of format (any but INDEXED8)
+void media_stats_init(struct media_stats* stats, enum media_pixel_format format);
+
+// adds count pixels of a row in the format stats were made for
+void media_stats_row(struct media_stats* stats, enum media_pixel_format format, const uint8_t* row, uint32_t count);
+
+// adds other into stats, both of the same format
+void media_stats_merge(struct media_stats* stats, const struct media_stats* other);
+
+// empty histogram of format (any but INDEXED8), bins from 1 up to 1 << depth.
+// return 0 if success, otherwise another number
+int media_histogram_init(struct media_histogram* histogram, enum media_pixel_format format, uint32_t bins);
+
+// adds count pixels of a row in the format histogram was made for
+void media_histogram_row(struct media_histogram* histogram, const uint8_t* row, uint32_t count);
+
+// adds counts into out (channels x bins, channel after channel) and frees histogram.
+// out can be NULL to only free it
+void media_histogram_end(struct media_histogram* histogram, uint64_t* out);
+
+#endif // MEDIA_STATS_GUARD_HEADER
@@ -1,9 +1,19 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include "utils.h"
 #include "../zlib/zlib.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <malloc.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
 
 static uint32_t CRCTable[256];
 static uint8_t crc_table_initialized;
@@ -145,3 +155,171 @@ void media_zlib_deflate(uint8_t* data, size_t data_size,
     *out_compressed = compressed;
     *out_size = size;
 }
+
+int media_zlib_deflate_raw(uint8_t* data, size_t data_size,
+                           uint8_t** out_compressed, size_t* out_size,
+                           int compression_level) {
+    *out_compressed = NULL;
+    *out_size = 0;
+
+    if (compression_level < Z_DEFAULT_COMPRESSION) {
+        compression_level = Z_DEFAULT_COMPRESSION;
+    } else if (compression_level > Z_BEST_COMPRESSION) {
+        compression_level = Z_BEST_COMPRESSION;
+    }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(z_stream));
+
+    // negative window bits means raw deflate
+    if (deflateInit2(&stream, compression_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return 1;
+    }
+
+    stream.next_in = data;
+    stream.avail_in = data_size;
+
+    size_t size = deflateBound(&stream, data_size) + 16;
+    uint8_t* compressed = malloc(sizeof(uint8_t) * size);
+    if (compressed == NULL) {
+        deflateEnd(&stream);
+        return 2;
+    }
+
+    stream.next_out = compressed;
+    stream.avail_out = size;
+
+    // the bound leaves room for everything, so all of data is consumed at once
+    int ret = deflate(&stream, Z_FULL_FLUSH);
+    deflateEnd(&stream);
+
+    if (ret != Z_OK || stream.avail_in != 0) {
+        free(compressed);
+        return 3;
+    }
+
+    // re-adjust, the larger block is kept if it can't shrink
+    size -= stream.avail_out;
+    uint8_t* shrunk = realloc(compressed, sizeof(uint8_t) * (size != 0 ? size : 1));
+
+    *out_compressed = shrunk != NULL ? shrunk : compressed;
+    *out_size = size;
+
+    return 0;
+}
+
+int media_copy_file_range(FILE* in, FILE* out, size_t size) {
+#ifdef __linux__
+    // both streams need to agree with their descriptors before going under stdio
+    if (fflush(out) == 0) {
+        off_t in_offset = ftello(in);
+        off_t out_offset = ftello(out);
+        off_t in_end = in_offset + size;
+        off_t out_end = out_offset + size;
+
+        size_t left = size;
+        while (left > 0) {
+            ssize_t copied = copy_file_range(fileno(in), &in_offset, fileno(out), &out_offset, left, 0);
+            if (copied <= 0) {
+                break;
+            }
+
+            left -= copied;
+        }
+
+        if (left == 0) {
+            fseeko(in, in_end, SEEK_SET);
+            fseeko(out, out_end, SEEK_SET);
+            return 0;
+        }
+
+        // not supported between these files (or partially done), continue in user space
+        fseeko(in, in_end - left, SEEK_SET);
+        fseeko(out, out_end - left, SEEK_SET);
+        size = left;
+    }
+#endif
+
+    uint8_t buffer[64 * 1024];
+
+    while (size > 0) {
+        size_t block = size < sizeof(buffer) ? size : sizeof(buffer);
+
+        if (fread(buffer, sizeof(uint8_t), block, in) != block) {
+            return 1;
+        }
+
+        if (fwrite(buffer, sizeof(uint8_t), block, out) != block) {
+            return 2;
+        }
+
+        size -= block;
+    }
+
+    return 0;
+}
+
+struct _media_range {
+    media_range_fn fn;
+    void* context;
+    size_t begin;
+    size_t end;
+};
+
+static void* _media_range_thread(void* arg) {
+    struct _media_range* range = arg;
+    range->fn(range->context, range->begin, range->end);
+
+    return NULL;
+}
+
+void media_parallel_for(size_t count, uint32_t threads, media_range_fn fn, void* context) {
+    if (threads > count) {
+        threads = count;
+    }
+
+    if (threads <= 1) {
+        fn(context, 0, count);
+        return;
+    }
+
+    struct _media_range* ranges = malloc(sizeof(struct _media_range) * threads);
+    pthread_t* ids = malloc(sizeof(pthread_t) * threads);
+    uint8_t* started = calloc(threads, sizeof(uint8_t));
+
+    if (ranges == NULL || ids == NULL || started == NULL) {
+        free(ranges);
+        free(ids);
+        free(started);
+
+        fn(context, 0, count);
+        return;
+    }
+
+    for (uint32_t i = 0; i < threads; i++) {
+        ranges[i].fn = fn;
+        ranges[i].context = context;
+        ranges[i].begin = count * i / threads;
+        ranges[i].end = count * (i + 1) / threads;
+    }
+
+    // the last range goes in the calling thread
+    for (uint32_t i = 0; i + 1 < threads; i++) {
+        started[i] = pthread_create(&ids[i], NULL, _media_range_thread, &ranges[i]) == 0;
+    }
+
+    fn(context, ranges[threads - 1].begin, ranges[threads - 1].end);
+
+    for (uint32_t i = 0; i + 1 < threads; i++) {
+        if (started[i]) {
+            pthread_join(ids[i], NULL);
+        } else {
+            // it couldn't be created, so it runs here
+            fn(context, ranges[i].begin, ranges[i].end);
+        }
+    }
+
+    free(ranges);
+    free(ids);
+    free(started);
+}
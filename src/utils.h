@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
 
 #define MEDIA_CRC32_DEFAULT 0xFFFFFFFF
 #define MEDIA_CRC32(crc) (crc ^ 0xFFFFFFFF)
@@ -23,4 +24,21 @@ void media_zlib_deflate(uint8_t* data, size_t data_size,
                         uint8_t** out_compressed, size_t* out_size,
                         int compression_level);
 
+// raw deflate (no zlib header nor trailer) ending in a full flush instead of a final block,
+// so out_compressed can be concatenated with other segments of the same stream.
+// return 0 if success, otherwise another number and out_compressed is NULL
+int media_zlib_deflate_raw(uint8_t* data, size_t data_size,
+                            uint8_t** out_compressed, size_t* out_size,
+                            int compression_level);
+
+// copies size bytes from the current position of in to the current position of out,
+// in kernel space when the platform allows it. return 0 if success, otherwise another number
+int media_copy_file_range(FILE* in, FILE* out, size_t size);
+
+typedef void (*media_range_fn)(void* context, size_t begin, size_t end);
+
+// calls fn over [0, count) split in up to threads contiguous ranges running in parallel,
+// it returns once all of them are done. ranges that can't get a thread run in the caller
+void media_parallel_for(size_t count, uint32_t threads, media_range_fn fn, void* context);
+
 #endif // MEDIA_UTILS_GUARD_HEADER